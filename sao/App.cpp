@@ -48,13 +48,20 @@ void App::onInit() {
     // not in the constructor so that common exceptions will be
     // automatically caught.
 
+    // List the scenes on a background thread while the GPU resources are created
+    Scene::startSceneScan();
+
     showRenderingStats    = false;
     m_showLightSources    = false;
     m_showAxes            = false;
     m_showWireframe       = false;
+    m_cullSurfaces        = true;
     m_preventEntityDrag   = false;
     m_preventEntitySelect = false;
     m_aoIntensity         = 1.0f;
+    m_aoQuality           = SAOCPU::HIGH_QUALITY;
+    m_captureCount        = 0;
+    m_profileCount        = 0;
     m_useAO               = true;
     m_useTexture          = true;
     m_useEnvironmentMap   = true;
@@ -89,6 +96,11 @@ void App::onInit() {
 
     m_shadowMap = ShadowMap::create();
 
+    // The first launch has no scene index, so it waits for the scan to find the default scene
+    if (! Scene::sceneNames().contains("Sponza")) {
+        Scene::finishSceneScan();
+        updateSceneList();
+    }
     m_sceneDropDownList->setSelectedValue("Sponza");
     loadScene();
 }
@@ -117,6 +129,7 @@ void App::makeGUI() {
         scenePane->moveBy(0, -10);
         scenePane->beginRow(); {
             // Example of using a callback; you can also listen for events in onEvent or bind controls to data
+            m_sceneNamesVersion = Scene::sceneNamesVersion();
             m_sceneDropDownList = scenePane->addDropDownList("", Scene::sceneNames(), NULL, GuiControl::Callback(this, &App::loadScene));
 
             static const char* reloadIcon = "q";
@@ -135,6 +148,7 @@ void App::makeGUI() {
             scenePane->addCheckBox("Wireframe", &m_showWireframe)->setWidth(w);
             scenePane->addCheckBox("Profile", Pointer<bool>(&m_profiler, &Profiler::enabled, &Profiler::setEnabled));
         } scenePane->endRow();
+        scenePane->addCheckBox("Cull surfaces", &m_cullSurfaces);
         static const char* lockIcon = "\xcf";
         scenePane->addCheckBox(GuiText(lockIcon, iconFont, 20), &m_preventEntityDrag, GuiTheme::TOOL_CHECK_BOX_STYLE);
         scenePane->pack();
@@ -158,6 +172,17 @@ void App::makeGUI() {
         aoPane->addNumberBox("Radius",    Pointer<float>(m_SAO, &SAO::radius,    &SAO::setRadius),    "m", GuiTheme::LOG_SLIDER,    0.010f,  4.0f);
         aoPane->addNumberBox("Bias",      Pointer<float>(m_SAO, &SAO::bias,      &SAO::setBias),      "m", GuiTheme::LINEAR_SLIDER, 0.000f,  0.5f);
         aoPane->addNumberBox("Darkness",  &m_aoIntensity,                                                "x", GuiTheme::LOG_SLIDER,    0.001f,  4.0f);
+        Array<std::string> qualityNames;
+        for (int q = 0; q < SAOCPU::QUALITY_COUNT; ++q) {
+            qualityNames.append(SAOCPU::qualityParameters(SAOCPU::Quality(q)).name);
+        }
+        aoPane->addDropDownList("Quality", qualityNames, &m_aoQuality);
+        aoPane->addCheckBox("Single-sweep CSZ", Pointer<bool>(m_SAO, &SAO::singleSweepCSZ, &SAO::setSingleSweepCSZ));
+        aoPane->addCheckBox("Guard band culling", Pointer<bool>(m_SAO, &SAO::guardBandCulling, &SAO::setGuardBandCulling));
+        aoPane->addCheckBox("Deinterleaved AO", Pointer<bool>(m_SAO, &SAO::deinterleaved, &SAO::setDeinterleaved));
+        aoPane->addCheckBox("Temporal AO",      Pointer<bool>(m_SAO, &SAO::temporal,      &SAO::setTemporal));
+        aoPane->addCheckBox("Adaptive samples", Pointer<bool>(m_SAO, &SAO::adaptiveSampling, &SAO::setAdaptiveSampling));
+        aoPane->addCheckBox("Profile passes",   Pointer<bool>(&m_SAO->profiler(), &SAOProfiler::enabled, &SAOProfiler::setEnabled));
 
         aoPane->addLabel("Lighting Terms:");
         aoPane->addCheckBox("AO",          &m_useAO); 
@@ -243,6 +268,23 @@ void App::makeGUI() {
 }
 
 
+void App::updateSceneList() {
+    const int version = Scene::sceneNamesVersion();
+    if (version == m_sceneNamesVersion) {
+        return;
+    }
+    m_sceneNamesVersion = version;
+
+    // Keep the selection; the scene that is loaded stays loaded even if its file is gone
+    const std::string selected = (m_sceneDropDownList->numElements() > 0) ? m_sceneDropDownList->selectedValue().text() : "";
+    const Array<std::string> names = Scene::sceneNames();
+    m_sceneDropDownList->setList(names);
+    if (names.contains(selected)) {
+        m_sceneDropDownList->setSelectedValue(selected);
+    }
+}
+
+
 void App::loadScene() {
     const std::string& sceneName = m_sceneDropDownList->selectedValue().text();
 
@@ -285,7 +327,7 @@ void App::onSimulation(RealTime rdt, SimTime sdt, SimTime idt) {
         if (m_selectedEntity.notNull() && m_splineEditor->enabled()) {
             // Apply the edited spline.  Do this before object simulation, so that the object
             // is in sync with the widget for manipulating it.
-            m_selectedEntity->setFrameSpline(m_splineEditor->spline());
+            m_scene->setFrameSpline(m_selectedEntity, m_splineEditor->spline());
         }
 
         m_scene->onSimulation(sdt);
@@ -328,6 +370,26 @@ bool App::onEvent(const GEvent& event) {
     // if ((event.type == GEventType::GUI_ACTION) && (event.gui.control == m_button)) { ... return true;}
     if ((event.type == GEventType::KEY_DOWN) && (event.key.keysym.sym == 'r')) { reloadShaders(); return true; }
 
+    if ((event.type == GEventType::KEY_DOWN) && (event.key.keysym.sym == GKey::F9)) {
+        // Capture the depth buffer and camera of the next frame for tools/SAOReplay.cpp
+        FileSystem::createDirectory("captures");
+        m_SAO->captureNextFrame(format("captures/capture-%05d%s", m_captureCount, SAOCapture::extension()), m_captureCount);
+        ++m_captureCount;
+        return true;
+    }
+
+    if ((event.type == GEventType::KEY_DOWN) && (event.key.keysym.sym == GKey::F10)) {
+        // Export the per-pass timing of "Profile passes" for chrome://tracing and spreadsheets
+        FileSystem::createDirectory("profiles");
+        const SAOProfiler& profiler = m_SAO->profiler();
+        const std::string base = format("profiles/sao-profile-%05d", m_profileCount);
+        if (! (profiler.writeChromeTrace(base + ".json") && profiler.writeCSV(base + ".csv") && profiler.writeStatisticsCSV(base + "-stats.csv"))) {
+            debugPrintf("Could not write %s\n", base.c_str());
+        }
+        ++m_profileCount;
+        return true;
+    }
+
     return false;
 }
 
@@ -348,6 +410,7 @@ void App::selectEntity(const Entity::Ref& e) {
 void App::onUserInput(UserInput* ui) {
     GApp::onUserInput(ui);
     (void)ui;
+    updateSceneList();
     // Add key handling here based on the keys currently held or
     // ones that changed in the last frame.
 }
@@ -372,9 +435,17 @@ void App::onGraphics3D(RenderDevice* rd, Array<Surface::Ref>& surface3D) {
     m_gbuffer->resize(COMPUTE_WIDTH + 2 * COMPUTE_GUARD_BAND, COMPUTE_HEIGHT + 2 * COMPUTE_GUARD_BAND);
     m_gbuffer->prepare(rd, defaultCamera, 0, -1.0f / desiredFrameRate());
 
+    // Cull over the whole G-buffer, guard band included, because SAO reads depth there
+    m_visibleSurface.fastClear();
+    if (m_cullSurfaces) {
+        m_scene->cull(surface3D, defaultCamera, m_gbuffer->rect2DBounds(), m_visibleSurface);
+    } else {
+        m_visibleSurface.append(surface3D);
+    }
+
     // In a real deferred shading program, we would render early z, then use a scissor test to 
     // avoid the cost of rendering all of the other G-buffers outside of the visible frame
-    Surface::renderIntoGBuffer(rd, surface3D, m_gbuffer);
+    Surface::renderIntoGBuffer(rd, m_visibleSurface, m_gbuffer);
 
     const double width  = m_gbuffer->width();
     const double height = m_gbuffer->height();
@@ -395,6 +466,7 @@ void App::onGraphics3D(RenderDevice* rd, Array<Surface::Ref>& surface3D) {
 
     rd->push2D(m_aoResultFramebuffer); {
         m_profiler.beginGFX("AO");
+        m_SAO->setQuality(SAOCPU::Quality(m_aoQuality));
         m_SAO->compute(rd, m_gbuffer->texture(GBuffer::Field::DEPTH_AND_STENCIL), defaultCamera, COMPUTE_GUARD_BAND);
         m_profiler.endGFX();
     } rd->pop2D();
@@ -415,7 +487,7 @@ void App::onGraphics3D(RenderDevice* rd, Array<Surface::Ref>& surface3D) {
 
 
     if (m_showWireframe) {
-        Surface::renderWireframe(rd, surface3D);
+        Surface::renderWireframe(rd, m_visibleSurface);
     }
 
     //////////////////////////////////////////////////////
@@ -443,6 +515,23 @@ void App::onGraphics3D(RenderDevice* rd, Array<Surface::Ref>& surface3D) {
         // screenPrintf("AO: %5.2f ms\n", t);
         m_perfLabel->setCaption(GuiText(format("%5.2f ms", t), m_perfFont, 18.0f));
     }
+
+    if (m_cullSurfaces && m_profiler.enabled()) {
+        const SceneCulling::Statistics& s = m_scene->cullingStatistics();
+        screenPrintf("Culled %d of %d surfaces (%d frustum, %d occlusion), %d of %d triangles; %d occluder triangles, %.2f + %.2f ms",
+                     s.frustumCulledBoxes + s.occlusionCulledBoxes, s.boxes, s.frustumCulledBoxes, s.occlusionCulledBoxes,
+                     int(s.frustumCulledTriangles + s.occlusionCulledTriangles), int(s.triangles), int(s.occluderTriangles),
+                     s.rasterizeMilliseconds, s.testMilliseconds);
+    }
+
+    if (m_SAO->profiler().enabled()) {
+        const std::vector<SAOProfiler::StageStatistics> stats = m_SAO->profiler().statistics();
+        screenPrintf("%-12s %-18s %7s %7s %7s  (ms, F10 exports)", "", "SAO stage", "p50", "p95", "p99");
+        for (size_t i = 0; i < stats.size(); ++i) {
+            const SAOProfiler::StageStatistics& s = stats[i];
+            screenPrintf("%-12s %-18s %7.3f %7.3f %7.3f", SAOProfiler::trackName(s.track), s.stage, s.p50, s.p95, s.p99);
+        }
+    }
 }
 
 
@@ -457,6 +546,12 @@ void App::endProgram() {
 }
 
 
+void App::onCleanup() {
+    m_SAO = NULL;
+    SAOResourcePool::shared()->clear();
+}
+
+
 void App::saveScene() {
     // Called when the "save" button is pressed
     if (m_scene.notNull()) {
@@ -21,6 +21,9 @@ class App : public GApp {
     GuiDropDownList*    m_sceneDropDownList;
     Scene::Ref          m_scene;
 
+    /** Scene::sceneNamesVersion() when m_sceneDropDownList was filled */
+    int                 m_sceneNamesVersion;
+
     Shader::Ref         m_deferredShader;
 
     ShadowMap::Ref      m_shadowMap;
@@ -31,6 +34,15 @@ class App : public GApp {
 
     float               m_aoIntensity;
 
+    /** SAOCPU::Quality index selected in the GUI */
+    int                 m_aoQuality;
+
+    /** Number of SAOCapture files written with F9 in this session; numbers the next one */
+    int                 m_captureCount;
+
+    /** Number of SAOProfiler exports written with F10 in this session; numbers the next one */
+    int                 m_profileCount;
+
     bool                m_useAO;
     bool                m_useTexture;
     bool                m_useEnvironmentMap;
@@ -51,6 +63,12 @@ class App : public GApp {
     bool                m_showLightSources;
     bool                m_showWireframe;
 
+    /** Cull the posed surfaces with Scene::cull before G-buffer fill */
+    bool                m_cullSurfaces;
+
+    /** The surfaces that survived culling this frame, kept to reuse its storage */
+    Array<Surface::Ref> m_visibleSurface;
+
     void reloadShaders();
 
     /** Loads whatever scene is currently selected in the m_sceneDropDownList. */
@@ -59,6 +77,9 @@ class App : public GApp {
     /** Save the current scene over the one on disk. */
     void saveScene();
 
+    /** Refills m_sceneDropDownList when the background scene scan has changed Scene::sceneNames(). */
+    void updateSceneList();
+
     /** Called from onInit */
     void makeGUI();
 
@@ -69,6 +90,9 @@ public:
     App(const GApp::Settings& settings = GApp::Settings());
 
     virtual void onInit() override;
+
+    /** Returns the SAO buffers to SAOResourcePool::shared() and frees them while the GL context still exists */
+    virtual void onCleanup() override;
     virtual void onSimulation(RealTime rdt, SimTime sdt, SimTime idt) override;
     virtual void onPose(Array<Surface::Ref>& posed3D, Array<Surface2D::Ref>& posed2D) override;
 
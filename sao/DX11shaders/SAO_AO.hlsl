@@ -28,17 +28,26 @@
 
   */
 
+// The defaults below are SAOCPU::HIGH_QUALITY.  Compile with D3D_SHADER_MACROs from
+// SAOCPU::shaderDefines() to build the other quality presets.
+
 // Total number of direct samples to take at each pixel
+#ifndef NUM_SAMPLES
 #define NUM_SAMPLES (11)
+#endif
 
 // If using depth mip levels, the log of the maximum pixel offset before we need to switch to a lower 
 // miplevel to maintain reasonable spatial locality in the cache
 // If this number is too small (< 3), too many taps will land in the same pixel, and we'll get bad variance that manifests as flashing.
 // If it is too high (> 5), we'll get bad performance because we're not using the MIP levels effectively
+#ifndef LOG_MAX_OFFSET
 #define LOG_MAX_OFFSET 3
+#endif
 
 // This must be less than or equal to the MAX_MIP_LEVEL defined in SSAO.cpp
+#ifndef MAX_MIP_LEVEL
 #define MAX_MIP_LEVEL 5
+#endif
 
 /** Used for preventing AO computation on the sky (at infinite depth) and defining the CS Z to bilateral depth key scaling. 
     This need not match the real far plane*/
@@ -46,7 +55,22 @@
 
 // This is the number of turns around the circle that the spiral pattern makes.  This should be prime to prevent
 // taps from lining up.  This particular choice was tuned for NUM_SAMPLES == 9
+#ifndef NUM_SPIRAL_TURNS
 #define NUM_SPIRAL_TURNS (7)
+#endif
+
+// TAP(x, y, radius) of each tap of the spiral on the unit disk before the per-pixel rotation: radius
+// alpha = (i + 0.5) / NUM_SAMPLES and angle alpha * NUM_SPIRAL_TURNS * 6.28.  Tabulated by SAOSpiral in
+// SAOPresets.h; must be redefined along with NUM_SAMPLES and NUM_SPIRAL_TURNS.
+#ifndef SPIRAL_TAPS
+#define SPIRAL_TAPS TAP(-0.414493, 0.910053, 0.045455), TAP(0.958632, -0.284649, 0.136364), TAP(-0.843982, -0.536371, 0.227273), TAP(0.149334, 0.988787, 0.318182), TAP(0.647940, -0.761691, 0.409091), TAP(-0.999938, 0.011148, 0.500000), TAP(0.664761, 0.747056, 0.590909), TAP(0.127251, -0.991871, 0.681818), TAP(-0.831814, 0.555054, 0.772727), TAP(0.964740, 0.263205, 0.863636), TAP(-0.434680, -0.900585, 0.954545)
+#endif
+
+// When 1, each pixel takes fewer, evenly spaced taps of the spiral where its screen-space disk radius is small,
+// as chosen by minTaps, maxTaps, and pixelsPerTap (SAOCPU::setAdaptiveSampling).  0 keeps the fully unrolled loop.
+#ifndef ADAPTIVE_SAMPLING
+#define ADAPTIVE_SAMPLING 0
+#endif
 
 //////////////////////////////////////////////////
 
@@ -77,6 +101,13 @@ float intensity;
     to [-1, 1] x [-1, 1].  That is, GCamera::getProjectUnit(). */
 float4 projInfo;
 
+#if ADAPTIVE_SAMPLING
+/** Fewest and most taps per pixel, with maxTaps <= NUM_SAMPLES, and screen-space disk radius in pixels per tap */
+int minTaps;
+int maxTaps;
+float pixelsPerTap;
+#endif
+
 #define visibility      fragment.color.r
 #define bilateralKey    fragment.color.gb
 
@@ -93,6 +124,11 @@ struct PixelOutput
 
 float radius2 = radius * radius;
 
+/** The taps of SPIRAL_TAPS.  The compiler places the table in the immediate constant buffer, or folds it
+    into the unrolled tap loop. */
+#define TAP float3
+static const float3 spiralTap[NUM_SAMPLES] = { SPIRAL_TAPS };
+
 /////////////////////////////////////////////////////////
 
 /** Reconstruct camera-space P.xyz from screen-space S = (x, y) in
@@ -111,14 +147,14 @@ float3 reconstructCSFaceNormal(float3 C) {
 	return normalize(cross(ddy(C), ddx(C)));
 }
 
-/** Returns a unit vector and a screen-space radius for the tap on a unit disk (the caller should scale by the actual disk radius) */
-float2 tapLocation(int sampleNumber, float spinAngle, out float ssR){
-	// Radius relative to ssR
-	float alpha = float(sampleNumber + 0.5) * (1.0 / NUM_SAMPLES);
-	float angle = alpha * (NUM_SPIRAL_TURNS * 6.28) + spinAngle;
+/** Returns a unit vector and a screen-space radius for the tap on a unit disk (the caller should scale by the actual disk radius).
+    \a spin is (cos, sin) of the rotation of the pixel's spiral, so a tap costs a 2x2 rotation instead of a cos and sin. */
+float2 tapLocation(int sampleNumber, float2 spin, out float ssR){
+	float3 tap = spiralTap[sampleNumber];
 
-	ssR = alpha;
-	return float2(cos(angle), sin(angle));
+	// Radius relative to ssR
+	ssR = tap.z;
+	return float2(tap.x * spin.x - tap.y * spin.y, tap.x * spin.y + tap.y * spin.x);
 }
 
 
@@ -174,10 +210,10 @@ float3 getOffsetPosition(int2 ssC, float2 unitOffset, float ssR) {
 
 /** Compute the occlusion due to sample with index \a i about the pixel at \a ssC that corresponds
     to camera-space point \a C with unit normal \a n_C, using maximum screen-space sampling radius \a ssDiskRadius */
-float sampleAO(in int2 ssC, in float3 C, in float3 n_C, in float ssDiskRadius, in int tapIndex, in float randomPatternRotationAngle) {
+float sampleAO(in int2 ssC, in float3 C, in float3 n_C, in float ssDiskRadius, in int tapIndex, in float2 spin) {
 	// Offset on the unit disk, spun for this pixel
 	float ssR;
-	float2 unitOffset = tapLocation(tapIndex, randomPatternRotationAngle, ssR);
+	float2 unitOffset = tapLocation(tapIndex, spin, ssR);
 	ssR *= ssDiskRadius;
 
 	// The occluding point in camera space
@@ -208,6 +244,8 @@ PixelOutput ps_main(const PixelInput pixel)
 
 	// Hash function used in the HPG12 AlchemyAO paper
 	float randomPatternRotationAngle = (3 * ssC.x ^ ssC.y + ssC.x * ssC.y) * 10;
+	float2 spin;
+	sincos(randomPatternRotationAngle, spin.y, spin.x);
 
 	// Reconstruct normals from positions. These will lead to 1-pixel black lines
 	// at depth discontinuities, however the blur will wipe those out so they are not visible
@@ -219,13 +257,22 @@ PixelOutput ps_main(const PixelInput pixel)
 	float ssDiskRadius = -projScale * radius / C.z;
 
 	float sum = 0.0;
+#if ADAPTIVE_SAMPLING
+	// SAOCPU::adaptiveTapCount and adaptiveTapIndex; clamped as a float first, which cannot overflow
+	int tapCount = max((int)min(ceil(ssDiskRadius / pixelsPerTap), (float)maxTaps), minTaps);
+	[loop] for (int i = 0; i < tapCount; ++i) {
+	     sum += sampleAO(ssC, C, n_C, ssDiskRadius, ((2 * i + 1) * NUM_SAMPLES) / (2 * tapCount), spin);
+	}
+#else
+	const int tapCount = NUM_SAMPLES;
 	for (int i = 0; i < NUM_SAMPLES; ++i) {
-	     sum += sampleAO(ssC, C, n_C, ssDiskRadius, i, randomPatternRotationAngle);
+	     sum += sampleAO(ssC, C, n_C, ssDiskRadius, i, spin);
 	}
+#endif
 
         float temp = radius2 * radius;
         sum /= temp * temp;
-	float A = max(0.0, 1.0 - sum * intensity * (5.0 / NUM_SAMPLES));
+	float A = max(0.0, 1.0 - sum * intensity * (5.0 / tapCount));
 
 	// Bilateral box-filter over a quad for free, respecting depth edges
 	// (the difference that this makes is subtle)
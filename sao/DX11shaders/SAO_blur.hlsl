@@ -32,10 +32,23 @@
     unobjectionable after shading was applied but eliminated most temporal incoherence
     from using small numbers of sample taps.
     */
+#ifndef SCALE
 #define SCALE               (2)
+#endif
 
 /** Filter radius in pixels. This will be multiplied by SCALE. */
+#ifndef R
 #define R                   (4)
+#endif
+
+/** The R + 1 Gaussian coefficients, center first.  Must be redefined along with R.
+    SCALE, R and GAUSSIAN_TABLE default to SAOCPU::HIGH_QUALITY; see SAOCPU::shaderDefines(). */
+#ifndef GAUSSIAN_TABLE
+//#define GAUSSIAN_TABLE 0.356642, 0.239400, 0.072410, 0.009869
+//#define GAUSSIAN_TABLE 0.398943, 0.241971, 0.053991, 0.004432, 0.000134  // stddev = 1.0
+#define GAUSSIAN_TABLE 0.153170, 0.144893, 0.122649, 0.092902, 0.062970  // stddev = 2.0
+//#define GAUSSIAN_TABLE 0.111220, 0.107798, 0.098151, 0.083953, 0.067458, 0.050920, 0.036108 // stddev = 3.0
+#endif
 
 
 
@@ -55,11 +68,7 @@
 #define KEY_COMPONENTS     gb
 
 // Gaussian coefficients
-static const float gaussian[] = 
-//	{ 0.356642, 0.239400, 0.072410, 0.009869 };
-//	{ 0.398943, 0.241971, 0.053991, 0.004432, 0.000134 };  // stddev = 1.0
-	{ 0.153170, 0.144893, 0.122649, 0.092902, 0.062970 };  // stddev = 2.0
-//	{ 0.111220, 0.107798, 0.098151, 0.083953, 0.067458, 0.050920, 0.036108 }; // stddev = 3.0
+static const float gaussian[R + 1] = { GAUSSIAN_TABLE };
 
 Texture2D<float4> source;
 
@@ -0,0 +1,169 @@
+/** 
+  \file SAO_blurFused.hlsl
+
+  \brief Compute shader that runs both axes of the SAO_blur.hlsl cross-bilateral blur in one dispatch
+
+  Each thread group loads a TILE_SIZE x TILE_SIZE tile of the raw AO buffer plus a halo of R * SCALE
+  texels on every side into groupshared memory, blurs the tile rows and the halo rows horizontally
+  into a second groupshared block, and then blurs vertically from that block into the result.
+  The intermediate hBlurredBuffer of the two-pass version is never written to memory.
+
+  Dispatch ceil((width - 2 * guardBand) / TILE_SIZE) x ceil((height - 2 * guardBand) / TILE_SIZE)
+  groups after clearing result to white, as SAO::blurVertical does.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+
+  Copyright (c) 2011-2012, NVIDIA
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+  Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Tunable Parameters: these must match SAO_blur.hlsl
+
+#define EDGE_SHARPNESS     (1.0)
+#ifndef SCALE
+#define SCALE               (2)
+#endif
+#ifndef R
+#define R                   (4)
+#endif
+#ifndef GAUSSIAN_TABLE
+#define GAUSSIAN_TABLE 0.153170, 0.144893, 0.122649, 0.092902, 0.062970  // stddev = 2.0
+#endif
+
+/** Output pixels per thread group along each axis */
+#define TILE_SIZE           (16)
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+#define HALO                (R * SCALE)
+#define CACHE_SIZE          (TILE_SIZE + 2 * HALO)
+
+#define VALUE_COMPONENTS   r
+#define KEY_COMPONENTS     gb
+
+static const float gaussian[R + 1] = { GAUSSIAN_TABLE };
+
+/** Output of SAO_AO.hlsl */
+Texture2D<float4>   source;
+
+/** Final AO, with the key passed through in KEY_COMPONENTS like SAO_blur.hlsl */
+RWTexture2D<float4> result;
+
+/** First pixel inside the guard band */
+int2 interiorMin;
+
+/** One past the last pixel inside the guard band */
+int2 interiorMax;
+
+groupshared float cachedValue[CACHE_SIZE][CACHE_SIZE];
+groupshared float cachedKey[CACHE_SIZE][CACHE_SIZE];
+
+/** Horizontally blurred values of the tile columns for the tile rows and the halo rows */
+groupshared float hBlurred[CACHE_SIZE][TILE_SIZE];
+
+/** Returns a number on (0, 1) */
+float unpackKey(float2 p)
+{
+	return p.x * (256.0 / 257.0) + p.y * (1.0 / 257.0);
+}
+
+float bilateralWeight(int r, float tapKey, float key)
+{
+	// spatial domain: offset gaussian tap, range domain: the "bilateral" weight
+	return (0.3 + gaussian[abs(r)]) * max(0.0, 1.0 - (2000.0 * EDGE_SHARPNESS) * abs(tapKey - key));
+}
+
+[numthreads(TILE_SIZE, TILE_SIZE, 1)]
+void cs_main(uint3 groupID : SV_GroupID, uint3 threadID : SV_GroupThreadID, uint threadIndex : SV_GroupIndex)
+{
+	const int2 tileOrigin = interiorMin + int2(groupID.xy) * TILE_SIZE;
+	const int2 cacheOrigin = tileOrigin - HALO;
+
+	uint width, height;
+	source.GetDimensions(width, height);
+	const int2 size = int2(width, height);
+
+	// Load the tile and its halo.  Load() returns zero outside of the texture, like texelFetch in the two-pass version.
+	for (int i = threadIndex; i < CACHE_SIZE * CACHE_SIZE; i += TILE_SIZE * TILE_SIZE) {
+		const int2 c = int2(i % CACHE_SIZE, i / CACHE_SIZE);
+		const float4 temp = source.Load(int3(cacheOrigin + c, 0));
+		cachedValue[c.y][c.x] = temp.VALUE_COMPONENTS;
+		cachedKey[c.y][c.x]   = unpackKey(temp.KEY_COMPONENTS);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// Horizontal pass over all cached rows of the tile columns
+	for (int j = threadIndex; j < CACHE_SIZE * TILE_SIZE; j += TILE_SIZE * TILE_SIZE) {
+		const int2 c = int2(j % TILE_SIZE + HALO, j / TILE_SIZE);
+		const int2 ssC = cacheOrigin + c;
+
+		float sum;
+		if (any(ssC < 0) || any(ssC >= size)) {
+			// Off the texture
+			sum = 0.0;
+		} else if (any(ssC < interiorMin) || any(ssC >= interiorMax)) {
+			// The guard band of hBlurredBuffer is cleared to white
+			sum = 1.0;
+		} else {
+			const float key = cachedKey[c.y][c.x];
+			sum = cachedValue[c.y][c.x];
+
+			// Sky pixels pass through
+			if (key != 1.0) {
+				float totalWeight = gaussian[0];
+				sum *= totalWeight;
+
+				[unroll]
+				for (int r = -R; r <= R; ++r) {
+					if (r != 0) {
+						const float weight = bilateralWeight(r, cachedKey[c.y][c.x + r * SCALE], key);
+						sum += cachedValue[c.y][c.x + r * SCALE] * weight;
+						totalWeight += weight;
+					}
+				}
+
+				sum /= totalWeight + 0.0001;
+			}
+		}
+
+		hBlurred[c.y][c.x - HALO] = sum;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// Vertical pass
+	const int2 ssC = tileOrigin + int2(threadID.xy);
+	if (any(ssC >= interiorMax)) {
+		return;
+	}
+
+	const int2 c = int2(threadID.xy) + HALO;
+	const float key = cachedKey[c.y][c.x];
+	float sum = hBlurred[c.y][threadID.x];
+
+	if (key != 1.0) {
+		float totalWeight = gaussian[0];
+		sum *= totalWeight;
+
+		[unroll]
+		for (int r = -R; r <= R; ++r) {
+			if (r != 0) {
+				const float weight = bilateralWeight(r, cachedKey[c.y + r * SCALE][c.x], key);
+				sum += hBlurred[c.y + r * SCALE][threadID.x] * weight;
+				totalWeight += weight;
+			}
+		}
+
+		sum /= totalWeight + 0.0001;
+	}
+
+	const float4 raw = source.Load(int3(ssC, 0));
+	result[ssC] = float4(sum, raw.KEY_COMPONENTS, 1.0);
+}
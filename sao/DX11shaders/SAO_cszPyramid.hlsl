@@ -0,0 +1,102 @@
+/**
+ \file SAO_cszPyramid.hlsl
+
+  Compute shader that builds all MIP levels of the camera-space z buffer in one dispatch, replacing
+  SAO_reconstruct_csz.hlsl followed by one SAO_minify.hlsl pass per level.
+
+  Each thread group reconstructs a TILE_SIZE x TILE_SIZE tile of level 0 from the depth buffer into
+  groupshared memory and then minifies it in place with the rotated grid rule of SAO_minify.hlsl down
+  to a single texel of level MAX_MIP_LEVEL.  Rotated grid subsampling maps every texel of level i to a
+  texel of level i - 1 in the same tile, so no group depends on another and no level is read back
+  from memory.  Every texel of every level is written, so the levels need not be cleared.
+
+  Dispatch ceil(width / TILE_SIZE) x ceil(height / TILE_SIZE) groups with the UAV of MIP level i
+  bound to cszLevel<i>.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+
+  Copyright (c) 2011-2012, NVIDIA
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+  Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  */
+
+/** Must match MAX_MIP_LEVEL in SAO_AO.hlsl */
+#define MAX_MIP_LEVEL (5)
+
+/** Level 0 texels per thread group along each axis, so that the last level has one texel per group */
+#define TILE_SIZE     (1 << MAX_MIP_LEVEL)
+
+/* 
+ Clipping plane constants for use by reconstructZ
+
+ clipInfo = (z_f == -inf()) ? Vector3(z_n, -1.0f, 1.0f) : Vector3(z_n * z_f,  z_n - z_f,  z_f);
+*/
+float3 clipInfo;
+
+Texture2D<float>   depthBuffer;
+
+RWTexture2D<float> cszLevel0;
+RWTexture2D<float> cszLevel1;
+RWTexture2D<float> cszLevel2;
+RWTexture2D<float> cszLevel3;
+RWTexture2D<float> cszLevel4;
+RWTexture2D<float> cszLevel5;
+
+/** Level i of the tile is stored in cachedZ[i & 1] */
+groupshared float cachedZ[2][TILE_SIZE * TILE_SIZE];
+
+float reconstructCSZ(float d) {
+	return clipInfo[0] / (clipInfo[1] * d + clipInfo[2]);
+}
+
+int2 levelSize(RWTexture2D<float> level) {
+	uint width, height;
+	level.GetDimensions(width, height);
+	return int2(width, height);
+}
+
+/** Computes texels of level LEVEL from level LEVEL - 1 of the tile.  Threads outside of the level's
+    part of the tile idle but still reach the barrier. */
+#define MINIFY(LEVEL, DST, PREVIOUS)                                                                        \
+	{                                                                                                       \
+		const int n = TILE_SIZE >> LEVEL;                                                                   \
+		if (all(int2(threadID.xy) < n)) {                                                                   \
+			const int2 ssP = int2(groupID.xy) * n + int2(threadID.xy);                                      \
+                                                                                                            \
+			/* Rotated grid subsampling; the parity is that of the global coordinate */                     \
+			const int2 ssQ = min(ssP * 2 + int2((ssP.y & 1) ^ 1, (ssP.x & 1) ^ 1), levelSize(PREVIOUS) - 1); \
+			const int2 q = ssQ - int2(groupID.xy) * (2 * n);                                                \
+			const float z = cachedZ[(LEVEL - 1) & 1][q.y * TILE_SIZE + q.x];                                \
+                                                                                                            \
+			cachedZ[LEVEL & 1][threadID.y * TILE_SIZE + threadID.x] = z;                                    \
+			if (all(ssP < levelSize(DST))) {                                                                \
+				DST[ssP] = z;                                                                               \
+			}                                                                                               \
+		}                                                                                                   \
+		GroupMemoryBarrierWithGroupSync();                                                                  \
+	}
+
+[numthreads(TILE_SIZE, TILE_SIZE, 1)]
+void cs_main(uint3 groupID : SV_GroupID, uint3 threadID : SV_GroupThreadID)
+{
+	// Level 0
+	const int2 ssC = int2(groupID.xy) * TILE_SIZE + int2(threadID.xy);
+	const float z = reconstructCSZ(depthBuffer.Load(int3(ssC, 0)));
+	cachedZ[0][threadID.y * TILE_SIZE + threadID.x] = z;
+	if (all(ssC < levelSize(cszLevel0))) {
+		cszLevel0[ssC] = z;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	MINIFY(1, cszLevel1, cszLevel0)
+	MINIFY(2, cszLevel2, cszLevel1)
+	MINIFY(3, cszLevel3, cszLevel2)
+	MINIFY(4, cszLevel4, cszLevel3)
+	MINIFY(5, cszLevel5, cszLevel4)
+}
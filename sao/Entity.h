@@ -28,6 +28,23 @@ public:
     virtual void setFrame(const CFrame& f) {
         m_frame = f;
     }
+
+    /** NULL unless this entity was created from an ArticulatedModel */
+    ArticulatedModel::Ref articulatedModel() const {
+        return m_artModel;
+    }
+
+    /** True if the parts of the model are animated, which only onSimulation() evaluates */
+    bool hasPoseSpline() const {
+        return m_artPoseSpline.partSpline.size() > 0;
+    }
+
+    /** Does what onSimulation() does to the frame, for a frame that was evaluated elsewhere (see
+        Scene::onSimulation) */
+    void setSimulatedFrame(const CFrame& f) {
+        m_previousFrame = m_frame;
+        m_frame = f;
+    }
 };
 
 #endif
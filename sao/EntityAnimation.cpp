@@ -0,0 +1,344 @@
+/**
+ \file EntityAnimation.cpp
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#include "EntityAnimation.h"
+#include "SAOSIMD.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+using namespace SAOSIMD;
+
+static const float inf = std::numeric_limits<float>::infinity();
+
+
+int EntityAnimation::add(const float* time, const Control* control, int count, bool cyclic, float finalInterval) {
+    assert(count > 0);
+    const uint32_t s = uint32_t(m_first.size());
+    m_first.push_back(uint32_t(m_point.size()));
+    m_count.push_back(uint32_t(count));
+    m_cyclic.push_back(cyclic ? 1 : 0);
+
+    if (finalInterval <= 0.0f) {
+        finalInterval = (count >= 2) ? 0.5f * (time[1] - time[0] + time[count - 1] - time[count - 2]) : 1.0f;
+    }
+    m_period.push_back(time[count - 1] - time[0] + finalInterval);
+
+    for (int i = 0; i < count; ++i) {
+        assert((i == 0) || (time[i] > time[i - 1]));
+        Point p;
+        p.time = time[i];
+        for (int k = 0; k < 3; ++k) {
+            p.value[TRANSLATION + k] = control[i].translation[k];
+        }
+        for (int k = 0; k < 4; ++k) {
+            p.value[ROTATION + k] = control[i].rotation[k];
+        }
+        m_point.push_back(p);
+    }
+
+    // Padding splines are constant
+    const size_t padded = (m_first.size() + PADDING - 1) / PADDING * PADDING;
+    if (m_start.size() < padded) {
+        m_start.resize(padded);
+        m_end.resize(padded);
+        m_inverseLength.resize(padded);
+        for (int k = 0; k < 4 * COMPONENTS; ++k) {
+            m_cubic[k].resize(padded);
+        }
+        for (int k = 0; k < 12; ++k) {
+            m_frame[k].resize(padded);
+        }
+        for (size_t i = s; i < padded; ++i) {
+            setIdentity(uint32_t(i));
+        }
+    }
+
+    setSegment(s, time[0]);
+    return int(s);
+}
+
+
+void EntityAnimation::remove(int s) {
+    setIdentity(uint32_t(s));
+}
+
+
+void EntityAnimation::clear() {
+    m_point.clear();
+    m_first.clear();
+    m_count.clear();
+    m_cyclic.clear();
+    m_period.clear();
+    m_start.clear();
+    m_end.clear();
+    m_inverseLength.clear();
+    for (int k = 0; k < 4 * COMPONENTS; ++k) {
+        m_cubic[k].clear();
+    }
+    for (int k = 0; k < 12; ++k) {
+        m_frame[k].clear();
+    }
+}
+
+
+void EntityAnimation::setIdentity(uint32_t s) {
+    m_start[s] = -inf;
+    m_end[s] = inf;
+    m_inverseLength[s] = 0.0f;
+    for (int k = 0; k < 4 * COMPONENTS; ++k) {
+        m_cubic[k][s] = 0.0f;
+    }
+    m_cubic[4 * (ROTATION + 3) + 3][s] = 1.0f;
+    for (int k = 0; k < 12; ++k) {
+        m_frame[k][s] = ((k == 0) || (k == 5) || (k == 10)) ? 1.0f : 0.0f;
+    }
+}
+
+
+void EntityAnimation::control(uint32_t s, int i, float& t, float c[COMPONENTS]) const {
+    const Point* point = &m_point[m_first[s]];
+    const int N = int(m_count[s]);
+
+    if ((i >= 0) && (i < N)) {
+        t = point[i].time;
+        for (int k = 0; k < COMPONENTS; ++k) {
+            c[k] = point[i].value[k];
+        }
+        return;
+    }
+
+    if (m_cyclic[s]) {
+        // findSegment() wraps the time into the first period, so i is on [-1, N + 1]
+        const int wraps = (i < 0) ? -((N - 1 - i) / N) : (i / N);
+        const int j = i - wraps * N;
+        t = point[j].time + float(wraps) * m_period[s];
+        for (int k = 0; k < COMPONENTS; ++k) {
+            c[k] = point[j].value[k];
+        }
+        return;
+    }
+
+    // Linear extrapolation from the two control points at that end, x steps beyond it
+    int a, b;
+    float x;
+    if (i < 0) {
+        a = 0;
+        b = 1;
+        x = float(-i);
+    } else {
+        a = N - 1;
+        b = N - 2;
+        x = float(i - N + 1);
+    }
+    t = point[a].time + (point[a].time - point[b].time) * x;
+    for (int k = 0; k < COMPONENTS; ++k) {
+        c[k] = point[a].value[k] + (point[a].value[k] - point[b].value[k]) * x;
+    }
+    float length = 0.0f;
+    for (int k = ROTATION; k < ROTATION + 4; ++k) {
+        length += c[k] * c[k];
+    }
+    length = std::sqrt(length);
+    for (int k = ROTATION; k < ROTATION + 4; ++k) {
+        c[k] /= length;
+    }
+}
+
+
+void EntityAnimation::findSegment(uint32_t s, float time, Segment& segment) const {
+    const Point* point = &m_point[m_first[s]];
+    const int N = int(m_count[s]);
+    assert(N >= 2);
+
+    if (m_cyclic[s]) {
+        const float period = m_period[s];
+        time -= std::floor((time - point[0].time) / period) * period;
+        // Rounding can leave the wrapped time just outside the period
+        time = std::max(point[0].time, time);
+    }
+
+    int i;
+    float u;
+    if (time < point[0].time) {
+        const float x = (time - point[0].time) / (point[1].time - point[0].time);
+        i = int(std::floor(x));
+        u = x - float(i);
+    } else if (time >= point[N - 1].time) {
+        if (m_cyclic[s]) {
+            i = N - 1;
+            u = (time - point[N - 1].time) / (m_period[s] - (point[N - 1].time - point[0].time));
+        } else {
+            const float x = float(N - 1) + (time - point[N - 1].time) / (point[N - 1].time - point[N - 2].time);
+            i = int(std::floor(x));
+            u = x - float(i);
+        }
+    } else {
+        i = 0;
+        while (point[i + 1].time <= time) {
+            ++i;
+        }
+        u = (time - point[i].time) / (point[i + 1].time - point[i].time);
+    }
+    segment.index = i;
+    segment.u     = std::min(std::max(u, 0.0f), 1.0f);
+
+    float t[4];
+    for (int j = 0; j < 4; ++j) {
+        control(s, i - 1 + j, t[j], segment.p[j]);
+    }
+
+    // Shortest path between consecutive rotations
+    for (int j = 1; j < 4; ++j) {
+        float dot = 0.0f;
+        for (int k = ROTATION; k < ROTATION + 4; ++k) {
+            dot += segment.p[j - 1][k] * segment.p[j][k];
+        }
+        if (dot < 0.0f) {
+            for (int k = ROTATION; k < ROTATION + 4; ++k) {
+                segment.p[j][k] = -segment.p[j][k];
+            }
+        }
+    }
+
+    const float dt0 = t[1] - t[0], dt1 = t[2] - t[1], dt2 = t[3] - t[2];
+    const float x = 0.5f * (dt0 + dt1);
+    segment.length = dt1;
+    segment.n[0] = x / dt0;
+    segment.n[1] = x / dt1;
+    segment.n[2] = x / dt2;
+}
+
+
+void EntityAnimation::setSegment(uint32_t s, float time) {
+    if (m_count[s] == 1) {
+        // Constant
+        const Point& p = m_point[m_first[s]];
+        m_start[s] = -inf;
+        m_end[s] = inf;
+        m_inverseLength[s] = 0.0f;
+        for (int k = 0; k < COMPONENTS; ++k) {
+            for (int j = 0; j < 4; ++j) {
+                m_cubic[4 * k + j][s] = (j == 3) ? p.value[k] : 0.0f;
+            }
+        }
+        return;
+    }
+
+    Segment segment;
+    findSegment(s, time, segment);
+    m_start[s] = time - segment.u * segment.length;
+    m_end[s] = m_start[s] + segment.length;
+    m_inverseLength[s] = 1.0f / segment.length;
+
+    // The Hermite form that Spline evaluates, p1 h00 + p2 h01 + (tangent1 h10 + tangent2 h11) / 2, in powers of u
+    for (int k = 0; k < COMPONENTS; ++k) {
+        const float p0 = segment.p[0][k], p1 = segment.p[1][k], p2 = segment.p[2][k], p3 = segment.p[3][k];
+        const float dp1n1 = (p2 - p1) * segment.n[1];
+        const float tangent1 = 0.5f * ((p1 - p0) * segment.n[0] + dp1n1);
+        const float tangent2 = 0.5f * ((p3 - p2) * segment.n[2] + dp1n1);
+        m_cubic[4 * k + 0][s] = 2.0f * (p1 - p2) + tangent1 + tangent2;
+        m_cubic[4 * k + 1][s] = 3.0f * (p2 - p1) - 2.0f * tangent1 - tangent2;
+        m_cubic[4 * k + 2][s] = tangent1;
+        m_cubic[4 * k + 3][s] = p1;
+    }
+}
+
+
+/** Rotation matrix of a unit quaternion in elements 0-2, 4-6, and 8-10 of the row-major \a frame, and the
+    translation in 3, 7, and 11 */
+template<class T>
+static inline void toFrame(const T q[4], const T p[3], T frame[12]) {
+    const T x = q[0], y = q[1], z = q[2], w = q[3];
+    const T one(1.0f), two(2.0f);
+    frame[0]  = one - two * (y * y + z * z);
+    frame[1]  = two * (x * y - w * z);
+    frame[2]  = two * (x * z + w * y);
+    frame[3]  = p[0];
+    frame[4]  = two * (x * y + w * z);
+    frame[5]  = one - two * (x * x + z * z);
+    frame[6]  = two * (y * z - w * x);
+    frame[7]  = p[1];
+    frame[8]  = two * (x * z - w * y);
+    frame[9]  = two * (y * z + w * x);
+    frame[10] = one - two * (x * x + y * y);
+    frame[11] = p[2];
+}
+
+
+void EntityAnimation::evaluateScalar(int s, float time, float frame[12]) const {
+    float r[COMPONENTS];
+    if (m_count[s] == 1) {
+        float t;
+        control(uint32_t(s), 0, t, r);
+    } else {
+        Segment segment;
+        findSegment(uint32_t(s), time, segment);
+        const float u = segment.u, u2 = u * u, u3 = u2 * u;
+        // Hermite weights of p1, p2 and the tangents, with Catmull-Rom's factor of 1/2 on the tangents
+        const float w0 = 0.5f * u3 - u2 + 0.5f * u;
+        const float w1 = 2.0f * u3 - 3.0f * u2 + 1.0f;
+        const float w2 = -2.0f * u3 + 3.0f * u2;
+        const float w3 = 0.5f * u3 - 0.5f * u2;
+        const float (*p)[COMPONENTS] = segment.p;
+        for (int k = 0; k < COMPONENTS; ++k) {
+            const float dp1n1 = (p[2][k] - p[1][k]) * segment.n[1];
+            const float tangent1 = (p[1][k] - p[0][k]) * segment.n[0] + dp1n1;
+            const float tangent2 = (p[3][k] - p[2][k]) * segment.n[2] + dp1n1;
+            r[k] = tangent1 * w0 + p[1][k] * w1 + p[2][k] * w2 + tangent2 * w3;
+        }
+    }
+    const float scale = 1.0f / std::sqrt(r[3] * r[3] + r[4] * r[4] + r[5] * r[5] + r[6] * r[6]);
+    for (int k = ROTATION; k < ROTATION + 4; ++k) {
+        r[k] *= scale;
+    }
+    toFrame(r + ROTATION, r + TRANSLATION, frame);
+}
+
+
+void EntityAnimation::evaluate(float time, int begin, int end) {
+    assert((begin >= 0) && (begin % PADDING == 0));
+    end = std::min(int(m_start.size()), (end + PADDING - 1) / PADDING * PADDING);
+    const Float T(time);
+
+    for (int s = begin; s < end; s += WIDTH) {
+        // Splines whose time left their segment, which happens every few dozen frames for each
+        const Float outside = (T < Float::load(&m_start[s])) | (Float::load(&m_end[s]) <= T);
+        if (any(outside)) {
+            float mask[WIDTH];
+            outside.store(mask);
+            for (int l = 0; l < WIDTH; ++l) {
+                if ((mask[l] != 0.0f) && (s + l < int(m_first.size()))) {
+                    setSegment(uint32_t(s + l), time);
+                }
+            }
+        }
+
+        const Float u = min(max((T - Float::load(&m_start[s])) * Float::load(&m_inverseLength[s]), Float(0.0f)), Float(1.0f));
+        Float r[COMPONENTS];
+        for (int k = 0; k < COMPONENTS; ++k) {
+            r[k] = madd(madd(madd(Float::load(&m_cubic[4 * k][s]), u, Float::load(&m_cubic[4 * k + 1][s])), u,
+                             Float::load(&m_cubic[4 * k + 2][s])), u, Float::load(&m_cubic[4 * k + 3][s]));
+        }
+        const Float scale = Float(1.0f) / sqrt(madd(r[3], r[3], madd(r[4], r[4], madd(r[5], r[5], r[6] * r[6]))));
+        for (int k = ROTATION; k < ROTATION + 4; ++k) {
+            r[k] = r[k] * scale;
+        }
+
+        Float f[12];
+        toFrame(r + ROTATION, r + TRANSLATION, f);
+        for (int k = 0; k < 12; ++k) {
+            f[k].store(&m_frame[k][s]);
+        }
+    }
+}
+
+
+void EntityAnimation::frame(int s, float frame[12]) const {
+    for (int k = 0; k < 12; ++k) {
+        frame[k] = m_frame[k][s];
+    }
+}
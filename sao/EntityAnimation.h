@@ -0,0 +1,136 @@
+/**
+ \file EntityAnimation.h
+
+ Frame splines of many entities in structure-of-arrays form, evaluated several entities at a time with
+ SAOSIMD.  No G3D dependency; Scene.cpp copies each Entity's PhysicsFrameSpline here and writes the
+ evaluated frames back.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef EntityAnimation_h
+#define EntityAnimation_h
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ \brief The PhysicsFrameSpline of every animated entity, with the current segment and frame of each kept in
+ one array per component.
+
+ G3D evaluates a spline per GEntity through the generic Spline<PhysicsFrame> template, which finds the
+ segment, copies its four PhysicsFrame%s, and weights them, every frame.  A segment is a cubic in its
+ parameter, so this class finds it only when the time leaves it, stores the cubic's coefficients for each
+ of the seven components (translation and quaternion), and evaluate() then reads SAOSIMD::WIDTH splines
+ per load, evaluates the cubics, normalizes the quaternions, and writes the rotation matrices and
+ translations.  Splines are padded to a multiple of 8, the widest SAOSIMD::WIDTH, so ranges that start
+ at multiples of 8 can be evaluated on different threads.
+
+ The segments match Spline's non-uniform Catmull-Rom segments: cyclic splines wrap with a period of their
+ duration plus the final interval, other splines continue linearly past their ends, and quaternions are
+ flipped onto the shortest path before weighting, as PhysicsFrameSpline does.  evaluateScalar() weights
+ the control points directly, as Spline does, for reference.
+ */
+class EntityAnimation {
+public:
+
+    /** A PhysicsFrame: a translation and a unit quaternion (x, y, z, w) */
+    class Control {
+    public:
+        float               translation[3];
+        float               rotation[4];
+    };
+
+    enum {PADDING = 8};
+
+protected:
+
+    enum {TRANSLATION = 0, ROTATION = 3, COMPONENTS = 7};
+
+    /** A control point and its time, 32 bytes */
+    class Point {
+    public:
+        float               time;
+        float               value[COMPONENTS];
+    };
+
+    /** The segment of a spline at one time, with its four control points flipped onto the shortest rotation path */
+    class Segment {
+    public:
+        int                 index;
+
+        /** Parameter on [0, 1] */
+        float               u;
+
+        /** Duration */
+        float               length;
+
+        /** Scales of the differences of the control points for unequal time intervals */
+        float               n[3];
+
+        float               p[4][COMPONENTS];
+    };
+
+    /** The control points of each spline, consecutively */
+    std::vector<Point>      m_point;
+
+    /** Per spline */
+    std::vector<uint32_t>   m_first;
+    std::vector<uint32_t>   m_count;
+    std::vector<uint8_t>    m_cyclic;
+
+    /** Cyclic splines repeat with this period: the last time minus the first plus the final interval */
+    std::vector<float>      m_period;
+
+    /** Per spline, padded to a multiple of PADDING.  The current segment covers times [m_start, m_end). */
+    std::vector<float>      m_start;
+    std::vector<float>      m_end;
+    std::vector<float>      m_inverseLength;
+
+    /** m_cubic[4 * k + j] is the coefficient of u^(3 - j) for component k on the current segment */
+    std::vector<float>      m_cubic[4 * COMPONENTS];
+
+    /** Row-major 3 x 4 frame of each spline from the last evaluate(), one array per element */
+    std::vector<float>      m_frame[12];
+
+    /** The time of control point \a i of spline \a s, which may be before the first or after the last, and
+        its components */
+    void control(uint32_t s, int i, float& t, float c[COMPONENTS]) const;
+
+    /** The segment of spline \a s at \a time */
+    void findSegment(uint32_t s, float time, Segment& segment) const;
+
+    /** Sets the cubics of spline \a s to the segment at \a time */
+    void setSegment(uint32_t s, float time);
+
+    /** Makes spline \a s constant at the identity */
+    void setIdentity(uint32_t s);
+
+public:
+
+    /** Adds a spline and returns its index.  \a finalInterval is the time from the last control point back to
+        the first for a cyclic spline; if it is not positive, the mean of the first and last intervals is used,
+        as in Spline.  \a time must be increasing. */
+    int add(const float* time, const Control* control, int count, bool cyclic, float finalInterval);
+
+    /** Makes spline \a s constant at the identity, e.g., when its entity is simulated elsewhere from then on */
+    void remove(int s);
+
+    void clear();
+
+    int size() const {
+        return int(m_first.size());
+    }
+
+    /** Evaluates splines [begin, end) at \a time.  \a begin must be a multiple of PADDING, and the range is
+        rounded up to one.  Ranges that do not overlap may run concurrently. */
+    void evaluate(float time, int begin, int end);
+
+    /** Evaluates spline \a s by weighting its control points, as Spline does, without SIMD.  Does not change
+        frame(). */
+    void evaluateScalar(int s, float time, float frame[12]) const;
+
+    /** Row-major 3 x 4, from the last evaluate() */
+    void frame(int s, float frame[12]) const;
+};
+
+#endif // EntityAnimation_h
@@ -0,0 +1,468 @@
+/**
+ \file ModelCache.cpp
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#include "ModelCache.h"
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#ifdef _WIN32
+#   define NOMINMAX
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+static const char MAGIC[8] = {'M', 'D', 'L', 'C', 'A', 'C', 'H', '\0'};
+
+enum {VERTICES, INDICES, PARTS, MESHES, MATERIALS, STRINGS, SECTION_COUNT};
+
+static const size_t sectionElementBytes[SECTION_COUNT] =
+    {sizeof(ModelCache::Vertex), sizeof(uint32_t), sizeof(ModelCache::Part), sizeof(ModelCache::Mesh), sizeof(ModelCache::Material), 1};
+
+/** The fields are copied in host byte order, which is little-endian on every platform that the demo runs on */
+static bool hostIsLittleEndian() {
+    const unsigned int one = 1;
+    unsigned char b;
+    memcpy(&b, &one, 1);
+    return b == 1;
+}
+
+
+static size_t alignUp(size_t x) {
+    return (x + ModelCache::ALIGNMENT - 1) & ~size_t(ModelCache::ALIGNMENT - 1);
+}
+
+
+uint64_t ModelCache::hash(const void* data, size_t bytes, uint64_t seed) {
+    // Eight bytes per step, with the multiply-rotate rounds and finalizer of MurmurHash3
+    const uint64_t k1 = 0x87c37b91114253d5ULL, k2 = 0x4cf5ad432745937fULL;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = seed ^ (uint64_t(bytes) * k1);
+
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        w *= k1;
+        w  = (w << 31) | (w >> 33);
+        h ^= w * k2;
+        h  = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+    }
+    uint64_t tail = 0;
+    for (size_t j = 0; i + j < bytes; ++j) {
+        tail |= uint64_t(p[i + j]) << (8 * j);
+    }
+    h ^= tail * k2;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+bool ModelCache::hashFile(const std::string& filename, uint64_t& result, std::string& error, uint64_t seed) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL) {
+        error = "Cannot open " + filename;
+        return false;
+    }
+    std::vector<unsigned char> buffer(1 << 20);
+    result = seed;
+    size_t n;
+    while ((n = fread(&buffer[0], 1, buffer.size(), file)) > 0) {
+        result = hash(&buffer[0], n, result);
+    }
+    const bool ok = (ferror(file) == 0);
+    fclose(file);
+    if (! ok) {
+        error = "Cannot read " + filename;
+    }
+    return ok;
+}
+
+
+ModelCache::Builder::Builder() : flags(HAS_TANGENTS | HAS_TEXCOORDS), m_strings(1, '\0') {}
+
+
+uint32_t ModelCache::Builder::addString(const std::string& s) {
+    if (s.empty()) {
+        return 0;
+    }
+    const uint32_t offset = uint32_t(m_strings.size());
+    m_strings.append(s.c_str(), s.size() + 1);
+    return offset;
+}
+
+
+std::string ModelCache::Builder::string(uint32_t offset) const {
+    return m_strings.c_str() + offset;
+}
+
+
+int ModelCache::Builder::findMaterial(const std::string& name) const {
+    for (int i = 0; i < int(materials.size()); ++i) {
+        if (name == m_strings.c_str() + materials[i].name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/** Number of arguments of each texture map option of the MTL format */
+static int mapOptionArguments(const std::string& option) {
+    if ((option == "-o") || (option == "-s") || (option == "-t")) {
+        return 3;
+    } else if (option == "-mm") {
+        return 2;
+    } else {
+        // -bm, -blendu, -blendv, -boost, -cc, -clamp, -imfchan, -texres
+        return 1;
+    }
+}
+
+
+/** Parses "[options] filename" of a texture map statement, returning the filename with forward slashes and
+    setting \a bumpScale if there is a -bm option */
+static std::string parseMap(std::istringstream& line, float* bumpScale = NULL) {
+    std::string token;
+    while (line >> token) {
+        if ((token.size() > 1) && (token[0] == '-') && ! isdigit((unsigned char)token[1])) {
+            const int n = mapOptionArguments(token);
+            for (int i = 0; i < n; ++i) {
+                std::string argument;
+                line >> argument;
+                if ((token == "-bm") && (bumpScale != NULL)) {
+                    *bumpScale = float(atof(argument.c_str()));
+                }
+            }
+        } else {
+            // The filename is the rest of the line, which may contain spaces
+            std::string rest;
+            std::getline(line, rest);
+            std::string filename = token + rest;
+            while (! filename.empty() && isspace((unsigned char)filename[filename.size() - 1])) {
+                filename.erase(filename.size() - 1);
+            }
+            std::replace(filename.begin(), filename.end(), '\\', '/');
+            return filename;
+        }
+    }
+    return "";
+}
+
+
+void ModelCache::Builder::parseMTL(const std::string& text, const std::string& directory) {
+    std::istringstream input(text);
+    std::string lineText;
+    Material* m = NULL;
+    while (std::getline(input, lineText)) {
+        std::istringstream line(lineText);
+        std::string keyword;
+        if (! (line >> keyword) || (keyword[0] == '#')) {
+            continue;
+        }
+
+        if (keyword == "newmtl") {
+            std::string name;
+            std::getline(line >> std::ws, name);
+            while (! name.empty() && isspace((unsigned char)name[name.size() - 1])) {
+                name.erase(name.size() - 1);
+            }
+            Material material;
+            memset(&material, 0, sizeof(material));
+            material.name    = addString(name);
+            std::fill(material.diffuse, material.diffuse + 3, 1.0f);
+            material.opacity   = 1.0f;
+            material.bumpScale = 1.0f;
+            materials.push_back(material);
+            m = &materials.back();
+        } else if (m == NULL) {
+            continue;
+        } else if (keyword == "Kd") {
+            line >> m->diffuse[0] >> m->diffuse[1] >> m->diffuse[2];
+        } else if (keyword == "Ks") {
+            line >> m->specular[0] >> m->specular[1] >> m->specular[2];
+        } else if (keyword == "Ke") {
+            line >> m->emissive[0] >> m->emissive[1] >> m->emissive[2];
+        } else if (keyword == "Ns") {
+            line >> m->shininess;
+        } else if (keyword == "d") {
+            line >> m->opacity;
+        } else if (keyword == "Tr") {
+            float transparency = 0;
+            line >> transparency;
+            m->opacity = 1.0f - transparency;
+        } else if (keyword == "map_Kd") {
+            const std::string filename = parseMap(line);
+            m->diffuseMap = filename.empty() ? 0 : addString(directory + filename);
+        } else if (keyword == "map_d") {
+            const std::string filename = parseMap(line);
+            m->opacityMap = filename.empty() ? 0 : addString(directory + filename);
+        } else if (keyword == "map_Ks") {
+            const std::string filename = parseMap(line);
+            m->specularMap = filename.empty() ? 0 : addString(directory + filename);
+        } else if ((keyword == "map_bump") || (keyword == "bump") || (keyword == "map_Bump")) {
+            const std::string filename = parseMap(line, &m->bumpScale);
+            m->bumpMap = filename.empty() ? 0 : addString(directory + filename);
+        }
+    }
+}
+
+
+bool ModelCache::Builder::write(const std::string& filename, uint64_t contentHash, std::string& error) const {
+    assert(hostIsLittleEndian());
+
+    const void* data[SECTION_COUNT] = {
+        vertices.empty()  ? NULL : &vertices[0],
+        indices.empty()   ? NULL : &indices[0],
+        parts.empty()     ? NULL : &parts[0],
+        meshes.empty()    ? NULL : &meshes[0],
+        materials.empty() ? NULL : &materials[0],
+        m_strings.c_str()};
+    const uint64_t count[SECTION_COUNT] = {vertices.size(), indices.size(), parts.size(), meshes.size(), materials.size(), m_strings.size()};
+
+    unsigned char header[HEADER_BYTES];
+    memset(header, 0, sizeof(header));
+    const uint32_t version = VERSION, headerBytes = HEADER_BYTES;
+    memcpy(header +  0, MAGIC, 8);
+    memcpy(header +  8, &version, 4);
+    memcpy(header + 12, &headerBytes, 4);
+    memcpy(header + 16, &contentHash, 8);
+    memcpy(header + 24, &flags, 4);
+
+    uint64_t offset[SECTION_COUNT];
+    size_t end = HEADER_BYTES;
+    for (int s = 0; s < SECTION_COUNT; ++s) {
+        offset[s] = alignUp(end);
+        end = size_t(offset[s] + count[s] * sectionElementBytes[s]);
+        memcpy(header + 32 + 16 * s,     &offset[s], 8);
+        memcpy(header + 32 + 16 * s + 8, &count[s],  8);
+    }
+
+    const std::string temporary = filename + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == NULL) {
+        error = "Cannot open " + temporary + " for writing";
+        return false;
+    }
+
+    static const unsigned char zero[ALIGNMENT] = {0};
+    bool ok = (fwrite(header, 1, sizeof(header), file) == sizeof(header));
+    size_t position = HEADER_BYTES;
+    for (int s = 0; (s < SECTION_COUNT) && ok; ++s) {
+        const size_t padding = size_t(offset[s]) - position;
+        const size_t bytes   = size_t(count[s] * sectionElementBytes[s]);
+        ok = (fwrite(zero, 1, padding, file) == padding) && ((bytes == 0) || (fwrite(data[s], 1, bytes, file) == bytes));
+        position += padding + bytes;
+    }
+    if ((fclose(file) != 0) || ! ok) {
+        error = "Cannot write " + temporary;
+        remove(temporary.c_str());
+        return false;
+    }
+
+    // rename() does not replace an existing file on Windows
+    remove(filename.c_str());
+    if (rename(temporary.c_str(), filename.c_str()) != 0) {
+        error = "Cannot rename " + temporary + " to " + filename;
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+ModelCache::ModelCache() : m_mapping(NULL), m_mappingBytes(0), m_contentHash(0), m_flags(0),
+    m_vertices(NULL), m_vertexCount(0), m_indices(NULL), m_indexCount(0), m_parts(NULL), m_partCount(0),
+    m_meshes(NULL), m_meshCount(0), m_materials(NULL), m_materialCount(0), m_strings(""), m_stringBytes(0) {
+#   ifdef _WIN32
+        m_fileHandle    = INVALID_HANDLE_VALUE;
+        m_mappingHandle = NULL;
+#   endif
+}
+
+
+ModelCache::~ModelCache() {
+    unmap();
+}
+
+
+void ModelCache::unmap() {
+#   ifdef _WIN32
+        if (m_mapping != NULL) {
+            UnmapViewOfFile(m_mapping);
+        }
+        if (m_mappingHandle != NULL) {
+            CloseHandle(m_mappingHandle);
+            m_mappingHandle = NULL;
+        }
+        if (m_fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_fileHandle);
+            m_fileHandle = INVALID_HANDLE_VALUE;
+        }
+#   else
+        if (m_mapping != NULL) {
+            munmap(const_cast<unsigned char*>(m_mapping), m_mappingBytes);
+        }
+#   endif
+    m_mapping       = NULL;
+    m_mappingBytes  = 0;
+    m_contentHash   = 0;
+    m_flags         = 0;
+    m_vertices      = NULL;
+    m_vertexCount   = 0;
+    m_indices       = NULL;
+    m_indexCount    = 0;
+    m_parts         = NULL;
+    m_partCount     = 0;
+    m_meshes        = NULL;
+    m_meshCount     = 0;
+    m_materials     = NULL;
+    m_materialCount = 0;
+    m_strings       = "";
+    m_stringBytes   = 0;
+}
+
+
+bool ModelCache::load(const std::string& filename, uint64_t contentHash, std::string& error) {
+    assert(hostIsLittleEndian());
+    unmap();
+
+#   ifdef _WIN32
+        m_fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        LARGE_INTEGER size;
+        if ((m_fileHandle == INVALID_HANDLE_VALUE) || ! GetFileSizeEx(m_fileHandle, &size)) {
+            error = "Cannot open " + filename;
+            unmap();
+            return false;
+        }
+        m_mappingBytes = size_t(size.QuadPart);
+        if (m_mappingBytes >= HEADER_BYTES) {
+            m_mappingHandle = CreateFileMappingA(m_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (m_mappingHandle != NULL) {
+                m_mapping = static_cast<const unsigned char*>(MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+            }
+        }
+#   else
+        const int fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if ((fd < 0) || (fstat(fd, &st) != 0)) {
+            error = "Cannot open " + filename;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        m_mappingBytes = size_t(st.st_size);
+        if (m_mappingBytes >= HEADER_BYTES) {
+            void* p = mmap(NULL, m_mappingBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                m_mapping = static_cast<const unsigned char*>(p);
+            }
+        }
+        // The mapping keeps the file open
+        close(fd);
+#   endif
+
+    if (m_mappingBytes < HEADER_BYTES) {
+        error = filename + " is too short to be a model cache";
+        unmap();
+        return false;
+    }
+    if (m_mapping == NULL) {
+        error = "Cannot map " + filename;
+        unmap();
+        return false;
+    }
+
+    const unsigned char* header = m_mapping;
+    uint32_t version = 0, headerBytes = 0;
+    uint64_t fileHash = 0;
+    memcpy(&version,     header +  8, 4);
+    memcpy(&headerBytes, header + 12, 4);
+    memcpy(&fileHash,    header + 16, 8);
+    if ((memcmp(header, MAGIC, 8) != 0) || (headerBytes < HEADER_BYTES)) {
+        error = filename + " is not a model cache";
+        unmap();
+        return false;
+    }
+    if (version != VERSION) {
+        error = filename + " was written by another version of ModelCache";
+        unmap();
+        return false;
+    }
+    if (fileHash != contentHash) {
+        error = filename + " was built from another version of the model or its specification";
+        unmap();
+        return false;
+    }
+
+    const void* section[SECTION_COUNT];
+    uint64_t count[SECTION_COUNT];
+    for (int s = 0; s < SECTION_COUNT; ++s) {
+        uint64_t offset = 0;
+        memcpy(&offset,   header + 32 + 16 * s,     8);
+        memcpy(&count[s], header + 32 + 16 * s + 8, 8);
+        if ((offset % ALIGNMENT != 0) || (offset < headerBytes) || (offset > m_mappingBytes) ||
+            (count[s] > (m_mappingBytes - offset) / sectionElementBytes[s])) {
+            error = filename + " is truncated or has an invalid section table";
+            unmap();
+            return false;
+        }
+        section[s] = m_mapping + offset;
+    }
+
+    m_contentHash   = fileHash;
+    memcpy(&m_flags, header + 24, 4);
+    m_vertices      = static_cast<const Vertex*>(section[VERTICES]);
+    m_vertexCount   = size_t(count[VERTICES]);
+    m_indices       = static_cast<const uint32_t*>(section[INDICES]);
+    m_indexCount    = size_t(count[INDICES]);
+    m_parts         = static_cast<const Part*>(section[PARTS]);
+    m_partCount     = int(count[PARTS]);
+    m_meshes        = static_cast<const Mesh*>(section[MESHES]);
+    m_meshCount     = int(count[MESHES]);
+    m_materials     = static_cast<const Material*>(section[MATERIALS]);
+    m_materialCount = int(count[MATERIALS]);
+    m_strings       = static_cast<const char*>(section[STRINGS]);
+    m_stringBytes   = size_t(count[STRINGS]);
+
+    // The tables are small; check every reference in them so that a bad file cannot index out of the mapping
+    bool valid = (m_stringBytes > 0) && (m_strings[0] == '\0') && (m_strings[m_stringBytes - 1] == '\0');
+    for (int i = 0; (i < m_partCount) && valid; ++i) {
+        const Part& p = m_parts[i];
+        valid = (p.name < m_stringBytes) && (p.parent >= -1) && (p.parent < i) &&
+                (p.firstVertex <= m_vertexCount) && (p.vertexCount <= m_vertexCount - p.firstVertex);
+    }
+    for (int i = 0; (i < m_meshCount) && valid; ++i) {
+        const Mesh& m = m_meshes[i];
+        valid = (m.name < m_stringBytes) && (m.part >= 0) && (m.part < m_partCount) && (m.material >= -1) && (m.material < m_materialCount) &&
+                (m.firstIndex <= m_indexCount) && (m.indexCount <= m_indexCount - m.firstIndex) && (m.indexCount % 3 == 0);
+    }
+    for (int i = 0; (i < m_materialCount) && valid; ++i) {
+        const Material& m = m_materials[i];
+        valid = (m.name < m_stringBytes) && (m.diffuseMap < m_stringBytes) && (m.opacityMap < m_stringBytes) &&
+                (m.specularMap < m_stringBytes) && (m.bumpMap < m_stringBytes);
+    }
+    if (! valid) {
+        error = filename + " has an inconsistent part, mesh, or material table";
+        unmap();
+        return false;
+    }
+
+    return true;
+}
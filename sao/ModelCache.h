@@ -0,0 +1,269 @@
+/**
+ \file ModelCache.h
+
+ Binary cache of the preprocessed geometry, materials, and part hierarchy of a model, so that Scene::create
+ maps one file instead of parsing OBJ text out of a zip on every launch.  No G3D dependency; Scene.cpp
+ converts to and from ArticulatedModel.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef ModelCache_h
+#define ModelCache_h
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ \brief A model's vertex and index arrays, part hierarchy, and material table in one file that is used in
+ place from a single read-only memory mapping.
+
+ File layout, all little-endian:
+
+ \code
+ offset  size  field
+      0     8  "MDLCACH\0"
+      8     4  uint32 version (VERSION)
+     12     4  uint32 headerBytes
+     16     8  uint64 contentHash, of the source files and the specification that produced it
+     24     4  uint32 flags (HAS_TANGENTS, HAS_TEXCOORDS)
+     28     4  reserved, zero
+     32    96  six sections { uint64 offset; uint64 count; }: vertices, indices, parts, meshes, materials, strings
+    128        sections, each at a multiple of ALIGNMENT bytes
+ \endcode
+
+ The vertices of all parts are one contiguous array of Vertex, which has the layout of G3D's
+ CPUVertexArray::Vertex, and the indices of all meshes are one contiguous uint32 array, so both can be
+ passed from the mapping straight to glBufferData.  Mesh indices are relative to the first vertex of their
+ part (use glDrawElementsBaseVertex with Part::firstVertex).  Parts precede their children.  Names and
+ texture filenames are offsets into a table of NUL-terminated strings whose offset 0 is the empty string.
+
+ load() rejects files whose contentHash differs from the caller's, so a cache is rebuilt whenever the
+ model source or its preprocess specification changes.  It checks that every table and range lies inside
+ the file, but does not read the vertex and index arrays, which are paged in as they are uploaded.
+ */
+class ModelCache {
+public:
+
+    enum {VERSION = 1, HEADER_BYTES = 128, ALIGNMENT = 64};
+
+    enum Flags {HAS_TANGENTS = 1, HAS_TEXCOORDS = 2};
+
+    class Vertex {
+    public:
+        float           position[3];
+        float           normal[3];
+
+        /** xyz tangent, w = handedness of the bitangent */
+        float           tangent[4];
+        float           texCoord0[2];
+    };
+
+    class Part {
+    public:
+        uint32_t        name;
+
+        /** Index of the parent part, which precedes this one, or -1 for a root */
+        int32_t         parent;
+
+        /** Row-major 3 x 4 coordinate frame relative to the parent */
+        float           cframe[12];
+
+        uint32_t        firstVertex;
+        uint32_t        vertexCount;
+    };
+
+    /** Triangle list */
+    class Mesh {
+    public:
+        uint32_t        name;
+        int32_t         part;
+
+        /** Index into the material table, or -1 */
+        int32_t         material;
+
+        uint32_t        firstIndex;
+        uint32_t        indexCount;
+        uint32_t        twoSided;
+    };
+
+    /** The terms of a Wavefront MTL material that the model loader turns into a material */
+    class Material {
+    public:
+        uint32_t        name;
+
+        /** Kd */
+        float           diffuse[3];
+
+        /** d, or 1 - Tr */
+        float           opacity;
+
+        /** Ks */
+        float           specular[3];
+
+        /** Ns */
+        float           shininess;
+
+        /** Ke */
+        float           emissive[3];
+
+        /** -bm of the bump map */
+        float           bumpScale;
+
+        /** Texture filenames, resolved against the directory of the MTL file; 0 if absent */
+        uint32_t        diffuseMap;
+        uint32_t        opacityMap;
+        uint32_t        specularMap;
+        uint32_t        bumpMap;
+    };
+
+    /** Accumulates the contents of a cache file; see write() */
+    class Builder {
+    public:
+        std::vector<Vertex>     vertices;
+        std::vector<uint32_t>   indices;
+        std::vector<Part>       parts;
+        std::vector<Mesh>       meshes;
+        std::vector<Material>   materials;
+        uint32_t                flags;
+
+        Builder();
+
+        /** Adds \a s to the string table and returns its offset.  The empty string is offset 0. */
+        uint32_t addString(const std::string& s);
+
+        std::string string(uint32_t offset) const;
+
+        /** Index of the material named \a name, or -1 */
+        int findMaterial(const std::string& name) const;
+
+        /** Appends the materials of the MTL file \a text, whose texture filenames are relative to \a directory
+            (which is empty or ends in a slash) */
+        void parseMTL(const std::string& text, const std::string& directory);
+
+        /** Writes the cache through a temporary file that is renamed over \a filename, so that an interrupted
+            write never leaves a truncated cache.  Returns false and sets \a error on failure. */
+        bool write(const std::string& filename, uint64_t contentHash, std::string& error) const;
+
+    protected:
+
+        /** NUL-terminated strings */
+        std::string             m_strings;
+    };
+
+protected:
+
+    /** Memory-mapped file; NULL when nothing is loaded */
+    const unsigned char*    m_mapping;
+    size_t                  m_mappingBytes;
+
+#   ifdef _WIN32
+        void*               m_fileHandle;
+        void*               m_mappingHandle;
+#   endif
+
+    uint64_t                m_contentHash;
+    uint32_t                m_flags;
+
+    const Vertex*           m_vertices;
+    size_t                  m_vertexCount;
+    const uint32_t*         m_indices;
+    size_t                  m_indexCount;
+    const Part*             m_parts;
+    int                     m_partCount;
+    const Mesh*             m_meshes;
+    int                     m_meshCount;
+    const Material*         m_materials;
+    int                     m_materialCount;
+    const char*             m_strings;
+    size_t                  m_stringBytes;
+
+    void unmap();
+
+    /** Not copyable, because the arrays point into the mapping */
+    ModelCache(const ModelCache&);
+    ModelCache& operator=(const ModelCache&);
+
+public:
+
+    ModelCache();
+
+    ~ModelCache();
+
+    /** Maps \a filename and checks its tables, releasing any previous cache.  Returns false and sets \a error
+        if the file cannot be read, is not a cache, is of another version, was built from other content than
+        \a contentHash, or is inconsistent. */
+    bool load(const std::string& filename, uint64_t contentHash, std::string& error);
+
+    const Vertex* vertices() const {
+        return m_vertices;
+    }
+
+    size_t vertexCount() const {
+        return m_vertexCount;
+    }
+
+    const uint32_t* indices() const {
+        return m_indices;
+    }
+
+    size_t indexCount() const {
+        return m_indexCount;
+    }
+
+    const Part& part(int i) const {
+        return m_parts[i];
+    }
+
+    int partCount() const {
+        return m_partCount;
+    }
+
+    const Mesh& mesh(int i) const {
+        return m_meshes[i];
+    }
+
+    int meshCount() const {
+        return m_meshCount;
+    }
+
+    const Material& material(int i) const {
+        return m_materials[i];
+    }
+
+    int materialCount() const {
+        return m_materialCount;
+    }
+
+    /** Entry of the string table at \a offset */
+    const char* string(uint32_t offset) const {
+        return m_strings + offset;
+    }
+
+    bool hasTangents() const {
+        return (m_flags & HAS_TANGENTS) != 0;
+    }
+
+    bool hasTexCoords() const {
+        return (m_flags & HAS_TEXCOORDS) != 0;
+    }
+
+    /** Size of the file on disk, which is 0 when nothing is loaded */
+    size_t fileBytes() const {
+        return m_mappingBytes;
+    }
+
+    /** 64-bit hash of \a bytes bytes at \a data, chained from \a seed.  Not cryptographic. */
+    static uint64_t hash(const void* data, size_t bytes, uint64_t seed = 0);
+
+    /** hash() of the contents of \a filename, chained from \a seed.  Returns false and sets \a error if the
+        file cannot be read. */
+    static bool hashFile(const std::string& filename, uint64_t& result, std::string& error, uint64_t seed = 0);
+
+    static const char* extension() {
+        return ".modelcache";
+    }
+};
+
+#endif // ModelCache_h
@@ -15,6 +15,8 @@
 
  */
 #include "SAO.h"
+#include "SAOPresets.h"
+#include <sstream>
 
 /** Floating point bits per pixel for CSZ: 16 or 32.  There is no perf difference on GeForce GTX 580 */
 #define ZBITS (32)
@@ -25,17 +27,45 @@
 /** Used to allow us to depth test versus the sky without an explicit check, speeds up rendering when some of the skybox is visible */
 #define Z_COORD (-1.0f)
 
+/** Layers per axis in deinterleaved mode.  Must match SAO_AO.pix, SAO_deinterleaveCSZ.pix, and SAO_reinterleave.pix */
+#define DEINTERLEAVE (4)
+
 SAO::Settings::Settings() : 
     radius(1.0f * units::meters()),
     bias(0.012f),
     intensity(1.0f) {}
 
 
+SAO::SAO() : m_pool(SAOResourcePool::shared()), m_size(0, 0), m_singleSweepCSZ(false), m_guardBandCulling(true), m_fusedBlur(false), m_deinterleaved(false), m_layerSize(0, 0),
+    m_quality(SAOCPU::HIGH_QUALITY), m_shaderQuality(SAOCPU::HIGH_QUALITY),
+    m_temporal(false), m_temporalTapsPerFrame(3), m_temporalHistoryLength(8),
+    m_adaptiveSampling(false), m_adaptiveMinTaps(3), m_adaptiveMaxTaps(SAOPresetLimits::MAX_NUM_SAMPLES), m_adaptivePixelsPerTap(4.0f),
+    m_frameIndex(0), m_historyIndex(0), m_historyValid(false),
+    m_captureFrameIndex(0), m_captureCompression(SAOCapture::NONE), m_timerFrameIndex(0), m_stage(NULL) {}
+
+
 SAO::Ref SAO::create() {
     return new SAO();
 }
 
 
+SAO::~SAO() {
+    releaseBuffers();
+    for (int f = 0; f < TIMER_FRAMES; ++f) {
+        if (m_timerFrames[f].queries.size() > 0) {
+            glDeleteQueries(m_timerFrames[f].queries.size(), m_timerFrames[f].queries.getCArray());
+        }
+    }
+}
+
+
+void SAO::setResourcePool(const SAOResourcePool::Ref& pool) {
+    alwaysAssertM(pool.notNull(), "A resource pool is required.");
+    releaseBuffers();
+    m_pool = pool;
+}
+
+
 void SAO::compute
    (RenderDevice*               rd,
     const Texture::Ref&         depthBuffer, 
@@ -44,87 +74,516 @@ void SAO::compute
     float                       projScale,
     const int                   guardBandSize) {
 
+    computeView(rd, depthBuffer, clipConstant, projConstant, projScale, guardBandSize, m_temporal);
+}
+
+
+void SAO::computeView
+   (RenderDevice*               rd,
+    const Texture::Ref&         depthBuffer, 
+    const Vector3&              clipConstant,
+    const Vector4&              projConstant,
+    float                       projScale,
+    const int                   guardBandSize,
+    bool                        temporal) {
+
     alwaysAssertM(depthBuffer.notNull(), 
         "Depth buffer is required.");
 
-    if (m_blurShader.isNull()) {
+    if (m_blurShader.isNull() || (m_shaderQuality != m_quality)) {
         reloadShaders();
     }
 
-    resizeBuffers(depthBuffer->width(), depthBuffer->height());
+    if (! m_captureFilename.empty()) {
+        writeCapture(depthBuffer, clipConstant, projConstant, projScale, guardBandSize);
+        m_captureFilename.clear();
+    }
+
+    beginTimerFrame();
+
+    resizeBuffers(depthBuffer->width(), depthBuffer->height(), temporal);
+
+    computeCSZ(rd, depthBuffer, clipConstant, guardBandSize);
+
+    if (m_deinterleaved) {
+        beginStage("deinterleave CSZ");
+        deinterleaveCSZ(rd);
+        endStage();
+
+        beginStage("raw AO");
+        computeRawAO(rd, depthBuffer, clipConstant, projConstant, projScale, m_layerCSZBuffer, guardBandSize, temporal);
+        endStage();
+
+        beginStage("reinterleave");
+        reinterleave(rd, depthBuffer, guardBandSize);
+        endStage();
+    } else {
+        beginStage("raw AO");
+        computeRawAO(rd, depthBuffer, clipConstant, projConstant, projScale, m_cszBuffer, guardBandSize, temporal);
+        endStage();
+    }
+
+    if (temporal) {
+        beginStage("temporal resolve");
+        resolveTemporal(rd, clipConstant, projConstant, guardBandSize);
+        endStage();
+        ++m_frameIndex;
+    } else if (! m_temporal) {
+        m_historyValid = false;
+    }
+
+    const Texture::Ref& blurSource = temporal ? m_resolvedAOBuffer : m_rawAOBuffer;
+    if (m_fusedBlur) {
+        beginStage("blur fused");
+        blurFused(rd, blurSource, guardBandSize);
+        endStage();
+    } else {
+        beginStage("blur horizontal");
+        blurHorizontal(rd, blurSource, depthBuffer, guardBandSize);
+        endStage();
+
+        beginStage("blur vertical");
+        blurVertical(rd, depthBuffer, guardBandSize);
+        endStage();
+    }
+}
+
+
+/** GL 2.1 contexts often lack timestamp queries, in which case the profiler only records the CPU track */
+static bool supportsTimerQueries() {
+    static const bool supported = GLCaps::supports("GL_ARB_timer_query");
+    return supported;
+}
+
+
+void SAO::beginTimerFrame() {
+    resolveTimers(false);
+
+    m_timerFrameIndex = (m_timerFrameIndex + 1) % TIMER_FRAMES;
+    TimerFrame& timer = m_timerFrames[m_timerFrameIndex];
+    if (timer.pending) {
+        // The GPU is TIMER_FRAMES frames behind; the queries of this slot are about to be reused
+        resolveTimers(true);
+    }
+
+    timer.stages.fastClear();
+    timer.cpuStart.fastClear();
+    timer.pending = m_profiler.enabled();
+    if (timer.pending) {
+        timer.frame = m_profiler.beginFrame();
+    }
+}
+
+
+void SAO::beginStage(const char* name) {
+    TimerFrame& timer = m_timerFrames[m_timerFrameIndex];
+    if (! timer.pending) {
+        return;
+    }
+
+    const int i = timer.stages.size();
+    if (supportsTimerQueries()) {
+        if (timer.queries.size() < 2 * (i + 1)) {
+            GLuint q[2];
+            glGenQueries(2, q);
+            timer.queries.append(q[0], q[1]);
+        }
+        glQueryCounter(timer.queries[2 * i], GL_TIMESTAMP);
+    }
+    timer.stages.append(name);
+    timer.cpuStart.append(m_profiler.nowMicroseconds());
+    m_stage = name;
+}
+
+
+void SAO::endStage() {
+    if (m_stage == NULL) {
+        return;
+    }
+
+    TimerFrame& timer = m_timerFrames[m_timerFrameIndex];
+    const int i = timer.stages.size() - 1;
+    if (supportsTimerQueries()) {
+        glQueryCounter(timer.queries[2 * i + 1], GL_TIMESTAMP);
+    }
+
+    // Time to issue the stage, not to execute it
+    const double start = timer.cpuStart[i];
+    m_profiler.record(m_stage, SAOProfiler::CPU_TRACK, timer.frame, start, float((m_profiler.nowMicroseconds() - start) / 1000.0));
+    m_stage = NULL;
+}
+
+
+void SAO::resolveTimers(bool wait) {
+    // Oldest first, so that each stage's samples stay in frame order
+    for (int k = 1; k <= TIMER_FRAMES; ++k) {
+        TimerFrame& timer = m_timerFrames[(m_timerFrameIndex + k) % TIMER_FRAMES];
+        if (! timer.pending) {
+            continue;
+        }
+
+        const int n = timer.stages.size();
+        if ((n > 0) && supportsTimerQueries()) {
+            if (! wait) {
+                // Timestamps complete in order, so the last one being available means that all are
+                GLint available = 0;
+                glGetQueryObjectiv(timer.queries[2 * n - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (! available) {
+                    continue;
+                }
+            }
+
+            GLuint64 first = 0;
+            glGetQueryObjectui64v(timer.queries[0], GL_QUERY_RESULT, &first);
+            for (int i = 0; i < n; ++i) {
+                GLuint64 begin = 0, end = 0;
+                glGetQueryObjectui64v(timer.queries[2 * i],     GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(timer.queries[2 * i + 1], GL_QUERY_RESULT, &end);
+
+                // Nanoseconds; placed on the CPU timeline at the submission of the first stage
+                m_profiler.record(timer.stages[i], SAOProfiler::GPU_TRACK, timer.frame,
+                                  timer.cpuStart[0] + double(begin - first) / 1000.0, float(double(end - begin) / 1.0e6));
+            }
+        }
+        timer.pending = false;
+    }
+}
+
+
+/** The 3 x 4 row-major matrix of SAOCPU::setCameraToWorld and SAOCapture */
+static void toRowMajor(const CoordinateFrame& frame, float M[12]) {
+    const Matrix3& R = frame.rotation;
+    const Vector3& t = frame.translation;
+    const float rows[12] = {
+        R[0][0], R[0][1], R[0][2], t.x,
+        R[1][0], R[1][1], R[1][2], t.y,
+        R[2][0], R[2][1], R[2][2], t.z};
+    System::memcpy(M, rows, sizeof(rows));
+}
+
+
+void SAO::computeCPU
+   (const float*                depthBuffer,
+    int                         width,
+    int                         height,
+    const Vector3&              clipConstant,
+    const Vector4&              projConstant,
+    float                       projScale,
+    float*                      result,
+    const int                   guardBandSize) {
+
+    alwaysAssertM(depthBuffer != NULL, "Depth buffer is required.");
+    debugAssert(projScale > 0);
+
+    updateCPUSettings();
+
+    float cameraToWorld[12];
+    toRowMajor(m_cameraToWorld, cameraToWorld);
+    m_cpu.setCameraToWorld(cameraToWorld);
+
+    const float clipInfo[3] = {clipConstant.x, clipConstant.y, clipConstant.z};
+    const float projInfo[4] = {projConstant.x, projConstant.y, projConstant.z, projConstant.w};
+    const double start = m_profiler.nowMicroseconds();
+    m_cpu.compute(depthBuffer, width, height, clipInfo, projInfo, projScale, result, guardBandSize);
+    m_profiler.recordPasses(m_cpu.passTiming(), m_profiler.beginFrame(), start);
+}
+
+
+void SAO::computeCPUBatch(const std::vector<SAOCPU::View>& views) {
+    updateCPUSettings();
+    const double start = m_profiler.nowMicroseconds();
+    m_cpu.computeBatch(views);
+    m_profiler.recordPasses(m_cpu.passTiming(), m_profiler.beginFrame(), start);
+}
+
+
+void SAO::computeBatch(RenderDevice* rd, const Array<View>& views) {
+    // The history of one view cannot be reprojected into another, so each view skips the temporal passes
+    // and leaves the history and camera of compute() alone
+    const CoordinateFrame cameraToWorld = m_cameraToWorld;
+    for (int i = 0; i < views.size(); ++i) {
+        const View& view = views[i];
+        alwaysAssertM(view.output.notNull(), "Each view requires an output framebuffer.");
+        rd->push2D(view.output); {
+            Vector3 clipConstant;
+            Vector4 projConstant;
+            float   projScale;
+            cameraConstants(view.camera, view.depthBuffer, rd->viewport(), clipConstant, projConstant, projScale);
+            setCameraToWorld(view.camera.coordinateFrame());
+            computeView(rd, view.depthBuffer, clipConstant, projConstant, projScale, view.guardBandSize, false);
+        } rd->pop2D();
+    }
+    setCameraToWorld(cameraToWorld);
+}
+
+
+void SAO::updateCPUSettings() {
+    m_cpu.setRadius(m_settings.radius);
+    m_cpu.setBias(m_settings.bias);
+    m_cpu.setIntensity(m_settings.intensity);
+    m_cpu.setDeinterleaved(m_deinterleaved);
+    m_cpu.setQuality(m_quality);
+    m_cpu.setGuardBandCulling(m_guardBandCulling);
+    m_cpu.setTemporal(m_temporal);
+    m_cpu.setTemporalTapsPerFrame(m_temporalTapsPerFrame);
+    m_cpu.setTemporalHistoryLength(m_temporalHistoryLength);
+    m_cpu.setAdaptiveSampling(m_adaptiveSampling);
+    m_cpu.setAdaptiveTapRange(m_adaptiveMinTaps, m_adaptiveMaxTaps);
+    m_cpu.setAdaptivePixelsPerTap(m_adaptivePixelsPerTap);
+}
+
+
+void SAO::writeCapture
+   (const Texture::Ref&         depthBuffer,
+    const Vector3&              clipConstant,
+    const Vector4&              projConstant,
+    float                       projScale,
+    const int                   guardBandSize) {
+
+    const Image1::Ref depth = depthBuffer->toDepthImage1();
+
+    float cameraToWorld[12];
+    toRowMajor(m_cameraToWorld, cameraToWorld);
+    const float clipInfo[3] = {clipConstant.x, clipConstant.y, clipConstant.z};
+    const float projInfo[4] = {projConstant.x, projConstant.y, projConstant.z, projConstant.w};
 
-    computeCSZ(rd, depthBuffer, clipConstant);
+    // Color1 is a single float
+    std::string error;
+    if (! SAOCapture::write(m_captureFilename, reinterpret_cast<const float*>(depth->getCArray()), depth->width(), depth->height(),
+                            guardBandSize, clipInfo, projInfo, projScale, cameraToWorld, m_captureFrameIndex, m_captureCompression, error)) {
+        debugPrintf("SAO capture failed: %s\n", error.c_str());
+    }
+}
+
+
+/** Source of \a pixFilename with its #include directives expanded and the constants of preset \a q
+    defined after the #version and #extension lines, where the shader's own #ifndef defaults skip them. */
+static std::string presetShaderCode(const std::string& pixFilename, SAOCPU::Quality q) {
+    const std::string source = readWholeFile(System::findDataFile(pixFilename));
+
+    std::string mismatches;
+    alwaysAssertM(SAOCPU::checkShaderDefaults(source, mismatches),
+        pixFilename + " does not match the SAOCPU::HIGH_QUALITY preset:\n" + mismatches);
+
+    std::string defines;
+    const std::vector<std::pair<std::string, std::string> > presetDefines = SAOCPU::shaderDefines(q);
+    for (int i = 0; i < int(presetDefines.size()); ++i) {
+        defines += "#define " + presetDefines[i].first + " " + presetDefines[i].second + "\n";
+    }
 
-    computeRawAO(rd, depthBuffer, clipConstant, projConstant, projScale, m_cszBuffer, guardBandSize);
+    std::string code;
+    bool inHeader = true;
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line)) {
+        const std::string trimmed = trimWhitespace(line);
+        if (inHeader && ! beginsWith(trimmed, "#version") && ! beginsWith(trimmed, "#extension")) {
+            code += defines;
+            inHeader = false;
+        }
 
-    blurHorizontal(rd, depthBuffer, guardBandSize);
+        if (beginsWith(trimmed, "#include")) {
+            const size_t first = trimmed.find('"');
+            const size_t last  = trimmed.rfind('"');
+            alwaysAssertM(first != std::string::npos && last > first, "Malformed #include in " + pixFilename);
+            code += readWholeFile(System::findDataFile(trimmed.substr(first + 1, last - first - 1))) + "\n";
+        } else {
+            code += line + "\n";
+        }
+    }
 
-    blurVertical(rd, depthBuffer, guardBandSize);
+    return code;
 }
 
 
 void SAO::reloadShaders() {
-    m_rawAOShader = Shader::fromFiles(System::findDataFile("SAO.vrt"), System::findDataFile("SAO_AO.pix"));
+    const std::string vertexCode = readWholeFile(System::findDataFile("SAO.vrt"));
+
+    m_rawAOShader = Shader::fromStrings(vertexCode, presetShaderCode("SAO_AO.pix", m_quality));
     m_rawAOShader->setPreserveState(false);
 
-    m_blurShader = Shader::fromFiles(System::findDataFile("SAO.vrt"), System::findDataFile("SAO_blur.pix"));
+    m_blurShader = Shader::fromStrings(vertexCode, presetShaderCode("SAO_blur.pix", m_quality));
     m_blurShader->setPreserveState(false);
 
+    m_fusedBlurShader = Shader::fromStrings(vertexCode, presetShaderCode("SAO_blurFused.pix", m_quality));
+    m_fusedBlurShader->setPreserveState(false);
+
+    m_shaderQuality = m_quality;
+
     m_reconstructCSZShader = Shader::fromFiles(System::findDataFile("SAO.vrt"), System::findDataFile("SAO_reconstructCSZ.pix"));
     m_reconstructCSZShader->setPreserveState(false);
 
     m_cszMinifyShader = Shader::fromFiles(System::findDataFile("SAO.vrt"), System::findDataFile("SAO_minify.pix"));
     m_cszMinifyShader->setPreserveState(false);
+
+    m_reconstructCSZLevelShader = Shader::fromFiles(System::findDataFile("SAO.vrt"), System::findDataFile("SAO_reconstructCSZLevel.pix"));
+    m_reconstructCSZLevelShader->setPreserveState(false);
+
+    m_deinterleaveCSZShader = Shader::fromFiles(System::findDataFile("SAO.vrt"), System::findDataFile("SAO_deinterleaveCSZ.pix"));
+    m_deinterleaveCSZShader->setPreserveState(false);
+
+    m_reinterleaveShader = Shader::fromFiles(System::findDataFile("SAO.vrt"), System::findDataFile("SAO_reinterleave.pix"));
+    m_reinterleaveShader->setPreserveState(false);
+
+    m_temporalShader = Shader::fromFiles(System::findDataFile("SAO.vrt"), System::findDataFile("SAO_temporal.pix"));
+    m_temporalShader->setPreserveState(false);
+
+    m_copyDepthShader = Shader::fromFiles(System::findDataFile("SAO.vrt"), System::findDataFile("SAO_copyDepth.pix"));
+    m_copyDepthShader->setPreserveState(false);
 }
 
 
-void SAO::resizeBuffers(int width, int height) {
-    bool rebind = false;
+/** Format of the camera-space z buffers */
+static const ImageFormat* cszFormat() {
+    // R16F is too low-precision, but we provide it as a fallback
+    alwaysAssertM(ZBITS == 16 || ZBITS == 32, "Only ZBITS = 16 and 32 are supported.");
+    return
+        (ZBITS == 16) ? 
 
-    if (m_rawAOFramebuffer.isNull()) {
-        // Allocate for the first call
-        m_rawAOFramebuffer    = Framebuffer::create("rawAOFramebuffer");
-        m_hBlurredFramebuffer = Framebuffer::create("hBlurredFramebuffer");
+        (GLCaps::supportsTextureDrawBuffer(ImageFormat::R16F()) ? ImageFormat::R16F() : ImageFormat::L16F()) :
+
+        (GLCaps::supportsTextureDrawBuffer(ImageFormat::R32F()) ? ImageFormat::R32F() : 
+         (GLCaps::supportsTextureDrawBuffer(ImageFormat::L32F()) ? ImageFormat::L32F() :
+          ImageFormat::RG32F()));
+}
+
+
+bool SAO::leaseBuffer(Texture::Ref& buffer, const std::string& name, const SAOResourcePool::Key& key, const Texture::Settings& settings) {
+    if (buffer.notNull()) {
+        if (m_pool->fits(m_pool->keyOf(buffer), key)) {
+            return false;
+        }
+        m_pool->release(buffer);
+    }
+    buffer = m_pool->lease(name, key, settings, true);
+    return true;
+}
+
+
+void SAO::releaseBuffers() {
+    m_pool->release(m_cszBuffer);
+    m_pool->release(m_rawAOBuffer);
+    m_pool->release(m_rawAODepthBuffer);
+    m_pool->release(m_hBlurredBuffer);
+    m_cszBuffer        = NULL;
+    m_rawAOBuffer      = NULL;
+    m_rawAODepthBuffer = NULL;
+    m_hBlurredBuffer   = NULL;
+}
 
-        m_rawAOBuffer         = Texture::createEmpty("rawAOBuffer",    width, height, ImageFormat::RGB8(), Texture::DIM_2D_NPOT, Texture::Settings::buffer());
-        m_hBlurredBuffer      = Texture::createEmpty("hBlurredBuffer", width, height, ImageFormat::RGB8(), Texture::DIM_2D_NPOT, Texture::Settings::buffer());
 
-        // R16F is too low-precision, but we provide it as a fallback
-        const ImageFormat* csZFormat =
-            (ZBITS == 16) ? 
+void SAO::bindRawAODepth(RenderDevice* rd, const Texture::Ref& depthBuffer) {
+    const int width  = m_rawAOBuffer->width();
+    const int height = m_rawAOBuffer->height();
+    if ((depthBuffer->width() == width) && (depthBuffer->height() == height)) {
+        m_pool->release(m_rawAODepthBuffer);
+        m_rawAODepthBuffer = NULL;
+        m_rawAOFramebuffer->set(Framebuffer::DEPTH, depthBuffer);
+        return;
+    }
+
+    // Attachments of different sizes make the framebuffer incomplete on some drivers, so a pooled
+    // m_rawAOBuffer that is larger than the frame gets a pooled depth buffer of its own size
+    const SAOResourcePool::Key key(width, height, depthBuffer->format());
+    if (m_rawAODepthBuffer.isNull() || ! (m_pool->keyOf(m_rawAODepthBuffer) == key)) {
+        m_pool->release(m_rawAODepthBuffer);
+        m_rawAODepthBuffer = m_pool->lease("rawAODepthBuffer", key, Texture::Settings::buffer());
+    }
+    m_rawAOFramebuffer->set(Framebuffer::DEPTH, m_rawAODepthBuffer);
+
+    rd->push2D(m_rawAOFramebuffer, activeRect()); {
+        rd->setColorWrite(false);
+        rd->setDepthWrite(true);
+        rd->setDepthTest(RenderDevice::DEPTH_ALWAYS_PASS);
+        m_copyDepthShader->args.set("DEPTH_AND_STENCIL_buffer", depthBuffer);
+        rd->applyRect(m_copyDepthShader);
+    } rd->pop2D();
+}
 
-            (GLCaps::supportsTextureDrawBuffer(ImageFormat::R16F()) ? ImageFormat::R16F() : ImageFormat::L16F()) :
 
-            (GLCaps::supportsTextureDrawBuffer(ImageFormat::R32F()) ? ImageFormat::R32F() : 
-             (GLCaps::supportsTextureDrawBuffer(ImageFormat::L32F()) ? ImageFormat::L32F() :
-              ImageFormat::RG32F()));
-        alwaysAssertM(ZBITS == 16 || ZBITS == 32, "Only ZBITS = 16 and 32 are supported.");
+void SAO::resizeBuffers(int width, int height, bool temporal) {
+    debugAssert(width > 0 && height > 0);
+    bool rebind = false;
 
-        Texture::Settings cszSettings = Texture::Settings::buffer();
-        cszSettings.interpolateMode   = Texture::NEAREST_MIPMAP;
-        cszSettings.maxMipMap         = MAX_MIP_LEVEL;
-        debugAssert(width > 0 && height > 0);
-        m_cszBuffer                   = Texture::createEmpty("cszBuffer", width, height, csZFormat, Texture::DIM_2D_NPOT, cszSettings);
+    if (m_rawAOFramebuffer.isNull()) {
+        // Allocate for the first call
+        m_rawAOFramebuffer    = Framebuffer::create("rawAOFramebuffer");
 
         for (int i = 0; i <= MAX_MIP_LEVEL; ++i) {
             m_cszFramebuffers.append(Framebuffer::create("cszFramebuffers[" + G3D::format("%d", i) + "]"));
         }
+    }
+
+    // A smaller size keeps the current buffers and renders into a sub-rectangle of them
+    m_size = Vector2int16(width, height);
+    const SAOResourcePool::Key aoKey(width, height, ImageFormat::RGB8());
+    rebind = leaseBuffer(m_rawAOBuffer, "rawAOBuffer", aoKey, Texture::Settings::buffer()) || rebind;
+    rebind = leaseBuffer(m_cszBuffer,   "cszBuffer",   SAOResourcePool::Key(width, height, cszFormat(), MAX_MIP_LEVEL + 1), cszSettings()) || rebind;
+
+    // The intermediate blur buffer only exists in two-pass mode
+    if (m_fusedBlur) {
+        m_pool->release(m_hBlurredBuffer);
+        m_hBlurredBuffer      = NULL;
+        m_hBlurredFramebuffer = NULL;
+    } else {
+        if (m_hBlurredFramebuffer.isNull()) {
+            m_hBlurredFramebuffer = Framebuffer::create("hBlurredFramebuffer");
+            rebind = true;
+        }
+        rebind = leaseBuffer(m_hBlurredBuffer, "hBlurredBuffer", aoKey, Texture::Settings::buffer()) || rebind;
+    }
 
-        rebind = true;
+    // The layer atlases only exist in deinterleaved mode
+    const int layerAlignment = 1 << MAX_MIP_LEVEL;
+    const Vector2int16 layerSize
+        ((((width  + DEINTERLEAVE - 1) / DEINTERLEAVE + layerAlignment - 1) / layerAlignment) * layerAlignment,
+         (((height + DEINTERLEAVE - 1) / DEINTERLEAVE + layerAlignment - 1) / layerAlignment) * layerAlignment);
+    if (! m_deinterleaved) {
+        m_layerCSZBuffer      = NULL;
+        m_layerAOBuffer       = NULL;
+        m_layerAOFramebuffer  = NULL;
+        m_layerCSZFramebuffers.clear();
+    } else if (m_layerCSZBuffer.isNull() || (layerSize != m_layerSize)) {
+        m_layerSize           = layerSize;
+        const int atlasWidth  = DEINTERLEAVE * layerSize.x;
+        const int atlasHeight = DEINTERLEAVE * layerSize.y;
+
+        m_layerCSZBuffer      = Texture::createEmpty("layerCSZBuffer", atlasWidth, atlasHeight, m_cszBuffer->format(), Texture::DIM_2D_NPOT, cszSettings());
+        m_layerCSZFramebuffers.clear();
+        for (int i = 0; i <= MAX_MIP_LEVEL; ++i) {
+            m_layerCSZFramebuffers.append(Framebuffer::create("layerCSZFramebuffers[" + G3D::format("%d", i) + "]"));
+            m_layerCSZFramebuffers[i]->set(Framebuffer::COLOR0, m_layerCSZBuffer, CubeFace::POS_X, i);
+        }
 
-    } else if ((m_rawAOBuffer->width() != width) || (m_rawAOBuffer->height() != height)) {
-        // Resize
-        m_rawAOBuffer->resize(width, height);
-        m_hBlurredBuffer->resize(width, height);
-        m_cszBuffer->resize(width, height);
+        m_layerAOFramebuffer  = Framebuffer::create("layerAOFramebuffer");
+        m_layerAOBuffer       = Texture::createEmpty("layerAOBuffer", atlasWidth, atlasHeight, ImageFormat::RGB8(), Texture::DIM_2D_NPOT, Texture::Settings::buffer());
+        m_layerAOFramebuffer->set(Framebuffer::COLOR0, m_layerAOBuffer);
+    }
 
-        rebind = true;
+    // The history only exists in temporal mode, and only follows the size of the frames that use it
+    if (! m_temporal) {
+        m_resolvedAOBuffer = NULL;
+        for (int i = 0; i < 2; ++i) {
+            m_historyBuffer[i]        = NULL;
+            m_temporalFramebuffers[i] = NULL;
+        }
+    } else if (temporal && (m_resolvedAOBuffer.isNull() || (m_resolvedAOBuffer->width() != width) || (m_resolvedAOBuffer->height() != height))) {
+        m_resolvedAOBuffer = Texture::createEmpty("resolvedAOBuffer", width, height, ImageFormat::RGB8(), Texture::DIM_2D_NPOT, Texture::Settings::buffer());
+        for (int i = 0; i < 2; ++i) {
+            m_historyBuffer[i]        = Texture::createEmpty(G3D::format("historyBuffer[%d]", i), width, height, ImageFormat::RGBA32F(), Texture::DIM_2D_NPOT, Texture::Settings::buffer());
+            m_temporalFramebuffers[i] = Framebuffer::create(G3D::format("temporalFramebuffers[%d]", i));
+            m_temporalFramebuffers[i]->set(Framebuffer::COLOR0, m_resolvedAOBuffer);
+            m_temporalFramebuffers[i]->set(Framebuffer::COLOR1, m_historyBuffer[i]);
+        }
+        m_historyValid = false;
     }
 
     if (rebind) {
         // Sizes have changed or just been allocated
         m_rawAOFramebuffer->set(Framebuffer::COLOR0, m_rawAOBuffer);
-        m_hBlurredFramebuffer->set(Framebuffer::COLOR0, m_hBlurredBuffer);
+        if (m_hBlurredFramebuffer.notNull()) {
+            m_hBlurredFramebuffer->set(Framebuffer::COLOR0, m_hBlurredBuffer);
+        }
 
         for (int i = 0; i <= MAX_MIP_LEVEL; ++i) {
             m_cszFramebuffers[i]->set(Framebuffer::COLOR0, m_cszBuffer, CubeFace::POS_X, i);
@@ -133,32 +592,143 @@ void SAO::resizeBuffers(int width, int height) {
 }
 
 
+Texture::Settings SAO::cszSettings() {
+    Texture::Settings settings = Texture::Settings::buffer();
+    settings.interpolateMode   = Texture::NEAREST_MIPMAP;
+    settings.maxMipMap         = MAX_MIP_LEVEL;
+    return settings;
+}
+
+
+static Rect2D toRect2D(const SAOCPU::TexelRect& r) {
+    return Rect2D::xyxy(float(r.x0), float(r.y0), float(r.x1), float(r.y1));
+}
+
+
+Rect2D SAO::clearRect(int guardBandSize, int halo) const {
+    const Rect2D& active = activeRect();
+    if (! m_guardBandCulling) {
+        return active;
+    }
+    const int g = max(0, guardBandSize - halo);
+    return Rect2D::xyxy(float(g), float(g), max(float(g), active.width() - g), max(float(g), active.height() - g));
+}
+
+
 void SAO::computeCSZ
 (RenderDevice* rd,         
  const Texture::Ref&         depthBuffer, 
- const Vector3&              clipInfo) {
+ const Vector3&              clipInfo,
+ const int                   guardBandSize) {
+
+    // In deinterleaved mode the MIP levels of the layers replace those of m_cszBuffer, and every texel of
+    // level 0 is deinterleaved, so nothing is culled
+    const int maxLevel = m_deinterleaved ? 0 : MAX_MIP_LEVEL;
+
+    // Texels outside rect[i] are never read, so they are neither rendered nor cleared
+    SAOCPU::TexelRect rect[MAX_MIP_LEVEL + 1], minified[MAX_MIP_LEVEL + 1];
+    SAOCPU::cszLevelRects(m_quality, m_size.x, m_size.y, (m_guardBandCulling && ! m_deinterleaved) ? guardBandSize : 0, rect, minified);
+
+    m_reconstructCSZLevelShader->args.set("clipInfo",                 clipInfo);
+    m_reconstructCSZLevelShader->args.set("DEPTH_AND_STENCIL_buffer", depthBuffer);
+
+    if (m_singleSweepCSZ) {
+        // Every level from the depth buffer
+        beginStage("CSZ sweep");
+        for (int i = 0; i <= maxLevel; ++i) {
+            rd->push2D(m_cszFramebuffers[i], activeRect(i)); {
+                rd->setClip2D(toRect2D(rect[i]));
+                m_reconstructCSZLevelShader->args.set("level", i);
+                rd->applyRect(m_reconstructCSZLevelShader);
+            } rd->pop2D();
+        }
+        endStage();
+        return;
+    }
 
     // Generate level 0
-    rd->push2D(m_cszFramebuffers[0]); {
-        rd->clear();
+    beginStage("reconstruct CSZ");
+    rd->push2D(m_cszFramebuffers[0], activeRect()); {
+        rd->setClip2D(toRect2D(rect[0]));
         m_reconstructCSZShader->args.set("clipInfo",                 clipInfo);
         m_reconstructCSZShader->args.set("DEPTH_AND_STENCIL_buffer", depthBuffer);
         rd->applyRect(m_reconstructCSZShader);
     } rd->pop2D();
+    endStage();
+
+
+    // Generate the other levels, with the stage names of SAOCPU::passTiming
+    static const char* minifyStageName[MAX_MIP_LEVEL + 1] = {"", "minify 1", "minify 2", "minify 3", "minify 4", "minify 5"};
+    for (int i = 1; i <= maxLevel; ++i) {
+        beginStage(minifyStageName[i]);
+        rd->push2D(m_cszFramebuffers[i], activeRect(i)); {
+            if (! minified[i].empty()) {
+                m_cszMinifyShader->args.set("texture",           m_cszBuffer);
+                m_cszMinifyShader->args.set("previousMIPNumber", i - 1);
+                m_cszMinifyShader->args.set("previousMIPSize",   Vector2int16(activeRect(i - 1).wh()));
+                rd->setClip2D(toRect2D(minified[i]));
+                rd->applyRect(m_cszMinifyShader);
+            }
+
+            // Texels whose source in level i - 1 was culled come straight from the depth buffer, which
+            // gives the same value
+            SAOCPU::TexelRect strip[4];
+            const int numStrips = rect[i].subtract(minified[i], strip);
+            m_reconstructCSZLevelShader->args.set("level", i);
+            for (int s = 0; s < numStrips; ++s) {
+                rd->setClip2D(toRect2D(strip[s]));
+                rd->applyRect(m_reconstructCSZLevelShader);
+            }
+        } rd->pop2D();
+        endStage();
+    }
+}
 
 
-    // Generate the other levels
+void SAO::deinterleaveCSZ(RenderDevice* rd) {
+    // Level 0 of every layer.  The rectangle covers the whole atlas, so there is nothing to clear.
+    rd->push2D(m_layerCSZFramebuffers[0]); {
+        m_deinterleaveCSZShader->args.set("CS_Z_buffer", m_cszBuffer);
+        m_deinterleaveCSZShader->args.set("cszSize",     m_size);
+        m_deinterleaveCSZShader->args.set("layerSize",   m_layerSize);
+        rd->applyRect(m_deinterleaveCSZShader);
+    } rd->pop2D();
+
+    // The layers are aligned at every level, so minifying the atlas minifies each layer
     for (int i = 1; i <= MAX_MIP_LEVEL; ++i) {
-        m_cszMinifyShader->args.set("texture", m_cszBuffer);
-        rd->push2D(m_cszFramebuffers[i]); {
-            rd->clear();
+        m_cszMinifyShader->args.set("texture", m_layerCSZBuffer);
+        rd->push2D(m_layerCSZFramebuffers[i]); {
             m_cszMinifyShader->args.set("previousMIPNumber", i - 1);
+            m_cszMinifyShader->args.set("previousMIPSize",   Vector2int16(m_layerCSZBuffer->width() >> (i - 1), m_layerCSZBuffer->height() >> (i - 1)));
             rd->applyRect(m_cszMinifyShader);
         } rd->pop2D();
     }
 }
 
 
+void SAO::reinterleave
+   (RenderDevice*               rd,
+    const Texture::Ref&         depthBuffer, 
+    const int                   guardBandSize) {
+
+    bindRawAODepth(rd, depthBuffer);
+    rd->push2D(m_rawAOFramebuffer, activeRect()); {
+        // The same depth test and clear as the full-resolution computeRawAO()
+        rd->setDepthTest(RenderDevice::DEPTH_GREATER);
+        rd->setColorClearValue(Color3::white());
+        rd->setClip2D(clearRect(guardBandSize, blurReach()));
+        rd->clear(true, false, false);
+
+        m_reinterleaveShader->args.set("source",    m_layerAOBuffer);
+        m_reinterleaveShader->args.set("layerSize", m_layerSize);
+
+        rd->setClip2D(Rect2D::xyxy(guardBandSize, guardBandSize, rd->viewport().width() - guardBandSize, rd->viewport().height() - guardBandSize));
+
+        rd->applyRect(m_reinterleaveShader, Z_COORD);
+    } rd->pop2D();
+}
+
+
 void SAO::computeRawAO
    (RenderDevice*               rd,
     const Texture::Ref&         depthBuffer, 
@@ -166,18 +736,29 @@ void SAO::computeRawAO
     const Vector4&              projConstant,
     const float                 projScale,
     const Texture::Ref&         csZBuffer,
-    const int                   guardBandSize) {
+    const int                   guardBandSize,
+    bool                        temporal) {
 
     debugAssert(projScale > 0);
-    m_rawAOFramebuffer->set(Framebuffer::DEPTH,      depthBuffer);
-    rd->push2D(m_rawAOFramebuffer); {
 
-        // For quick early-out testing vs. skybox 
-        rd->setDepthTest(RenderDevice::DEPTH_GREATER);
-
-        // Values that are never touched due to the depth test will be white
-        rd->setColorClearValue(Color3::white());
-        rd->clear(true, false, false);
+    // In deinterleaved mode, the target is the layer atlas, in which every texel is shaded and which
+    // has no depth buffer to test against.  reinterleave() applies the depth test and guard band.
+    if (! m_deinterleaved) {
+        bindRawAODepth(rd, depthBuffer);
+    }
+    const Framebuffer::Ref& target = m_deinterleaved ? m_layerAOFramebuffer : m_rawAOFramebuffer;
+    rd->push2D(target, m_deinterleaved ? target->rect2DBounds() : activeRect()); {
+
+        if (! m_deinterleaved) {
+            // For quick early-out testing vs. skybox 
+            rd->setDepthTest(RenderDevice::DEPTH_GREATER);
+
+            // Values that are never touched due to the depth test will be white.  Only the blur reads
+            // outside the interior.
+            rd->setColorClearValue(Color3::white());
+            rd->setClip2D(clearRect(guardBandSize, blurReach()));
+            rd->clear(true, false, false);
+        }
         Shader::ArgList& args = m_rawAOShader->args;
 
         args.set("radius",      m_settings.radius);
@@ -186,25 +767,98 @@ void SAO::computeRawAO
         args.set("projInfo",    projConstant);
         args.set("projScale",   projScale);
         args.set("CS_Z_buffer", csZBuffer);
-        args.set("intensityDivR6", m_settings.intensity / pow(m_settings.radius, 6.0f));
+        args.set("cszSize",     m_size);
 
-        rd->setClip2D(Rect2D::xyxy(guardBandSize, guardBandSize, rd->viewport().width() - guardBandSize, rd->viewport().height() - guardBandSize));
+        const int numSamples = SAOCPU::qualityParameters(m_quality).numSamples;
+        int   firstTap = 0, tapStride = 1, tapCount = numSamples;
+        float frameSpin = 0.0f;
+        if (temporal) {
+            SAOCPU::temporalTaps(numSamples, m_frameIndex, m_temporalTapsPerFrame, firstTap, tapStride, tapCount, frameSpin);
+        }
+        args.set("tapScale",    (m_settings.intensity / pow(m_settings.radius, 6.0f)) * ((5.0f / numSamples) * tapStride));
+        args.set("firstTap",    firstTap);
+        args.set("tapStride",   tapStride);
+        args.set("tapCount",    tapCount);
+        args.set("frameSpin",   frameSpin);
+        args.set("temporal",    temporal);
+
+        // The same tap range as SAOCPU, clamped to the preset
+        const int maxTaps = min(m_adaptiveMaxTaps, numSamples);
+        args.set("adaptive",     m_adaptiveSampling && ! temporal);
+        args.set("minTaps",      min(m_adaptiveMinTaps, maxTaps));
+        args.set("maxTaps",      maxTaps);
+        args.set("pixelsPerTap", m_adaptivePixelsPerTap);
+        args.set("deinterleaved", m_deinterleaved);
+        args.set("layerSize",   m_layerSize);
+
+        if (! m_deinterleaved) {
+            rd->setClip2D(Rect2D::xyxy(guardBandSize, guardBandSize, rd->viewport().width() - guardBandSize, rd->viewport().height() - guardBandSize));
+        }
        
         rd->applyRect(m_rawAOShader, Z_COORD);
     } rd->pop2D();
 }
 
 
+void SAO::resolveTemporal
+   (RenderDevice*               rd,
+    const Vector3&              clipConstant,
+    const Vector4&              projConstant,
+    const int                   guardBandSize) {
+
+    const int previous = m_historyIndex;
+    const int current  = previous ^ 1;
+
+    // Rows of inverse(previousCameraToWorld) * cameraToWorld
+    const CoordinateFrame currentToPrevious = m_previousCameraToWorld.inverse() * m_cameraToWorld;
+    Vector4 row[3];
+    for (int i = 0; i < 3; ++i) {
+        row[i] = Vector4(currentToPrevious.rotation.row(i), currentToPrevious.translation[i]);
+    }
+
+    // The rectangle covers the whole target and the shader clears sky and the guard band, so there is
+    // nothing to clear or clip
+    rd->push2D(m_temporalFramebuffers[current]); {
+        Shader::ArgList& args = m_temporalShader->args;
+
+        args.set("rawAO",              m_rawAOBuffer);
+        args.set("CS_Z_buffer",        m_cszBuffer);
+        args.set("viewSize",           m_size);
+        args.set("history",            m_historyBuffer[previous]);
+        args.set("historyValid",       m_historyValid);
+        args.set("currentToPrevious0", row[0]);
+        args.set("currentToPrevious1", row[1]);
+        args.set("currentToPrevious2", row[2]);
+        args.set("clipInfo",           clipConstant);
+        args.set("projInfo",           projConstant);
+        args.set("previousProjInfo",   m_previousProjInfo);
+        args.set("historyLength",      float(m_temporalHistoryLength));
+        args.set("guardBandSize",      guardBandSize);
+
+        rd->applyRect(m_temporalShader);
+    } rd->pop2D();
+
+    m_previousCameraToWorld = m_cameraToWorld;
+    m_previousProjInfo      = projConstant;
+    m_historyIndex          = current;
+    m_historyValid          = true;
+}
+
+
 void SAO::blurHorizontal
    (RenderDevice*               rd,
+    const Texture::Ref&         source,
     const Texture::Ref&         depthBuffer, 
     const int                   guardBandSize) {
 
-    rd->push2D(m_hBlurredFramebuffer); {
+    rd->push2D(m_hBlurredFramebuffer, activeRect()); {
+        // The vertical pass reads rows up to blurReach() outside the interior
         rd->setColorClearValue(Color3::white());
+        rd->setClip2D(clearRect(guardBandSize, blurReach()));
         rd->clear(true, false, false);
 
-        m_blurShader->args.set("source",                    m_rawAOBuffer);
+        m_blurShader->args.set("source",                    source);
+        m_blurShader->args.set("viewSize",                  m_size);
         m_blurShader->args.set("axis",                      Vector2int16(1, 0));
 
         rd->setClip2D(Rect2D::xyxy(guardBandSize, guardBandSize, rd->viewport().width() - guardBandSize, rd->viewport().height() - guardBandSize));
@@ -222,9 +876,11 @@ void SAO::blurVertical
     // Render directly to the currently-bound framebuffer
     rd->push2D(); {
         rd->setColorClearValue(Color3::white());
+        rd->setClip2D(clearRect(guardBandSize, 0));
         rd->clear(true, false, false);
 
         m_blurShader->args.set("source",                    m_hBlurredBuffer);
+        m_blurShader->args.set("viewSize",                  m_size);
         m_blurShader->args.set("axis",                      Vector2int16(0, 1));
 
         rd->setClip2D(Rect2D::xyxy(guardBandSize, guardBandSize, rd->viewport().width() - guardBandSize, rd->viewport().height() - guardBandSize));
@@ -234,29 +890,69 @@ void SAO::blurVertical
 }
 
 
+void SAO::blurFused
+   (RenderDevice*               rd,
+    const Texture::Ref&         source,
+    const int                   guardBandSize) {
+
+    // Render directly to the currently-bound framebuffer
+    rd->push2D(); {
+        rd->setColorClearValue(Color3::white());
+        rd->setClip2D(clearRect(guardBandSize, 0));
+        rd->clear(true, false, false);
+
+        m_fusedBlurShader->args.set("source",               source);
+        m_fusedBlurShader->args.set("viewSize",             m_size);
+        m_fusedBlurShader->args.set("guardBandSize",        guardBandSize);
+
+        rd->setClip2D(Rect2D::xyxy(guardBandSize, guardBandSize, rd->viewport().width() - guardBandSize, rd->viewport().height() - guardBandSize));
+       
+        rd->applyRect(m_fusedBlurShader, Z_COORD);
+    } rd->pop2D();
+}
+
+
 void SAO::compute
    (RenderDevice*               rd,
     const Texture::Ref&         depthBuffer, 
     const GCamera&              camera,
     const int                   guardBandSize) {
 
+    setCameraToWorld(camera.coordinateFrame());
+
+    Vector3 clipConstant;
+    Vector4 projConstant;
+    float   projScale;
+    cameraConstants(camera, depthBuffer, rd->viewport(), clipConstant, projConstant, projScale);
+    compute(rd, depthBuffer, clipConstant, projConstant, projScale, guardBandSize);
+}
+
+
+void SAO::cameraConstants
+   (const GCamera&              camera,
+    const Texture::Ref&         depthBuffer,
+    const Rect2D&               viewport,
+    Vector3&                    clipConstant,
+    Vector4&                    projConstant,
+    float&                      projScale) {
+
     const double width  = depthBuffer->width();
     const double height = depthBuffer->height();
     const double z_f    = camera.farPlaneZ();
     const double z_n    = camera.nearPlaneZ();
 
-    const Vector3& clipConstant = 
+    clipConstant = 
         (z_f == -inf()) ? 
             Vector3(float(z_n), -1.0f, 1.0f) : 
             Vector3(float(z_n * z_f),  float(z_n - z_f),  float(z_f));
 
     Matrix4 P;
     camera.getProjectUnitMatrix(Rect2D::xywh(0, 0, width, height), P);
-    const Vector4 projConstant
+    projConstant = Vector4
         (float(-2.0 / (width * P[0][0])), 
          float(-2.0 / (height * P[1][1])),
          float((1.0 - (double)P[0][2]) / P[0][0]), 
          float((1.0 + (double)P[1][2]) / P[1][1]));
 
-    compute(rd, depthBuffer, clipConstant, projConstant, abs(camera.imagePlanePixelsPerMeter(rd->viewport())), guardBandSize);
+    projScale = abs(camera.imagePlanePixelsPerMeter(viewport));
 }
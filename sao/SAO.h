@@ -30,6 +30,10 @@
 // Uses the G3D library (http://g3d.sf.net) as a light wrapper around OpenGL
 // to avoid boilerplate.
 #include <G3D/G3DAll.h>
+#include "SAOCapture.h"
+#include "SAOCPU.h"
+#include "SAOProfiler.h"
+#include "SAOResourcePool.h"
 
 /**
  \brief Screen-space ambient obscurance.
@@ -59,6 +63,8 @@
   After rendering, bind <code>aoBuffer</code> in the shading pass and use it to modulate
   ambient illumination.
 
+  On hosts without a GPU, use computeCPU() (or SAOCPU directly) with a depth buffer in memory.
+
  \author Morgan McGuire and Michael Mara, NVIDIA and Williams College, http://research.nvidia.com, http://graphics.cs.williams.edu 
 */
 class SAO : public ReferenceCountedObject {
@@ -66,6 +72,20 @@ public:
     /** Provide automated resource management. Use SAO::Ref in place of SAO* and never call delete. */
     typedef ReferenceCountedPointer<class SAO> Ref;
 
+    /** One view of computeBatch() */
+    class View {
+    public:
+        Texture::Ref                depthBuffer;
+        GCamera                     camera;
+
+        /** Receives the AO, like the framebuffer that is bound for compute() */
+        Framebuffer::Ref            output;
+
+        int                         guardBandSize;
+
+        View() : guardBandSize(0) {}
+    };
+
 protected:
     
     class Settings {
@@ -97,6 +117,14 @@ protected:
 
     Settings                        m_settings;
 
+    /** Source of m_cszBuffer, m_rawAOBuffer, and m_hBlurredBuffer, which may be larger than m_size */
+    SAOResourcePool::Ref            m_pool;
+
+    /** Size of the depth buffer of the last compute(), including the guard band.  The passes render into
+        the rectangle of this size at the origin of each pooled buffer (and its MIP levels) and the shaders
+        clamp their reads to it, so the rest of a larger buffer is never read. */
+    Vector2int16                    m_size;
+
     /** Stores camera-space (negative) linear z values at various scales in the MIP levels */
     Texture::Ref                    m_cszBuffer;
     Shader::Ref                     m_reconstructCSZShader;
@@ -104,23 +132,187 @@ protected:
     Array<Framebuffer::Ref>         m_cszFramebuffers;
     Shader::Ref                     m_cszMinifyShader;
 
+    bool                            m_singleSweepCSZ;
+
+    bool                            m_guardBandCulling;
+
+    /** Renders any MIP level of m_cszBuffer directly from the depth buffer */
+    Shader::Ref                     m_reconstructCSZLevelShader;
+
     /** Has AO in R and depth in G * 256 + B.*/
     Texture::Ref                    m_rawAOBuffer;
     Framebuffer::Ref                m_rawAOFramebuffer;
     Shader::Ref                     m_rawAOShader;
 
-    /** Has AO in R and depth in G */
+    /** Copy of the depth buffer at the size of m_rawAOBuffer, for the depth test of the raw AO pass.  Only
+        leased while m_rawAOBuffer is larger than the depth buffer. */
+    Texture::Ref                    m_rawAODepthBuffer;
+    Shader::Ref                     m_copyDepthShader;
+
+    /** Has AO in R and depth in G.  Only allocated when fusedBlur() is false. */
     Texture::Ref                    m_hBlurredBuffer;
     Framebuffer::Ref                m_hBlurredFramebuffer;
     Shader::Ref                     m_blurShader;
 
-    /** \param width Total buffer size of the GBuffer, including the guard band */
-    void resizeBuffers(int width, int height);
+    bool                            m_fusedBlur;
+    Shader::Ref                     m_fusedBlurShader;
+
+    bool                            m_deinterleaved;
+
+    /** Atlas of the DEINTERLEAVE x DEINTERLEAVE layers of m_cszBuffer level 0, each m_layerSize texels, with
+        the same MIP levels.  Only allocated when deinterleaved() is true. */
+    Texture::Ref                    m_layerCSZBuffer;
+    Array<Framebuffer::Ref>         m_layerCSZFramebuffers;
+    Shader::Ref                     m_deinterleaveCSZShader;
+
+    /** Raw AO and key of each layer, in the layout of m_layerCSZBuffer level 0.  Only allocated when deinterleaved() is true. */
+    Texture::Ref                    m_layerAOBuffer;
+    Framebuffer::Ref                m_layerAOFramebuffer;
+    Shader::Ref                     m_reinterleaveShader;
+
+    /** Texels per layer, rounded up to a multiple of 2^MAX_MIP_LEVEL so that the layers stay aligned at every MIP level */
+    Vector2int16                    m_layerSize;
+
+    /** Preset of the next compute(); m_shaderQuality is the one that the AO and blur shaders were compiled for */
+    SAOCPU::Quality                 m_quality;
+    SAOCPU::Quality                 m_shaderQuality;
+
+    bool                            m_temporal;
+    int                             m_temporalTapsPerFrame;
+    int                             m_temporalHistoryLength;
+
+    bool                            m_adaptiveSampling;
+    int                             m_adaptiveMinTaps;
+    int                             m_adaptiveMaxTaps;
+    float                           m_adaptivePixelsPerTap;
+
+    /** Frames computed in temporal mode; selects the taps and spiral rotation of each frame */
+    int                             m_frameIndex;
+
+    CoordinateFrame                 m_cameraToWorld;
+
+    /** Camera and projection of the frame that wrote m_historyBuffer[m_historyIndex] */
+    CoordinateFrame                 m_previousCameraToWorld;
+    Vector4                         m_previousProjInfo;
+
+    /** AO, frame count, and camera-space z of the accumulated frames, ping-ponged between frames.  Only
+        allocated when temporal() is true. */
+    Texture::Ref                    m_historyBuffer[2];
+    int                             m_historyIndex;
+    bool                            m_historyValid;
+
+    /** Resolved AO in R and depth in G * 256 + B, which the blur reads in temporal mode.  m_temporalFramebuffers[i]
+        writes it to COLOR0 and m_historyBuffer[i] to COLOR1.  Only allocated when temporal() is true. */
+    Texture::Ref                    m_resolvedAOBuffer;
+    Framebuffer::Ref                m_temporalFramebuffers[2];
+    Shader::Ref                     m_temporalShader;
+
+    /** Used by computeCPU() */
+    SAOCPU                          m_cpu;
+
+    /** Set by captureNextFrame(), cleared by the compute() that writes the capture */
+    std::string                     m_captureFilename;
+    unsigned int                    m_captureFrameIndex;
+    SAOCapture::Compression         m_captureCompression;
+
+    /** GPU timestamp queries of the stages of one compute(), read back TIMER_FRAMES - 1 frames later.  Without
+        GL_ARB_timer_query, only the CPU times of the stages are recorded. */
+    class TimerFrame {
+    public:
+        int                         frame;
+
+        /** Stage names in issue order */
+        Array<const char*>          stages;
+
+        /** Begin and end timestamp of each stage.  Persistent; grown as stages are added. */
+        Array<GLuint>               queries;
+
+        /** SAOProfiler::nowMicroseconds() at the start of each stage on the submitting thread */
+        Array<double>               cpuStart;
+
+        bool                        pending;
+
+        TimerFrame() : frame(0), pending(false) {}
+    };
+
+    enum {TIMER_FRAMES = 4};
+
+    SAOProfiler                     m_profiler;
+    TimerFrame                      m_timerFrames[TIMER_FRAMES];
+    int                             m_timerFrameIndex;
+
+    /** Of the stage between beginStage() and endStage(), or NULL */
+    const char*                     m_stage;
+
+    /** Reads back the finished frames of m_timerFrames and starts a new one.  Stalls only if the GPU is
+        TIMER_FRAMES frames behind. */
+    void beginTimerFrame();
+
+    /** Brackets one stage of compute() with timestamp queries.  No-ops when the profiler is disabled. */
+    void beginStage(const char* name);
+    void endStage();
 
+    /** Records the timestamps of pending frames in m_profiler.  \param wait Stall until all are available */
+    void resolveTimers(bool wait);
+
+    /** Reads \a depthBuffer back and writes it with the other arguments of compute() to m_captureFilename */
+    void writeCapture
+       (const Texture::Ref&         depthBuffer,
+        const Vector3&              clipConstant,
+        const Vector4&              projConstant,
+        float                       projScale,
+        const int                   guardBandSize);
+
+    /** Copies the settings of this instance to m_cpu, for computeCPU() and computeCPUBatch() */
+    void updateCPUSettings();
+
+    /** \param width Total buffer size of the GBuffer, including the guard band
+        \param temporal Resize the history too.  It is only freed when temporal() is false. */
+    void resizeBuffers(int width, int height, bool temporal);
+
+    /** Keeps \a buffer if it can hold \a key (see SAOResourcePool::fits), otherwise returns it to m_pool and leases
+        another.  Returns true if \a buffer changed and its framebuffer must be rebound. */
+    bool leaseBuffer(Texture::Ref& buffer, const std::string& name, const SAOResourcePool::Key& key, const Texture::Settings& settings);
+
+    /** Returns all pooled buffers to m_pool */
+    void releaseBuffers();
+
+    /** Attaches \a depthBuffer to m_rawAOFramebuffer, or a copy of it in m_rawAODepthBuffer when m_rawAOBuffer is larger */
+    void bindRawAODepth(RenderDevice* rd, const Texture::Ref& depthBuffer);
+
+    /** The m_size rectangle at MIP level \a level, which the passes render into */
+    Rect2D activeRect(int level = 0) const {
+        return Rect2D::xywh(0, 0, max(1, m_size.x >> level), max(1, m_size.y >> level));
+    }
+
+    /** The interior of the active rectangle grown by \a halo pixels on each side, or the whole active
+        rectangle when guardBandCulling() is false.  The passes clear only this much of their targets. */
+    Rect2D clearRect(int guardBandSize, int halo) const;
+
+    /** Pixels outside the interior that the blur reads */
+    int blurReach() const {
+        const SAOCPU::QualityParameters& q = SAOCPU::qualityParameters(m_quality);
+        return q.blurRadius * q.blurScale;
+    }
+
+    /** Texture settings of the camera-space z buffers, which have MIP levels 0...MAX_MIP_LEVEL */
+    static Texture::Settings cszSettings();
+
+    /** Renders only the texels of each level that raw AO taps from inside the guard band can read; see SAOCPU::cszLevelRects */
     void computeCSZ
        (RenderDevice* rd,         
         const Texture::Ref&         depthBuffer, 
-        const Vector3&              clipInfo);
+        const Vector3&              clipInfo,
+        const int                   guardBandSize);
+
+    /** Renders m_layerCSZBuffer and its MIP levels from m_cszBuffer level 0 */
+    void deinterleaveCSZ(RenderDevice* rd);
+
+    /** Copies m_layerAOBuffer into m_rawAOBuffer, with the same depth test and guard band as computeRawAO() */
+    void reinterleave
+       (RenderDevice*              rd, 
+        const Texture::Ref&         depthBuffer,
+        const int                   guardBandSize);
 
     void computeRawAO
        (RenderDevice* rd,         
@@ -129,10 +321,20 @@ protected:
         const Vector4&              projConstant,
         float                       projScale,
         const Texture::Ref&         csZBuffer,
+        const int                   guardBandSize,
+        bool                        temporal);
+
+    /** Blends m_rawAOBuffer with the reprojected history into m_resolvedAOBuffer and the next history buffer */
+    void resolveTemporal
+       (RenderDevice*              rd,
+        const Vector3&              clipConstant,
+        const Vector4&              projConstant,
         const int                   guardBandSize);
 
+    /** \param source m_rawAOBuffer, or m_resolvedAOBuffer in temporal mode */
     void blurHorizontal
         (RenderDevice*              rd, 
+        const Texture::Ref&         source,
         const Texture::Ref&         depthBuffer,
         const int                   guardBandSize);
 
@@ -141,14 +343,53 @@ protected:
         const Texture::Ref&         depthBuffer,
         const int                   guardBandSize);
 
+    /** Replaces blurHorizontal() and blurVertical() when fusedBlur() is true */
+    void blurFused
+        (RenderDevice*              rd, 
+        const Texture::Ref&         source,
+        const int                   guardBandSize);
+
+    /** compute(), with the temporal passes only if \a temporal.  The history is kept whenever temporal() is true. */
+    void computeView
+       (RenderDevice*               rd,
+        const Texture::Ref&         depthBuffer, 
+        const Vector3&              clipConstant,
+        const Vector4&              projConstant,
+        float                       projScale,
+        const int                   guardBandSize,
+        bool                        temporal);
+
+    /** The constants of the full version of compute() for \a camera, rendered into \a depthBuffer and
+        shown in \a viewport */
+    static void cameraConstants
+       (const GCamera&              camera,
+        const Texture::Ref&         depthBuffer,
+        const Rect2D&               viewport,
+        Vector3&                    clipConstant,
+        Vector4&                    projConstant,
+        float&                      projScale);
+
+    SAO();
+
 public:
 
     /** \brief Create a new SAO instance. 
     
-        Only one is ever needed, but if you are rendering to differently-sized
-        framebuffers it is faster to create one instance per resolution than to
-        constantly force SAO to resize its internal buffers. */
+        Only one is ever needed.  Its internal buffers are leased from SAOResourcePool::shared(), so instances
+        that render at different resolutions (split screen, thumbnails) share idle buffers, and a resolution
+        that shrinks, e.g., under dynamic resolution, keeps rendering into a sub-rectangle of the larger buffers
+        instead of reallocating them. */
     static Ref create();
+
+    /** Returns the pooled buffers and deletes the timer queries */
+    ~SAO();
+
+    /** Returns the current buffers to the old pool; the next compute() leases from \a pool */
+    void setResourcePool(const SAOResourcePool::Ref& pool);
+
+    const SAOResourcePool::Ref& resourcePool() const {
+        return m_pool;
+    }
     
     /**
      \brief Render the obscurance constant at each pixel to the currently-bound framebuffer.
@@ -208,7 +449,7 @@ public:
     /** \brief Convenience wrapper for the full version of compute() when
         using only a depth buffer. 
 
-        \param camera The camera that the scene was rendered with.
+        \param camera The camera that the scene was rendered with.  Also passed to setCameraToWorld().
     */
     void compute
        (RenderDevice*               rd,
@@ -216,6 +457,218 @@ public:
         const GCamera&              camera,
         const int                   guardBandSize = 0);
 
+    /**
+     \brief Compute AO on the CPU, for hosts without a GPU.  This does not touch the RenderDevice
+     and produces the same result as compute() to within the tolerance documented on SAOCPU.
+
+     \param depthBuffer \a width x \a height hyperbolic depth values, e.g., the DEPTH_AND_STENCIL
+     G-buffer read back with Texture::toDepthImage1().
+
+     \param result Receives \a width x \a height visibility values
+
+     See compute() for the other parameters.
+     */
+    void computeCPU
+       (const float*                depthBuffer,
+        int                         width,
+        int                         height,
+        const Vector3&              clipConstant,
+        const Vector4&              projConstant,
+        float                       projScale,
+        float*                      result,
+        const int                   guardBandSize = 0);
+
+    /** \brief Convenience loop that calls compute() for each of \a views in order, e.g., the six faces of a light
+        probe.  Each view sets up and issues all of its passes before the next; views of the same size reuse the same
+        leased buffers.
+
+        The views cannot share one temporal history, so they are computed as if temporal() were false.  The history
+        and camera of compute() are left as they were. */
+    void computeBatch(RenderDevice* rd, const Array<View>& views);
+
+    /** \brief computeCPU() for each of \a views.  SAOCPU::computeBatch runs each pass of all views in one parallel
+        loop, which keeps the CPU busy on views too small to fill it one at a time.  Each view keeps its own
+        temporal history.  The camera of each view is in its SAOCPU::View::cameraToWorld. */
+    void computeCPUBatch(const std::vector<SAOCPU::View>& views);
+
+    /** \brief Per-stage timing of compute() on the GPU and the submitting CPU thread, and of computeCPU() on
+        SAOCPU.  Disabled by default; see SAOProfiler::setEnabled.  GPU times lag compute() by a few frames, and
+        require GL_ARB_timer_query. */
+    SAOProfiler& profiler() {
+        return m_profiler;
+    }
+
+    const SAOProfiler& profiler() const {
+        return m_profiler;
+    }
+
+    /** Writes the depth buffer and constants of the next compute() to \a filename as an SAOCapture, for replay
+        on the CPU with tools/SAOReplay.cpp.  The depth buffer is read back with Texture::toDepthImage1(), which
+        stalls the GPU for that frame.  Failures are reported with debugPrintf.
+
+        \param frameIndex Stored in the capture; SAOReplay plays files in name order, not by this number */
+    void captureNextFrame(const std::string& filename, unsigned int frameIndex = 0, SAOCapture::Compression c = SAOCapture::NONE) {
+        alwaysAssertM(SAOCapture::supports(c), "Capture compression requires SAO_CAPTURE_ZLIB");
+        m_captureFilename    = filename;
+        m_captureFrameIndex  = frameIndex;
+        m_captureCompression = c;
+    }
+
+    /** When true, the two blur passes run as one pass (SAO_blurFused.pix) that never writes the intermediate
+        horizontally-blurred buffer, and that buffer and its framebuffer are not allocated.  This saves one
+        full-screen RGB8 write and read per frame at the cost of (2R + 1)^2 instead of 2 (2R + 1) source fetches
+        per pixel, which mostly hit the texture cache.  The result is identical.  Default is false.
+
+        computeCPU() always uses the fused blur; see SAOCPU::setFusedBlur. */
+    void setFusedBlur(bool b) {
+        m_fusedBlur = b;
+    }
+
+    bool fusedBlur() const {
+        return m_fusedBlur;
+    }
+
+    /** When true, each MIP level of the camera-space z buffer is rendered directly from the depth buffer
+        (SAO_reconstructCSZLevel.pix) instead of from the previous level, and the levels are not cleared
+        first because every texel is written.  The passes then read only the depth buffer, which stays
+        in cache between them, and do not depend on each other.  The result is identical.  Default is false.
+
+        OpenGL 2.1 cannot write several MIP levels from one draw call, so this is still one pass per level;
+        DX11shaders/SAO_cszPyramid.hlsl is the single-dispatch compute shader version.  computeCPU()
+        always builds the levels in a single sweep; see SAOCPU::setSingleSweepCSZ. */
+    void setSingleSweepCSZ(bool b) {
+        m_singleSweepCSZ = b;
+    }
+
+    bool singleSweepCSZ() const {
+        return m_singleSweepCSZ;
+    }
+
+    /** When true, the camera-space z pass and each minify pass render only the part of their level that raw AO
+        taps from inside the guard band can reach, reconstructing from the depth buffer the few texels whose
+        source in the finer level was skipped, and the clears cover only the interior plus the blur footprint.
+        The interior of the result is identical.  The top MIP level is always rendered whole because its taps
+        are unbounded.  Default is true; see SAOCPU::setGuardBandCulling, which computeCPU() follows. */
+    void setGuardBandCulling(bool b) {
+        m_guardBandCulling = b;
+    }
+
+    bool guardBandCulling() const {
+        return m_guardBandCulling;
+    }
+
+    /** When true, the raw AO pass runs on 4 x 4 interleaved quarter-resolution layers of the camera-space
+        z buffer, stored as tiles of one atlas texture (SAO_deinterleaveCSZ.pix).  Every pixel of a layer uses
+        the same rotation of the tap spiral in place of the per-pixel hash, and its taps read only that layer
+        and its MIP levels, so the taps of neighboring fragments land on neighboring texels even at large radii.
+        SAO_reinterleave.pix then restores the full-resolution raw AO buffer for the blur.
+
+        The atlas has no depth buffer, so sky pixels are shaded and then overwritten with white instead of
+        being rejected by the depth test, and the guard band is only applied by the reinterleave pass.
+        The result is close to but not identical to the default; see SAOCPU::setDeinterleaved, which
+        computeCPU() follows.  Default is false. */
+    void setDeinterleaved(bool b) {
+        m_deinterleaved = b;
+    }
+
+    bool deinterleaved() const {
+        return m_deinterleaved;
+    }
+
+    /** Selects the tap count, spiral, and blur footprint of SAOPresets.h.  SAO_AO.pix, SAO_blur.pix, and
+        SAO_blurFused.pix are recompiled with the preset's constants (SAOCPU::shaderDefines) on the next
+        compute() after a change.  computeCPU() uses the CPU kernels of the same preset.  Default is
+        SAOCPU::HIGH_QUALITY, which matches the defaults in the shader files. */
+    void setQuality(SAOCPU::Quality q) {
+        alwaysAssertM(q >= 0 && q < SAOCPU::QUALITY_COUNT, "Unknown quality preset");
+        m_quality = q;
+    }
+
+    SAOCPU::Quality quality() const {
+        return m_quality;
+    }
+
+    /** When true, each frame takes only about temporalTapsPerFrame() of the spiral taps and blends the raw AO
+        with the previous frames, reprojected with the camera of setCameraToWorld(), before the blur
+        (SAO_temporal.pix).  This keeps two RGBA32F history buffers and an RGB8 resolved AO buffer.  The RGB8
+        raw AO buffer stores 0.5 * A + 0.5 in this mode, so the per-frame AO is clamped to [-1, 1] where
+        SAOCPU does not clamp it at all.  See SAOCPU::setTemporal, which computeCPU() follows.  Default is false. */
+    void setTemporal(bool b) {
+        m_temporal = b;
+    }
+
+    bool temporal() const {
+        return m_temporal;
+    }
+
+    /** Default is 3 */
+    void setTemporalTapsPerFrame(int n) {
+        alwaysAssertM(n > 0, "Must take at least one tap per frame");
+        m_temporalTapsPerFrame = n;
+    }
+
+    int temporalTapsPerFrame() const {
+        return m_temporalTapsPerFrame;
+    }
+
+    /** Maximum number of frames averaged at a pixel.  Default is 8. */
+    void setTemporalHistoryLength(int n) {
+        alwaysAssertM(n > 0, "History length must be positive");
+        m_temporalHistoryLength = n;
+    }
+
+    int temporalHistoryLength() const {
+        return m_temporalHistoryLength;
+    }
+
+    /** When true, each pixel takes fewer, evenly spaced taps of the spiral where its screen-space disk radius
+        -projScale * radius / z is small, e.g., in wide outdoor views where most pixels are far away.  The count
+        is chosen per pixel in SAO_AO.pix; SAOCPU, which computeCPU() follows, chooses it per block of SIMD lanes.
+        See SAOCPU::setAdaptiveSampling.  Ignored in temporal mode.  Default is false. */
+    void setAdaptiveSampling(bool b) {
+        m_adaptiveSampling = b;
+    }
+
+    bool adaptiveSampling() const {
+        return m_adaptiveSampling;
+    }
+
+    /** Default is 3 to all of the preset's taps; see SAOCPU::setAdaptiveTapRange */
+    void setAdaptiveTapRange(int minTaps, int maxTaps) {
+        alwaysAssertM(minTaps > 0 && maxTaps >= minTaps, "Need 0 < minTaps <= maxTaps");
+        m_adaptiveMinTaps = minTaps;
+        m_adaptiveMaxTaps = maxTaps;
+    }
+
+    int adaptiveMinTaps() const {
+        return m_adaptiveMinTaps;
+    }
+
+    int adaptiveMaxTaps() const {
+        return m_adaptiveMaxTaps;
+    }
+
+    /** Default is 4; see SAOCPU::setAdaptivePixelsPerTap */
+    void setAdaptivePixelsPerTap(float p) {
+        alwaysAssertM(p > 0.0f, "Pixels per tap must be positive");
+        m_adaptivePixelsPerTap = p;
+    }
+
+    float adaptivePixelsPerTap() const {
+        return m_adaptivePixelsPerTap;
+    }
+
+    /** Pose of the camera for the next compute() call.  The GCamera overload of compute() sets it. */
+    void setCameraToWorld(const CoordinateFrame& c) {
+        m_cameraToWorld = c;
+    }
+
+    /** Discards the accumulated AO, e.g., on a camera cut */
+    void resetTemporalHistory() {
+        m_historyValid = false;
+        m_cpu.resetTemporalHistory();
+    }
+
     /** For debugging; not needed to be called from outside of SAO in production code */
     void reloadShaders();
 
@@ -0,0 +1,2239 @@
+/**
+ \file SAOCPU.cpp
+
+ Vectorized CPU version of the SAO passes.  Each kernel is a transcription of the
+ corresponding shader, evaluated SAOSIMD::WIDTH pixels at a time along a row.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#include "SAOCPU.h"
+#include "SAOPresets.h"
+#include "SAOSIMD.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+
+using namespace SAOSIMD;
+
+// These must match SAO_AO.pix.  DX11shaders/SAO_AO.hlsl declares FAR_PLANE_Z as +300, which clamps
+// every bilateral key to zero; the sign here follows the GLSL reference.  The tap and blur constants
+// depend on the quality preset; see SAOPresets.h.
+#define FAR_PLANE_Z         (-300.0f)
+
+// This must match SAO_blur.pix
+#define EDGE_SHARPNESS      (1.0f)
+
+/** Texels of zero padding around the AO planes so that blur taps never leave the allocation */
+#define BLUR_PAD            (SAOPresetLimits::MAX_BLUR_PAD)
+
+/** Fused blur tiles are this many times taller than wide, which amortizes the R * SCALE halo rows
+    that are blurred horizontally by two vertically adjacent tiles */
+#define BLUR_TILE_ASPECT    (4)
+
+/** The swizzled CSZ layout stores blocks of 2^SWIZZLE_BITS x 2^SWIZZLE_BITS texels contiguously */
+#define SWIZZLE_BITS        (3)
+#define SWIZZLE_BLOCK       (1 << SWIZZLE_BITS)
+
+/** Deinterleaved mode splits the pixels into DEINTERLEAVE x DEINTERLEAVE quarter-resolution layers */
+#define DEINTERLEAVE        (4)
+#define LAYER_COUNT         (DEINTERLEAVE * DEINTERLEAVE)
+
+/** Temporal mode keeps the history where the reprojected camera-space z is within this fraction of the stored one.
+    Must match SAO_temporal.pix */
+#define TEMPORAL_DEPTH_TOLERANCE (0.01f)
+
+static int roundUp(int x, int multiple) {
+    return ((x + multiple - 1) / multiple) * multiple;
+}
+
+
+/** Z-order (Morton) index of (x, y) within a swizzle block.  Each 4 x 4 sub-block is one 64-byte cache line. */
+static SAO_FORCEINLINE int mortonIndex(int x, int y) {
+    return (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+}
+
+static SAO_FORCEINLINE Int mortonIndex(Int x, Int y) {
+    const Int one(1), two(2), four(4);
+    return (x & one) | shiftLeft<1>(y & one) | shiftLeft<1>(x & two) | shiftLeft<2>(y & two) | shiftLeft<2>(x & four) | shiftLeft<3>(y & four);
+}
+
+
+/** Index of texel (x, y) of the level at \a offset with row (or block row) stride \a stride */
+template<bool swizzled>
+static SAO_FORCEINLINE int levelIndex(int offset, int stride, int x, int y) {
+    return swizzled ?
+        offset + (y >> SWIZZLE_BITS) * stride + ((x >> SWIZZLE_BITS) << (2 * SWIZZLE_BITS)) + mortonIndex(x, y) :
+        offset + y * stride + x;
+}
+
+template<bool swizzled>
+static SAO_FORCEINLINE Int levelIndex(Int offset, Int stride, Int x, Int y) {
+    return swizzled ?
+        offset + shiftRight<SWIZZLE_BITS>(y) * stride + shiftLeft<2 * SWIZZLE_BITS>(shiftRight<SWIZZLE_BITS>(x)) + mortonIndex(x, y) :
+        offset + y * stride + x;
+}
+
+
+/** Fills the geometry of a MIP chain whose level 0 is \a width x \a height and returns its size in floats.
+    Level 0 is padded so that whole SIMD vectors and whole 2x2 quads can always be read. */
+static int mipChainLayout(int width, int height, bool swizzled, int offset[], int stride[], int levelWidth[], int levelHeight[]) {
+    int total = 0;
+    for (int i = 0; i <= SAOCPU::MAX_MIP_LEVEL; ++i) {
+        levelWidth[i]  = (i == 0) ? width  : std::max(1, levelWidth[i - 1] / 2);
+        levelHeight[i] = (i == 0) ? height : std::max(1, levelHeight[i - 1] / 2);
+
+        int paddedWidth  = (i == 0) ? roundUp(width, WIDTH) : levelWidth[i];
+        int paddedHeight = (i == 0) ? roundUp(height, 2)    : levelHeight[i];
+
+        if (swizzled) {
+            // The stride is between rows of blocks
+            paddedWidth  = roundUp(paddedWidth,  SWIZZLE_BLOCK);
+            paddedHeight = roundUp(paddedHeight, SWIZZLE_BLOCK);
+            stride[i] = paddedWidth * SWIZZLE_BLOCK;
+        } else {
+            stride[i] = paddedWidth;
+        }
+
+        offset[i] = total;
+        total += paddedWidth * paddedHeight;
+    }
+    return total;
+}
+
+
+/** SAO_minify: texels [xBegin, xEnd) x [yBegin, yEnd) of \a level of the MIP chain in \a csz from level - 1, by rotated grid subsampling */
+template<bool swizzled>
+static void minifyRows(float* csz, const int offset[], const int stride[], const int levelWidth[], const int levelHeight[], int level, int xBegin, int xEnd, int yBegin, int yEnd) {
+    const int    srcOffset = offset[level - 1];
+    const int    srcStride = stride[level - 1];
+    const int    srcMaxX   = levelWidth[level - 1] - 1;
+    const int    srcMaxY   = levelHeight[level - 1] - 1;
+    const int    dstOffset = offset[level];
+    const int    dstStride = stride[level];
+
+    for (int y = yBegin; y < yEnd; ++y) {
+        for (int x = xBegin; x < xEnd; ++x) {
+            const int sx = std::min(x * 2 + ((y & 1) ^ 1), srcMaxX);
+            const int sy = std::min(y * 2 + ((x & 1) ^ 1), srcMaxY);
+            csz[levelIndex<swizzled>(dstOffset, dstStride, x, y)] = csz[levelIndex<swizzled>(srcOffset, srcStride, sx, sy)];
+        }
+    }
+}
+
+
+#ifdef SAO_TRACE_CSZ_READS
+/** Called with the address of every m_cszBuffer (or, in deinterleaved mode, m_layerCSZBuffer) element that
+    the raw AO pass reads, in execution order.
+    Defined by the program that sets SAO_TRACE_CSZ_READS, e.g., tools/SAOCacheBenchmark.cpp. */
+void saoTraceCSZRead(const float* address);
+
+static void traceCSZReads(const float* base, Int index) {
+    int i[WIDTH];
+    index.store(i);
+    for (int lane = 0; lane < WIDTH; ++lane) {
+        saoTraceCSZRead(base + i[lane]);
+    }
+}
+#   define TRACE_CSZ_READS(base, index) traceCSZReads(base, index)
+#else
+#   define TRACE_CSZ_READS(base, index)
+#endif
+
+
+SAOCPU::Settings::Settings() :
+    radius(1.0f),
+    bias(0.012f),
+    intensity(1.0f) {}
+
+
+SAOCPU::View::View() :
+    depthBuffer(NULL),
+    width(0),
+    height(0),
+    projScale(1.0f),
+    result(NULL),
+    guardBandSize(0) {
+
+    static const float identity[12] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0};
+    std::fill(clipConstant, clipConstant + 3, 0.0f);
+    std::fill(projConstant, projConstant + 4, 0.0f);
+    std::copy(identity, identity + 12, cameraToWorld);
+}
+
+
+SAOCPU::SAOCPU() :
+    m_width(0),
+    m_height(0),
+    m_quality(HIGH_QUALITY),
+    m_cszLayout(ROW_MAJOR_LAYOUT),
+    m_cszBufferLayout(ROW_MAJOR_LAYOUT),
+    m_planeStride(0),
+    m_planeOrigin(0),
+    m_fusedBlur(true),
+    m_blurBytesRead(0),
+    m_blurBytesWritten(0),
+    m_singleSweepCSZ(true),
+    m_guardBandCulling(true),
+    m_deinterleaved(false),
+    m_layerSize(0),
+    m_layerPlaneSize(0),
+    m_temporal(false),
+    m_temporalTapsPerFrame(3),
+    m_temporalHistoryLength(8),
+    m_frameIndex(0),
+    m_historyStride(0),
+    m_historyIndex(0),
+    m_historyValid(false),
+    m_threadCount(0),
+    m_tileSize(64),
+    m_tileSteals(0),
+    m_adaptiveSampling(false),
+    m_adaptiveMinTaps(3),
+    m_adaptiveMaxTaps(SAOPresetLimits::MAX_NUM_SAMPLES),
+    m_adaptivePixelsPerTap(4.0f),
+    m_depthTileSkipping(true),
+    m_flatBlurTolerance(0.0f),
+    m_threadPoolOwner(NULL) {
+
+    for (int i = 0; i <= MAX_MIP_LEVEL; ++i) {
+        m_cszLevelOffset[i] = m_cszLevelStride[i] = m_cszLevelWidth[i] = m_cszLevelHeight[i] = 0;
+        m_layerLevelOffset[i] = m_layerLevelStride[i] = m_layerLevelWidth[i] = m_layerLevelHeight[i] = 0;
+    }
+    for (int l = 0; l < DEPTH_TILE_LEVELS; ++l) {
+        m_depthTilesX[l] = m_depthTilesY[l] = 0;
+    }
+
+    static const float identity[12] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0};
+    setCameraToWorld(identity);
+    std::copy(identity, identity + 12, m_previousCameraToWorld);
+    std::fill(m_previousProjInfo, m_previousProjInfo + 4, 0.0f);
+}
+
+
+SAOCPU::~SAOCPU() {}
+
+
+void SAOCPU::setThreadCount(int n) {
+    assert(n >= 0);
+    if (n != m_threadCount) {
+        m_threadCount = n;
+        m_threadPool.reset();
+        m_tileTiming.clear();
+    }
+}
+
+
+void SAOCPU::setTemporalTapsPerFrame(int n) {
+    assert(n > 0);
+    m_temporalTapsPerFrame = n;
+}
+
+
+void SAOCPU::setTemporalHistoryLength(int n) {
+    assert(n > 0);
+    m_temporalHistoryLength = n;
+}
+
+
+void SAOCPU::setCameraToWorld(const float cameraToWorld[12]) {
+    std::copy(cameraToWorld, cameraToWorld + 12, m_cameraToWorld);
+}
+
+
+void SAOCPU::setAdaptiveTapRange(int minTaps, int maxTaps) {
+    assert(minTaps > 0 && maxTaps >= minTaps);
+    m_adaptiveMinTaps = minTaps;
+    m_adaptiveMaxTaps = maxTaps;
+}
+
+
+void SAOCPU::setAdaptivePixelsPerTap(float p) {
+    assert(p > 0.0f);
+    m_adaptivePixelsPerTap = p;
+}
+
+
+void SAOCPU::setFlatBlurTolerance(float e) {
+    assert(e >= 0.0f);
+    m_flatBlurTolerance = e;
+}
+
+
+int SAOCPU::adaptiveTapCount(float ssDiskRadius, int minTaps, int maxTaps, float pixelsPerTap) {
+    // Compared as floats first so that the infinite radius of a tile at z = 0 does not overflow the conversion
+    const float n = std::ceil(ssDiskRadius / pixelsPerTap);
+    return (n >= float(maxTaps)) ? maxTaps : std::max(minTaps, int(n));
+}
+
+
+void SAOCPU::temporalTaps(int numSamples, int frameIndex, int tapsPerFrame, int& firstTap, int& tapStride, int& tapCount, float& spin) {
+    assert(numSamples > 0 && tapsPerFrame > 0);
+    tapStride = (numSamples + tapsPerFrame - 1) / tapsPerFrame;
+    firstTap  = frameIndex % tapStride;
+    tapCount  = (numSamples - firstTap + tapStride - 1) / tapStride;
+
+    // Golden angle steps never repeat a rotation
+    spin = float(std::fmod(double(frameIndex) * 2.3999632297286533, 6.283185307179586));
+}
+
+
+int SAOCPU::threadCount() const {
+    if (m_threadPoolOwner != NULL) {
+        return m_threadPoolOwner->threadCount();
+    }
+    return m_threadPool ? m_threadPool->size() : m_threadCount;
+}
+
+
+void SAOCPU::setTileSize(int s) {
+    assert(s > 0);
+    m_tileSize = roundUp(s, WIDTH);
+}
+
+
+ThreadPool& SAOCPU::threadPool() {
+    if (m_threadPoolOwner != NULL) {
+        return m_threadPoolOwner->threadPool();
+    }
+    if (! m_threadPool) {
+        m_threadPool.reset(new ThreadPool(m_threadCount));
+    }
+    return *m_threadPool;
+}
+
+
+void SAOCPU::parallelRows(int begin, int end, const std::function<void (int, int)>& body) {
+    // A few bands per worker so that stealing can even out the guard band and sky rows
+    const int rows  = end - begin;
+    const int bands = std::min(rows, threadPool().size() * 4);
+    threadPool().parallelFor(bands, [&](int band, int) {
+        body(begin + int((long long)rows * band / bands), begin + int((long long)rows * (band + 1) / bands));
+    });
+}
+
+
+void SAOCPU::runJob(const PassJob& job) {
+    threadPool().parallelFor(job.items, job.run);
+    if (job.finish) {
+        job.finish();
+    }
+}
+
+
+void SAOCPU::runJobs(const std::vector<PassJob>& jobs) {
+    // first[j] is the index of the first item of job j
+    std::vector<int> first(jobs.size() + 1, 0);
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        first[j + 1] = first[j] + jobs[j].items;
+    }
+
+    threadPool().parallelFor(first.back(), [&](int index, int worker) {
+        // Jobs with no items have the same first index as the next one, which upper_bound skips
+        const size_t j = size_t(std::upper_bound(first.begin(), first.end(), index) - first.begin()) - 1;
+        jobs[j].run(index - first[j], worker);
+    });
+
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        if (jobs[j].finish) {
+            jobs[j].finish();
+        }
+    }
+}
+
+
+void SAOCPU::copySettings(const SAOCPU& other) {
+    m_settings              = other.m_settings;
+    m_quality               = other.m_quality;
+    m_cszLayout             = other.m_cszLayout;
+    m_fusedBlur             = other.m_fusedBlur;
+    m_singleSweepCSZ        = other.m_singleSweepCSZ;
+    m_guardBandCulling      = other.m_guardBandCulling;
+    m_deinterleaved         = other.m_deinterleaved;
+    m_temporal              = other.m_temporal;
+    m_temporalTapsPerFrame  = other.m_temporalTapsPerFrame;
+    m_temporalHistoryLength = other.m_temporalHistoryLength;
+    m_tileSize              = other.m_tileSize;
+    m_adaptiveSampling      = other.m_adaptiveSampling;
+    m_adaptiveMinTaps       = other.m_adaptiveMinTaps;
+    m_adaptiveMaxTaps       = other.m_adaptiveMaxTaps;
+    m_adaptivePixelsPerTap  = other.m_adaptivePixelsPerTap;
+    m_depthTileSkipping     = other.m_depthTileSkipping;
+    m_flatBlurTolerance     = other.m_flatBlurTolerance;
+}
+
+
+SAOCPU::TileStatistics SAOCPU::tileStatistics() const {
+    TileStatistics stats;
+    std::vector<float> busy(std::max(1, threadCount()), 0.0f);
+    for (size_t i = 0; i < m_tileTiming.size(); ++i) {
+        const TileTiming& t = m_tileTiming[i];
+        busy[t.worker] += t.milliseconds;
+        stats.maxTileMilliseconds = std::max(stats.maxTileMilliseconds, t.milliseconds);
+    }
+    for (size_t w = 0; w < busy.size(); ++w) {
+        stats.totalMilliseconds += busy[w];
+        stats.maxWorkerMilliseconds = std::max(stats.maxWorkerMilliseconds, busy[w]);
+    }
+    stats.meanWorkerMilliseconds = stats.totalMilliseconds / float(busy.size());
+    stats.steals = m_tileSteals;
+    return stats;
+}
+
+
+const char* SAOCPU::instructionSet() {
+    return SAOSIMD::name();
+}
+
+
+void SAOCPU::setQuality(Quality q) {
+    assert(q >= LOW_QUALITY && q < QUALITY_COUNT);
+    m_quality = q;
+}
+
+
+template<class Preset>
+static SAOCPU::QualityParameters presetParameters(const char* name) {
+    SAOCPU::QualityParameters p;
+    p.name           = name;
+    p.numSamples     = Preset::NUM_SAMPLES;
+    p.numSpiralTurns = Preset::NUM_SPIRAL_TURNS;
+    p.logMaxOffset   = Preset::LOG_MAX_OFFSET;
+    p.blurRadius     = Preset::R;
+    p.blurScale      = Preset::SCALE;
+    p.gaussian       = Preset::gaussian();
+
+    typedef SAOSpiral<Preset::NUM_SAMPLES, Preset::NUM_SPIRAL_TURNS> Spiral;
+    p.spiralRadius   = Spiral::radius;
+    p.spiralX        = Spiral::unitX;
+    p.spiralY        = Spiral::unitY;
+    return p;
+}
+
+
+SAOCPU::QualityParameters SAOCPU::qualityParameters(Quality q) {
+    switch (q) {
+    case LOW_QUALITY:    return presetParameters<SAOPreset<LOW_QUALITY> >("Low");
+    case MEDIUM_QUALITY: return presetParameters<SAOPreset<MEDIUM_QUALITY> >("Medium");
+    case ULTRA_QUALITY:  return presetParameters<SAOPreset<ULTRA_QUALITY> >("Ultra");
+    default:             return presetParameters<SAOPreset<HIGH_QUALITY> >("High");
+    }
+}
+
+
+/** \a f as a shader float literal: max_digits10 significant digits read back as the same float, and
+    a literal without a point or exponent gets ".0" so that GLSL does not take it for an int. */
+static std::string floatLiteral(float f) {
+    std::ostringstream s;
+    s.precision(std::numeric_limits<float>::max_digits10);
+    s << f;
+    std::string literal = s.str();
+    if (literal.find_first_of(".e") == std::string::npos) {
+        literal += ".0";
+    }
+    return literal;
+}
+
+
+std::vector<std::pair<std::string, std::string> > SAOCPU::shaderDefines(Quality q) {
+    const QualityParameters p = qualityParameters(q);
+
+    std::vector<std::pair<std::string, std::string> > defines;
+    const std::pair<const char*, int> integers[] = {
+        std::make_pair("NUM_SAMPLES",      p.numSamples),
+        std::make_pair("NUM_SPIRAL_TURNS", p.numSpiralTurns),
+        std::make_pair("LOG_MAX_OFFSET",   p.logMaxOffset),
+        std::make_pair("MAX_MIP_LEVEL",    int(MAX_MIP_LEVEL)),
+        std::make_pair("R",                p.blurRadius),
+        std::make_pair("SCALE",            p.blurScale)};
+    for (int i = 0; i < int(sizeof(integers) / sizeof(integers[0])); ++i) {
+        std::ostringstream value;
+        value << "(" << integers[i].second << ")";
+        defines.push_back(std::make_pair(std::string(integers[i].first), value.str()));
+    }
+
+    // The shaders then weight and place taps with exactly the floats that SAOCPU uses
+    std::ostringstream table;
+    for (int r = 0; r <= p.blurRadius; ++r) {
+        table << ((r > 0) ? ", " : "") << floatLiteral(p.gaussian[r]);
+    }
+    defines.push_back(std::make_pair(std::string("GAUSSIAN_TABLE"), table.str()));
+
+    // TAP(unitX, unitY, radius) of each spiral tap.  The shader defines TAP as its 3-vector constructor.
+    std::ostringstream spiral;
+    for (int i = 0; i < p.numSamples; ++i) {
+        spiral << ((i > 0) ? ", " : "") << "TAP(" << floatLiteral(p.spiralX[i]) << ", " <<
+            floatLiteral(p.spiralY[i]) << ", " << floatLiteral(p.spiralRadius[i]) << ")";
+    }
+    defines.push_back(std::make_pair(std::string("SPIRAL_TAPS"), spiral.str()));
+
+    return defines;
+}
+
+
+/** The numbers in a macro value such as "(11)" or "0.1, 0.2" */
+static std::vector<double> macroNumbers(const std::string& value) {
+    std::vector<double> numbers;
+    const char* c = value.c_str();
+    while (*c != '\0') {
+        if ((*c == '-') || (*c == '.') || ((*c >= '0') && (*c <= '9'))) {
+            char* end;
+            numbers.push_back(strtod(c, &end));
+            c = end;
+        } else {
+            ++c;
+        }
+    }
+    return numbers;
+}
+
+
+bool SAOCPU::checkShaderDefaults(const std::string& source, std::string& mismatches) {
+    const std::vector<std::pair<std::string, std::string> > defines = shaderDefines(HIGH_QUALITY);
+
+    bool ok = true;
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line)) {
+        // "#define NAME value", with any spacing after the '#', up to a comment
+        std::istringstream words(line);
+        std::string hash, name;
+        words >> hash;
+        if (hash == "#") {
+            words >> hash;
+        } else if (hash.size() > 1 && hash[0] == '#') {
+            hash = hash.substr(1);
+        }
+        if (hash != "define") {
+            continue;
+        }
+        words >> name;
+
+        std::string value;
+        std::getline(words, value);
+        const size_t comment = value.find("//");
+        if (comment != std::string::npos) {
+            value.erase(comment);
+        }
+
+        for (int i = 0; i < int(defines.size()); ++i) {
+            if (defines[i].first != name) {
+                continue;
+            }
+            const std::vector<double> actual   = macroNumbers(value);
+            const std::vector<double> expected = macroNumbers(defines[i].second);
+            // The defaults are written to six decimals, so they may differ from the floats of the preset
+            // by up to half of 1e-6; a shader compiled without shaderDefines() is that close to SAOCPU
+            bool same = (actual.size() == expected.size());
+            for (int j = 0; same && (j < int(actual.size())); ++j) {
+                same = std::abs(actual[j] - expected[j]) <= 0.5e-6 + std::abs(expected[j]) * std::numeric_limits<float>::epsilon();
+            }
+            if (! same) {
+                mismatches += name + " is" + value + " but the HIGH_QUALITY preset has " + defines[i].second + "\n";
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+
+void SAOCPU::compute
+   (const float*                depthBuffer,
+    int                         width,
+    int                         height,
+    const float                 clipConstant[3],
+    const float                 projConstant[4],
+    float                       projScale,
+    float*                      result,
+    int                         guardBandSize) {
+
+    assert(depthBuffer != NULL && result != NULL);
+    assert(projScale > 0);
+    assert(guardBandSize >= 0 && 2 * guardBandSize < std::min(width, height));
+
+    typedef std::chrono::high_resolution_clock Clock;
+    m_passTiming.clear();
+
+    resizeBuffers(width, height);
+
+    computeCSZ(depthBuffer, clipConstant, guardBandSize);
+
+    // Pixels inside the guard band, which the raw AO, reinterleave, and temporal passes read and write
+    const long long interior = (long long)(width - 2 * guardBandSize) * (height - 2 * guardBandSize);
+
+    if (m_deinterleaved) {
+        const Clock::time_point start = Clock::now();
+        deinterleaveCSZ();
+        recordPass("deinterleave CSZ", start, (long long)m_layerCSZBuffer.size(), (long long)cszLevelSize(0) * sizeof(float), (long long)m_layerCSZBuffer.size() * sizeof(float));
+    }
+
+    {
+        // The center z of each pixel, and its raw AO and key
+        const Clock::time_point start = Clock::now();
+        computeRawAO(depthBuffer, projConstant, projScale, guardBandSize);
+        recordPass("raw AO", start, interior, interior * sizeof(float), interior * 2 * sizeof(float));
+    }
+
+    if (m_deinterleaved) {
+        const Clock::time_point start = Clock::now();
+        reinterleave(guardBandSize);
+        recordPass("reinterleave", start, interior, interior * 2 * sizeof(float), interior * 2 * sizeof(float));
+    }
+
+    if (m_temporal) {
+        // Raw AO, key, and the three previous history planes in; the current history and the raw AO out
+        const Clock::time_point start = Clock::now();
+        resolveTemporal(projConstant, guardBandSize);
+        recordPass("temporal resolve", start, interior, interior * 5 * sizeof(float), interior * 4 * sizeof(float));
+        ++m_frameIndex;
+    } else {
+        m_historyValid = false;
+        m_temporalStatistics = TemporalStatistics();
+    }
+
+    blur(result, guardBandSize);
+}
+
+
+void SAOCPU::computeBatch(const std::vector<View>& views) {
+    typedef std::chrono::high_resolution_clock Clock;
+
+    while (m_batchViews.size() < views.size()) {
+        m_batchViews.push_back(std::unique_ptr<SAOCPU>(new SAOCPU()));
+        m_batchViews.back()->m_threadPoolOwner = this;
+    }
+    m_batchViews.resize(views.size());
+
+    for (size_t v = 0; v < views.size(); ++v) {
+        const View& view = views[v];
+        assert(view.depthBuffer != NULL && view.result != NULL);
+        assert(view.projScale > 0);
+        assert(view.guardBandSize >= 0 && 2 * view.guardBandSize < std::min(view.width, view.height));
+
+        SAOCPU& sao = *m_batchViews[v];
+        sao.copySettings(*this);
+        sao.setCameraToWorld(view.cameraToWorld);
+    }
+
+    // The passes of compute() in this configuration, each over all views at once
+    const bool batched = m_singleSweepCSZ && m_fusedBlur && ! m_deinterleaved && ! m_temporal;
+    if (batched) {
+        std::vector<PassJob> jobs(views.size());
+
+        Clock::time_point start = Clock::now();
+        for (size_t v = 0; v < views.size(); ++v) {
+            const View& view = views[v];
+            SAOCPU& sao = *m_batchViews[v];
+            sao.m_passTiming.clear();
+            sao.resizeBuffers(view.width, view.height);
+            sao.beginCSZ(view.guardBandSize);
+            jobs[v] = sao.cszSweepJob(view.depthBuffer, view.clipConstant, view.guardBandSize);
+        }
+        runJobs(jobs);
+        for (size_t v = 0; v < views.size(); ++v) {
+            m_batchViews[v]->endCSZ(start);
+        }
+
+        start = Clock::now();
+        for (size_t v = 0; v < views.size(); ++v) {
+            const View& view = views[v];
+            jobs[v] = m_batchViews[v]->rawAOJob(view.depthBuffer, view.projConstant, view.projScale, view.guardBandSize);
+        }
+        runJobs(jobs);
+        for (size_t v = 0; v < views.size(); ++v) {
+            const View& view = views[v];
+            SAOCPU& sao = *m_batchViews[v];
+            const long long interior = (long long)(view.width - 2 * view.guardBandSize) * (view.height - 2 * view.guardBandSize);
+            sao.recordPass("raw AO", start, interior, interior * sizeof(float), interior * 2 * sizeof(float));
+            sao.m_historyValid = false;
+            sao.m_temporalStatistics = TemporalStatistics();
+        }
+
+        start = Clock::now();
+        for (size_t v = 0; v < views.size(); ++v) {
+            const View& view = views[v];
+            SAOCPU& sao = *m_batchViews[v];
+            sao.beginBlur();
+            switch (m_quality) {
+            case LOW_QUALITY:    jobs[v] = sao.blurFusedJob<SAOPreset<LOW_QUALITY> >(view.result, view.guardBandSize);    break;
+            case MEDIUM_QUALITY: jobs[v] = sao.blurFusedJob<SAOPreset<MEDIUM_QUALITY> >(view.result, view.guardBandSize); break;
+            case ULTRA_QUALITY:  jobs[v] = sao.blurFusedJob<SAOPreset<ULTRA_QUALITY> >(view.result, view.guardBandSize);  break;
+            default:             jobs[v] = sao.blurFusedJob<SAOPreset<HIGH_QUALITY> >(view.result, view.guardBandSize);   break;
+            }
+        }
+        runJobs(jobs);
+        for (size_t v = 0; v < views.size(); ++v) {
+            const View& view = views[v];
+            SAOCPU& sao = *m_batchViews[v];
+            const long long written = sao.m_guardBandCulling ?
+                (long long)(view.width - 2 * view.guardBandSize) * (view.height - 2 * view.guardBandSize) : (long long)view.width * view.height;
+            sao.recordPass("blur fused", start, written, sao.m_blurBytesRead, sao.m_blurBytesWritten);
+            sao.endBlur(start);
+        }
+    } else {
+        for (size_t v = 0; v < views.size(); ++v) {
+            const View& view = views[v];
+            m_batchViews[v]->compute(view.depthBuffer, view.width, view.height, view.clipConstant, view.projConstant,
+                                     view.projScale, view.result, view.guardBandSize);
+        }
+    }
+
+    // Every view ran the same passes.  Batched passes were timed once for all views.
+    m_passTiming = m_batchViews.empty() ? std::vector<PassTiming>() : m_batchViews[0]->m_passTiming;
+    for (size_t v = 1; v < m_batchViews.size(); ++v) {
+        const std::vector<PassTiming>& timing = m_batchViews[v]->m_passTiming;
+        for (size_t i = 0; i < m_passTiming.size(); ++i) {
+            PassTiming& p = m_passTiming[i];
+            p.pixels       += timing[i].pixels;
+            p.texels       += timing[i].texels;
+            p.bytesRead    += timing[i].bytesRead;
+            p.bytesWritten += timing[i].bytesWritten;
+            if (! batched) {
+                p.milliseconds += timing[i].milliseconds;
+            }
+        }
+    }
+}
+
+
+void SAOCPU::recordPass(const char* name, std::chrono::high_resolution_clock::time_point start, long long texels, long long bytesRead, long long bytesWritten) {
+    PassTiming p;
+    p.name         = name;
+    p.pixels       = m_width * m_height;
+    p.texels       = texels;
+    p.bytesRead    = bytesRead;
+    p.bytesWritten = bytesWritten;
+    p.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    m_passTiming.push_back(p);
+}
+
+
+void SAOCPU::resizeBuffers(int width, int height) {
+    if ((width == m_width) && (height == m_height) && (m_cszLayout == m_cszBufferLayout)) {
+        return;
+    }
+
+    const bool sizeChanged = (width != m_width) || (height != m_height);
+    m_width  = width;
+    m_height = height;
+    m_cszBufferLayout = m_cszLayout;
+
+    const int total = mipChainLayout(width, height, m_cszLayout == SWIZZLED_LAYOUT,
+                                     m_cszLevelOffset, m_cszLevelStride, m_cszLevelWidth, m_cszLevelHeight);
+    m_cszBuffer.assign(total, 0.0f);
+
+    if (! sizeChanged) {
+        return;
+    }
+
+    m_planeStride = roundUp(width + 2 * BLUR_PAD, WIDTH);
+    m_planeOrigin = BLUR_PAD * m_planeStride + BLUR_PAD;
+    const int planeSize = m_planeStride * (height + 2 * BLUR_PAD);
+
+    // Padding is zero, the frame itself starts white like the cleared GPU buffers
+    m_rawAOBuffer.assign(planeSize, 0.0f);
+    m_keyBuffer.assign(planeSize, 0.0f);
+    for (int y = 0; y < height; ++y) {
+        std::fill(&m_rawAOBuffer[planeIndex(0, y)], &m_rawAOBuffer[planeIndex(0, y)] + width, 1.0f);
+        std::fill(&m_keyBuffer[planeIndex(0, y)],   &m_keyBuffer[planeIndex(0, y)]   + width, 1.0f);
+    }
+
+    for (int l = 0; l < DEPTH_TILE_LEVELS; ++l) {
+        m_depthTilesX[l] = (l == 0) ? (width  + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE : (m_depthTilesX[l - 1] + 1) / 2;
+        m_depthTilesY[l] = (l == 0) ? (height + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE : (m_depthTilesY[l - 1] + 1) / 2;
+        m_depthTilePyramid[l].assign(m_depthTilesX[l] * m_depthTilesY[l], DepthTile());
+    }
+
+    // Reallocated by blur() if the two-pass mode is used at this size
+    std::vector<float>().swap(m_hBlurredBuffer);
+
+    // Reallocated by deinterleaveCSZ() if the deinterleaved mode is used at this size
+    std::vector<float>().swap(m_layerCSZBuffer);
+    std::vector<float>().swap(m_layerAOBuffer);
+    std::vector<float>().swap(m_layerKeyBuffer);
+
+    // Reallocated by resolveTemporal() if the temporal mode is used at this size
+    for (int i = 0; i < 2; ++i) {
+        std::vector<float>().swap(m_historyAO[i]);
+        std::vector<float>().swap(m_historyCount[i]);
+        std::vector<float>().swap(m_historyZ[i]);
+    }
+    m_historyValid = false;
+}
+
+
+int SAOCPU::TexelRect::subtract(const TexelRect& inner, TexelRect strip[4]) const {
+    if (empty()) {
+        return 0;
+    } else if (inner.empty()) {
+        strip[0] = *this;
+        return 1;
+    }
+
+    int n = 0;
+    if (inner.y0 > y0) {
+        strip[n++] = TexelRect(x0, y0, x1, inner.y0);
+    }
+    if (inner.x0 > x0) {
+        strip[n++] = TexelRect(x0, inner.y0, inner.x0, inner.y1);
+    }
+    if (inner.x1 < x1) {
+        strip[n++] = TexelRect(inner.x1, inner.y0, x1, inner.y1);
+    }
+    if (inner.y1 < y1) {
+        strip[n++] = TexelRect(x0, inner.y1, x1, y1);
+    }
+    return n;
+}
+
+
+void SAOCPU::cszLevelRects(Quality q, int width, int height, int guardBandSize, TexelRect rect[MAX_MIP_LEVEL + 1], TexelRect minified[MAX_MIP_LEVEL + 1]) {
+    assert(guardBandSize >= 0 && 2 * guardBandSize < std::min(width, height));
+    const int logMaxOffset = qualityParameters(q).logMaxOffset;
+
+    for (int i = 0; i <= MAX_MIP_LEVEL; ++i) {
+        const int levelWidth  = std::max(1, width  >> i);
+        const int levelHeight = std::max(1, height >> i);
+
+        if ((guardBandSize == 0) || (i == MAX_MIP_LEVEL)) {
+            rect[i] = TexelRect(0, 0, levelWidth, levelHeight);
+        } else {
+            // Farthest tap at this level in pixels, plus one for the other pixel of the quad
+            const int reach = (1 << (logMaxOffset + i + 1)) + 1;
+            rect[i] = TexelRect(std::max(0, (guardBandSize - reach) >> i),
+                                std::max(0, (guardBandSize - reach) >> i),
+                                std::min(levelWidth,  ((width  - guardBandSize + reach - 1) >> i) + 1),
+                                std::min(levelHeight, ((height - guardBandSize + reach - 1) >> i) + 1));
+        }
+
+        if (i == 0) {
+            minified[i] = TexelRect();
+        } else {
+            // Texel x reads x' = min(2x + 0 or 1, previous width - 1), which is in [s.x0, s.x1) for both offsets
+            // when 2x >= s.x0 and either 2x + 1 < s.x1 or s.x1 is the edge of the level; the same holds for y
+            const TexelRect& s = rect[i - 1];
+            const int previousWidth  = std::max(1, width  >> (i - 1));
+            const int previousHeight = std::max(1, height >> (i - 1));
+            minified[i] = TexelRect(std::max(rect[i].x0, (s.x0 + 1) / 2),
+                                    std::max(rect[i].y0, (s.y0 + 1) / 2),
+                                    std::min(rect[i].x1, (s.x1 == previousWidth)  ? levelWidth  : s.x1 / 2),
+                                    std::min(rect[i].y1, (s.y1 == previousHeight) ? levelHeight : s.y1 / 2));
+            if (minified[i].empty()) {
+                minified[i] = TexelRect();
+            }
+        }
+    }
+}
+
+
+void SAOCPU::computeCSZ(const float* depthBuffer, const float clipInfo[3], int guardBandSize) {
+    typedef std::chrono::high_resolution_clock Clock;
+    const Clock::time_point start = Clock::now();
+
+    beginCSZ(guardBandSize);
+
+    if (m_singleSweepCSZ) {
+        runJob(cszSweepJob(depthBuffer, clipInfo, guardBandSize));
+    } else {
+        const int maxLevel = m_deinterleaved ? 0 : int(MAX_MIP_LEVEL);
+
+        Clock::time_point passStart = Clock::now();
+        parallelRows(m_cszRect[0].y0, m_cszRect[0].y1, [&](int yBegin, int yEnd) {
+            computeCSZRows(depthBuffer, clipInfo, yBegin, yEnd);
+        });
+        recordPass("reconstruct CSZ", passStart, m_cszRect[0].area(), m_cszRect[0].area() * sizeof(float), m_cszRect[0].area() * sizeof(float));
+
+        if (m_depthTileSkipping) {
+            // Reads the depth buffer again, which the single sweep does while its band is still in cache
+            passStart = Clock::now();
+            parallelRows(0, m_depthTilesY[0], [&](int rowBegin, int rowEnd) {
+                computeDepthTileRows(depthBuffer, clipInfo, guardBandSize, rowBegin, rowEnd);
+            });
+            minifyDepthTiles();
+            const long long interior = (long long)(m_width - 2 * guardBandSize) * (m_height - 2 * guardBandSize);
+            recordPass("depth tiles", passStart, m_depthTileStatistics.tiles, interior * sizeof(float), (long long)m_depthTilePyramid[0].size() * sizeof(DepthTile));
+        }
+
+        static const char* minifyPassName[MAX_MIP_LEVEL + 1] = {"", "minify 1", "minify 2", "minify 3", "minify 4", "minify 5"};
+        for (int i = 1; i <= maxLevel; ++i) {
+            passStart = Clock::now();
+            std::atomic<int> reconstructed(0);
+            parallelRows(m_cszRect[i].y0, m_cszRect[i].y1, [&](int yBegin, int yEnd) {
+                reconstructed += minifyCSZRows(depthBuffer, clipInfo, i, yBegin, yEnd);
+            });
+            m_cszStatistics.reconstructedTexels += reconstructed;
+
+            // Minified texels read the previous level, the others the depth buffer
+            const long long minified = m_cszMinifiedRect[i].area();
+            recordPass(minifyPassName[i], passStart, m_cszRect[i].area(),
+                       (4 * minified + (m_cszRect[i].area() - minified)) * sizeof(float), m_cszRect[i].area() * sizeof(float));
+        }
+    }
+
+    endCSZ(start);
+}
+
+
+void SAOCPU::beginCSZ(int guardBandSize) {
+    // In deinterleaved mode each layer has its own MIP chain, built by deinterleaveCSZ() from all of level 0
+    const int maxLevel = m_deinterleaved ? 0 : int(MAX_MIP_LEVEL);
+    cszLevelRects(m_quality, m_width, m_height, (m_guardBandCulling && ! m_deinterleaved) ? guardBandSize : 0, m_cszRect, m_cszMinifiedRect);
+
+    m_cszStatistics = CSZStatistics();
+    m_cszStatistics.singleSweep = m_singleSweepCSZ;
+    m_cszStatistics.pixels      = m_width * m_height;
+
+    m_depthTileStatistics = DepthTileStatistics();
+
+    // Level 0 reads the depth buffer and writes its rectangle
+    m_cszStatistics.texels       += m_cszRect[0].area();
+    m_cszStatistics.bytesRead    += m_cszRect[0].area() * sizeof(float);
+    m_cszStatistics.bytesWritten += m_cszRect[0].area() * sizeof(float);
+    for (int i = 1; i <= maxLevel; ++i) {
+        m_cszStatistics.texels       += m_cszRect[i].area();
+        m_cszStatistics.bytesWritten += m_cszRect[i].area() * sizeof(float);
+        if (! m_singleSweepCSZ) {
+            // The previous level has left the cache by the time the next pass reads its rows
+            m_cszStatistics.bytesRead += 4 * m_cszMinifiedRect[i].area() * sizeof(float);
+        }
+    }
+}
+
+
+SAOCPU::PassJob SAOCPU::cszSweepJob(const float* depthBuffer, const float clipInfo[3], int guardBandSize) {
+    // Every texel of level i depends only on level 0 rows within the same aligned band of
+    // 2^MAX_MIP_LEVEL rows, so each band builds all levels, and its whole rows of depth tiles, while its
+    // rows are still in cache
+    const int maxLevel      = m_deinterleaved ? 0 : int(MAX_MIP_LEVEL);
+    const int bandRows      = 1 << MAX_MIP_LEVEL;
+    const int bandTileRows  = bandRows / DEPTH_TILE_SIZE;
+    const int depthTileRows = m_depthTilesY[0];
+    const std::shared_ptr<std::vector<int> > reconstructed = std::make_shared<std::vector<int> >((m_height + bandRows - 1) / bandRows, 0);
+
+    PassJob job;
+    job.items = int(reconstructed->size());
+    job.run = [this, depthBuffer, clipInfo, guardBandSize, maxLevel, depthTileRows, reconstructed](int band, int) {
+        computeCSZRows(depthBuffer, clipInfo, band * bandRows, std::min((band + 1) * bandRows, m_height));
+        if (m_depthTileSkipping) {
+            computeDepthTileRows(depthBuffer, clipInfo, guardBandSize, band * bandTileRows, std::min((band + 1) * bandTileRows, depthTileRows));
+        }
+        for (int i = 1; i <= maxLevel; ++i) {
+            (*reconstructed)[band] += minifyCSZRows(depthBuffer, clipInfo, i, (band * bandRows) >> i, std::min(((band + 1) * bandRows) >> i, m_cszLevelHeight[i]));
+        }
+    };
+    job.finish = [this, reconstructed]() {
+        for (size_t b = 0; b < reconstructed->size(); ++b) {
+            m_cszStatistics.reconstructedTexels += (*reconstructed)[b];
+        }
+        if (m_depthTileSkipping) {
+            minifyDepthTiles();
+        }
+    };
+    return job;
+}
+
+
+void SAOCPU::endCSZ(std::chrono::high_resolution_clock::time_point start) {
+    typedef std::chrono::high_resolution_clock Clock;
+
+    // The texels of the levels above 0 that were not minified were reconstructed from the depth buffer
+    m_cszStatistics.bytesRead += m_cszStatistics.reconstructedTexels * sizeof(float);
+
+    m_cszStatistics.milliseconds = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+    if (m_singleSweepCSZ) {
+        recordPass("CSZ sweep", start, m_cszStatistics.texels, m_cszStatistics.bytesRead, m_cszStatistics.bytesWritten);
+    }
+}
+
+
+void SAOCPU::computeCSZRows(const float* depthBuffer, const float clipInfo[3], int yBegin, int yEnd) {
+    const TexelRect& r = m_cszRect[0];
+    yBegin = std::max(yBegin, r.y0);
+    yEnd   = std::min(yEnd,   r.y1);
+
+    const bool   swizzled = (m_cszBufferLayout == SWIZZLED_LAYOUT);
+    const int    width    = m_width;
+    const int    stride   = m_cszLevelStride[0];
+    const int    padded   = swizzled ? roundUp(roundUp(width, WIDTH), SWIZZLE_BLOCK) : stride;
+    float*       csz      = &m_cszBuffer[0];
+
+    // Whole vectors from the one that contains r.x0, so that every column takes the same (SIMD or scalar)
+    // path as without culling.  The padding is only written when the rectangle reaches the right edge.
+    const int    xBegin   = (r.x0 / WIDTH) * WIDTH;
+    const int    xEnd     = (r.x1 == width) ? padded : r.x1;
+
+    // The swizzled layout reconstructs each row in row-major order and then scatters it into the blocks
+    std::vector<float> row(swizzled ? padded : 0);
+
+    // SAO_reconstructCSZ.pix
+    const Float c0(clipInfo[0]), c1(clipInfo[1]), c2(clipInfo[2]);
+    for (int y = yBegin; y < yEnd; ++y) {
+        const float* src = depthBuffer + y * width;
+        float*       dst = swizzled ? &row[0] : csz + y * stride;
+        int x = xBegin;
+        for (; (x < r.x1) && (x + WIDTH <= width); x += WIDTH) {
+            (c0 / madd(c1, Float::load(src + x), c2)).store(dst + x);
+        }
+        for (; x < r.x1; ++x) {
+            dst[x] = clipInfo[0] / (clipInfo[1] * src[x] + clipInfo[2]);
+        }
+        // Replicate the edge into the padding
+        for (; x < xEnd; ++x) {
+            dst[x] = dst[width - 1];
+        }
+
+        if (swizzled) {
+            for (x = xBegin; x < xEnd; ++x) {
+                csz[levelIndex<true>(0, stride, x, y)] = dst[x];
+            }
+        }
+    }
+
+    if ((yBegin < yEnd) && (yEnd == m_height) && (m_height & 1)) {
+        for (int x = xBegin; x < xEnd; ++x) {
+            csz[cszIndex(0, x, m_height)] = csz[cszIndex(0, x, m_height - 1)];
+        }
+    }
+}
+
+
+int SAOCPU::minifyCSZRows(const float* depthBuffer, const float clipInfo[3], int level, int yBegin, int yEnd) {
+    const TexelRect band(m_cszRect[level].x0, std::max(yBegin, m_cszRect[level].y0), m_cszRect[level].x1, std::min(yEnd, m_cszRect[level].y1));
+    if (band.empty()) {
+        return 0;
+    }
+
+    const TexelRect& m = m_cszMinifiedRect[level];
+    TexelRect inner(m.x0, std::max(band.y0, m.y0), m.x1, std::min(band.y1, m.y1));
+    if (inner.empty()) {
+        inner = TexelRect();
+    } else if (m_cszBufferLayout == SWIZZLED_LAYOUT) {
+        minifyRows<true>(&m_cszBuffer[0], m_cszLevelOffset, m_cszLevelStride, m_cszLevelWidth, m_cszLevelHeight, level, inner.x0, inner.x1, inner.y0, inner.y1);
+    } else {
+        minifyRows<false>(&m_cszBuffer[0], m_cszLevelOffset, m_cszLevelStride, m_cszLevelWidth, m_cszLevelHeight, level, inner.x0, inner.x1, inner.y0, inner.y1);
+    }
+
+    TexelRect strip[4];
+    const int n = band.subtract(inner, strip);
+    int reconstructed = 0;
+    for (int i = 0; i < n; ++i) {
+        reconstructCSZTexels(depthBuffer, clipInfo, level, strip[i]);
+        reconstructed += int(strip[i].area());
+    }
+    return reconstructed;
+}
+
+
+void SAOCPU::reconstructCSZTexels(const float* depthBuffer, const float clipInfo[3], int level, const TexelRect& r) {
+    // Columns below vectorEnd take the SIMD path of computeCSZRows(), which may round differently from the scalar one
+    const int   vectorEnd = (m_width / WIDTH) * WIDTH;
+    const Float c0(clipInfo[0]), c1(clipInfo[1]), c2(clipInfo[2]);
+
+    for (int y = r.y0; y < r.y1; ++y) {
+        for (int x = r.x0; x < r.x1; ++x) {
+            // Follow the rotated grid subsampling of minifyRows() down to level 0
+            int sx = x, sy = y;
+            for (int i = level; i > 0; --i) {
+                const int px = std::min(sx * 2 + ((sy & 1) ^ 1), m_cszLevelWidth[i - 1] - 1);
+                const int py = std::min(sy * 2 + ((sx & 1) ^ 1), m_cszLevelHeight[i - 1] - 1);
+                sx = px;
+                sy = py;
+            }
+
+            const float d = depthBuffer[sy * m_width + sx];
+            m_cszBuffer[cszIndex(level, x, y)] = (sx < vectorEnd) ?
+                (c0 / madd(c1, Float(d), c2)).lane(0) :
+                clipInfo[0] / (clipInfo[1] * d + clipInfo[2]);
+        }
+    }
+}
+
+
+/** The key that the raw AO pass writes for a pixel that is not sky and has depth buffer value \a depth, computed with
+    the same vector operations as computeCSZRows() and the raw AO pass so that it is identical */
+static float bilateralKeyOfDepth(float depth, const float clipInfo[3]) {
+    const Float z = Float(clipInfo[0]) / madd(Float(clipInfo[1]), Float(depth), Float(clipInfo[2]));
+    return (clamp(z * Float(1.0f / FAR_PLANE_Z), Float(0.0f), Float(1.0f)) * Float(256.0f / 257.0f)).lane(0);
+}
+
+
+void SAOCPU::computeDepthTileRows(const float* depthBuffer, const float clipInfo[3], int guardBandSize, int rowBegin, int rowEnd) {
+    const int width  = m_width;
+    const int x0 = guardBandSize, x1 = width - guardBandSize;
+    const int y0 = guardBandSize, y1 = m_height - guardBandSize;
+    const int tilesX = m_depthTilesX[0];
+    const int lanes  = tilesX * DEPTH_TILE_SIZE;
+
+    const float  inf = std::numeric_limits<float>::infinity();
+    const Float  laneX = Float::laneIndex();
+
+    // The smallest and largest depth of each column of the tile row.  The rows are read in order, which is
+    // faster than reading the tiles one at a time.
+    std::vector<float> nearestLanes(lanes), farthestLanes(lanes);
+
+    for (int ty = rowBegin; ty < rowEnd; ++ty) {
+        std::fill(nearestLanes.begin(),  nearestLanes.end(),  inf);
+        std::fill(farthestLanes.begin(), farthestLanes.end(), -inf);
+
+        for (int y = std::max(ty * DEPTH_TILE_SIZE, y0); y < std::min((ty + 1) * DEPTH_TILE_SIZE, y1); ++y) {
+            const float* row = depthBuffer + y * width;
+            for (int x = 0; x < lanes; x += WIDTH) {
+                Float nearest, farthest;
+                if ((x >= x0) && (x + WIDTH <= x1)) {
+                    nearest = farthest = Float::load(row + x);
+                } else {
+                    // Pixels outside of the guard band do not count
+                    float temp[WIDTH];
+                    for (int i = 0; i < WIDTH; ++i) {
+                        temp[i] = (x + i < width) ? row[x + i] : 1.0f;
+                    }
+                    const Float depth  = Float::load(temp);
+                    const Float xs     = laneX + Float(float(x));
+                    const Float inside = (Float(float(x0)) <= xs) & (xs < Float(float(x1)));
+                    nearest  = select(inside, depth, Float(inf));
+                    farthest = select(inside, depth, Float(-inf));
+                }
+                min(Float::load(&nearestLanes[x]),  nearest).store(&nearestLanes[x]);
+                max(Float::load(&farthestLanes[x]), farthest).store(&farthestLanes[x]);
+            }
+        }
+
+        for (int tx = 0; tx < tilesX; ++tx) {
+            const float* nearestBegin  = &nearestLanes[tx * DEPTH_TILE_SIZE];
+            const float* farthestBegin = &farthestLanes[tx * DEPTH_TILE_SIZE];
+            const float nearest  = *std::min_element(nearestBegin,  nearestBegin  + DEPTH_TILE_SIZE);
+            const float farthest = *std::max_element(farthestBegin, farthestBegin + DEPTH_TILE_SIZE);
+
+            // The key is monotonic in depth, and sky (depth >= 1) has a key of 1
+            DepthTile& t = m_depthTilePyramid[0][tx + ty * tilesX];
+            t = DepthTile();
+            if (farthest >= nearest) {
+                t.minKey = (nearest  < 1.0f) ? bilateralKeyOfDepth(nearest,  clipInfo) : 1.0f;
+                t.maxKey = (farthest < 1.0f) ? bilateralKeyOfDepth(farthest, clipInfo) : 1.0f;
+            }
+        }
+    }
+}
+
+
+void SAOCPU::minifyDepthTiles() {
+    const std::vector<DepthTile>& base = m_depthTilePyramid[0];
+    m_depthTileStatistics.tiles = int(base.size());
+    for (size_t i = 0; i < base.size(); ++i) {
+        // Tiles with no pixel inside the guard band have a maxKey of 0
+        if (base[i].allSky() && (base[i].maxKey == 1.0f)) {
+            ++m_depthTileStatistics.skyTiles;
+        }
+    }
+
+    for (int l = 1; l < DEPTH_TILE_LEVELS; ++l) {
+        const std::vector<DepthTile>& fine = m_depthTilePyramid[l - 1];
+        const int fineX = m_depthTilesX[l - 1], fineY = m_depthTilesY[l - 1];
+        for (int ty = 0; ty < m_depthTilesY[l]; ++ty) {
+            for (int tx = 0; tx < m_depthTilesX[l]; ++tx) {
+                DepthTile t;
+                for (int y = 2 * ty; y < std::min(2 * ty + 2, fineY); ++y) {
+                    for (int x = 2 * tx; x < std::min(2 * tx + 2, fineX); ++x) {
+                        t.extend(fine[x + y * fineX]);
+                    }
+                }
+                m_depthTilePyramid[l][tx + ty * m_depthTilesX[l]] = t;
+            }
+        }
+    }
+}
+
+
+SAOCPU::DepthTile SAOCPU::depthTileBounds(const TexelRect& r) const {
+    DepthTile bounds;
+    if (r.empty() || m_depthTilePyramid[0].empty()) {
+        return bounds;
+    }
+
+    int level = 0;
+    const int side = std::min(r.x1 - r.x0, r.y1 - r.y0);
+    while ((level + 1 < DEPTH_TILE_LEVELS) && (2 * (DEPTH_TILE_SIZE << (level + 1)) <= side)) {
+        ++level;
+    }
+
+    const int size   = DEPTH_TILE_SIZE << level;
+    const int tilesX = m_depthTilesX[level];
+    const int tx0 = std::max(r.x0, 0) / size, tx1 = std::min((r.x1 - 1) / size + 1, tilesX);
+    const int ty0 = std::max(r.y0, 0) / size, ty1 = std::min((r.y1 - 1) / size + 1, m_depthTilesY[level]);
+    const std::vector<DepthTile>& tiles = m_depthTilePyramid[level];
+    for (int ty = ty0; ty < ty1; ++ty) {
+        for (int tx = tx0; tx < tx1; ++tx) {
+            bounds.extend(tiles[tx + ty * tilesX]);
+        }
+    }
+    return bounds;
+}
+
+
+int SAOCPU::cszIndex(int level, int x, int y) const {
+    return (m_cszBufferLayout == SWIZZLED_LAYOUT) ?
+        levelIndex<true>(m_cszLevelOffset[level], m_cszLevelStride[level], x, y) :
+        levelIndex<false>(m_cszLevelOffset[level], m_cszLevelStride[level], x, y);
+}
+
+
+int SAOCPU::cszLevelSize(int level) const {
+    return ((level < MAX_MIP_LEVEL) ? m_cszLevelOffset[level + 1] : int(m_cszBuffer.size())) - m_cszLevelOffset[level];
+}
+
+
+void SAOCPU::deinterleaveCSZ() {
+    const int layerWidth  = (m_width  + DEINTERLEAVE - 1) / DEINTERLEAVE;
+    const int layerHeight = (m_height + DEINTERLEAVE - 1) / DEINTERLEAVE;
+
+    if (m_layerCSZBuffer.empty()) {
+        // All layers share one geometry, which is always row-major
+        m_layerSize      = mipChainLayout(layerWidth, layerHeight, false, m_layerLevelOffset, m_layerLevelStride, m_layerLevelWidth, m_layerLevelHeight);
+        m_layerPlaneSize = m_layerLevelOffset[1];
+        m_layerCSZBuffer.assign(m_layerSize * LAYER_COUNT, 0.0f);
+        m_layerAOBuffer.assign(m_layerPlaneSize * LAYER_COUNT, 1.0f);
+        m_layerKeyBuffer.assign(m_layerPlaneSize * LAYER_COUNT, 1.0f);
+    }
+
+    const int paddedWidth  = m_layerLevelStride[0];
+    const int paddedHeight = m_layerPlaneSize / paddedWidth;
+
+    threadPool().parallelFor(LAYER_COUNT, [&](int layer, int) {
+        const int layerX = layer % DEINTERLEAVE;
+        const int layerY = layer / DEINTERLEAVE;
+        float*    csz    = &m_layerCSZBuffer[layer * m_layerSize];
+
+        // Level 0 subsamples the full-resolution level 0, replicating the edge into the padding
+        for (int y = 0; y < paddedHeight; ++y) {
+            const int sy = std::min(y * DEINTERLEAVE + layerY, m_height - 1);
+            float*    dst = csz + y * paddedWidth;
+            if (m_cszBufferLayout == ROW_MAJOR_LAYOUT) {
+                const float* src = &m_cszBuffer[sy * m_cszLevelStride[0]];
+                for (int x = 0; x < paddedWidth; ++x) {
+                    dst[x] = src[std::min(x * DEINTERLEAVE + layerX, m_width - 1)];
+                }
+            } else {
+                for (int x = 0; x < paddedWidth; ++x) {
+                    dst[x] = m_cszBuffer[cszIndex(0, std::min(x * DEINTERLEAVE + layerX, m_width - 1), sy)];
+                }
+            }
+        }
+
+        for (int i = 1; i <= MAX_MIP_LEVEL; ++i) {
+            minifyRows<false>(csz, m_layerLevelOffset, m_layerLevelStride, m_layerLevelWidth, m_layerLevelHeight, i, 0, m_layerLevelWidth[i], 0, m_layerLevelHeight[i]);
+        }
+    });
+}
+
+
+void SAOCPU::reinterleave(int guardBandSize) {
+    const int x0 = guardBandSize, x1 = m_width - guardBandSize;
+    const int stride = m_layerLevelStride[0];
+
+    parallelRows(guardBandSize, m_height - guardBandSize, [&](int yBegin, int yEnd) {
+        for (int y = yBegin; y < yEnd; ++y) {
+            float* dstAO  = &m_rawAOBuffer[planeIndex(0, y)];
+            float* dstKey = &m_keyBuffer[planeIndex(0, y)];
+
+            // Row y of the image interleaves one row of each of DEINTERLEAVE layers
+            for (int layerX = 0; layerX < DEINTERLEAVE; ++layerX) {
+                const int    src = ((y % DEINTERLEAVE) * DEINTERLEAVE + layerX) * m_layerPlaneSize + (y / DEINTERLEAVE) * stride;
+                const float* ao  = &m_layerAOBuffer[src];
+                const float* key = &m_layerKeyBuffer[src];
+                for (int gx = std::max(0, x0 - layerX + DEINTERLEAVE - 1) / DEINTERLEAVE, x = gx * DEINTERLEAVE + layerX; x < x1; ++gx, x += DEINTERLEAVE) {
+                    dstAO[x]  = ao[gx];
+                    dstKey[x] = key[gx];
+                }
+            }
+        }
+    });
+}
+
+
+/** Unroll<begin, end>::run(f) calls f(begin), f(begin + 1), ..., f(end - 1) without a loop */
+template<int begin, int end>
+class Unroll {
+public:
+    template<class Function>
+    static SAO_FORCEINLINE void run(Function& f) {
+        f(begin);
+        Unroll<begin + 1, end>::run(f);
+    }
+};
+
+template<int end>
+class Unroll<end, end> {
+public:
+    template<class Function>
+    static SAO_FORCEINLINE void run(Function&) {}
+};
+
+
+/** Spiral taps from the SAOSpiral table of the preset */
+class SAOCPU::RawAOTaps {
+public:
+    int             count;
+
+    /** intensity / radius^6 times the weight of each tap: 5 / NUM_SAMPLES for the full spiral.  In temporal
+        mode each tap stands for the tapStride taps of one cycle of subsets, so a cycle sums to the full spiral,
+        and in adaptive mode each of the n taps stands for NUM_SAMPLES / n. */
+    float           scale;
+    float           radius[SAOPresetLimits::MAX_NUM_SAMPLES];
+    float           x[SAOPresetLimits::MAX_NUM_SAMPLES];
+    float           y[SAOPresetLimits::MAX_NUM_SAMPLES];
+
+    RawAOTaps() : count(0), scale(0) {}
+
+    /** Appends tap \a i of \a preset */
+    void append(const SAOCPU::QualityParameters& preset, int i) {
+        radius[count] = preset.spiralRadius[i];
+        x[count]      = preset.spiralX[i];
+        y[count]      = preset.spiralY[i];
+        ++count;
+    }
+};
+
+
+/** Per-frame values shared by all tiles of the raw AO pass */
+class SAOCPU::RawAOConstants {
+public:
+    const float*    depthBuffer;
+    float           projInfo[4];
+    float           projScale;
+    float           radius2;
+
+    /** Interior of the guard band */
+    int             x0, y0, x1, y1;
+
+    // Per-level addressing, indexed by MIP level in SIMD lanes
+    int             levelOffset[8];
+    int             levelStride[8];
+    int             levelMaxX[8];
+    int             levelMaxY[8];
+
+    /** Spiral taps of this frame */
+    RawAOTaps       taps;
+
+    /** adaptiveTaps[n] holds n taps, for the tap counts of adaptive mode */
+    RawAOTaps       adaptiveTaps[SAOPresetLimits::MAX_NUM_SAMPLES + 1];
+
+    /** Rotation added to every pixel in temporal mode */
+    float           frameSpin;
+
+    /** Lower bound of the raw AO.  Temporal mode accumulates 1 - obscurance without clamping it to zero,
+        because clamping the few-tap estimate of each frame would bias the average toward white. */
+    float           minAO;
+
+    /** Adaptive mode and its tap range, clamped to the preset */
+    bool            adaptive;
+    int             minTaps;
+    int             maxTaps;
+    float           pixelsPerTap;
+
+    /** Rotation of each deinterleaved layer, which replaces the per-pixel hash */
+    float           layerSpin[LAYER_COUNT];
+
+    /** Fill tiles that the depth tiles show to be all sky without shading them */
+    bool            skipSky;
+};
+
+
+/** Rotation of layer (x % 4, y % 4) in sixteenths of a turn: a 4 x 4 ordered dither.  The blur taps
+    every SCALE = 2 pixels at HIGH_QUALITY, so the four layers that it mixes ((x, y), (x + 2, y), (x, y + 2), (x + 2, y + 2))
+    are a quarter turn apart. */
+static const int layerRotation[LAYER_COUNT] = {
+     0,  2,  8, 10,
+     3,  1, 11,  9,
+    12, 14,  4,  6,
+    15, 13,  7,  5};
+
+
+void SAOCPU::computeRawAO
+   (const float*                depthBuffer,
+    const float                 projInfo[4],
+    const float                 projScale,
+    const int                   guardBandSize) {
+
+    runJob(rawAOJob(depthBuffer, projInfo, projScale, guardBandSize));
+}
+
+
+SAOCPU::PassJob SAOCPU::rawAOJob
+   (const float*                depthBuffer,
+    const float                 projInfo[4],
+    const float                 projScale,
+    const int                   guardBandSize) {
+
+    // Shared by the tiles until the last of them finishes
+    const std::shared_ptr<RawAOConstants> constants = std::make_shared<RawAOConstants>();
+    RawAOConstants& k = *constants;
+    k.depthBuffer    = depthBuffer;
+    std::copy(projInfo, projInfo + 4, k.projInfo);
+    k.projScale      = projScale;
+    k.radius2        = m_settings.radius * m_settings.radius;
+    k.x0 = guardBandSize;  k.x1 = m_width  - guardBandSize;
+    k.y0 = guardBandSize;  k.y1 = m_height - guardBandSize;
+
+    // The taps read the MIP chain of one layer in deinterleaved mode
+    const int* levelOffset = m_deinterleaved ? m_layerLevelOffset : m_cszLevelOffset;
+    const int* levelStride = m_deinterleaved ? m_layerLevelStride : m_cszLevelStride;
+    const int* levelWidth  = m_deinterleaved ? m_layerLevelWidth  : m_cszLevelWidth;
+    const int* levelHeight = m_deinterleaved ? m_layerLevelHeight : m_cszLevelHeight;
+    for (int i = 0; i < 8; ++i) {
+        const int level = std::min(i, int(MAX_MIP_LEVEL));
+        k.levelOffset[i] = levelOffset[level];
+        k.levelStride[i] = levelStride[level];
+        k.levelMaxX[i]   = levelWidth[level] - 1;
+        k.levelMaxY[i]   = levelHeight[level] - 1;
+    }
+
+    // All taps, or one subset of them per frame in temporal mode
+    const QualityParameters preset = qualityParameters(m_quality);
+    const float intensityScale = m_settings.intensity / std::pow(m_settings.radius, 6.0f);
+    int firstTap = 0, tapStride = 1, tapCount = preset.numSamples;
+    k.frameSpin = 0.0f;
+    k.minAO     = m_temporal ? -std::numeric_limits<float>::infinity() : 0.0f;
+    if (m_temporal) {
+        temporalTaps(preset.numSamples, m_frameIndex, m_temporalTapsPerFrame, firstTap, tapStride, tapCount, k.frameSpin);
+    }
+    k.taps.scale = intensityScale * ((5.0f / float(preset.numSamples)) * tapStride);
+    for (int j = 0; j < tapCount; ++j) {
+        k.taps.append(preset, firstTap + j * tapStride);
+    }
+
+    // Evenly spaced subsets of the spiral for every tap count that a tile can take
+    k.adaptive     = m_adaptiveSampling && ! m_temporal;
+    k.minTaps      = std::min(m_adaptiveMinTaps, preset.numSamples);
+    k.maxTaps      = std::min(m_adaptiveMaxTaps, preset.numSamples);
+    k.pixelsPerTap = m_adaptivePixelsPerTap;
+    if (k.adaptive) {
+        for (int n = k.minTaps; n <= k.maxTaps; ++n) {
+            RawAOTaps& taps = k.adaptiveTaps[n];
+            taps.scale = intensityScale * (5.0f / float(n));
+            for (int j = 0; j < n; ++j) {
+                taps.append(preset, adaptiveTapIndex(j, n, preset.numSamples));
+            }
+        }
+    }
+
+    for (int i = 0; i < LAYER_COUNT; ++i) {
+        k.layerSpin[i] = float(layerRotation[i]) * (6.2831853f / LAYER_COUNT);
+    }
+    k.skipSky = m_depthTileSkipping;
+
+    // Tiles are aligned to whole SIMD vectors in x and whole quads in y so that they never share a store.
+    // In deinterleaved mode, each layer is tiled in its own coordinates over the pixels inside the guard band.
+    const int tileSize = roundUp(std::max(m_tileSize, WIDTH), WIDTH);
+    const int layers   = m_deinterleaved ? LAYER_COUNT : 1;
+    m_tileTiming.clear();
+    for (int layer = 0; layer < layers; ++layer) {
+        int x0 = k.x0, y0 = k.y0, x1 = k.x1, y1 = k.y1;
+        if (m_deinterleaved) {
+            const int layerX = layer % DEINTERLEAVE, layerY = layer / DEINTERLEAVE;
+            x0 = std::max(0, x0 - layerX + DEINTERLEAVE - 1) / DEINTERLEAVE;
+            y0 = std::max(0, y0 - layerY + DEINTERLEAVE - 1) / DEINTERLEAVE;
+            x1 = (x1 - layerX + DEINTERLEAVE - 1) / DEINTERLEAVE;
+            y1 = (y1 - layerY + DEINTERLEAVE - 1) / DEINTERLEAVE;
+        }
+
+        const int qx0 = (x0 / WIDTH) * WIDTH;
+        const int qy0 = y0 & ~1;
+        const int tilesX = (x1 - qx0 + tileSize - 1) / tileSize;
+        const int tilesY = (y1 - qy0 + tileSize - 1) / tileSize;
+
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                TileTiming t;
+                t.layer = m_deinterleaved ? layer : -1;
+                t.x0 = qx0 + tx * tileSize;
+                t.y0 = qy0 + ty * tileSize;
+                t.x1 = std::min(t.x0 + tileSize, x1);
+                t.y1 = std::min(t.y0 + tileSize, y1);
+                t.worker = 0;
+                t.milliseconds = 0;
+                t.shadedPixels = 0;
+                t.taps = 0;
+                t.skipped = false;
+                m_tileTiming.push_back(t);
+            }
+        }
+    }
+
+    PassJob job;
+    job.items = int(m_tileTiming.size());
+    switch (m_quality) {
+    case LOW_QUALITY:    job.run = rawAOTileTask<SAOPreset<LOW_QUALITY> >(constants);    break;
+    case MEDIUM_QUALITY: job.run = rawAOTileTask<SAOPreset<MEDIUM_QUALITY> >(constants); break;
+    case ULTRA_QUALITY:  job.run = rawAOTileTask<SAOPreset<ULTRA_QUALITY> >(constants);  break;
+    default:             job.run = rawAOTileTask<SAOPreset<HIGH_QUALITY> >(constants);   break;
+    }
+    job.finish = [this]() {
+        m_tileSteals = threadPool().stealCount();
+        m_depthTileStatistics.rawAOTiles = int(m_tileTiming.size());
+        for (size_t i = 0; i < m_tileTiming.size(); ++i) {
+            m_depthTileStatistics.skippedRawAOTiles += m_tileTiming[i].skipped ? 1 : 0;
+        }
+    };
+    return job;
+}
+
+
+template<class Preset>
+std::function<void (int, int)> SAOCPU::rawAOTileTask(const std::shared_ptr<const RawAOConstants>& constants) {
+    return [this, constants](int index, int worker) {
+        typedef std::chrono::high_resolution_clock Clock;
+        const RawAOConstants& k = *constants;
+        TileTiming& t = m_tileTiming[index];
+        const Clock::time_point start = Clock::now();
+        if (m_deinterleaved) {
+            computeRawAOTile<Preset, false, true>(k, t);
+        } else if (m_cszBufferLayout == SWIZZLED_LAYOUT) {
+            computeRawAOTile<Preset, true, false>(k, t);
+        } else {
+            computeRawAOTile<Preset, false, false>(k, t);
+        }
+        t.worker = worker;
+        t.milliseconds = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+    };
+}
+
+
+template<class Preset, bool swizzled, bool deinterleaved>
+void SAOCPU::computeRawAOTile(const RawAOConstants& k, TileTiming& tile) {
+    const int    layer = tile.layer;
+    const int    tx0 = tile.x0, ty0 = tile.y0, tx1 = tile.x1, ty1 = tile.y1;
+
+    // In deinterleaved mode the tile is in the coordinates of one layer, whose pixel (gx, gy) is
+    // screen pixel (gx * DEINTERLEAVE + layerX, gy * DEINTERLEAVE + layerY).  Otherwise g = ssC.
+    const int    layerX  = deinterleaved ? layer % DEINTERLEAVE : 0;
+    const int    layerY  = deinterleaved ? layer / DEINTERLEAVE : 0;
+    const float* csz     = deinterleaved ? &m_layerCSZBuffer[layer * m_layerSize] : &m_cszBuffer[0];
+    const int    stride0 = deinterleaved ? m_layerLevelStride[0] : m_cszLevelStride[0];
+    float*       aoOut   = deinterleaved ? &m_layerAOBuffer[layer * m_layerPlaneSize]  : &m_rawAOBuffer[m_planeOrigin];
+    float*       keyOut  = deinterleaved ? &m_layerKeyBuffer[layer * m_layerPlaneSize] : &m_keyBuffer[m_planeOrigin];
+    const int    outStride = deinterleaved ? stride0 : m_planeStride;
+    const int    width   = m_width;
+    const int    height  = m_height;
+    const float* depthBuffer = k.depthBuffer;
+    const float  projScale = k.projScale;
+    const float  radius  = m_settings.radius;
+    const int    x0 = k.x0, x1 = k.x1, y0 = k.y0, y1 = k.y1;
+
+    // A tile whose pixels are all sky is white, as the depth test leaves it on the GPU
+    if (k.skipSky) {
+        const TexelRect screen = deinterleaved ?
+            TexelRect(tx0 * DEINTERLEAVE + layerX, ty0 * DEINTERLEAVE + layerY, (tx1 - 1) * DEINTERLEAVE + layerX + 1, (ty1 - 1) * DEINTERLEAVE + layerY + 1) :
+            TexelRect(tx0, ty0, tx1, ty1);
+        if (depthTileBounds(screen).allSky()) {
+            for (int gy = ty0; gy < ty1; ++gy) {
+                const int y = deinterleaved ? gy * DEINTERLEAVE + layerY : gy;
+                for (int gx = tx0; (gx < tx1) && (y >= y0) && (y < y1); ++gx) {
+                    const int x = deinterleaved ? gx * DEINTERLEAVE + layerX : gx;
+                    if ((x >= x0) && (x < x1)) {
+                        aoOut[gy * outStride + gx]  = 1.0f;
+                        keyOut[gy * outStride + gx] = 1.0f;
+                    }
+                }
+            }
+            tile.skipped = true;
+            return;
+        }
+    }
+
+    const Table8 levelOffset = loadTable8(k.levelOffset);
+    const Table8 levelStride = loadTable8(k.levelStride);
+    const Table8 levelMaxX   = loadTable8(k.levelMaxX);
+    const Table8 levelMaxY   = loadTable8(k.levelMaxY);
+
+    const Float projX(k.projInfo[0]), projY(k.projInfo[1]), projZ(k.projInfo[2]), projW(k.projInfo[3]);
+    const Float half(0.5f), zero(0.0f), one(1.0f);
+    const Float noLanes = zero < zero;
+    const Float farZ(-std::numeric_limits<float>::infinity());
+    const float diskScale = -projScale * radius;
+
+    // Per-lane counts of shaded pixels and their taps
+    Float shadedLanes(0.0f), tapLanes(0.0f);
+    const Int   laneXi = Int::laneIndex();
+
+    // ddx sign and (ssC.x & 1) - 0.5 for each lane; vectors always start at an even x
+    float signXArray[WIDTH], parityXArray[WIDTH];
+    for (int i = 0; i < WIDTH; ++i) {
+        signXArray[i]   = (i & 1) ? -1.0f : 1.0f;
+        parityXArray[i] = (i & 1) ? 0.5f : -0.5f;
+    }
+    const Float signX = Float::load(signXArray);
+    const Float parityX = Float::load(parityXArray);
+
+    // Process 2 x WIDTH blocks so that the quad derivatives are available in registers.
+    for (int qy = ty0; qy < ty1; qy += 2) {
+        for (int qx = tx0; qx < tx1; qx += WIDTH) {
+
+            const Int   gCx  = Int(qx) + laneXi;
+            const Int   ssCx = deinterleaved ? Int(qx * DEINTERLEAVE + layerX) + laneXi * Int(DEINTERLEAVE) : gCx;
+            const Float ssX  = toFloat(ssCx);
+            const Float inX  = (Float(float(x0)) <= ssX) & (ssX < Float(float(x1)));
+
+            Float C_x[2], C_y[2], C_z[2], active[2], sky[2], live[2];
+            for (int r = 0; r < 2; ++r) {
+                const int gy = qy + r;
+                const int y  = deinterleaved ? gy * DEINTERLEAVE + layerY : gy;
+                if (swizzled) {
+                    const Int index = levelIndex<true>(Int(0), Int(stride0), gCx, Int(gy));
+                    TRACE_CSZ_READS(csz, index);
+                    C_z[r] = gather(csz, index);
+                } else {
+                    TRACE_CSZ_READS(csz, Int(gy * stride0 + qx) + laneXi);
+                    C_z[r] = Float::load(csz + gy * stride0 + qx);
+                }
+                C_x[r] = madd(ssX + half, projX, projZ) * C_z[r];
+                C_y[r] = madd(Float(float(y) + 0.5f), projY, projW) * C_z[r];
+
+                // Sky test: the depth test against Z_COORD in SAO::computeRawAO
+                Float depth;
+                if (! deinterleaved && (y < height) && (qx + WIDTH <= width)) {
+                    depth = Float::load(depthBuffer + y * width + qx);
+                } else {
+                    float temp[WIDTH];
+                    for (int i = 0; i < WIDTH; ++i) {
+                        const int x = deinterleaved ? (qx + i) * DEINTERLEAVE + layerX : qx + i;
+                        temp[i] = ((y < height) && (x < width)) ? depthBuffer[y * width + x] : 1.0f;
+                    }
+                    depth = Float::load(temp);
+                }
+                sky[r] = depth >= one;
+                const bool inY = (y >= y0) && (y < y1);
+                active[r] = inY ? inX : noLanes;
+                live[r] = select(sky[r], noLanes, active[r]);
+            }
+
+            // Vectors that are entirely sky are rejected by the depth test before shading on the GPU
+            Float A[2] = {one, one};
+            if (any(live[0] | live[1])) {
+                // In adaptive mode, the taps of the nearest live pixel for the whole block
+                const RawAOTaps* blockTaps = &k.taps;
+                if (k.adaptive) {
+                    float z[WIDTH];
+                    max(select(live[0], C_z[0], farZ), select(live[1], C_z[1], farZ)).store(z);
+                    const float nearestZ = *std::max_element(z, z + WIDTH);
+                    blockTaps = &k.adaptiveTaps[adaptiveTapCount(diskScale / nearestZ, k.minTaps, k.maxTaps, k.pixelsPerTap)];
+                }
+                const RawAOTaps& taps = *blockTaps;
+
+                const Float shaded = select(live[0], one, zero) + select(live[1], one, zero);
+                shadedLanes = shadedLanes + shaded;
+                tapLanes    = madd(shaded, Float(float(taps.count)), tapLanes);
+
+                Float dx_zAbs[2];
+
+                // ddy is shared by both rows of the quad
+                const Float dy_x = C_x[1] - C_x[0], dy_y = C_y[1] - C_y[0], dy_z = C_z[1] - C_z[0];
+
+                // Sky and guard band lanes are evaluated like GPU helper pixels because
+                // their quad partners read them through ddx/ddy
+                for (int r = 0; r < 2; ++r) {
+                    const int gy = qy + r;
+                    const int y  = deinterleaved ? gy * DEINTERLEAVE + layerY : gy;
+
+                    // reconstructCSFaceNormal: normalize(cross(ddy(C), ddx(C)))
+                    const Float dx_x = (C_x[r].swapPairs() - C_x[r]) * signX;
+                    const Float dx_y = (C_y[r].swapPairs() - C_y[r]) * signX;
+                    const Float dx_z = (C_z[r].swapPairs() - C_z[r]) * signX;
+                    dx_zAbs[r] = abs(dx_z);
+
+                    Float n_x = dy_y * dx_z - dy_z * dx_y;
+                    Float n_y = dy_z * dx_x - dy_x * dx_z;
+                    Float n_z = dy_x * dx_y - dy_y * dx_x;
+                    const Float invLen = one / sqrt(madd(n_x, n_x, madd(n_y, n_y, n_z * n_z)));
+                    n_x = n_x * invLen; n_y = n_y * invLen; n_z = n_z * invLen;
+
+                    // Hash function used in the HPG12 AlchemyAO paper, or one rotation per layer
+                    const Int ssCy(y);
+                    const Float spin = Float(k.frameSpin) + (deinterleaved ? Float(k.layerSpin[layer]) :
+                        reduceAngle(toFloat(((Int(3) * ssCx) ^ (ssCy + ssCx * ssCy)) * Int(10))));
+
+                    const Float ssDiskRadius = Float(-projScale * radius) / C_z[r];
+
+                    // Every tap is rotated by the same angle, so the trig is per pixel rather than per tap
+                    Float sinSpin, cosSpin;
+                    sincos(spin, sinSpin, cosSpin);
+                    const Float negSinSpin = zero - sinSpin;
+
+                    // Unrolled over the preset's NUM_SAMPLES; temporal and adaptive modes take only the first taps.count
+                    Float sum(0.0f);
+                    auto sampleAO = [&](int i) {
+                        if (i >= taps.count) {
+                            return;
+                        }
+                        // tapLocation: the table offset rotated by spin
+                        const Float tapX(taps.x[i]), tapY(taps.y[i]);
+                        const Float unitX = madd(tapX, cosSpin, tapY * negSinSpin);
+                        const Float unitY = madd(tapX, sinSpin, tapY * cosSpin);
+                        const Float ssR = Float(taps.radius[i]) * ssDiskRadius;
+
+                        // getOffsetPosition.  A layer tap moves 1/DEINTERLEAVE as many layer pixels, and
+                        // the MIP level is chosen for that distance.
+                        const Float gR = deinterleaved ? ssR * Float(1.0f / DEINTERLEAVE) : ssR;
+                        const Int mipLevel = clamp(floorLog2(gR) - Int(Preset::LOG_MAX_OFFSET), Int(0), Int(MAX_MIP_LEVEL));
+                        const Int gPx = truncate(gR * unitX) + gCx;
+                        const Int gPy = truncate(gR * unitY) + Int(gy);
+                        const Int ssPx = deinterleaved ? gPx * Int(DEINTERLEAVE) + Int(layerX) : gPx;
+                        const Int ssPy = deinterleaved ? gPy * Int(DEINTERLEAVE) + Int(layerY) : gPy;
+
+                        // gP >> mipLevel, using an exact power-of-two multiply because SSE has no per-lane shift
+                        const Float mipScale = asFloat(shiftLeft<23>(Int(127) - mipLevel));
+                        const Int mipPx = clamp(truncate(floor(toFloat(gPx) * mipScale)), Int(0), lookup8(levelMaxX, mipLevel));
+                        const Int mipPy = clamp(truncate(floor(toFloat(gPy) * mipScale)), Int(0), lookup8(levelMaxY, mipLevel));
+                        const Int   index = levelIndex<swizzled>(lookup8(levelOffset, mipLevel), lookup8(levelStride, mipLevel), mipPx, mipPy);
+                        TRACE_CSZ_READS(csz, index);
+                        const Float Qz = gather(csz, index);
+
+                        const Float Qx = madd(toFloat(ssPx) + half, projX, projZ) * Qz;
+                        const Float Qy = madd(toFloat(ssPy) + half, projY, projW) * Qz;
+
+                        // sampleAO, falloff function B
+                        const Float vx = Qx - C_x[r], vy = Qy - C_y[r], vz = Qz - C_z[r];
+                        const Float vv = madd(vx, vx, madd(vy, vy, vz * vz));
+                        const Float vn = madd(vx, n_x, madd(vy, n_y, vz * n_z));
+                        const Float f = max(Float(k.radius2) - vv, zero);
+                        sum = madd(f * f * f, max((vn - Float(m_settings.bias)) / (Float(0.01f) + vv), zero), sum);
+                    };
+                    Unroll<0, Preset::NUM_SAMPLES>::run(sampleAO);
+
+                    A[r] = max(one - sum * Float(taps.scale), Float(k.minAO));
+                }
+
+                // Bilateral box-filter over a quad for free, respecting depth edges
+                for (int r = 0; r < 2; ++r) {
+                    const Float ddxA = (A[r].swapPairs() - A[r]) * signX;
+                    A[r] = select(dx_zAbs[r] < Float(0.02f), A[r] - ddxA * parityX, A[r]);
+                }
+                const Float ddyA = A[1] - A[0];
+                const Float smoothY = abs(dy_z) < Float(0.02f);
+                A[0] = select(smoothY, A[0] + ddyA * half, A[0]);
+                A[1] = select(smoothY, A[1] - ddyA * half, A[1]);
+            }
+
+            for (int r = 0; r < 2; ++r) {
+                if (! any(active[r])) {
+                    continue;
+                }
+                const int index = (qy + r) * outStride + qx;
+
+                // Raw AO is white where the depth test failed
+                const Float visibility = select(sky[r], one, A[r]);
+                const Float key = select(sky[r], one, clamp(C_z[r] * Float(1.0f / FAR_PLANE_Z), zero, one) * Float(256.0f / 257.0f));
+
+                select(active[r], visibility, Float::load(aoOut + index)).store(aoOut + index);
+                select(active[r], key,        Float::load(keyOut + index)).store(keyOut + index);
+            }
+        }
+    }
+
+    tile.shadedPixels = 0;
+    tile.taps         = 0;
+    for (int i = 0; i < WIDTH; ++i) {
+        tile.shadedPixels += int(shadedLanes.lane(i));
+        tile.taps         += (long long)tapLanes.lane(i);
+    }
+}
+
+
+void SAOCPU::resolveTemporal(const float projInfo[4], int guardBandSize) {
+    typedef std::chrono::high_resolution_clock Clock;
+    const Clock::time_point start = Clock::now();
+
+    const int width  = m_width;
+    const int height = m_height;
+    const int x0 = guardBandSize, x1 = width - guardBandSize;
+    const int y0 = guardBandSize, y1 = height - guardBandSize;
+
+    if (m_historyAO[0].empty()) {
+        m_historyStride = roundUp(width, WIDTH);
+        for (int i = 0; i < 2; ++i) {
+            m_historyAO[i].assign(m_historyStride * height, 1.0f);
+            m_historyCount[i].assign(m_historyStride * height, 0.0f);
+            m_historyZ[i].assign(m_historyStride * height, 0.0f);
+        }
+        m_historyValid = false;
+    }
+
+    const int previous = m_historyIndex;
+    const int current  = previous ^ 1;
+    if (! m_historyValid) {
+        std::fill(m_historyCount[previous].begin(), m_historyCount[previous].end(), 0.0f);
+    }
+
+    // currentToPrevious = inverse(previousCameraToWorld) * cameraToWorld, for a general affine previous matrix
+    float M[12];
+    {
+        const float* p = m_previousCameraToWorld;
+        const float* c = m_cameraToWorld;
+        double inv[9] = {
+            double(p[5]) * p[10] - double(p[6]) * p[9],  double(p[2]) * p[9] - double(p[1]) * p[10], double(p[1]) * p[6] - double(p[2]) * p[5],
+            double(p[6]) * p[8]  - double(p[4]) * p[10], double(p[0]) * p[10] - double(p[2]) * p[8], double(p[2]) * p[4] - double(p[0]) * p[6],
+            double(p[4]) * p[9]  - double(p[5]) * p[8],  double(p[1]) * p[8] - double(p[0]) * p[9],  double(p[0]) * p[5] - double(p[1]) * p[4]};
+        const double det = double(p[0]) * inv[0] + double(p[1]) * inv[3] + double(p[2]) * inv[6];
+        assert(det != 0.0);
+        for (int i = 0; i < 9; ++i) {
+            inv[i] /= det;
+        }
+        for (int r = 0; r < 3; ++r) {
+            for (int col = 0; col < 4; ++col) {
+                double v = 0.0;
+                for (int j = 0; j < 3; ++j) {
+                    v += inv[r * 3 + j] * ((col < 3) ? double(c[j * 4 + col]) : double(c[j * 4 + 3]) - double(p[j * 4 + 3]));
+                }
+                M[r * 4 + col] = float(v);
+            }
+        }
+    }
+
+    const Float m00(M[0]), m01(M[1]), m02(M[2]),  m03(M[3]);
+    const Float m10(M[4]), m11(M[5]), m12(M[6]),  m13(M[7]);
+    const Float m20(M[8]), m21(M[9]), m22(M[10]), m23(M[11]);
+    const Float projX(projInfo[0]), projY(projInfo[1]), projZ(projInfo[2]), projW(projInfo[3]);
+    const Float invPrevX(1.0f / m_previousProjInfo[0]), invPrevY(1.0f / m_previousProjInfo[1]);
+    const Float negPrevZ(-m_previousProjInfo[2]), negPrevW(-m_previousProjInfo[3]);
+    const Float zero(0.0f), half(0.5f), one(1.0f), tolerance(TEMPORAL_DEPTH_TOLERANCE);
+    const Float maxX(float(width - 1)), maxY(float(height - 1));
+    const Float historyLength = Float(float(m_temporalHistoryLength));
+    const Float laneX = Float::laneIndex();
+    const int   stride = m_historyStride;
+    const bool  swizzled = (m_cszBufferLayout == SWIZZLED_LAYOUT);
+
+    const float* previousAO    = &m_historyAO[previous][0];
+    const float* previousCount = &m_historyCount[previous][0];
+    const float* previousZ     = &m_historyZ[previous][0];
+    float*       currentAO     = &m_historyAO[current][0];
+    float*       currentCount  = &m_historyCount[current][0];
+    float*       currentZ      = &m_historyZ[current][0];
+
+    double     totalPixels = 0, totalRejected = 0, totalFrames = 0;
+    std::mutex totalsMutex;
+
+    parallelRows(0, height, [&](int yBegin, int yEnd) {
+        double pixels = 0, rejected = 0, frames = 0;
+        for (int y = yBegin; y < yEnd; ++y) {
+            if ((y < y0) || (y >= y1)) {
+                // Rows in the guard band have no history
+                std::fill(currentCount + y * stride, currentCount + (y + 1) * stride, 0.0f);
+                continue;
+            }
+
+            // Per-lane sums over the row
+            Float rowPixels(0.0f), rowRejected(0.0f), rowFrames(0.0f);
+
+            const Float ssY = Float(float(y) + 0.5f);
+            for (int x = 0; x < width; x += WIDTH) {
+                const int   h     = y * stride + x;
+                const int   p     = planeIndex(x, y);
+                const Float ssX   = laneX + Float(float(x));
+                const Float key   = Float::load(&m_keyBuffer[p]);
+                const Float live  = (Float(float(x0)) <= ssX) & (ssX < Float(float(x1))) & (key < one);
+
+                if (! any(live)) {
+                    // Sky and guard band
+                    zero.store(currentCount + h);
+                    continue;
+                }
+
+                const Float z     = swizzled ?
+                    gather(&m_cszBuffer[0], levelIndex<true>(Int(0), Int(m_cszLevelStride[0]), Int::laneIndex() + Int(x), Int(y))) :
+                    Float::load(&m_cszBuffer[y * m_cszLevelStride[0] + x]);
+                const Float raw   = Float::load(&m_rawAOBuffer[p]);
+
+                // Camera-space position of the pixel center in this frame and in the previous one
+                const Float Cx = madd(ssX + half, projX, projZ) * z;
+                const Float Cy = madd(ssY, projY, projW) * z;
+                const Float Px = madd(m00, Cx, madd(m01, Cy, madd(m02, z, m03)));
+                const Float Py = madd(m10, Cx, madd(m11, Cy, madd(m12, z, m13)));
+                const Float Pz = madd(m20, Cx, madd(m21, Cy, madd(m22, z, m23)));
+
+                // Previous pixel coordinates, by inverting reconstructCSPosition, relative to pixel centers
+                const Float invPz = one / Pz;
+                const Float sx = madd(Px, invPz, negPrevZ) * invPrevX - half;
+                const Float sy = madd(Py, invPz, negPrevW) * invPrevY - half;
+                const Float bx = floor(sx), by = floor(sy);
+                const Float wx = sx - bx,   wy = sy - by;
+
+                // Bilinear blend of the history texels around that point that hold the same surface
+                Float hAO(0.0f), hCount(0.0f), weight(0.0f);
+                for (int t = 0; t < 4; ++t) {
+                    const Float tx = bx + Float(float(t & 1)), ty = by + Float(float(t >> 1));
+                    const Float w  = ((t & 1) ? wx : one - wx) * ((t >> 1) ? wy : one - wy);
+
+                    // clamp() maps NaN to zero, so the gathers stay inside the history
+                    const Int   index = truncate(clamp(ty, zero, maxY)) * Int(stride) + truncate(clamp(tx, zero, maxX));
+                    const Float count = gather(previousCount, index);
+                    const Float same  = (Pz < zero) & (zero <= tx) & (tx <= maxX) & (zero <= ty) & (ty <= maxY) &
+                        (zero < count) & (abs(gather(previousZ, index) - Pz) <= tolerance * abs(Pz));
+                    const Float wt = w & same;
+                    hAO    = madd(wt, gather(previousAO, index), hAO);
+                    hCount = madd(wt, count, hCount);
+                    weight = weight + wt;
+                }
+
+                const Float valid = live & (zero < weight);
+                hAO    = hAO / weight;
+                hCount = hCount / weight;
+                const Float n     = select(valid, min(hCount + one, historyLength), one);
+                const Float ao    = select(valid, madd(raw - hAO, one / n, hAO), raw);
+
+                // The history keeps the unclamped average; see RawAOConstants::minAO
+                select(live, max(ao, zero), raw).store(&m_rawAOBuffer[p]);
+                ao.store(currentAO + h);
+                select(live, n, zero).store(currentCount + h);
+                z.store(currentZ + h);
+
+                rowPixels   = rowPixels + (live & one);
+                rowRejected = rowRejected + (select(valid, zero, live) & one);
+                rowFrames   = rowFrames + (live & n);
+            }
+
+            float lanes[3][WIDTH];
+            rowPixels.store(lanes[0]);
+            rowRejected.store(lanes[1]);
+            rowFrames.store(lanes[2]);
+            for (int i = 0; i < WIDTH; ++i) {
+                pixels   += lanes[0][i];
+                rejected += lanes[1][i];
+                frames   += lanes[2][i];
+            }
+        }
+        std::lock_guard<std::mutex> lock(totalsMutex);
+        totalPixels   += pixels;
+        totalRejected += rejected;
+        totalFrames   += frames;
+    });
+
+    // Mean taps per frame over one cycle of the tap subsets
+    const int numSamples = qualityParameters(m_quality).numSamples;
+    int firstTap, tapStride, tapCount;
+    float spin;
+    temporalTaps(numSamples, m_frameIndex, m_temporalTapsPerFrame, firstTap, tapStride, tapCount, spin);
+    const float tapsPerFrame = float(numSamples) / float(tapStride);
+
+    m_temporalStatistics.taps = tapCount;
+    m_temporalStatistics.effectiveSamplesPerPixel = (totalPixels > 0) ? tapsPerFrame * float(totalFrames) / float(totalPixels) : 0.0f;
+    m_temporalStatistics.rejectedFraction = (totalPixels > 0) ? float(totalRejected) / float(totalPixels) : 0.0f;
+
+    std::copy(m_cameraToWorld, m_cameraToWorld + 12, m_previousCameraToWorld);
+    std::copy(projInfo, projInfo + 4, m_previousProjInfo);
+    m_historyIndex = current;
+    m_historyValid = true;
+
+    m_temporalStatistics.milliseconds = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+/** One bilateral blur tap set along a row or column.  \a valueStep and \a keyStep are the distances in floats
+    between taps, which differ when the values come from a scratch block and the keys from m_keyBuffer.
+    When \a flat, the keys are known to be equal and not sky, and are not read. */
+template<class Preset, bool flat>
+static SAO_FORCEINLINE Float blurKernel(const float* value, int valueStep, const float* key, int keyStep) {
+    enum {R = Preset::R, SCALE = Preset::SCALE};
+    const float* gaussian = Preset::gaussian();
+
+    const Float centerValue = Float::load(value);
+    const Float centerKey   = flat ? Float(0.0f) : Float::load(key);
+
+    Float totalWeight(gaussian[0]);
+    Float sum = centerValue * totalWeight;
+
+    for (int r = -R; r <= R; ++r) {
+        if (r != 0) {
+            const Float tapValue = Float::load(value + r * SCALE * valueStep);
+
+            // spatial domain: offset gaussian tap, range domain: bilateral weight, which is 1 between equal keys
+            Float weight(0.3f + gaussian[(r < 0) ? -r : r]);
+            if (! flat) {
+                const Float tapKey = Float::load(key + r * SCALE * keyStep);
+                weight = weight * max(Float(1.0f) - Float(EDGE_SHARPNESS * 2000.0f) * abs(tapKey - centerKey), Float(0.0f));
+            }
+
+            sum = madd(tapValue, weight, sum);
+            totalWeight = totalWeight + weight;
+        }
+    }
+
+    // Sky pixels pass through unblurred
+    return flat ? sum / (totalWeight + Float(0.0001f)) : select(centerKey == Float(1.0f), centerValue, sum / (totalWeight + Float(0.0001f)));
+}
+
+
+void SAOCPU::blur(float* result, int guardBandSize) {
+    typedef std::chrono::high_resolution_clock Clock;
+    const Clock::time_point start = Clock::now();
+
+    beginBlur();
+
+    switch (m_quality) {
+    case LOW_QUALITY:    blurPasses<SAOPreset<LOW_QUALITY> >(result, guardBandSize);    break;
+    case MEDIUM_QUALITY: blurPasses<SAOPreset<MEDIUM_QUALITY> >(result, guardBandSize); break;
+    case ULTRA_QUALITY:  blurPasses<SAOPreset<ULTRA_QUALITY> >(result, guardBandSize);  break;
+    default:             blurPasses<SAOPreset<HIGH_QUALITY> >(result, guardBandSize);   break;
+    }
+
+    endBlur(start);
+}
+
+
+void SAOCPU::beginBlur() {
+    m_blurBytesRead = 0;
+    m_blurBytesWritten = 0;
+
+    if (! m_fusedBlur && (m_hBlurredBuffer.size() != m_rawAOBuffer.size())) {
+        // Allocated on first use in two-pass mode, white inside the frame like the cleared GPU buffer
+        m_hBlurredBuffer.assign(m_rawAOBuffer.size(), 0.0f);
+        for (int y = 0; y < m_height; ++y) {
+            std::fill(&m_hBlurredBuffer[planeIndex(0, y)], &m_hBlurredBuffer[planeIndex(0, y)] + m_width, 1.0f);
+        }
+    }
+
+}
+
+
+void SAOCPU::endBlur(std::chrono::high_resolution_clock::time_point start) {
+    typedef std::chrono::high_resolution_clock Clock;
+    m_blurStatistics.fused        = m_fusedBlur;
+    m_blurStatistics.pixels       = m_width * m_height;
+    m_blurStatistics.bytesRead    = m_blurBytesRead;
+    m_blurStatistics.bytesWritten = m_blurBytesWritten;
+    m_blurStatistics.milliseconds = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+template<class Preset>
+void SAOCPU::blurPasses(float* result, int guardBandSize) {
+    typedef std::chrono::high_resolution_clock Clock;
+    const Clock::time_point start = Clock::now();
+
+    // The guard band of the result is filled with white unless guardBandCulling() is true
+    const long long interior = (long long)(m_width - 2 * guardBandSize) * (m_height - 2 * guardBandSize);
+    const long long written  = m_guardBandCulling ? interior : (long long)m_width * m_height;
+
+    if (m_fusedBlur) {
+        runJob(blurFusedJob<Preset>(result, guardBandSize));
+        recordPass("blur fused", start, written, m_blurBytesRead, m_blurBytesWritten);
+    } else {
+        blurHorizontal<Preset>(guardBandSize);
+        recordPass("blur horizontal", start, interior, m_blurBytesRead, m_blurBytesWritten);
+
+        const long long bytesRead = m_blurBytesRead, bytesWritten = m_blurBytesWritten;
+        const Clock::time_point verticalStart = Clock::now();
+        blurVertical<Preset>(result, guardBandSize);
+        recordPass("blur vertical", verticalStart, written, m_blurBytesRead - bytesRead, m_blurBytesWritten - bytesWritten);
+    }
+}
+
+
+template<class Preset>
+void SAOCPU::blurHorizontal(int guardBandSize) {
+    const int x0 = guardBandSize, x1 = m_width - guardBandSize;
+    const int pad = Preset::R * Preset::SCALE;
+    const Float laneX = Float::laneIndex();
+
+    // Each row reads its span of value and key plus the halo, and read-modify-writes m_hBlurredBuffer
+    const long long spanFloats = roundUp(x1 - x0, WIDTH);
+    m_blurBytesRead    += (m_height - 2 * guardBandSize) * ((spanFloats + 2 * pad) * 2 + spanFloats) * sizeof(float);
+    m_blurBytesWritten += (m_height - 2 * guardBandSize) * spanFloats * sizeof(float);
+
+    parallelRows(guardBandSize, m_height - guardBandSize, [&](int yBegin, int yEnd) {
+        for (int y = yBegin; y < yEnd; ++y) {
+            for (int x = x0; x < x1; x += WIDTH) {
+                const int index = planeIndex(x, y);
+                const Float blurred = blurKernel<Preset, false>(&m_rawAOBuffer[index], 1, &m_keyBuffer[index], 1);
+                const Float inside = (laneX + Float(float(x))) < Float(float(x1));
+                select(inside, blurred, Float::load(&m_hBlurredBuffer[index])).store(&m_hBlurredBuffer[index]);
+            }
+        }
+    });
+}
+
+
+template<class Preset>
+void SAOCPU::blurVertical(float* result, int guardBandSize) {
+    const int width  = m_width;
+    const int height = m_height;
+    const int x0 = guardBandSize, x1 = width - guardBandSize;
+    const int pad = Preset::R * Preset::SCALE;
+
+    // Each band reads its rows of value and key plus the halo, and every output pixel is written once
+    const long long spanFloats = roundUp(x1 - x0, WIDTH);
+    const int bands = std::min(height, threadPool().size() * 4);
+    m_blurBytesRead    += ((long long)(height - 2 * guardBandSize) + (long long)bands * 2 * pad) * spanFloats * 2 * sizeof(float);
+    // With guard band culling, only the pixels inside the guard band are written
+    const bool fillGuardBand = ! m_guardBandCulling;
+    m_blurBytesWritten += fillGuardBand ? (long long)width * height * sizeof(float) : (long long)(x1 - x0) * (height - 2 * guardBandSize) * sizeof(float);
+
+    parallelRows(fillGuardBand ? 0 : guardBandSize, fillGuardBand ? height : height - guardBandSize, [&](int yBegin, int yEnd) {
+        for (int y = yBegin; y < yEnd; ++y) {
+            float* dst = result + y * width;
+            if ((y < guardBandSize) || (y >= height - guardBandSize)) {
+                std::fill(dst, dst + width, 1.0f);
+                continue;
+            }
+
+            if (fillGuardBand) {
+                std::fill(dst, dst + x0, 1.0f);
+                std::fill(dst + x1, dst + width, 1.0f);
+            }
+
+            int x = x0;
+            for (; x + WIDTH <= x1; x += WIDTH) {
+                const int index = planeIndex(x, y);
+                blurKernel<Preset, false>(&m_hBlurredBuffer[index], m_planeStride, &m_keyBuffer[index], m_planeStride).store(dst + x);
+            }
+            if (x < x1) {
+                float temp[WIDTH];
+                const int index = planeIndex(x, y);
+                blurKernel<Preset, false>(&m_hBlurredBuffer[index], m_planeStride, &m_keyBuffer[index], m_planeStride).store(temp);
+                std::copy(temp, temp + (x1 - x), dst + x);
+            }
+        }
+    });
+}
+
+
+template<class Preset>
+SAOCPU::PassJob SAOCPU::blurFusedJob(float* result, int guardBandSize) {
+    const int width  = m_width;
+    const int height = m_height;
+    const int x0 = guardBandSize, x1 = width - guardBandSize;
+    const int y0 = guardBandSize, y1 = height - guardBandSize;
+    const int pad = Preset::R * Preset::SCALE;
+
+    // Same tiling as the raw AO pass, except that x starts at the guard band because the output is unpadded
+    const int tileSize = roundUp(std::max(m_tileSize, WIDTH), WIDTH);
+    const int tileRows = tileSize * BLUR_TILE_ASPECT;
+    const int tilesX = (x1 - x0 + tileSize - 1) / tileSize;
+    const int tilesY = (y1 - y0 + tileRows - 1) / tileRows;
+
+    // Rows of the horizontally blurred tile plus pad rows of halo above and below
+    const int scratchStride = tileSize;
+    const int scratchRows   = tileRows + 2 * pad;
+    m_blurScratch.resize(threadPool().size());
+
+    // The halo rows are read from the value and key planes.  The vertical taps then
+    // hit the scratch block and the key rows that the horizontal pass just loaded.
+    for (int ty = 0; ty < tilesY; ++ty) {
+        const int rows = std::min(tileRows, y1 - (y0 + ty * tileRows));
+        for (int tx = 0; tx < tilesX; ++tx) {
+            const long long span = roundUp(std::min(tileSize, x1 - (x0 + tx * tileSize)), WIDTH);
+            m_blurBytesRead += (rows + 2 * pad) * (span + 2 * pad) * 2 * sizeof(float);
+        }
+    }
+    if (m_guardBandCulling) {
+        // The guard band of the result is left as it was
+        m_blurBytesWritten += (long long)(x1 - x0) * (y1 - y0) * sizeof(float);
+    } else {
+        m_blurBytesWritten += (long long)width * height * sizeof(float);
+
+        // Guard band rows and columns are white
+        parallelRows(0, height, [&](int yBegin, int yEnd) {
+            for (int y = yBegin; y < yEnd; ++y) {
+                float* dst = result + y * width;
+                if ((y < y0) || (y >= y1)) {
+                    std::fill(dst, dst + width, 1.0f);
+                } else {
+                    std::fill(dst, dst + x0, 1.0f);
+                    std::fill(dst + x1, dst + width, 1.0f);
+                }
+            }
+        });
+    }
+
+    // Keys that differ by this much change a bilateral weight by at most flatBlurTolerance()
+    const float flatKeyRange = m_flatBlurTolerance / (EDGE_SHARPNESS * 2000.0f);
+    const TexelRect interior(x0, y0, x1, y1);
+
+    // How each tile was blurred, for m_depthTileStatistics
+    enum {BLURRED, SKIPPED, FLAT};
+    const std::shared_ptr<std::vector<char> > outcome = std::make_shared<std::vector<char> >(tilesX * tilesY, char(BLURRED));
+
+    PassJob job;
+    job.items = tilesX * tilesY;
+    job.run = [=](int index, int worker) {
+        std::vector<float>& scratch = m_blurScratch[worker];
+        scratch.resize(scratchStride * scratchRows);
+
+        const int tx0 = x0 + (index % tilesX) * tileSize, tx1 = std::min(tx0 + tileSize, x1);
+        const int ty0 = y0 + (index / tilesX) * tileRows, ty1 = std::min(ty0 + tileRows, y1);
+
+        if (m_depthTileSkipping) {
+            // Sky pixels pass through the blur, and the raw AO of sky is white
+            if (depthTileBounds(TexelRect(tx0, ty0, tx1, ty1)).allSky()) {
+                for (int y = ty0; y < ty1; ++y) {
+                    std::fill(result + y * width + tx0, result + y * width + tx1, 1.0f);
+                }
+                (*outcome)[index] = SKIPPED;
+                return;
+            }
+
+            // The halo must be inside the guard band, where the depth tiles describe the keys
+            const TexelRect halo(tx0 - pad, ty0 - pad, tx1 + pad, ty1 + pad);
+            if ((halo.x0 >= interior.x0) && (halo.y0 >= interior.y0) && (halo.x1 <= interior.x1) && (halo.y1 <= interior.y1) &&
+                depthTileBounds(halo).flat(flatKeyRange)) {
+                blurFusedTile<Preset, true>(result, guardBandSize, scratch, tx0, ty0, tx1, ty1);
+                (*outcome)[index] = FLAT;
+                return;
+            }
+        }
+
+        blurFusedTile<Preset, false>(result, guardBandSize, scratch, tx0, ty0, tx1, ty1);
+    };
+    job.finish = [this, outcome]() {
+        m_depthTileStatistics.blurTiles        = int(outcome->size());
+        m_depthTileStatistics.skippedBlurTiles = int(std::count(outcome->begin(), outcome->end(), char(SKIPPED)));
+        m_depthTileStatistics.flatBlurTiles    = int(std::count(outcome->begin(), outcome->end(), char(FLAT)));
+    };
+    return job;
+}
+
+
+template<class Preset, bool flat>
+void SAOCPU::blurFusedTile(float* result, int guardBandSize, std::vector<float>& scratch, int tx0, int ty0, int tx1, int ty1) {
+    const int width  = m_width;
+    const int height = m_height;
+    const int y0 = guardBandSize, y1 = height - guardBandSize;
+    const int pad = Preset::R * Preset::SCALE;
+    const int scratchStride = roundUp(std::max(m_tileSize, WIDTH), WIDTH);
+
+    // Horizontal pass into the scratch block.  Rows outside of the guard band hold what the
+    // two-pass version leaves in m_hBlurredBuffer there: white inside the frame, zero outside.
+    for (int y = ty0 - pad; y < ty1 + pad; ++y) {
+        float* dst = &scratch[(y - ty0 + pad) * scratchStride];
+        if ((y < y0) || (y >= y1)) {
+            std::fill(dst, dst + scratchStride, ((y < 0) || (y >= height)) ? 0.0f : 1.0f);
+        } else {
+            for (int x = tx0; x < tx1; x += WIDTH) {
+                const int i = planeIndex(x, y);
+                blurKernel<Preset, flat>(&m_rawAOBuffer[i], 1, &m_keyBuffer[i], 1).store(dst + x - tx0);
+            }
+        }
+    }
+
+    // Vertical pass from the scratch block into the result
+    for (int y = ty0; y < ty1; ++y) {
+        const float* src = &scratch[(y - ty0 + pad) * scratchStride];
+        float*       dst = result + y * width;
+        int x = tx0;
+        for (; x + WIDTH <= tx1; x += WIDTH) {
+            const int i = planeIndex(x, y);
+            blurKernel<Preset, flat>(src + x - tx0, scratchStride, &m_keyBuffer[i], m_planeStride).store(dst + x);
+        }
+        if (x < tx1) {
+            float temp[WIDTH];
+            const int i = planeIndex(x, y);
+            blurKernel<Preset, flat>(src + x - tx0, scratchStride, &m_keyBuffer[i], m_planeStride).store(temp);
+            std::copy(temp, temp + (tx1 - x), dst + x);
+        }
+    }
+}
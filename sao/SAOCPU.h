@@ -0,0 +1,1082 @@
+/**
+ \file SAOCPU.h
+
+ CPU implementation of Scalable Ambient Obscurance for machines without a GPU.  It runs the same
+ four passes as SAO::compute (CSZ reconstruction + MIP chain, raw AO, horizontal and vertical
+ bilateral blur) as SSE4.1/AVX2 kernels; see SAOSIMD.h for how the instruction set is selected.
+
+ This file has no G3D dependency.  SAO::computeCPU() is a convenience wrapper for G3D programs.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef SAOCPU_h
+#define SAOCPU_h
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+/**
+ \brief Headless, vectorized implementation of SAO that reads a raw float depth buffer.
+
+ The math follows the reference shaders (SAO_reconstructCSZ.pix, SAO_minify, SAO_AO, SAO_blur)
+ pass for pass, including the rotated-grid minification rule of DX11shaders/SAO_minify.hlsl,
+ the 2x2 quad box filter that the shader performs with ddx/ddy, the key == 1 sky test in the blur,
+ and, when guardBandCulling() is false, white output outside of the guard band.
+
+ <h3>Tolerance versus the GPU</h3>
+
+ - CSZ levels: identical formula; agree to within 1 float ulp.
+
+ - Bilateral key: stored unpacked as a float, i.e., as unpackKey(packKey(k)) without the 8-bit
+   quantization of the fractional channel.  Differs from the GPU by at most 1/(257 * 255) per pixel.
+
+ - Raw AO: every pixel uses the same hash, tap radii, MIP selection and falloff as SAO_AO.  The
+   tap angle is reduced to [-pi, pi] in double precision before sin/cos.  GPU sin/cos of the
+   unreduced angle (up to ~10^8 radians) is implementation-defined, so individual tap directions
+   differ between GPUs and this implementation.  Expect per-pixel raw AO to match only in
+   distribution, not value.
+
+ - Final AO: the blurs run in float without the RGB8 round trip through m_hBlurredBuffer.  For
+   identical raw AO input, the output differs only by the 8-bit quantization of the GPU's
+   intermediate buffer and key.
+
+ Against a scalar, line-by-line transcription of the shaders that uses the same angle reduction,
+ the SSE4.1 and portable kernels agree to within 2.4e-7 per pixel on the final AO.  The AVX2 kernels
+ contract multiply-adds with FMA when it is available, which moves isolated pixels by up to 1e-3.
+
+ The ddx/ddy operations are evaluated as "fine" derivatives within each 2x2 quad aligned to even
+ pixel coordinates.
+
+ Depth rows are read in memory order: row 0 of \a depthBuffer is y = 0 in gl_FragCoord terms.
+
+ <h3>Threading</h3>
+
+ The raw AO pass is split into square tiles of tileSize() pixels that run on a work-stealing
+ ThreadPool of threadCount() workers.  The cost of a tile varies widely (sky tiles are nearly free,
+ while tiles close to the camera have a large sample radius that misses the cache), so idle workers
+ steal the remaining tiles of busy ones.  tileTiming() and tileStatistics() report the time of each
+ tile of the last frame and the resulting load balance.  The other passes are split into row bands
+ on the same pool.  Results do not depend on the thread count or tile size.
+
+ <h3>Example</h3>
+    \code
+    SAOCPU sao;
+    std::vector<float> ao(width * height);
+    sao.compute(depth, width, height, clipInfo, projInfo, projScale, &ao[0], guardBand);
+    \endcode
+ */
+class SAOCPU {
+public:
+
+    /** Must match MAX_MIP_LEVEL in SAO.cpp and SAO_AO.pix */
+    enum {MAX_MIP_LEVEL = 5};
+
+    /** Pixels on a side of the finest depth tiles, and the number of levels of the depth tile pyramid, each
+        with tiles twice as large as the previous one; see setDepthTileSkipping() */
+    enum {DEPTH_TILE_SIZE = 8, DEPTH_TILE_LEVELS = 4};
+
+    /** Memory layout of each MIP level of the camera-space z buffer; see setCSZLayout() */
+    enum CSZLayout {ROW_MAJOR_LAYOUT, SWIZZLED_LAYOUT};
+
+    /** Named sets of tap and blur constants; see setQuality() and SAOPresets.h */
+    enum Quality {LOW_QUALITY, MEDIUM_QUALITY, HIGH_QUALITY, ULTRA_QUALITY, QUALITY_COUNT};
+
+    /** Texels [x0, x1) x [y0, y1) of one MIP level; see cszLevelRects() */
+    class TexelRect {
+    public:
+        int                         x0;
+        int                         y0;
+        int                         x1;
+        int                         y1;
+
+        TexelRect(int ax0 = 0, int ay0 = 0, int ax1 = 0, int ay1 = 0) : x0(ax0), y0(ay0), x1(ax1), y1(ay1) {}
+
+        bool empty() const {
+            return (x1 <= x0) || (y1 <= y0);
+        }
+
+        long long area() const {
+            return empty() ? 0 : (long long)(x1 - x0) * (y1 - y0);
+        }
+
+        bool contains(int x, int y) const {
+            return (x >= x0) && (x < x1) && (y >= y0) && (y < y1);
+        }
+
+        /** Splits the texels of this rectangle that are not in \a inner, which must be empty or inside it,
+            into at most four rectangles: full-width ones above and below \a inner and ones to its left and
+            right.  Returns the number written to \a strip. */
+        int subtract(const TexelRect& inner, TexelRect strip[4]) const;
+    };
+
+    /** The constants of one Quality preset, for code that cannot use the SAOPreset templates */
+    class QualityParameters {
+    public:
+        const char*                 name;
+        int                         numSamples;
+        int                         numSpiralTurns;
+        int                         logMaxOffset;
+
+        /** Blur taps on each side of the center */
+        int                         blurRadius;
+
+        /** Pixels between blur taps */
+        int                         blurScale;
+
+        /** blurRadius + 1 spatial blur weights, center first */
+        const float*                gaussian;
+
+        /** numSamples radii and unrotated unit offsets of the spiral taps; see SAOSpiral */
+        const float*                spiralRadius;
+        const float*                spiralX;
+        const float*                spiralY;
+    };
+
+    class Settings {
+    public:
+        /** Radius in world-space units */
+        float                       radius;
+
+        /** \copydoc SAO::Settings::bias */
+        float                       bias;
+
+        float                       intensity;
+
+        Settings();
+    };
+
+    /** Execution record of one raw AO tile, covering pixels [x0, x1) x [y0, y1) */
+    class TileTiming {
+    public:
+        /** In deinterleaved mode, the layer (x % 4) + 4 (y % 4) whose coordinates x0...y1 are in; otherwise -1 */
+        int                         layer;
+
+        int                         x0;
+        int                         y0;
+        int                         x1;
+        int                         y1;
+
+        /** ThreadPool worker that ran the tile */
+        int                         worker;
+
+        float                       milliseconds;
+
+        /** Pixels of the tile inside the guard band that are not sky, and the spiral taps that they took in
+            all, which is less than shadedPixels times NUM_SAMPLES when adaptiveSampling() is true */
+        int                         shadedPixels;
+        long long                   taps;
+
+        /** True if the depth tiles showed every pixel of the tile to be sky, so that it was filled with white
+            without loading its depth; see setDepthTileSkipping() */
+        bool                        skipped;
+    };
+
+    /** Load balance of the raw AO pass over the tiles of the last frame */
+    class TileStatistics {
+    public:
+        /** Sum of all tile times */
+        float                       totalMilliseconds;
+
+        /** Busy time of the slowest worker, which bounds the wall-clock time of the pass */
+        float                       maxWorkerMilliseconds;
+
+        float                       meanWorkerMilliseconds;
+
+        float                       maxTileMilliseconds;
+
+        /** Tiles that ran on a worker other than the one they were dealt to */
+        int                         steals;
+
+        TileStatistics() : totalMilliseconds(0), maxWorkerMilliseconds(0), meanWorkerMilliseconds(0), maxTileMilliseconds(0), steals(0) {}
+
+        /** maxWorkerMilliseconds / meanWorkerMilliseconds; 1.0 is perfectly balanced */
+        float imbalance() const {
+            return (meanWorkerMilliseconds > 0) ? maxWorkerMilliseconds / meanWorkerMilliseconds : 1.0f;
+        }
+    };
+
+    /** Time and memory traffic of CSZ reconstruction and the MIP chain for the last frame.  Reads of a
+        level that the previous step has just written and that are still in cache are not counted. */
+    class CSZStatistics {
+    public:
+        bool                        singleSweep;
+        int                         pixels;
+
+        /** Texels written to all levels, which is less than the size of the MIP chain when guardBandCulling() is true */
+        long long                   texels;
+
+        /** Of texels, those above level 0 that were reconstructed from the depth buffer because their source
+            texel in the finer level was culled; see cszLevelRects() */
+        long long                   reconstructedTexels;
+
+        long long                   bytesRead;
+        long long                   bytesWritten;
+        float                       milliseconds;
+
+        CSZStatistics() : singleSweep(false), pixels(0), texels(0), reconstructedTexels(0), bytesRead(0), bytesWritten(0), milliseconds(0) {}
+
+        float bytesPerPixel() const {
+            return (pixels > 0) ? float(bytesRead + bytesWritten) / float(pixels) : 0.0f;
+        }
+    };
+
+    /** Memory traffic of the blur passes of the last frame.  The byte counts are the frame-sized
+        buffer memory (value, key, intermediate and result planes) that each tile or row band touches,
+        counting every cache line once per tile or band.  Traffic to the per-worker scratch block
+        is not counted because it stays in cache. */
+    class BlurStatistics {
+    public:
+        bool                        fused;
+        int                         pixels;
+        long long                   bytesRead;
+        long long                   bytesWritten;
+        float                       milliseconds;
+
+        BlurStatistics() : fused(false), pixels(0), bytesRead(0), bytesWritten(0), milliseconds(0) {}
+
+        float bytesPerPixel() const {
+            return (pixels > 0) ? float(bytesRead + bytesWritten) / float(pixels) : 0.0f;
+        }
+    };
+
+    /** Wall-clock time and frame-buffer memory traffic of one pass of the last compute(); see passTiming() */
+    class PassTiming {
+    public:
+        const char*                 name;
+
+        /** Pixels of the frame, so that bytesPerPixel() is comparable across passes */
+        int                         pixels;
+
+        /** Texels that the pass wrote, over all MIP levels or layers, which is less than pixels when it
+            skips the guard band */
+        long long                   texels;
+        long long                   bytesRead;
+        long long                   bytesWritten;
+        float                       milliseconds;
+
+        PassTiming() : name(""), pixels(0), texels(0), bytesRead(0), bytesWritten(0), milliseconds(0) {}
+
+        float bytesPerPixel() const {
+            return (pixels > 0) ? float(bytesRead + bytesWritten) / float(pixels) : 0.0f;
+        }
+    };
+
+    /** Reprojection results of the last frame in temporal mode; see setTemporal() */
+    class TemporalStatistics {
+    public:
+        /** Raw AO taps per pixel in this frame */
+        int                         taps;
+
+        /** Mean over the non-sky pixels inside the guard band of the frames in their history, times the
+            mean taps per frame over a full cycle of the tap subsets */
+        float                       effectiveSamplesPerPixel;
+
+        /** Fraction of the non-sky pixels inside the guard band whose history was discarded because it was
+            off-screen, sky, disoccluded, or reset */
+        float                       rejectedFraction;
+
+        /** Time of the reprojection pass, which runs between the raw AO pass and the blur */
+        float                       milliseconds;
+
+        TemporalStatistics() : taps(0), effectiveSamplesPerPixel(0), rejectedFraction(0), milliseconds(0) {}
+    };
+
+    /** Range of the bilateral keys (see bilateralKey()) of the pixels inside the guard band in one tile of the
+        depth tile pyramid, or in the tiles that depthTileBounds() merged.  Sky pixels have a key of 1. */
+    class DepthTile {
+    public:
+        float                       minKey;
+        float                       maxKey;
+
+        /** Covers no pixel inside the guard band */
+        DepthTile() : minKey(1.0f), maxKey(0.0f) {}
+
+        void extend(const DepthTile& t) {
+            minKey = std::min(minKey, t.minKey);
+            maxKey = std::max(maxKey, t.maxKey);
+        }
+
+        /** True if every pixel inside the guard band is sky, including when there are none */
+        bool allSky() const {
+            return minKey == 1.0f;
+        }
+
+        /** True if there is no sky and the keys differ by at most \a keyRange */
+        bool flat(float keyRange) const {
+            return (maxKey < 1.0f) && (maxKey - minKey <= keyRange);
+        }
+    };
+
+    /** What the depth tiles saved in the last frame; see setDepthTileSkipping() */
+    class DepthTileStatistics {
+    public:
+        /** Tiles of DEPTH_TILE_SIZE pixels covering the frame, and those with pixels inside the guard band that are all sky */
+        int                         tiles;
+        int                         skyTiles;
+
+        /** Raw AO tiles (tileTiming()) and those filled with white because they were all sky */
+        int                         rawAOTiles;
+        int                         skippedRawAOTiles;
+
+        /** Fused blur tiles, those filled with white because they were all sky, and those blurred without
+            reading the keys because they and their halo were flat */
+        int                         blurTiles;
+        int                         skippedBlurTiles;
+        int                         flatBlurTiles;
+
+        DepthTileStatistics() : tiles(0), skyTiles(0), rawAOTiles(0), skippedRawAOTiles(0), blurTiles(0), skippedBlurTiles(0), flatBlurTiles(0) {}
+
+        float skippedRawAOFraction() const {
+            return (rawAOTiles > 0) ? float(skippedRawAOTiles) / float(rawAOTiles) : 0.0f;
+        }
+
+        float skippedBlurFraction() const {
+            return (blurTiles > 0) ? float(skippedBlurTiles) / float(blurTiles) : 0.0f;
+        }
+
+        float flatBlurFraction() const {
+            return (blurTiles > 0) ? float(flatBlurTiles) / float(blurTiles) : 0.0f;
+        }
+    };
+
+    /** The arguments of compute() for one view of computeBatch() */
+    class View {
+    public:
+        const float*                depthBuffer;
+        int                         width;
+        int                         height;
+        float                       clipConstant[3];
+        float                       projConstant[4];
+        float                       projScale;
+        float*                      result;
+        int                         guardBandSize;
+
+        /** Row-major 3 x 4 camera-to-world matrix; see setCameraToWorld().  Default is the identity. */
+        float                       cameraToWorld[12];
+
+        View();
+    };
+
+protected:
+
+    /** One pass of compute() as \a items independent work items, so that computeBatch() can run the same pass of
+        every view in one ThreadPool::parallelFor.  run(index, worker) may be called from any worker; finish()
+        runs on the calling thread after all items. */
+    class PassJob {
+    public:
+        int                                         items;
+        std::function<void (int index, int worker)> run;
+        std::function<void ()>                      finish;
+
+        PassJob() : items(0) {}
+    };
+
+    /** Per-frame values shared by all tiles of the raw AO pass; defined in SAOCPU.cpp */
+    class RawAOConstants;
+
+    /** The spiral taps that a raw AO tile takes; defined in SAOCPU.cpp */
+    class RawAOTaps;
+
+    Settings                        m_settings;
+
+    int                             m_width;
+    int                             m_height;
+
+    /** Camera-space (negative) linear z for all MIP levels packed into one array so that the
+        AO pass can gather from different levels in different SIMD lanes.  Level i starts at
+        m_cszLevelOffset[i] and has row stride m_cszLevelStride[i]. Level 0 is padded to a
+        multiple of the SIMD width horizontally and to an even number of rows by edge replication.
+
+        In SWIZZLED_LAYOUT, every level is further padded to whole 8 x 8 blocks that are stored
+        contiguously in Z-order, and m_cszLevelStride[i] is the distance between rows of blocks.
+        Use cszIndex() to address either layout. */
+    std::vector<float>              m_cszBuffer;
+    int                             m_cszLevelOffset[MAX_MIP_LEVEL + 1];
+    int                             m_cszLevelStride[MAX_MIP_LEVEL + 1];
+    int                             m_cszLevelWidth[MAX_MIP_LEVEL + 1];
+    int                             m_cszLevelHeight[MAX_MIP_LEVEL + 1];
+
+    Quality                         m_quality;
+
+    /** Requested by setCSZLayout() */
+    CSZLayout                       m_cszLayout;
+
+    /** Layout of m_cszBuffer, which changes to m_cszLayout on the next compute() */
+    CSZLayout                       m_cszBufferLayout;
+
+    /** Layout of the padded AO planes below.  The planes have SAOPresetLimits::MAX_BLUR_PAD texels of zero
+        on every side, which is what texelFetch returns outside of the GPU texture. */
+    int                             m_planeStride;
+    int                             m_planeOrigin;
+
+    /** Has AO (R channel of m_rawAOBuffer on the GPU) */
+    std::vector<float>              m_rawAOBuffer;
+
+    /** Bilateral key: unpackKey(bilateralKey) from SAO_AO, or 1.0 for sky and the guard band */
+    std::vector<float>              m_keyBuffer;
+
+    /** Has AO after the horizontal pass.  The key is unchanged by the blur, so m_keyBuffer is shared.
+        Only allocated when fusedBlur() is false. */
+    std::vector<float>              m_hBlurredBuffer;
+
+    bool                            m_fusedBlur;
+
+    /** Horizontally blurred tile plus halo for each ThreadPool worker, used when fusedBlur() is true */
+    std::vector<std::vector<float> > m_blurScratch;
+
+    long long                       m_blurBytesRead;
+    long long                       m_blurBytesWritten;
+    BlurStatistics                  m_blurStatistics;
+
+    bool                            m_singleSweepCSZ;
+    CSZStatistics                   m_cszStatistics;
+
+    bool                            m_guardBandCulling;
+
+    /** Texels of each level that computeCSZ() writes, and the part of each level above 0 that it minifies
+        from the previous level; see cszLevelRects() */
+    TexelRect                       m_cszRect[MAX_MIP_LEVEL + 1];
+    TexelRect                       m_cszMinifiedRect[MAX_MIP_LEVEL + 1];
+
+    std::vector<PassTiming>         m_passTiming;
+
+    bool                            m_deinterleaved;
+
+    /** In deinterleaved mode, CSZ level 0 split into 4 x 4 layers of (ceil(width / 4), ceil(height / 4))
+        texels, where layer (i, j) holds pixels (4x + i, 4y + j), each followed by its own MIP chain.
+        Layer l starts at l * m_layerSize, and its levels are laid out like m_cszBuffer in ROW_MAJOR_LAYOUT.
+        Only allocated when deinterleaved() is true. */
+    std::vector<float>              m_layerCSZBuffer;
+    int                             m_layerLevelOffset[MAX_MIP_LEVEL + 1];
+    int                             m_layerLevelStride[MAX_MIP_LEVEL + 1];
+    int                             m_layerLevelWidth[MAX_MIP_LEVEL + 1];
+    int                             m_layerLevelHeight[MAX_MIP_LEVEL + 1];
+    int                             m_layerSize;
+
+    /** Raw AO and key of each layer, reinterleaved into m_rawAOBuffer and m_keyBuffer before the blur.
+        Layer l starts at l * m_layerPlaneSize and has row stride m_layerLevelStride[0]. */
+    std::vector<float>              m_layerAOBuffer;
+    std::vector<float>              m_layerKeyBuffer;
+    int                             m_layerPlaneSize;
+
+    bool                            m_temporal;
+    int                             m_temporalTapsPerFrame;
+    int                             m_temporalHistoryLength;
+
+    /** Frames computed in temporal mode, which selects the tap subset and spiral rotation */
+    int                             m_frameIndex;
+
+    /** Row-major 3 x 4 camera-to-world matrices of this and the previous frame */
+    float                           m_cameraToWorld[12];
+    float                           m_previousCameraToWorld[12];
+    float                           m_previousProjInfo[4];
+
+    /** Accumulated raw AO, number of frames accumulated (0 = none), and camera-space z of each pixel, with
+        rows of m_historyStride floats.  Index m_historyIndex is the previous frame and the other one the
+        current frame.  Only allocated when temporal() is true. */
+    std::vector<float>              m_historyAO[2];
+    std::vector<float>              m_historyCount[2];
+    std::vector<float>              m_historyZ[2];
+    int                             m_historyStride;
+    int                             m_historyIndex;
+
+    /** False when the previous frame did not write the history */
+    bool                            m_historyValid;
+
+    TemporalStatistics              m_temporalStatistics;
+
+    /** Created on first use so that setThreadCount() before the first frame does not spawn threads twice */
+    std::unique_ptr<ThreadPool>     m_threadPool;
+
+    /** 0 = one per hardware thread */
+    int                             m_threadCount;
+
+    int                             m_tileSize;
+
+    std::vector<TileTiming>         m_tileTiming;
+
+    int                             m_tileSteals;
+
+    bool                            m_adaptiveSampling;
+    int                             m_adaptiveMinTaps;
+    int                             m_adaptiveMaxTaps;
+    float                           m_adaptivePixelsPerTap;
+
+    bool                            m_depthTileSkipping;
+    float                           m_flatBlurTolerance;
+
+    /** Level l has m_depthTilesX[l] x m_depthTilesY[l] row-major tiles of DEPTH_TILE_SIZE << l pixels,
+        built by computeCSZ() when m_depthTileSkipping is true */
+    std::vector<DepthTile>          m_depthTilePyramid[DEPTH_TILE_LEVELS];
+    int                             m_depthTilesX[DEPTH_TILE_LEVELS];
+    int                             m_depthTilesY[DEPTH_TILE_LEVELS];
+
+    DepthTileStatistics             m_depthTileStatistics;
+
+    /** One instance per view of the last computeBatch(), which keeps the buffers and temporal history of each view */
+    std::vector<std::unique_ptr<SAOCPU> > m_batchViews;
+
+    /** Instance whose thread pool this one runs on, or NULL for its own; set on the views of computeBatch() */
+    SAOCPU*                         m_threadPoolOwner;
+
+    ThreadPool& threadPool();
+
+    /** Runs all items of \a job on the thread pool, then its finish() */
+    void runJob(const PassJob& job);
+
+    /** Runs \a jobs in one ThreadPool::parallelFor over the concatenation of their items, then each finish() in order */
+    void runJobs(const std::vector<PassJob>& jobs);
+
+    /** Copies every setting except the camera and thread count from \a other */
+    void copySettings(const SAOCPU& other);
+
+    /** Runs body(yBegin, yEnd) on row bands that cover [begin, end), in parallel */
+    void parallelRows(int begin, int end, const std::function<void (int yBegin, int yEnd)>& body);
+
+    /** Index of pixel (x, y) in the padded planes */
+    int planeIndex(int x, int y) const {
+        return m_planeOrigin + y * m_planeStride + x;
+    }
+
+    /** \param width Total buffer size, including the guard band */
+    void resizeBuffers(int width, int height);
+
+    /** Builds the texels of m_cszRect for the raw AO pixels inside \a guardBandSize */
+    void computeCSZ
+       (const float*                depthBuffer,
+        const float                 clipInfo[3],
+        int                         guardBandSize);
+
+    /** The rectangles and byte counts of m_cszStatistics for computeCSZ() */
+    void beginCSZ(int guardBandSize);
+
+    /** The single sweep of computeCSZ(), one item per band of 2^MAX_MIP_LEVEL rows */
+    PassJob cszSweepJob(const float* depthBuffer, const float clipInfo[3], int guardBandSize);
+
+    /** Completes m_cszStatistics for a computeCSZ() that began at \a start */
+    void endCSZ(std::chrono::high_resolution_clock::time_point start);
+
+    /** Level 0 rows [yBegin, yEnd) of m_cszRect[0], including the padding column and row after the last ones */
+    void computeCSZRows(const float* depthBuffer, const float clipInfo[3], int yBegin, int yEnd);
+
+    /** Rows [yBegin, yEnd) of m_cszRect[level]: m_cszMinifiedRect[level] from level - 1 and the rest from the
+        depth buffer.  Returns the number of texels reconstructed from the depth buffer. */
+    int minifyCSZRows(const float* depthBuffer, const float clipInfo[3], int level, int yBegin, int yEnd);
+
+    /** Texels \a r of \a level directly from the depth buffer, by following the rotated grid subsampling down to
+        level 0 like SAO_reconstructCSZLevel.pix.  The result is identical to minifying. */
+    void reconstructCSZTexels(const float* depthBuffer, const float clipInfo[3], int level, const TexelRect& r);
+
+    /** Rows [rowBegin, rowEnd) of level 0 of m_depthTilePyramid, from the depth buffer */
+    void computeDepthTileRows(const float* depthBuffer, const float clipInfo[3], int guardBandSize, int rowBegin, int rowEnd);
+
+    /** The coarser levels of m_depthTilePyramid from level 0, and m_depthTileStatistics.skyTiles */
+    void minifyDepthTiles();
+
+    /** Floats of m_cszBuffer occupied by \a level, including padding */
+    int cszLevelSize(int level) const;
+
+    /** Appends the pass \a name, which started at \a start and wrote \a texels, to m_passTiming */
+    void recordPass(const char* name, std::chrono::high_resolution_clock::time_point start, long long texels, long long bytesRead, long long bytesWritten);
+
+    /** Builds m_layerCSZBuffer from CSZ level 0 */
+    void deinterleaveCSZ();
+
+    /** Copies the layer AO and keys inside the guard band to m_rawAOBuffer and m_keyBuffer */
+    void reinterleave(int guardBandSize);
+
+    void computeRawAO
+       (const float*                depthBuffer,
+        const float                 projConstant[4],
+        float                       projScale,
+        int                         guardBandSize);
+
+    /** The raw AO pass, one item per tile of m_tileTiming */
+    PassJob rawAOJob
+       (const float*                depthBuffer,
+        const float                 projConstant[4],
+        float                       projScale,
+        int                         guardBandSize);
+
+    /** Runs tile \a index of m_tileTiming with the kernel of \a Preset */
+    template<class Preset>
+    std::function<void (int index, int worker)> rawAOTileTask(const std::shared_ptr<const RawAOConstants>& constants);
+
+    /** Raw AO for the pixels of \a tile that are inside the guard band, and its shadedPixels and taps.
+        tile.x0 must be a multiple of SAOSIMD::WIDTH and tile.y0 must be even.  When \a deinterleaved, the tile
+        is in the coordinates of tile.layer. */
+    template<class Preset, bool swizzled, bool deinterleaved>
+    void computeRawAOTile(const RawAOConstants& k, TileTiming& tile);
+
+    /** Blends the raw AO inside the guard band with the reprojected history and writes the history of this frame */
+    void resolveTemporal(const float projInfo[4], int guardBandSize);
+
+    /** Runs blurPasses() for the current preset and records m_blurStatistics */
+    void blur(float* result, int guardBandSize);
+
+    /** Resets the blur byte counts and allocates m_hBlurredBuffer if needed */
+    void beginBlur();
+
+    /** Completes m_blurStatistics for a blur() that began at \a start */
+    void endBlur(std::chrono::high_resolution_clock::time_point start);
+
+    /** blurFusedJob() or blurHorizontal() + blurVertical() */
+    template<class Preset>
+    void blurPasses(float* result, int guardBandSize);
+
+    template<class Preset>
+    void blurHorizontal(int guardBandSize);
+
+    template<class Preset>
+    void blurVertical(float* result, int guardBandSize);
+
+    /** Both blur axes per tile through a per-worker scratch block, without m_hBlurredBuffer; one item per tile */
+    template<class Preset>
+    PassJob blurFusedJob(float* result, int guardBandSize);
+
+    /** One tile [tx0, tx1) x [ty0, ty1) of blurFusedJob().  When \a flat, the bilateral weights are the spatial ones
+        alone and no keys are read. */
+    template<class Preset, bool flat>
+    void blurFusedTile(float* result, int guardBandSize, std::vector<float>& scratch, int tx0, int ty0, int tx1, int ty1);
+
+    SAOCPU(const SAOCPU&);
+    SAOCPU& operator=(const SAOCPU&);
+
+public:
+
+    SAOCPU();
+
+    ~SAOCPU();
+
+    /**
+     \brief Compute the obscurance constant at each pixel, with the same conventions as SAO::compute.
+
+     \param depthBuffer Standard hyperbolic depth buffer of \a width x \a height floats on [0, 1], e.g., the
+      DEPTH32F G-buffer read back to the CPU.  Pixels with depth >= 1 are treated as sky, which is the
+      test that SAO::computeRawAO performs with the depth-tested full-screen rectangle at Z_COORD.
+
+     \param clipConstant See SAO::compute
+     \param projConstant See SAO::compute
+     \param projScale See SAO::compute
+
+     \param result Output of \a width x \a height visibility values on [0, 1].  Pixels in the guard band are
+     left unchanged when guardBandCulling() is true and set to 1 otherwise.
+
+     \param guardBandSize Size on EACH SIDE of the depthBuffer and output that should be ignored when computing AO
+     */
+    void compute
+       (const float*                depthBuffer,
+        int                         width,
+        int                         height,
+        const float                 clipConstant[3],
+        const float                 projConstant[4],
+        float                       projScale,
+        float*                      result,
+        int                         guardBandSize = 0);
+
+    /**
+     \brief compute() for each of \a views with the settings of this instance, e.g., the six faces of a light probe.
+
+     Every view runs through each pass together with the others: the CSZ sweep bands, raw AO tiles, and fused blur
+     tiles of all views are dealt out in one ThreadPool::parallelFor per pass, so small views keep every worker busy
+     and the pool synchronizes three times per batch instead of three times per view.  The results are identical to
+     calling compute() for each view.
+
+     Each view has its own instance, batchView(i), which keeps its buffers and temporal history between batches of
+     the same views and reports its statistics.  Their pass timings are those of the whole batched pass, and
+     passTiming() of this instance sums the pixels, texels, and bytes of every view.  With deinterleaved(),
+     temporal(), or the multi-pass CSZ or blur, the views run one after the other instead.
+     */
+    void computeBatch(const std::vector<View>& views);
+
+    /** Views of the last computeBatch() */
+    int batchViewCount() const {
+        return int(m_batchViews.size());
+    }
+
+    const SAOCPU& batchView(int i) const {
+        return *m_batchViews[i];
+    }
+
+    /** Name of the instruction set that the kernels were compiled for: "AVX2", "SSE4.1", or "portable" */
+    static const char* instructionSet();
+
+    /** Selects the tap count, spiral, MIP switch distance, and blur footprint, starting with the next compute().
+        Each preset has its own compiled raw AO and blur kernels with the constants of SAOPresets.h, and
+        SAO::setQuality selects the matching shader permutation.  HIGH_QUALITY (the default) is the
+        original SAO configuration.  All presets share MAX_MIP_LEVEL. */
+    void setQuality(Quality q);
+
+    Quality quality() const {
+        return m_quality;
+    }
+
+    static QualityParameters qualityParameters(Quality q);
+
+    /** Preprocessor macros (name, value) that compile the shaders for preset \a q: NUM_SAMPLES,
+        NUM_SPIRAL_TURNS, LOG_MAX_OFFSET, MAX_MIP_LEVEL, R, SCALE, and GAUSSIAN_TABLE, the comma-separated
+        gaussian weights.  Every shader that uses one of them defines HIGH_QUALITY defaults under #ifndef. */
+    static std::vector<std::pair<std::string, std::string> > shaderDefines(Quality q);
+
+    /** Checks the #ifndef defaults of the shaderDefines() macros in shader \a source against HIGH_QUALITY,
+        which catches a shader edited without SAOPresets.h.  Returns false and appends a line per
+        disagreeing macro to \a mismatches. */
+    static bool checkShaderDefaults(const std::string& source, std::string& mismatches);
+
+    void setRadius(float r) {
+        m_settings.radius = r;
+    }
+
+    float radius() const {
+        return m_settings.radius;
+    }
+
+    void setBias(float b) {
+        m_settings.bias = b;
+    }
+
+    float bias() const {
+        return m_settings.bias;
+    }
+
+    void setIntensity(float d) {
+        m_settings.intensity = d;
+    }
+
+    float intensity() const {
+        return m_settings.intensity;
+    }
+
+    /** Number of worker threads, including the calling thread.  0 (the default) uses one per hardware thread. */
+    void setThreadCount(int n);
+
+    int threadCount() const;
+
+    /** Edge length in pixels of the raw AO tiles, rounded up to a multiple of the SIMD width. Default is 64. */
+    void setTileSize(int s);
+
+    int tileSize() const {
+        return m_tileSize;
+    }
+
+    /** Per-tile timings of the raw AO pass of the last compute(), in row-major tile order */
+    const std::vector<TileTiming>& tileTiming() const {
+        return m_tileTiming;
+    }
+
+    TileStatistics tileStatistics() const;
+
+    /** When true (the default), the horizontal and vertical blurs run as one pass over tiles of tileSize()
+        pixels.  Each tile is blurred horizontally with a halo of R * SCALE rows into a scratch block that
+        stays in cache and then vertically into the result, so the intermediate buffer is never
+        written to memory.  The result is identical to the two-pass version. */
+    void setFusedBlur(bool b) {
+        m_fusedBlur = b;
+    }
+
+    bool fusedBlur() const {
+        return m_fusedBlur;
+    }
+
+    const BlurStatistics& blurStatistics() const {
+        return m_blurStatistics;
+    }
+
+    /** When true (the default), all MIP levels are built in one sweep over bands of 2^MAX_MIP_LEVEL rows,
+        each of which produces its rows of every level while the finer level is still in cache.  When
+        false, each level is a separate pass over the previous one like SAO::computeCSZ.  The result is
+        identical. */
+    void setSingleSweepCSZ(bool b) {
+        m_singleSweepCSZ = b;
+    }
+
+    bool singleSweepCSZ() const {
+        return m_singleSweepCSZ;
+    }
+
+    const CSZStatistics& cszStatistics() const {
+        return m_cszStatistics;
+    }
+
+    /** When true (the default), no pass writes texels of the guard band that later passes do not read.  The
+        CSZ reconstruction and minify passes only write the texels of each level that the raw AO taps of pixels
+        inside the guard band can read (see cszLevelRects()) instead of the whole level, and the blur leaves
+        the guard band of the result unchanged instead of filling it with white, like SAO does with its clears.
+        The raw AO, temporal, and blur passes skip the guard band either way.
+
+        The AO inside the guard band is identical.  Texels of the MIP chain outside of cszRect() are undefined.
+        Deinterleaved mode reads all of level 0, so there only the blur changes.
+        tools/SAOBenchmark.cpp --culling measures the pixels and time saved by each pass. */
+    void setGuardBandCulling(bool b) {
+        m_guardBandCulling = b;
+    }
+
+    bool guardBandCulling() const {
+        return m_guardBandCulling;
+    }
+
+    /** The texels of every camera-space z MIP level that the raw AO pass can read for the pixels inside a guard
+        band of \a guardBandSize on each side of a \a width x \a height frame with quality preset \a q.
+        SAO uses the same rectangles on the GPU.
+
+        A tap at MIP level i < MAX_MIP_LEVEL is less than 2^(LOG_MAX_OFFSET + i + 1) pixels from its pixel,
+        so \a rect[i] is the interior plus that halo (plus the 2 x 2 quad that the normal reconstruction reads),
+        clipped to the level.  Taps at MAX_MIP_LEVEL have no bound, so \a rect[MAX_MIP_LEVEL] is the whole
+        level; it only has 1 / 4^MAX_MIP_LEVEL of the pixels.  The halo grows with the level, so the finer level
+        does not hold the rotated-grid source of every texel of the next one.  \a minified[i], for i >= 1, is
+        the part of \a rect[i] whose sources are all in \a rect[i - 1]; the rest of \a rect[i] is rendered
+        directly from the depth buffer like SAO_reconstructCSZLevel.pix.  \a minified[0] is empty.
+
+        With \a guardBandSize = 0 every rectangle is the whole level. */
+    static void cszLevelRects(Quality q, int width, int height, int guardBandSize, TexelRect rect[MAX_MIP_LEVEL + 1], TexelRect minified[MAX_MIP_LEVEL + 1]);
+
+    /** The rectangles of cszLevelRects() that the last compute() used, which are the whole level when
+        guardBandCulling() is false */
+    const TexelRect& cszRect(int level) const {
+        return m_cszRect[level];
+    }
+
+    /** When true (the default), computeCSZ() also reduces the depth buffer to a pyramid of DEPTH_TILE_LEVELS levels of
+        tiles that hold the range of the bilateral keys of their pixels inside the guard band.  The raw AO pass then
+        fills tiles that are entirely sky with white without loading their depth, and the fused blur fills blur tiles
+        that are entirely sky with white and blurs those whose keys, including their halo, are within
+        flatBlurTolerance() of each other without reading the keys.  With the default tolerance of zero, the result
+        is identical.
+
+        On the GPU, the depth test already rejects sky pixels of the raw AO pass and the key is in the same texel
+        as the AO, so SAO has no equivalent.  See depthTileStatistics() and tools/SAOReplay.cpp --no-depth-tiles. */
+    void setDepthTileSkipping(bool b) {
+        m_depthTileSkipping = b;
+    }
+
+    bool depthTileSkipping() const {
+        return m_depthTileSkipping;
+    }
+
+    /** Largest error of the bilateral weights that the flat blur path may make: a blur tile is flat when its keys
+        differ by at most \a e / (2000 EDGE_SHARPNESS).  Default is 0, which only takes the flat path where every
+        key is the same, e.g., on a wall facing the camera. */
+    void setFlatBlurTolerance(float e);
+
+    float flatBlurTolerance() const {
+        return m_flatBlurTolerance;
+    }
+
+    /** The range of keys of the pixels inside the guard band in a superset of pixels \a r, merged from the
+        coarsest level of the depth tiles whose tiles are at most half of the smaller side of \a r.  Only valid
+        after compute() with depthTileSkipping(). */
+    DepthTile depthTileBounds(const TexelRect& r) const;
+
+    const DepthTileStatistics& depthTileStatistics() const {
+        return m_depthTileStatistics;
+    }
+
+    /** The passes of the last compute() in execution order:
+
+        - "reconstruct CSZ", "depth tiles" when depthTileSkipping() is true, then "minify 1" ... "minify 5";
+          or "CSZ sweep" for all of them when singleSweepCSZ() is true
+        - "deinterleave CSZ" and, after the raw AO, "reinterleave" when deinterleaved() is true
+        - "raw AO"
+        - "temporal resolve" when temporal() is true
+        - "blur horizontal" and "blur vertical"; or "blur fused" when fusedBlur() is true
+
+        Byte counts are the frame-sized buffer traffic of each pass, as in CSZStatistics and BlurStatistics.
+        After computeBatch(), the sums over its views.
+        The taps of the raw AO pass, which mostly hit in cache, are not counted; see tools/SAOCacheBenchmark.cpp. */
+    const std::vector<PassTiming>& passTiming() const {
+        return m_passTiming;
+    }
+
+    /** When true, the raw AO pass runs on 4 x 4 interleaved layers of quarter resolution in each axis
+        (interleaved sampling).  Every pixel of layer (x % 4, y % 4) uses the same fixed rotation of the tap
+        spiral in place of the per-pixel hash, and its taps read only that layer and its own MIP chain, which is
+        1/16 the size of the full-resolution one.  Taps of neighboring pixels in a layer therefore land on
+        neighboring texels at every radius.  The layers are reinterleaved before the blur.
+
+        Each tap snaps to a texel of its layer, i.e., moves by up to 3 pixels, and the normals and
+        quad filter use 4-pixel differences, so the result is close to but not the same as the default.
+        Default is false. The full-resolution MIP levels 1...MAX_MIP_LEVEL are not built in this mode. */
+    void setDeinterleaved(bool b) {
+        m_deinterleaved = b;
+    }
+
+    bool deinterleaved() const {
+        return m_deinterleaved;
+    }
+
+    /** All layers and MIP levels of the deinterleaved camera-space z buffer.  Valid after compute() when
+        deinterleaved() is true. */
+    const float* layerCSZBuffer() const {
+        return &m_layerCSZBuffer[0];
+    }
+
+    /** When true, each frame takes only a subset of about temporalTapsPerFrame() of the spiral taps, rotates
+        the spiral by the golden angle, and blends the raw AO with the previous frames before the blur.  The
+        history of accumulated AO, frame count, and camera-space z is reprojected with the camera matrices of
+        setCameraToWorld() and the projection constants of the previous and current frame, and each pixel
+        blends the four history texels around its previous position.  A texel is skipped where it is
+        off-screen, was sky or in the guard band, or has a camera-space z that differs by more than 1% from
+        the reprojected one (a disocclusion); the history is discarded when all four are.  Otherwise the new
+        AO is averaged in with weight 1 / min(frames, temporalHistoryLength()).
+
+        Successive frames cycle through disjoint subsets that together cover all NUM_SAMPLES taps, so a static
+        view converges to the average of rotated full spirals.  Moving views have fewer effective samples where
+        history was rejected; see temporalStatistics().  AO near the image border depends on the view, so use
+        a guard band when the camera moves.  Call resetTemporalHistory() on camera cuts.
+        Default is false. */
+    void setTemporal(bool b) {
+        m_temporal = b;
+    }
+
+    bool temporal() const {
+        return m_temporal;
+    }
+
+    /** Taps per pixel per frame in temporal mode, rounded so that every frame takes every
+        ceil(NUM_SAMPLES / n)-th tap of the preset's spiral.  Default is 3. */
+    void setTemporalTapsPerFrame(int n);
+
+    int temporalTapsPerFrame() const {
+        return m_temporalTapsPerFrame;
+    }
+
+    /** Maximum number of frames averaged in temporal mode.  After that many frames the history decays
+        exponentially, which bounds ghosting on moving objects.  Default is 8. */
+    void setTemporalHistoryLength(int n);
+
+    int temporalHistoryLength() const {
+        return m_temporalHistoryLength;
+    }
+
+    /** Row-major 3 x 4 camera-to-world matrix (rotation and translation) for the next compute().  Only
+        used in temporal mode.  Default is the identity. */
+    void setCameraToWorld(const float cameraToWorld[12]);
+
+    /** When true, the raw AO pass takes fewer of the preset's spiral taps where the screen-space disk radius
+        -projScale * radius / z is small, because there the taps crowd onto a few texels and add little
+        information.  n = adaptiveTapCount() taps are the evenly spaced taps adaptiveTapIndex() of the
+        spiral, which still cover the whole disk, each weighted by 5 / n.
+
+        The count is chosen for each block of 2 rows of one SIMD vector (the quads that the kernel shades
+        together) from the largest radius of its pixels, i.e., its nearest one, so every lane of a vector
+        takes the same taps and the quad derivatives of the bilateral box filter see one tap pattern.
+        SAO chooses the count per pixel, so the results differ slightly.
+
+        This is meant for wide outdoor views, where most pixels are far away.  The result is noisier where
+        fewer taps are taken; tools/SAOAdaptiveBenchmark.cpp measures the time saved and the error, and
+        TileTiming::taps the taps of each tile.  Ignored in temporal mode, which already takes only a few taps
+        per frame.  Default is false. */
+    void setAdaptiveSampling(bool b) {
+        m_adaptiveSampling = b;
+    }
+
+    bool adaptiveSampling() const {
+        return m_adaptiveSampling;
+    }
+
+    /** Fewest and most taps per pixel in adaptive mode.  \a maxTaps is clamped to the preset's NUM_SAMPLES.
+        Default is 3 to all of the preset's taps. */
+    void setAdaptiveTapRange(int minTaps, int maxTaps);
+
+    int adaptiveMinTaps() const {
+        return m_adaptiveMinTaps;
+    }
+
+    int adaptiveMaxTaps() const {
+        return m_adaptiveMaxTaps;
+    }
+
+    /** Screen-space disk radius in pixels per tap in adaptive mode.  Default is 4, which takes all 11 taps of
+        HIGH_QUALITY for a disk of radius 44 pixels or more. */
+    void setAdaptivePixelsPerTap(float p);
+
+    float adaptivePixelsPerTap() const {
+        return m_adaptivePixelsPerTap;
+    }
+
+    /** ceil(ssDiskRadius / pixelsPerTap) clamped to [minTaps, maxTaps].  SAO_AO.pix computes the same per pixel. */
+    static int adaptiveTapCount(float ssDiskRadius, int minTaps, int maxTaps, float pixelsPerTap);
+
+    /** Index in the spiral of \a numSamples taps of tap \a j of the \a tapCount taps in adaptive mode: the
+        middle of the j-th of tapCount equal runs of taps */
+    static int adaptiveTapIndex(int j, int tapCount, int numSamples) {
+        return ((2 * j + 1) * numSamples) / (2 * tapCount);
+    }
+
+    /** Discards the history, e.g., on a camera cut */
+    void resetTemporalHistory() {
+        m_historyValid = false;
+    }
+
+    /** Valid after compute() when temporal() is true */
+    const TemporalStatistics& temporalStatistics() const {
+        return m_temporalStatistics;
+    }
+
+    /** The taps of frame \a frameIndex in temporal mode: \a tapCount taps with indices firstTap + i * tapStride on
+        [0, numSamples), and an extra rotation \a spin in radians that is added to the per-pixel rotation.
+        SAO uses the same schedule on the GPU. */
+    static void temporalTaps(int numSamples, int frameIndex, int tapsPerFrame, int& firstTap, int& tapStride, int& tapCount, float& spin);
+
+    /** Selects how each MIP level of the camera-space z buffer is stored, starting with the next compute().
+
+        ROW_MAJOR_LAYOUT (the default) matches the GPU texture.  The spiral taps of the AO pass land on
+        different rows, so each tap at a given MIP level tends to touch its own cache line.
+
+        SWIZZLED_LAYOUT stores 8 x 8 blocks contiguously in Z-order, so every aligned 4 x 4 texel
+        neighborhood is one 64-byte cache line.  Taps of neighboring pixels and adjacent spiral turns
+        then share lines in both axes.  The AO result is identical.  tools/SAOCacheBenchmark.cpp
+        measures the cache misses of both layouts. */
+    void setCSZLayout(CSZLayout layout) {
+        m_cszLayout = layout;
+    }
+
+    CSZLayout cszLayout() const {
+        return m_cszLayout;
+    }
+
+    /** Index in cszBuffer() of texel (x, y) of MIP level \a level, for either layout */
+    int cszIndex(int level, int x, int y) const;
+
+    /** All MIP levels of the camera-space z buffer.  Valid after compute(). */
+    const float* cszBuffer() const {
+        return &m_cszBuffer[0];
+    }
+
+    /** Camera-space z of MIP level \a level, with width cszLevelWidth(level) and row stride cszLevelStride(level).
+        Valid after compute() in ROW_MAJOR_LAYOUT; use cszIndex() in general. */
+    const float* cszLevel(int level) const {
+        return &m_cszBuffer[m_cszLevelOffset[level]];
+    }
+
+    int cszLevelWidth(int level) const {
+        return m_cszLevelWidth[level];
+    }
+
+    int cszLevelHeight(int level) const {
+        return m_cszLevelHeight[level];
+    }
+
+    int cszLevelStride(int level) const {
+        return m_cszLevelStride[level];
+    }
+
+    /** Raw AO of pixel (x, y) that the blur reads, i.e., after the temporal resolve in temporal mode.  Valid after compute(). */
+    float rawAO(int x, int y) const {
+        return m_rawAOBuffer[planeIndex(x, y)];
+    }
+
+    /** Bilateral key of pixel (x, y), 1.0 for sky and the guard band.  Valid after compute(). */
+    float bilateralKey(int x, int y) const {
+        return m_keyBuffer[planeIndex(x, y)];
+    }
+};
+
+#endif // SAOCPU_h
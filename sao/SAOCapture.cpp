@@ -0,0 +1,351 @@
+/**
+ \file SAOCapture.cpp
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#include "SAOCapture.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#   define NOMINMAX
+#   include <windows.h>
+#else
+#   include <dirent.h>
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#ifdef SAO_CAPTURE_ZLIB
+#   include <zlib.h>
+#endif
+
+static const char MAGIC[8] = {'S', 'A', 'O', 'C', 'A', 'P', 'T', '\0'};
+
+/** The header fields are copied in host byte order, which is little-endian on every platform that the demo runs on */
+static bool hostIsLittleEndian() {
+    const unsigned int one = 1;
+    unsigned char b;
+    memcpy(&b, &one, 1);
+    return b == 1;
+}
+
+
+template<class T>
+static void put(unsigned char* header, size_t offset, const T* value, size_t count = 1) {
+    memcpy(header + offset, value, sizeof(T) * count);
+}
+
+
+template<class T>
+static void get(const unsigned char* header, size_t offset, T* value, size_t count = 1) {
+    memcpy(value, header + offset, sizeof(T) * count);
+}
+
+
+SAOCapture::SAOCapture() : width(0), height(0), guardBandSize(0), projScale(0), frameIndex(0), compression(NONE),
+    m_mapping(NULL), m_mappingBytes(0), m_depth(NULL) {
+#   ifdef _WIN32
+        m_fileHandle    = INVALID_HANDLE_VALUE;
+        m_mappingHandle = NULL;
+#   endif
+    std::fill(clipInfo, clipInfo + 3, 0.0f);
+    std::fill(projInfo, projInfo + 4, 0.0f);
+    std::fill(cameraToWorld, cameraToWorld + 12, 0.0f);
+}
+
+
+SAOCapture::~SAOCapture() {
+    unmap();
+}
+
+
+void SAOCapture::unmap() {
+#   ifdef _WIN32
+        if (m_mapping != NULL) {
+            UnmapViewOfFile(m_mapping);
+        }
+        if (m_mappingHandle != NULL) {
+            CloseHandle(m_mappingHandle);
+            m_mappingHandle = NULL;
+        }
+        if (m_fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_fileHandle);
+            m_fileHandle = INVALID_HANDLE_VALUE;
+        }
+#   else
+        if (m_mapping != NULL) {
+            munmap(const_cast<unsigned char*>(m_mapping), m_mappingBytes);
+        }
+#   endif
+    m_mapping      = NULL;
+    m_mappingBytes = 0;
+    m_depth        = NULL;
+    m_decompressed.clear();
+}
+
+
+bool SAOCapture::supports(Compression c) {
+#   ifdef SAO_CAPTURE_ZLIB
+        return (c == NONE) || (c == ZLIB_SHUFFLED);
+#   else
+        return c == NONE;
+#   endif
+}
+
+
+bool SAOCapture::write
+   (const std::string&  filename,
+    const float*        depth,
+    int                 width,
+    int                 height,
+    int                 guardBandSize,
+    const float         clipInfo[3],
+    const float         projInfo[4],
+    float               projScale,
+    const float         cameraToWorld[12],
+    unsigned int        frameIndex,
+    Compression         compression,
+    std::string&        error) {
+
+    assert(depth != NULL && width > 0 && height > 0);
+    assert(hostIsLittleEndian());
+
+    if (! supports(compression)) {
+        error = "This build does not support the requested capture compression";
+        return false;
+    }
+
+    const size_t count = size_t(width) * size_t(height);
+    const unsigned char* payload = reinterpret_cast<const unsigned char*>(depth);
+    unsigned long long payloadBytes = count * sizeof(float);
+
+#   ifdef SAO_CAPTURE_ZLIB
+        std::vector<unsigned char> compressed;
+        if (compression == ZLIB_SHUFFLED) {
+            std::vector<unsigned char> shuffled(count * sizeof(float));
+            for (size_t i = 0; i < count; ++i) {
+                for (int b = 0; b < 4; ++b) {
+                    shuffled[i + b * count] = payload[i * 4 + b];
+                }
+            }
+            uLongf compressedBytes = compressBound(uLong(shuffled.size()));
+            compressed.resize(compressedBytes);
+            // Level 1: depth compresses nearly as well as at level 9 and the capture keypress should not stall the frame
+            if (compress2(&compressed[0], &compressedBytes, &shuffled[0], uLong(shuffled.size()), 1) != Z_OK) {
+                error = "zlib could not compress the depth buffer";
+                return false;
+            }
+            payload      = &compressed[0];
+            payloadBytes = compressedBytes;
+        }
+#   endif
+
+    unsigned char header[HEADER_BYTES];
+    memset(header, 0, sizeof(header));
+    const unsigned int version = VERSION, headerBytes = HEADER_BYTES, c = compression;
+    put(header,   0, MAGIC, 8);
+    put(header,   8, &version);
+    put(header,  12, &headerBytes);
+    put(header,  16, &width);
+    put(header,  20, &height);
+    put(header,  24, &guardBandSize);
+    put(header,  28, &c);
+    put(header,  32, clipInfo, 3);
+    put(header,  44, projInfo, 4);
+    put(header,  60, &projScale);
+    put(header,  64, cameraToWorld, 12);
+    put(header, 112, &payloadBytes);
+    put(header, 120, &frameIndex);
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == NULL) {
+        error = "Cannot open " + filename + " for writing";
+        return false;
+    }
+    const bool ok = (fwrite(header, 1, sizeof(header), file) == sizeof(header)) &&
+                    (fwrite(payload, 1, size_t(payloadBytes), file) == size_t(payloadBytes));
+    if ((fclose(file) != 0) || ! ok) {
+        error = "Cannot write " + filename;
+        return false;
+    }
+    return true;
+}
+
+
+bool SAOCapture::load(const std::string& filename, std::string& error) {
+    assert(hostIsLittleEndian());
+    unmap();
+
+#   ifdef _WIN32
+        m_fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER size;
+        if ((m_fileHandle == INVALID_HANDLE_VALUE) || ! GetFileSizeEx(m_fileHandle, &size)) {
+            error = "Cannot open " + filename;
+            unmap();
+            return false;
+        }
+        m_mappingBytes = size_t(size.QuadPart);
+        if (m_mappingBytes >= HEADER_BYTES) {
+            m_mappingHandle = CreateFileMappingA(m_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (m_mappingHandle != NULL) {
+                m_mapping = static_cast<const unsigned char*>(MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+            }
+        }
+#   else
+        const int fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if ((fd < 0) || (fstat(fd, &st) != 0)) {
+            error = "Cannot open " + filename;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        m_mappingBytes = size_t(st.st_size);
+        if (m_mappingBytes >= HEADER_BYTES) {
+            void* p = mmap(NULL, m_mappingBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                m_mapping = static_cast<const unsigned char*>(p);
+                // The passes read the depth front to back
+                madvise(p, m_mappingBytes, MADV_SEQUENTIAL);
+            }
+        }
+        // The mapping keeps the file open
+        close(fd);
+#   endif
+
+    if (m_mappingBytes < HEADER_BYTES) {
+        error = filename + " is too short to be a capture";
+        unmap();
+        return false;
+    }
+    if (m_mapping == NULL) {
+        error = "Cannot map " + filename;
+        unmap();
+        return false;
+    }
+
+    const unsigned char* header = m_mapping;
+    char magic[8];
+    unsigned int version = 0, headerBytes = 0, c = 0;
+    unsigned long long payloadBytes = 0;
+    get(header, 0, magic, 8);
+    get(header, 8, &version);
+    get(header, 12, &headerBytes);
+    if ((memcmp(magic, MAGIC, 8) != 0) || (version == 0) || (headerBytes < HEADER_BYTES)) {
+        error = filename + " is not an SAO capture";
+        unmap();
+        return false;
+    }
+    if (version > VERSION) {
+        error = filename + " was written by a newer version of SAOCapture";
+        unmap();
+        return false;
+    }
+
+    get(header,  16, &width);
+    get(header,  20, &height);
+    get(header,  24, &guardBandSize);
+    get(header,  28, &c);
+    get(header,  32, clipInfo, 3);
+    get(header,  44, projInfo, 4);
+    get(header,  60, &projScale);
+    get(header,  64, cameraToWorld, 12);
+    get(header, 112, &payloadBytes);
+    get(header, 120, &frameIndex);
+    compression = Compression(c);
+
+    const unsigned long long count = (unsigned long long)(width) * (unsigned long long)(height);
+    if ((width <= 0) || (height <= 0) || (headerBytes > m_mappingBytes) || (payloadBytes > m_mappingBytes - headerBytes)) {
+        error = filename + " is truncated or has an invalid size";
+        unmap();
+        return false;
+    }
+    if (! supports(compression)) {
+        error = filename + " uses a compression that this build does not support; rebuild with SAO_CAPTURE_ZLIB";
+        unmap();
+        return false;
+    }
+
+    const unsigned char* payload = m_mapping + headerBytes;
+    if (compression == NONE) {
+        if ((payloadBytes != count * sizeof(float)) || (headerBytes % sizeof(float) != 0)) {
+            error = filename + " has a payload of the wrong size";
+            unmap();
+            return false;
+        }
+        m_depth = reinterpret_cast<const float*>(payload);
+    }
+
+#   ifdef SAO_CAPTURE_ZLIB
+        if (compression == ZLIB_SHUFFLED) {
+            std::vector<unsigned char> shuffled(size_t(count) * sizeof(float));
+            uLongf inflatedBytes = uLongf(shuffled.size());
+            if ((uncompress(&shuffled[0], &inflatedBytes, payload, uLong(payloadBytes)) != Z_OK) || (inflatedBytes != shuffled.size())) {
+                error = filename + " has a corrupt payload";
+                unmap();
+                return false;
+            }
+            m_decompressed.resize(size_t(count));
+            unsigned char* out = reinterpret_cast<unsigned char*>(&m_decompressed[0]);
+            for (size_t i = 0; i < size_t(count); ++i) {
+                for (int b = 0; b < 4; ++b) {
+                    out[i * 4 + b] = shuffled[i + b * size_t(count)];
+                }
+            }
+            m_depth = &m_decompressed[0];
+        }
+#   endif
+
+    return true;
+}
+
+
+bool SAOCapture::listDirectory
+   (const std::string&          directory,
+    const std::string&          extension,
+    std::vector<std::string>&   filenames,
+    std::string&                error) {
+
+    filenames.clear();
+    std::vector<std::string> names;
+
+#   ifdef _WIN32
+        WIN32_FIND_DATAA data;
+        const HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &data);
+        if (find == INVALID_HANDLE_VALUE) {
+            error = "Cannot list " + directory;
+            return false;
+        }
+        do {
+            if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+                names.push_back(data.cFileName);
+            }
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+#   else
+        DIR* dir = opendir(directory.c_str());
+        if (dir == NULL) {
+            error = "Cannot list " + directory;
+            return false;
+        }
+        for (struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+            names.push_back(entry->d_name);
+        }
+        closedir(dir);
+#   endif
+
+    for (int i = 0; i < int(names.size()); ++i) {
+        const std::string& n = names[i];
+        if ((n.size() > extension.size()) && (n.compare(n.size() - extension.size(), extension.size(), extension) == 0)) {
+            filenames.push_back(directory + "/" + n);
+        }
+    }
+    std::sort(filenames.begin(), filenames.end());
+    return true;
+}
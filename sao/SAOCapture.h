@@ -0,0 +1,157 @@
+/**
+ \file SAOCapture.h
+
+ Binary capture of the inputs of one SAO frame: the hyperbolic depth buffer together with the clip, projection,
+ and camera constants that SAO::compute received.  SAO::captureNextFrame() writes them from the G3D demo, and
+ tools/SAOReplay.cpp streams a directory of them back through SAOCPU.
+
+ This file has no G3D dependency.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef SAOCapture_h
+#define SAOCapture_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ \brief Depth buffer and camera of one frame, stored so that it can be memory-mapped and used in place.
+
+ File layout, all little-endian:
+
+ \code
+ offset  size  field
+      0     8  "SAOCAPT\0"
+      8     4  uint32 version (VERSION)
+     12     4  uint32 headerBytes, the offset of the depth payload
+     16     4  int32  width, including the guard band
+     20     4  int32  height, including the guard band
+     24     4  int32  guardBandSize
+     28     4  uint32 compression (Compression)
+     32    12  float  clipInfo[3]
+     44    16  float  projInfo[4]
+     60     4  float  projScale
+     64    48  float  cameraToWorld[12], row-major 3 x 4 as for SAOCPU::setCameraToWorld
+    112     8  uint64 payloadBytes
+    120     4  uint32 frameIndex
+    124     4  reserved, zero
+    128        payload
+ \endcode
+
+ The uncompressed payload is width * height floats in the row order of the buffer passed to SAOCPU::compute,
+ so load() returns a pointer directly into the mapped file and the depth is only paged in as the passes read
+ it.  The payload offset is a multiple of 64 bytes, so rows start on the same cache-line alignment as a
+ heap buffer would.
+
+ Later versions may append fields to the header and increase headerBytes; readers skip any header bytes they
+ do not know and reject files with a newer version number.
+ */
+class SAOCapture {
+public:
+
+    enum {VERSION = 1, HEADER_BYTES = 128};
+
+    enum Compression {
+        /** Raw floats, read in place from the mapping */
+        NONE = 0,
+
+        /** zlib (deflate) of the floats with their bytes shuffled into four planes (all low bytes, then all
+            second bytes, ...), which groups the slowly varying exponent bytes of neighboring pixels.  Only
+            available when built with SAO_CAPTURE_ZLIB defined and zlib linked. */
+        ZLIB_SHUFFLED = 1
+    };
+
+    int             width;
+    int             height;
+    int             guardBandSize;
+    float           clipInfo[3];
+    float           projInfo[4];
+    float           projScale;
+    float           cameraToWorld[12];
+
+    /** Frame number of the capture, for ordering and for selecting the spiral rotation in temporal replays */
+    unsigned int    frameIndex;
+
+    Compression     compression;
+
+protected:
+
+    /** Memory-mapped file; NULL when nothing is loaded */
+    const unsigned char*    m_mapping;
+    size_t                  m_mappingBytes;
+
+#   ifdef _WIN32
+        void*               m_fileHandle;
+        void*               m_mappingHandle;
+#   endif
+
+    /** Decompressed depth of compressed captures */
+    std::vector<float>      m_decompressed;
+
+    const float*            m_depth;
+
+    void unmap();
+
+    /** Not copyable, because depth() may point into the mapping */
+    SAOCapture(const SAOCapture&);
+    SAOCapture& operator=(const SAOCapture&);
+
+public:
+
+    SAOCapture();
+
+    ~SAOCapture();
+
+    /** Writes one capture.  Returns false and sets \a error on failure.
+        \param depth width * height hyperbolic depth values, as passed to SAOCPU::compute */
+    static bool write
+       (const std::string&  filename,
+        const float*        depth,
+        int                 width,
+        int                 height,
+        int                 guardBandSize,
+        const float         clipInfo[3],
+        const float         projInfo[4],
+        float               projScale,
+        const float         cameraToWorld[12],
+        unsigned int        frameIndex,
+        Compression         compression,
+        std::string&        error);
+
+    /** True if write() and load() support \a c in this build */
+    static bool supports(Compression c);
+
+    /** Maps \a filename and parses its header, releasing any previous capture.  Uncompressed depth stays in
+        the mapping; compressed depth is inflated into memory owned by this object.  Returns false and sets
+        \a error if the file cannot be read, is not a capture, is of a newer version, is truncated, or is
+        compressed in a way that this build does not support. */
+    bool load(const std::string& filename, std::string& error);
+
+    /** width * height depth values, valid until the next load() or the destruction of this object.  NULL if
+        nothing is loaded. */
+    const float* depth() const {
+        return m_depth;
+    }
+
+    /** Size of the file on disk, which is 0 when nothing is loaded */
+    size_t fileBytes() const {
+        return m_mappingBytes;
+    }
+
+    /** Files ending in \a extension in \a directory, sorted by name so that numbered captures are in frame
+        order.  Returns false and sets \a error if the directory cannot be listed. */
+    static bool listDirectory
+       (const std::string&          directory,
+        const std::string&          extension,
+        std::vector<std::string>&   filenames,
+        std::string&                error);
+
+    /** Extension of the files that SAO::captureNextFrame() writes */
+    static const char* extension() {
+        return ".saocap";
+    }
+};
+
+#endif // SAOCapture_h
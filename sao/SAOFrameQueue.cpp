@@ -0,0 +1,172 @@
+/**
+ \file SAOFrameQueue.cpp
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#include "SAOFrameQueue.h"
+#include <algorithm>
+#include <cassert>
+
+SAOFrameQueue::SAOFrameQueue(int depth) : m_nextIndex(0), m_shutdown(false) {
+    assert(depth >= 1);
+    for (int i = 0; i < depth; ++i) {
+        m_slots.push_back(std::unique_ptr<Slot>(new Slot()));
+    }
+    m_thread = std::thread(&SAOFrameQueue::threadLoop, this);
+}
+
+
+SAOFrameQueue::~SAOFrameQueue() {
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_submitted.notify_all();
+    m_thread.join();
+}
+
+
+SAOFrameQueue::Future SAOFrameQueue::submit
+   (const float*                depthBuffer,
+    int                         width,
+    int                         height,
+    const float                 clipConstant[3],
+    const float                 projConstant[4],
+    float                       projScale,
+    int                         guardBandSize,
+    const float*                cameraToWorld) {
+
+    assert(depthBuffer != NULL && width > 0 && height > 0);
+    static const float identity[12] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0};
+
+    int slotIndex = -1;
+    {
+        // Backpressure: wait for the caller to release a frame
+        const Clock::time_point start = Clock::now();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (slotIndex == -1) {
+            for (int i = 0; (i < depth()) && (slotIndex == -1); ++i) {
+                if (m_slots[i]->state == Slot::FREE) {
+                    slotIndex = i;
+                }
+            }
+            if (slotIndex == -1) {
+                m_changed.wait(lock);
+            }
+        }
+        m_statistics.blockedMilliseconds += std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+        m_slots[slotIndex]->state = Slot::FILLING;
+    }
+    Slot* slot = m_slots[slotIndex].get();
+
+    // Copied outside of the lock so that the background thread is not held up
+    slot->width  = width;
+    slot->height = height;
+    slot->depth.assign(depthBuffer, depthBuffer + size_t(width) * size_t(height));
+    slot->ao.resize(size_t(width) * size_t(height));
+    std::copy(clipConstant, clipConstant + 3, slot->clipInfo);
+    std::copy(projConstant, projConstant + 4, slot->projInfo);
+    slot->projScale     = projScale;
+    slot->guardBandSize = guardBandSize;
+    const float* pose = (cameraToWorld != NULL) ? cameraToWorld : identity;
+    std::copy(pose, pose + 12, slot->cameraToWorld);
+    slot->promise       = std::promise<Frame>();
+
+    const Future future = slot->promise.get_future().share();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        slot->index      = m_nextIndex++;
+        slot->state      = Slot::QUEUED;
+        slot->submitTime = Clock::now();
+        m_queue.push_back(slotIndex);
+        ++m_statistics.submitted;
+    }
+    m_submitted.notify_one();
+
+    return future;
+}
+
+
+void SAOFrameQueue::threadLoop() {
+    while (true) {
+        Slot* slot = NULL;
+        int slotIndex = 0;
+        {
+            const Clock::time_point start = Clock::now();
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (! m_shutdown && m_queue.empty()) {
+                m_submitted.wait(lock);
+            }
+            if (m_queue.empty()) {
+                return;
+            }
+            m_statistics.idleMilliseconds += std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+            slotIndex = m_queue.front();
+            m_queue.pop_front();
+            slot = m_slots[slotIndex].get();
+            slot->state = Slot::RUNNING;
+        }
+
+        Frame frame;
+        frame.index  = slot->index;
+        frame.slot   = slotIndex;
+        frame.width  = slot->width;
+        frame.height = slot->height;
+        frame.ao     = &slot->ao[0];
+
+        const Clock::time_point start = Clock::now();
+        frame.queueMilliseconds = std::chrono::duration<float, std::milli>(start - slot->submitTime).count();
+
+        m_sao.setCameraToWorld(slot->cameraToWorld);
+        m_sao.compute(&slot->depth[0], slot->width, slot->height, slot->clipInfo, slot->projInfo, slot->projScale, &slot->ao[0], slot->guardBandSize);
+
+        const Clock::time_point end = Clock::now();
+        frame.computeMilliseconds = std::chrono::duration<float, std::milli>(end - start).count();
+        frame.latencyMilliseconds = std::chrono::duration<float, std::milli>(end - slot->submitTime).count();
+
+        {
+            // Ready before finish() returns, and DONE before the caller can release() it
+            std::lock_guard<std::mutex> lock(m_mutex);
+            slot->state = Slot::DONE;
+            ++m_statistics.completed;
+            slot->promise.set_value(frame);
+        }
+        m_changed.notify_all();
+    }
+}
+
+
+void SAOFrameQueue::release(const Frame& frame) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Slot& slot = *m_slots[frame.slot];
+        assert(slot.state == Slot::DONE && slot.index == frame.index && "Released a frame that is not complete or was already released");
+        slot.state = Slot::FREE;
+    }
+    m_changed.notify_all();
+}
+
+
+void SAOFrameQueue::finish() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_statistics.completed < m_statistics.submitted) {
+        m_changed.wait(lock);
+    }
+}
+
+
+int SAOFrameQueue::framesInUse() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int n = 0;
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+        n += (m_slots[i]->state != Slot::FREE) ? 1 : 0;
+    }
+    return n;
+}
+
+
+SAOFrameQueue::Statistics SAOFrameQueue::statistics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_statistics;
+}
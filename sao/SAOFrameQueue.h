@@ -0,0 +1,196 @@
+/**
+ \file SAOFrameQueue.h
+
+ Asynchronous, pipelined submission of frames to SAOCPU for headless renderers.  No G3D dependency.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef SAOFrameQueue_h
+#define SAOFrameQueue_h
+
+#include "SAOCPU.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ \brief Bounded queue of frames that a background thread runs through SAOCPU::compute in submission order.
+
+ submit() copies the depth buffer and camera constants of a frame into one of depth() frame slots and returns
+ at once with a future for its AO, so the caller can produce the G-buffer of frame N + 1 (or encode frame N - 1)
+ while the AO of frame N is computed.  Each slot holds the depth buffer and the AO of its frame, so the AO of a
+ finished frame stays valid while later frames run, like the images of a swap chain.  A slot is in use from
+ submit() until release(); when all of them are, submit() blocks until the caller releases one, which bounds
+ both the memory and the latency of the pipeline.
+
+ With depth() = 1 every frame waits for the previous one to be released, which is synchronous execution on
+ another thread.  Depth 2 overlaps one frame of AO with the caller's work, and depth 3 also absorbs jitter in
+ either.  Larger depths add latency without throughput once the slower side is always busy;
+ tools/SAOPipelineBenchmark.cpp measures the trade-off.
+
+ Frames run one at a time on sao(), so temporal accumulation sees them in order, and sao() uses its own
+ thread pool.  Change the settings of sao() only when no frame is pending, e.g., after finish().
+
+ The queue itself is thread-safe, but frames are computed in submission order, so a single producer is
+ the expected use.
+
+ <h3>Example</h3>
+    \code
+    SAOFrameQueue queue(2);
+    std::deque<SAOFrameQueue::Future> pending;
+    for (int f = 0; f < frames; ++f) {
+        renderGBuffer(f, depth);
+        pending.push_back(queue.submit(&depth[0], width, height, clipInfo, projInfo, projScale));
+        if (int(pending.size()) == queue.depth()) {
+            const SAOFrameQueue::Frame& frame = pending.front().get();
+            encode(frame.ao);
+            queue.release(frame);
+            pending.pop_front();
+        }
+    }
+    \endcode
+ */
+class SAOFrameQueue {
+public:
+
+    /** A frame whose AO is ready */
+    class Frame {
+    public:
+        /** Submission order, from 0 */
+        int                         index;
+
+        /** Slot of depth(), which release() returns */
+        int                         slot;
+
+        int                         width;
+        int                         height;
+
+        /** width x height visibility values, as written by SAOCPU::compute.  Valid until release(). */
+        const float*                ao;
+
+        /** From submit() to the start of compute(), i.e., behind earlier frames */
+        float                       queueMilliseconds;
+
+        float                       computeMilliseconds;
+
+        /** From submit() to the AO being ready */
+        float                       latencyMilliseconds;
+
+        Frame() : index(0), slot(0), width(0), height(0), ao(NULL), queueMilliseconds(0), computeMilliseconds(0), latencyMilliseconds(0) {}
+    };
+
+    typedef std::shared_future<Frame> Future;
+
+    class Statistics {
+    public:
+        int                         submitted;
+        int                         completed;
+
+        /** Time that submit() spent waiting for a free slot, i.e., backpressure on the caller */
+        float                       blockedMilliseconds;
+
+        /** Time that the background thread spent waiting for a frame */
+        float                       idleMilliseconds;
+
+        Statistics() : submitted(0), completed(0), blockedMilliseconds(0), idleMilliseconds(0) {}
+    };
+
+protected:
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    class Slot {
+    public:
+        /** FILLING while submit() copies the frame in, outside of the lock */
+        enum State {FREE, FILLING, QUEUED, RUNNING, DONE};
+
+        State                       state;
+        int                         index;
+        int                         width;
+        int                         height;
+        std::vector<float>          depth;
+        std::vector<float>          ao;
+        float                       clipInfo[3];
+        float                       projInfo[4];
+        float                       projScale;
+        int                         guardBandSize;
+        float                       cameraToWorld[12];
+        Clock::time_point           submitTime;
+        std::promise<Frame>         promise;
+
+        Slot() : state(FREE), index(0), width(0), height(0), projScale(0), guardBandSize(0) {}
+    };
+
+    SAOCPU                          m_sao;
+
+    std::vector<std::unique_ptr<Slot> > m_slots;
+
+    /** Slots in the QUEUED state, oldest first */
+    std::deque<int>                 m_queue;
+
+    std::mutex                      m_mutex;
+
+    /** Signaled when a frame is queued or on shutdown */
+    std::condition_variable         m_submitted;
+
+    /** Signaled when a frame completes or a slot is released */
+    std::condition_variable         m_changed;
+
+    int                             m_nextIndex;
+    bool                            m_shutdown;
+    Statistics                      m_statistics;
+
+    std::thread                     m_thread;
+
+    void threadLoop();
+
+    SAOFrameQueue(const SAOFrameQueue&);
+    SAOFrameQueue& operator=(const SAOFrameQueue&);
+
+public:
+
+    /** \param depth Frame slots, at least 1.  2 (double buffering) overlaps AO with the caller's work. */
+    explicit SAOFrameQueue(int depth = 2);
+
+    /** Waits for the pending frames to finish */
+    ~SAOFrameQueue();
+
+    int depth() const {
+        return int(m_slots.size());
+    }
+
+    /** The SAOCPU that computes the frames; see the class documentation before changing its settings */
+    SAOCPU& sao() {
+        return m_sao;
+    }
+
+    /** Copies the arguments of SAOCPU::compute into a free slot, blocking until one is available, and queues
+        the frame.  \param cameraToWorld See SAOCPU::setCameraToWorld; NULL is the identity. */
+    Future submit
+       (const float*                depthBuffer,
+        int                         width,
+        int                         height,
+        const float                 clipConstant[3],
+        const float                 projConstant[4],
+        float                       projScale,
+        int                         guardBandSize = 0,
+        const float*                cameraToWorld = NULL);
+
+    /** Returns the slot of \a frame, whose AO is then invalid, for submit() to reuse */
+    void release(const Frame& frame);
+
+    /** Blocks until every submitted frame has completed */
+    void finish();
+
+    /** Frames submitted and not yet released */
+    int framesInUse();
+
+    Statistics statistics();
+};
+
+#endif // SAOFrameQueue_h
@@ -0,0 +1,184 @@
+/**
+ \file SAOPresets.h
+
+ Compile-time constants of the SAOCPU::Quality presets and their spiral tap tables.  SAOCPU.cpp instantiates one raw AO and blur kernel
+ per preset from these, and SAOCPU::shaderDefines() passes the same values to the shaders as preprocessor
+ macros, so the C++ kernels and the shader permutations cannot drift apart.
+
+ To add or retune a preset, edit the specialization here; the shaders need no change.
+
+ This file has no G3D dependency.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef SAOPresets_h
+#define SAOPresets_h
+
+#include "SAOCPU.h"
+
+/**
+ Members of each specialization:
+
+ - NUM_SAMPLES:       spiral taps per pixel (SAO_AO.pix)
+ - NUM_SPIRAL_TURNS:  turns of the tap spiral.  Should be prime and coprime to NUM_SAMPLES so that taps do not line up.
+ - LOG_MAX_OFFSET:    log2 of the tap offset in pixels beyond which a coarser MIP level is read
+ - R:                 blur taps on each side of the center (SAO_blur.pix)
+ - SCALE:             pixels between blur taps
+ - gaussian():        the R + 1 spatial blur weights, center first
+
+ The tap positions of each (NUM_SAMPLES, NUM_SPIRAL_TURNS) pair are tabulated by SAOSpiral below.
+ */
+template<int quality>
+class SAOPreset;
+
+/** Few taps with a sparse, wide blur that hides the resulting noise as a fine dither */
+template<>
+class SAOPreset<SAOCPU::LOW_QUALITY> {
+public:
+    enum {NUM_SAMPLES = 6, NUM_SPIRAL_TURNS = 5, LOG_MAX_OFFSET = 3, R = 3, SCALE = 3};
+
+    static const float* gaussian() {
+        static const float g[R + 1] = {0.153170f, 0.144893f, 0.122649f, 0.092902f};  // stddev = 2.0
+        return g;
+    }
+};
+
+
+template<>
+class SAOPreset<SAOCPU::MEDIUM_QUALITY> {
+public:
+    enum {NUM_SAMPLES = 9, NUM_SPIRAL_TURNS = 7, LOG_MAX_OFFSET = 3, R = 3, SCALE = 2};
+
+    static const float* gaussian() {
+        static const float g[R + 1] = {0.153170f, 0.144893f, 0.122649f, 0.092902f};  // stddev = 2.0
+        return g;
+    }
+};
+
+
+/** The original constants of SAO_AO.pix and SAO_blur.pix, which are also the defaults in the shader files */
+template<>
+class SAOPreset<SAOCPU::HIGH_QUALITY> {
+public:
+    enum {NUM_SAMPLES = 11, NUM_SPIRAL_TURNS = 7, LOG_MAX_OFFSET = 3, R = 4, SCALE = 2};
+
+    static const float* gaussian() {
+        static const float g[R + 1] = {0.153170f, 0.144893f, 0.122649f, 0.092902f, 0.062970f};  // stddev = 2.0
+        return g;
+    }
+};
+
+
+/** Enough taps that the blur can sample every pixel, which removes the dither of SCALE = 2 */
+template<>
+class SAOPreset<SAOCPU::ULTRA_QUALITY> {
+public:
+    enum {NUM_SAMPLES = 24, NUM_SPIRAL_TURNS = 11, LOG_MAX_OFFSET = 4, R = 6, SCALE = 1};
+
+    static const float* gaussian() {
+        static const float g[R + 1] = {0.111220f, 0.107798f, 0.098151f, 0.083953f, 0.067458f, 0.050920f, 0.036108f};  // stddev = 3.0
+        return g;
+    }
+};
+
+
+/** Compile-time sine and cosine for the SAOSpiral tables */
+class SAOSpiralMath {
+public:
+    static constexpr double PI = 3.14159265358979323846;
+
+    /** Taylor series of sin(x) from the term \a term = +/-x^(2k + 1) / (2k + 1)!; 13 terms are exact to
+        double precision for |x| <= pi */
+    static constexpr double sinSeries(double x2, double term, int k) {
+        return (k == 12) ? term : term + sinSeries(x2, -term * x2 / double((2 * k + 2) * (2 * k + 3)), k + 1);
+    }
+
+    /** x - 2 pi round(x / 2 pi) */
+    static constexpr double reduce(double x) {
+        return x - 2.0 * PI * double(static_cast<long long>(x / (2.0 * PI) + ((x >= 0.0) ? 0.5 : -0.5)));
+    }
+
+    static constexpr double sin(double x) {
+        return sinSeries(reduce(x) * reduce(x), reduce(x), 0);
+    }
+
+    static constexpr double cos(double x) {
+        return sin(x + 0.5 * PI);
+    }
+};
+
+
+template<int... i>
+class SAOIndexList {};
+
+/** SAOMakeIndexList<n>::Type is SAOIndexList<0, 1, ..., n - 1> */
+template<int n, int... i>
+class SAOMakeIndexList : public SAOMakeIndexList<n - 1, n - 1, i...> {};
+
+template<int... i>
+class SAOMakeIndexList<0, i...> {
+public:
+    typedef SAOIndexList<i...> Type;
+};
+
+
+/**
+ The unit-disk taps of SAO_AO.pix's tapLocation() without the per-pixel rotation, computed at compile time:
+ tap i is at radius alpha = (i + 0.5) / numSamples and angle alpha * numSpiralTurns * 6.28.  A pixel with
+ rotation spin reads tap i at radius[i] * (unitX[i] cos(spin) - unitY[i] sin(spin), unitX[i] sin(spin) +
+ unitY[i] cos(spin)), which replaces a sine and cosine per tap with one per pixel.
+
+ SAOCPU::shaderDefines() passes the same tables to the shaders as SPIRAL_TAPS.
+ */
+template<int numSamples, int numSpiralTurns, class Indices = typename SAOMakeIndexList<numSamples>::Type>
+class SAOSpiral;
+
+template<int numSamples, int numSpiralTurns, int... i>
+class SAOSpiral<numSamples, numSpiralTurns, SAOIndexList<i...> > {
+public:
+    static constexpr double alpha(int tap) {
+        return (tap + 0.5) / numSamples;
+    }
+
+    /** The 6.28 instead of 2 pi is from the original shader */
+    static constexpr double angle(int tap) {
+        return alpha(tap) * (numSpiralTurns * 6.28);
+    }
+
+    static constexpr float radius[numSamples] = {float(alpha(i))...};
+    static constexpr float unitX[numSamples]  = {float(SAOSpiralMath::cos(angle(i)))...};
+    static constexpr float unitY[numSamples]  = {float(SAOSpiralMath::sin(angle(i)))...};
+};
+
+template<int numSamples, int numSpiralTurns, int... i>
+constexpr float SAOSpiral<numSamples, numSpiralTurns, SAOIndexList<i...> >::radius[numSamples];
+
+template<int numSamples, int numSpiralTurns, int... i>
+constexpr float SAOSpiral<numSamples, numSpiralTurns, SAOIndexList<i...> >::unitX[numSamples];
+
+template<int numSamples, int numSpiralTurns, int... i>
+constexpr float SAOSpiral<numSamples, numSpiralTurns, SAOIndexList<i...> >::unitY[numSamples];
+
+
+/** Bounds over all presets, which size the per-frame tap tables and the padding of the AO planes */
+class SAOPresetLimits {
+public:
+    enum {
+        MAX_NUM_SAMPLES = 24,
+        MAX_BLUR_PAD    = 9
+    };
+};
+
+static_assert(int(SAOPreset<SAOCPU::LOW_QUALITY>::NUM_SAMPLES)    <= SAOPresetLimits::MAX_NUM_SAMPLES &&
+              int(SAOPreset<SAOCPU::MEDIUM_QUALITY>::NUM_SAMPLES) <= SAOPresetLimits::MAX_NUM_SAMPLES &&
+              int(SAOPreset<SAOCPU::HIGH_QUALITY>::NUM_SAMPLES)   <= SAOPresetLimits::MAX_NUM_SAMPLES &&
+              int(SAOPreset<SAOCPU::ULTRA_QUALITY>::NUM_SAMPLES)  <= SAOPresetLimits::MAX_NUM_SAMPLES,
+              "MAX_NUM_SAMPLES is too small");
+
+static_assert(int(SAOPreset<SAOCPU::LOW_QUALITY>::R)    * SAOPreset<SAOCPU::LOW_QUALITY>::SCALE    <= SAOPresetLimits::MAX_BLUR_PAD &&
+              int(SAOPreset<SAOCPU::MEDIUM_QUALITY>::R) * SAOPreset<SAOCPU::MEDIUM_QUALITY>::SCALE <= SAOPresetLimits::MAX_BLUR_PAD &&
+              int(SAOPreset<SAOCPU::HIGH_QUALITY>::R)   * SAOPreset<SAOCPU::HIGH_QUALITY>::SCALE   <= SAOPresetLimits::MAX_BLUR_PAD &&
+              int(SAOPreset<SAOCPU::ULTRA_QUALITY>::R)  * SAOPreset<SAOCPU::ULTRA_QUALITY>::SCALE  <= SAOPresetLimits::MAX_BLUR_PAD,
+              "MAX_BLUR_PAD is too small");
+
+#endif // SAOPresets_h
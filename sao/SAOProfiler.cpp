@@ -0,0 +1,179 @@
+/**
+ \file SAOProfiler.cpp
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#include "SAOProfiler.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+const char* SAOProfiler::trackName(Track t) {
+    static const char* name[TRACK_COUNT] = {"GPU", "CPU submit", "SAOCPU"};
+    return name[t];
+}
+
+
+SAOProfiler::SAOProfiler() : m_enabled(false), m_windowSize(240), m_maxEvents(100000), m_frame(0), m_epoch(Clock::now()) {}
+
+
+void SAOProfiler::setWindowSize(int n) {
+    assert(n > 0);
+    m_windowSize = n;
+    m_windows.clear();
+}
+
+
+void SAOProfiler::setMaxEvents(size_t n) {
+    m_maxEvents = n;
+    while (m_events.size() > m_maxEvents) {
+        m_events.pop_front();
+    }
+}
+
+
+double SAOProfiler::nowMicroseconds() const {
+    return std::chrono::duration<double, std::micro>(Clock::now() - m_epoch).count();
+}
+
+
+void SAOProfiler::add(const char* stage, Track track, int frame, double startMicroseconds, float milliseconds) {
+    Window* window = NULL;
+    for (size_t i = 0; (i < m_windows.size()) && (window == NULL); ++i) {
+        if ((m_windows[i].track == track) && (strcmp(m_windows[i].stage, stage) == 0)) {
+            window = &m_windows[i];
+        }
+    }
+    if (window == NULL) {
+        m_windows.push_back(Window());
+        window = &m_windows.back();
+        window->stage = stage;
+        window->track = track;
+        window->milliseconds.reserve(m_windowSize);
+        window->next  = 0;
+    }
+
+    if (int(window->milliseconds.size()) < m_windowSize) {
+        window->milliseconds.push_back(milliseconds);
+    } else {
+        window->milliseconds[window->next] = milliseconds;
+        window->next = (window->next + 1) % m_windowSize;
+    }
+
+    Event e;
+    e.stage             = stage;
+    e.track             = track;
+    e.frame             = frame;
+    e.startMicroseconds = startMicroseconds;
+    e.milliseconds      = milliseconds;
+    m_events.push_back(e);
+    if (m_events.size() > m_maxEvents) {
+        m_events.pop_front();
+    }
+}
+
+
+void SAOProfiler::recordPasses(const std::vector<SAOCPU::PassTiming>& passes, int frame, double startMicroseconds) {
+    if (! m_enabled) {
+        return;
+    }
+    for (size_t i = 0; i < passes.size(); ++i) {
+        add(passes[i].name, SAOCPU_TRACK, frame, startMicroseconds, passes[i].milliseconds);
+        startMicroseconds += 1000.0 * passes[i].milliseconds;
+    }
+}
+
+
+/** Nearest-rank percentile of sorted \a v */
+static float percentile(const std::vector<float>& v, float p) {
+    const size_t rank = size_t(std::ceil(p * float(v.size())));
+    return v[std::min(v.size() - 1, (rank > 0) ? rank - 1 : 0)];
+}
+
+
+std::vector<SAOProfiler::StageStatistics> SAOProfiler::statistics() const {
+    std::vector<StageStatistics> result;
+    std::vector<float> sorted;
+    for (size_t i = 0; i < m_windows.size(); ++i) {
+        const Window& w = m_windows[i];
+        sorted = w.milliseconds;
+        std::sort(sorted.begin(), sorted.end());
+
+        StageStatistics s;
+        s.stage   = w.stage;
+        s.track   = w.track;
+        s.samples = int(sorted.size());
+        for (size_t j = 0; j < sorted.size(); ++j) {
+            s.mean += sorted[j];
+        }
+        s.mean /= float(sorted.size());
+        s.p50 = percentile(sorted, 0.50f);
+        s.p95 = percentile(sorted, 0.95f);
+        s.p99 = percentile(sorted, 0.99f);
+        s.max = sorted.back();
+        result.push_back(s);
+    }
+    return result;
+}
+
+
+void SAOProfiler::clear() {
+    m_windows.clear();
+    m_events.clear();
+}
+
+
+bool SAOProfiler::writeChromeTrace(const std::string& filename) const {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    // Complete ("X") events in microseconds, with a named thread per track
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"SAO\"}}");
+    for (int t = 0; t < TRACK_COUNT; ++t) {
+        fprintf(file, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}", t + 1, trackName(Track(t)));
+    }
+    for (std::deque<Event>::const_iterator e = m_events.begin(); e != m_events.end(); ++e) {
+        fprintf(file, ",\n  {\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %d}}",
+                e->stage, trackName(e->track), int(e->track) + 1, e->startMicroseconds, 1000.0 * e->milliseconds, e->frame);
+    }
+    fprintf(file, "\n]}\n");
+
+    return fclose(file) == 0;
+}
+
+
+bool SAOProfiler::writeCSV(const std::string& filename) const {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "frame,track,stage,start_us,ms\n");
+    for (std::deque<Event>::const_iterator e = m_events.begin(); e != m_events.end(); ++e) {
+        fprintf(file, "%d,%s,%s,%.3f,%.4f\n", e->frame, trackName(e->track), e->stage, e->startMicroseconds, e->milliseconds);
+    }
+
+    return fclose(file) == 0;
+}
+
+
+bool SAOProfiler::writeStatisticsCSV(const std::string& filename) const {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    const std::vector<StageStatistics> stats = statistics();
+    fprintf(file, "track,stage,samples,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+    for (size_t i = 0; i < stats.size(); ++i) {
+        const StageStatistics& s = stats[i];
+        fprintf(file, "%s,%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f\n", trackName(s.track), s.stage, s.samples, s.mean, s.p50, s.p95, s.p99, s.max);
+    }
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,160 @@
+/**
+ \file SAOProfiler.h
+
+ Per-stage timing of SAO and SAOCPU with rolling percentiles and Chrome trace and CSV export.  No G3D dependency.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef SAOProfiler_h
+#define SAOProfiler_h
+
+#include "SAOCPU.h"
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ \brief Collects the duration of every stage of every frame on the GPU, the CPU thread that submits the GPU
+ stages, and SAOCPU, and keeps the last windowSize() samples of each stage for percentiles.
+
+ SAO::profiler() is filled by SAO::compute, which brackets each stage with GPU timestamp queries that are read
+ back a few frames later without stalling, and by SAO::computeCPU from SAOCPU::passTiming.  The stage names are
+ those of SAOCPU::passTiming, e.g., "reconstruct CSZ", "minify 1", "raw AO", "blur horizontal".
+
+ When disabled (the default), record() returns immediately and SAO issues no queries, so the cost is one
+ branch per stage.
+
+ writeChromeTrace() writes the events in the Trace Event Format that chrome://tracing and Perfetto load, with
+ one thread per Track.  GPU events are placed on the CPU timeline at the time their frame was submitted, offset
+ by the GPU timestamps, so gaps between GPU stages are real but the GPU track as a whole is not synchronized
+ with the CPU tracks.  writeCSV() writes the same events and writeStatisticsCSV() the percentiles.
+ */
+class SAOProfiler {
+public:
+
+    enum Track {GPU_TRACK, CPU_TRACK, SAOCPU_TRACK, TRACK_COUNT};
+
+    /** "GPU", "CPU submit", "SAOCPU" */
+    static const char* trackName(Track t);
+
+    class Event {
+    public:
+        /** A string literal, like SAOCPU::PassTiming::name */
+        const char*                 stage;
+        Track                       track;
+        int                         frame;
+
+        /** Since the profiler was created */
+        double                      startMicroseconds;
+        float                       milliseconds;
+    };
+
+    /** Over the last windowSize() frames that ran the stage */
+    class StageStatistics {
+    public:
+        const char*                 stage;
+        Track                       track;
+        int                         samples;
+        float                       mean;
+        float                       p50;
+        float                       p95;
+        float                       p99;
+        float                       max;
+
+        StageStatistics() : stage(""), track(GPU_TRACK), samples(0), mean(0), p50(0), p95(0), p99(0), max(0) {}
+    };
+
+protected:
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    /** Ring buffer of the last samples of one stage on one track */
+    class Window {
+    public:
+        const char*                 stage;
+        Track                       track;
+        std::vector<float>          milliseconds;
+        int                         next;
+    };
+
+    bool                            m_enabled;
+    int                             m_windowSize;
+    size_t                          m_maxEvents;
+    int                             m_frame;
+    Clock::time_point               m_epoch;
+
+    /** In the order in which the stages were first recorded */
+    std::vector<Window>             m_windows;
+
+    std::deque<Event>               m_events;
+
+public:
+
+    SAOProfiler();
+
+    void setEnabled(bool b) {
+        m_enabled = b;
+    }
+
+    bool enabled() const {
+        return m_enabled;
+    }
+
+    /** Samples per stage for the percentiles.  Default is 240.  Discards the current samples. */
+    void setWindowSize(int n);
+
+    int windowSize() const {
+        return m_windowSize;
+    }
+
+    /** Events kept for export; the oldest are dropped beyond this.  Default is 100000, about 5000 frames. */
+    void setMaxEvents(size_t n);
+
+    /** Starts a new frame and returns its number */
+    int beginFrame() {
+        return ++m_frame;
+    }
+
+    int frame() const {
+        return m_frame;
+    }
+
+    /** Microseconds since the profiler was created, the time base of Event::startMicroseconds */
+    double nowMicroseconds() const;
+
+    /** Adds one sample of \a stage, which must be a string literal or otherwise outlive the profiler.  Does nothing when disabled. */
+    void record(const char* stage, Track track, int frame, double startMicroseconds, float milliseconds) {
+        if (m_enabled) {
+            add(stage, track, frame, startMicroseconds, milliseconds);
+        }
+    }
+
+    /** Records the passes of one SAOCPU::compute that started at \a startMicroseconds on SAOCPU_TRACK, back to back */
+    void recordPasses(const std::vector<SAOCPU::PassTiming>& passes, int frame, double startMicroseconds);
+
+    std::vector<StageStatistics> statistics() const;
+
+    /** Oldest first */
+    const std::deque<Event>& events() const {
+        return m_events;
+    }
+
+    /** Discards all samples and events */
+    void clear();
+
+    /** Trace Event Format JSON for chrome://tracing or https://ui.perfetto.dev.  Returns false if the file cannot be written. */
+    bool writeChromeTrace(const std::string& filename) const;
+
+    /** One row per event: frame, track, stage, start in microseconds, milliseconds */
+    bool writeCSV(const std::string& filename) const;
+
+    /** One row per stage and track with the columns of StageStatistics */
+    bool writeStatisticsCSV(const std::string& filename) const;
+
+protected:
+
+    void add(const char* stage, Track track, int frame, double startMicroseconds, float milliseconds);
+};
+
+#endif // SAOProfiler_h
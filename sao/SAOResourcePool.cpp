@@ -0,0 +1,139 @@
+/**
+ \file SAOResourcePool.cpp
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#include "SAOResourcePool.h"
+
+size_t SAOResourcePool::Key::bytes() const {
+    size_t total = 0;
+    for (int i = 0; i < mipLevels; ++i) {
+        total += size_t(max(1, width >> i)) * size_t(max(1, height >> i)) * size_t(format->openGLBitsPerPixel) / 8;
+    }
+    return total;
+}
+
+
+SAOResourcePool::SAOResourcePool(size_t capacity) : m_capacity(capacity), m_maxSubRectWaste(0.5f), m_clock(0) {}
+
+
+SAOResourcePool::Ref SAOResourcePool::create(size_t capacity) {
+    return new SAOResourcePool(capacity);
+}
+
+
+const SAOResourcePool::Ref& SAOResourcePool::shared() {
+    static const Ref pool = create();
+    return pool;
+}
+
+
+bool SAOResourcePool::fits(const Key& have, const Key& want) const {
+    return have.contains(want) && (double(want.width) * double(want.height) >= (1.0 - m_maxSubRectWaste) * double(have.width) * double(have.height));
+}
+
+
+Texture::Ref SAOResourcePool::lease(const std::string& name, const Key& key, const Texture::Settings& settings, bool allowLarger) {
+    debugAssert(key.width > 0 && key.height > 0 && key.format != NULL);
+
+    // Prefer an exact match, then the smallest larger texture within the waste limit
+    int best = -1;
+    for (int i = 0; i < m_idle.size(); ++i) {
+        const Key& k = m_idle[i].key;
+        if (k == key) {
+            best = i;
+            break;
+        } else if (allowLarger && fits(k, key) && ((best == -1) || (k.bytes() < m_idle[best].key.bytes()))) {
+            best = i;
+        }
+    }
+
+    Entry entry;
+    if (best != -1) {
+        entry = m_idle[best];
+        m_idle.remove(best);
+        m_statistics.idleBytes -= entry.key.bytes();
+        if (entry.key == key) {
+            ++m_statistics.hits;
+        } else {
+            ++m_statistics.subRectHits;
+        }
+    } else {
+        entry.key     = key;
+        entry.texture = Texture::createEmpty(name, key.width, key.height, key.format, Texture::DIM_2D_NPOT, settings);
+        ++m_statistics.misses;
+    }
+
+    m_leased.append(entry);
+    m_statistics.leasedBytes += entry.key.bytes();
+
+    // A new allocation may have pushed the total over capacity
+    evict();
+
+    return entry.texture;
+}
+
+
+void SAOResourcePool::release(const Texture::Ref& texture) {
+    if (texture.isNull()) {
+        return;
+    }
+
+    for (int i = 0; i < m_leased.size(); ++i) {
+        if (m_leased[i].texture == texture) {
+            Entry entry = m_leased[i];
+            m_leased.fastRemove(i);
+            m_statistics.leasedBytes -= entry.key.bytes();
+
+            entry.lastUse = ++m_clock;
+            m_idle.append(entry);
+            m_statistics.idleBytes += entry.key.bytes();
+
+            evict();
+            return;
+        }
+    }
+
+    alwaysAssertM(false, "Released a texture that did not come from this pool");
+}
+
+
+const SAOResourcePool::Key& SAOResourcePool::keyOf(const Texture::Ref& texture) const {
+    for (int i = 0; i < m_leased.size(); ++i) {
+        if (m_leased[i].texture == texture) {
+            return m_leased[i].key;
+        }
+    }
+    alwaysAssertM(false, "Texture is not leased from this pool");
+    static const Key none;
+    return none;
+}
+
+
+void SAOResourcePool::evict() {
+    while ((m_statistics.leasedBytes + m_statistics.idleBytes > m_capacity) && (m_idle.size() > 0)) {
+        int oldest = 0;
+        for (int i = 1; i < m_idle.size(); ++i) {
+            if (m_idle[i].lastUse < m_idle[oldest].lastUse) {
+                oldest = i;
+            }
+        }
+        m_statistics.idleBytes -= m_idle[oldest].key.bytes();
+        m_idle.fastRemove(oldest);
+        ++m_statistics.evictions;
+    }
+}
+
+
+void SAOResourcePool::resetStatistics() {
+    m_statistics.hits        = 0;
+    m_statistics.subRectHits = 0;
+    m_statistics.misses      = 0;
+    m_statistics.evictions   = 0;
+}
+
+
+void SAOResourcePool::clear() {
+    m_idle.clear();
+    m_statistics.idleBytes = 0;
+}
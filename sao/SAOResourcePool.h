@@ -0,0 +1,153 @@
+/**
+ \file SAOResourcePool.h
+
+ Render targets shared by SAO instances, keyed by resolution, format, and MIP count.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef SAOResourcePool_h
+#define SAOResourcePool_h
+
+#include <G3D/G3DAll.h>
+
+/**
+ \brief LRU-bounded pool of textures that SAO instances lease their internal buffers from.
+
+ An SAO instance holds its camera-space z, raw AO, and intermediate blur buffers only while it uses them
+ at a resolution.  When it changes resolution or is destroyed, they return to the pool, where another
+ instance (e.g., the other half of a split screen, or a thumbnail renderer) can lease them again instead of
+ allocating its own set.  Idle textures are evicted least-recently-released first whenever the pool holds
+ more than capacity() bytes; leased textures are never evicted, so the pool may exceed its capacity while
+ they are in use.
+
+ lease() with \a allowLarger returns an idle texture that is larger than requested when it wastes at most
+ maxSubRectWaste() of its area, which SAO renders into with a sub-rectangle viewport.  This lets dynamic
+ resolution scale down and back up without reallocating.
+
+ Textures of the same Key must be created with the same Texture::Settings.
+
+ The pool is not thread-safe; lease and release from the rendering thread.
+ */
+class SAOResourcePool : public ReferenceCountedObject {
+public:
+    typedef ReferenceCountedPointer<class SAOResourcePool> Ref;
+
+    class Key {
+    public:
+        int                 width;
+        int                 height;
+        const ImageFormat*  format;
+        int                 mipLevels;
+
+        Key(int w = 0, int h = 0, const ImageFormat* f = NULL, int m = 1) : width(w), height(h), format(f), mipLevels(m) {}
+
+        bool operator==(const Key& other) const {
+            return (width == other.width) && (height == other.height) && (format == other.format) && (mipLevels == other.mipLevels);
+        }
+
+        /** True if a texture of this key can hold \a other in a sub-rectangle */
+        bool contains(const Key& other) const {
+            return (width >= other.width) && (height >= other.height) && (format == other.format) && (mipLevels == other.mipLevels);
+        }
+
+        /** GPU memory of all MIP levels */
+        size_t bytes() const;
+    };
+
+    class Statistics {
+    public:
+        /** lease() calls satisfied by an idle texture of exactly the requested size */
+        int             hits;
+
+        /** lease() calls satisfied by a larger idle texture */
+        int             subRectHits;
+
+        /** lease() calls that allocated */
+        int             misses;
+
+        /** Idle textures released to stay under capacity() */
+        int             evictions;
+
+        size_t          leasedBytes;
+        size_t          idleBytes;
+
+        Statistics() : hits(0), subRectHits(0), misses(0), evictions(0), leasedBytes(0), idleBytes(0) {}
+    };
+
+protected:
+
+    class Entry {
+    public:
+        Key             key;
+        Texture::Ref    texture;
+
+        /** Value of m_clock when the texture was released; larger is more recent */
+        int64           lastUse;
+    };
+
+    Array<Entry>        m_idle;
+    Array<Entry>        m_leased;
+
+    size_t              m_capacity;
+    float               m_maxSubRectWaste;
+    int64               m_clock;
+    Statistics          m_statistics;
+
+    SAOResourcePool(size_t capacity);
+
+    /** Evicts idle textures, oldest first, until the pool is within capacity() or has none left */
+    void evict();
+
+public:
+
+    /** True if a texture of \a have can hold \a want within maxSubRectWaste() */
+    bool fits(const Key& have, const Key& want) const;
+
+    /** \param capacity Bytes of leased plus idle textures above which idle ones are evicted */
+    static Ref create(size_t capacity = 256 * 1024 * 1024);
+
+    /** The pool that SAO::create() gives every instance.  It outlives the GL context, so programs should destroy
+        their SAO instances and clear() it before the context is destroyed, e.g., from GApp::onCleanup(). */
+    static const Ref& shared();
+
+    /** Returns an idle texture of \a key, or a larger one if \a allowLarger (see class documentation), or allocates
+        a new one named \a name with \a settings.  The texture is the caller's until release(); its contents are undefined. */
+    Texture::Ref lease(const std::string& name, const Key& key, const Texture::Settings& settings, bool allowLarger = false);
+
+    /** Returns \a texture, which must have come from lease(), to the idle list.  Releasing NULL does nothing. */
+    void release(const Texture::Ref& texture);
+
+    /** Key that \a texture was leased under */
+    const Key& keyOf(const Texture::Ref& texture) const;
+
+    void setCapacity(size_t bytes) {
+        m_capacity = bytes;
+        evict();
+    }
+
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    /** Largest fraction of a larger texture's area that lease() with allowLarger may leave unused.  Default is
+        0.5, which covers dynamic resolution scales down to about 70% on each axis. */
+    void setMaxSubRectWaste(float f) {
+        alwaysAssertM(f >= 0.0f && f < 1.0f, "Waste must be on [0, 1)");
+        m_maxSubRectWaste = f;
+    }
+
+    float maxSubRectWaste() const {
+        return m_maxSubRectWaste;
+    }
+
+    const Statistics& statistics() const {
+        return m_statistics;
+    }
+
+    void resetStatistics();
+
+    /** Releases every idle texture */
+    void clear();
+};
+
+#endif // SAOResourcePool_h
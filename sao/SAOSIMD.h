@@ -0,0 +1,402 @@
+/**
+ \file SAOSIMD.h
+
+ Thin wrapper over SSE4.1/AVX2 intrinsics used by the CPU implementation of SAO (SAOCPU).
+ The kernels in SAOCPU.cpp are written once against SAOSIMD::Float and SAOSIMD::Int, and the
+ instruction set is chosen at compile time:
+
+   - AVX2 (8 lanes) when compiled with <code>-mavx2 -mfma</code> or <code>/arch:AVX2</code>
+   - SSE4.1 (4 lanes) when compiled with <code>-msse4.1</code> or <code>/arch:AVX</code>
+   - Portable 4-lane emulation otherwise (the compiler is left to auto-vectorize)
+
+ The lane count is always even so that the 2x2 "quad" operations that emulate ddx/ddy in the
+ AO pass can pair adjacent lanes.
+
+ This file has no G3D dependency so that SAOCPU can be built on headless machines.
+ */
+#ifndef SAOSIMD_h
+#define SAOSIMD_h
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#   define SAO_SIMD_AVX2 1
+#   include <immintrin.h>
+#elif defined(__SSE4_1__) || defined(__AVX__)
+#   define SAO_SIMD_SSE41 1
+#   include <smmintrin.h>
+#else
+#   define SAO_SIMD_PORTABLE 1
+#endif
+
+#if defined(_MSC_VER)
+#   define SAO_FORCEINLINE __forceinline
+#else
+#   define SAO_FORCEINLINE inline __attribute__((always_inline))
+#endif
+
+namespace SAOSIMD {
+
+#if defined(SAO_SIMD_AVX2)
+//////////////////////////////////////////////////////////////////////////////////////
+// AVX2
+
+static const int WIDTH = 8;
+
+inline const char* name() { return "AVX2"; }
+
+class Int;
+
+/** Eight floats, or an eight-lane comparison mask */
+class Float {
+public:
+    __m256 v;
+    SAO_FORCEINLINE Float() {}
+    SAO_FORCEINLINE Float(__m256 x) : v(x) {}
+    SAO_FORCEINLINE Float(float x) : v(_mm256_set1_ps(x)) {}
+
+    static SAO_FORCEINLINE Float load(const float* p) { return _mm256_loadu_ps(p); }
+    SAO_FORCEINLINE void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+    /** (0, 1, 2, ...) */
+    static SAO_FORCEINLINE Float laneIndex() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+
+    /** Exchanges lanes 2i and 2i + 1 */
+    SAO_FORCEINLINE Float swapPairs() const { return _mm256_permute_ps(v, 0xB1); }
+
+    SAO_FORCEINLINE float lane(int i) const { float t[WIDTH]; store(t); return t[i]; }
+};
+
+/** Eight 32-bit signed integers */
+class Int {
+public:
+    __m256i v;
+    SAO_FORCEINLINE Int() {}
+    SAO_FORCEINLINE Int(__m256i x) : v(x) {}
+    SAO_FORCEINLINE Int(int x) : v(_mm256_set1_epi32(x)) {}
+
+    static SAO_FORCEINLINE Int laneIndex() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+    SAO_FORCEINLINE void store(int* p) const { _mm256_storeu_si256((__m256i*)p, v); }
+};
+
+SAO_FORCEINLINE Float operator+(Float a, Float b) { return _mm256_add_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator-(Float a, Float b) { return _mm256_sub_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator*(Float a, Float b) { return _mm256_mul_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator/(Float a, Float b) { return _mm256_div_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator&(Float a, Float b) { return _mm256_and_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator|(Float a, Float b) { return _mm256_or_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator<(Float a, Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+SAO_FORCEINLINE Float operator<=(Float a, Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+SAO_FORCEINLINE Float operator>=(Float a, Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+SAO_FORCEINLINE Float operator==(Float a, Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+
+/** Multiply-add a * b + c */
+SAO_FORCEINLINE Float madd(Float a, Float b, Float c) {
+#   if defined(__FMA__)
+        return _mm256_fmadd_ps(a.v, b.v, c.v);
+#   else
+        return _mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v);
+#   endif
+}
+
+/** Returns b wherever a is NaN, matching the IEEE maxNum behavior of GPU max() when b is the constant */
+SAO_FORCEINLINE Float max(Float a, Float b) { return _mm256_max_ps(a.v, b.v); }
+SAO_FORCEINLINE Float min(Float a, Float b) { return _mm256_min_ps(a.v, b.v); }
+SAO_FORCEINLINE Float abs(Float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+SAO_FORCEINLINE Float sqrt(Float a) { return _mm256_sqrt_ps(a.v); }
+SAO_FORCEINLINE Float floor(Float a) { return _mm256_floor_ps(a.v); }
+SAO_FORCEINLINE Float round(Float a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+/** mask ? a : b */
+SAO_FORCEINLINE Float select(Float mask, Float a, Float b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+SAO_FORCEINLINE bool any(Float mask) { return _mm256_movemask_ps(mask.v) != 0; }
+SAO_FORCEINLINE bool all(Float mask) { return _mm256_movemask_ps(mask.v) == 0xFF; }
+
+SAO_FORCEINLINE Int operator+(Int a, Int b) { return _mm256_add_epi32(a.v, b.v); }
+SAO_FORCEINLINE Int operator-(Int a, Int b) { return _mm256_sub_epi32(a.v, b.v); }
+SAO_FORCEINLINE Int operator*(Int a, Int b) { return _mm256_mullo_epi32(a.v, b.v); }
+SAO_FORCEINLINE Int operator^(Int a, Int b) { return _mm256_xor_si256(a.v, b.v); }
+SAO_FORCEINLINE Int operator&(Int a, Int b) { return _mm256_and_si256(a.v, b.v); }
+SAO_FORCEINLINE Int operator|(Int a, Int b) { return _mm256_or_si256(a.v, b.v); }
+SAO_FORCEINLINE Int operator==(Int a, Int b) { return _mm256_cmpeq_epi32(a.v, b.v); }
+SAO_FORCEINLINE Int min(Int a, Int b) { return _mm256_min_epi32(a.v, b.v); }
+SAO_FORCEINLINE Int max(Int a, Int b) { return _mm256_max_epi32(a.v, b.v); }
+template<int s> SAO_FORCEINLINE Int shiftRight(Int a) { return _mm256_srai_epi32(a.v, s); }
+template<int s> SAO_FORCEINLINE Int shiftLeft(Int a) { return _mm256_slli_epi32(a.v, s); }
+
+SAO_FORCEINLINE Float toFloat(Int a) { return _mm256_cvtepi32_ps(a.v); }
+/** Truncates toward zero, like a GLSL int() conversion */
+SAO_FORCEINLINE Int truncate(Float a) { return _mm256_cvttps_epi32(a.v); }
+SAO_FORCEINLINE Int asInt(Float a) { return _mm256_castps_si256(a.v); }
+SAO_FORCEINLINE Float asFloat(Int a) { return _mm256_castsi256_ps(a.v); }
+
+SAO_FORCEINLINE Float gather(const float* base, Int index) { return _mm256_i32gather_ps(base, index.v, 4); }
+SAO_FORCEINLINE Int gather(const int* base, Int index) { return _mm256_i32gather_epi32(base, index.v, 4); }
+
+/** An eight-entry lookup table held in a register */
+typedef Int Table8;
+
+/** Returns table[index] for index on [0, 7] */
+SAO_FORCEINLINE Int lookup8(Table8 table, Int index) { return _mm256_permutevar8x32_epi32(table.v, index.v); }
+SAO_FORCEINLINE Table8 loadTable8(const int* table) { return _mm256_loadu_si256((const __m256i*)table); }
+
+/** Reduces each lane to [-pi, pi] using double precision, which is required because
+    the AlchemyAO rotation hash produces angles up to ~10^8 radians */
+SAO_FORCEINLINE Float reduceAngle(Float a) {
+    const __m256d twoPi    = _mm256_set1_pd(6.283185307179586476925286766559);
+    const __m256d invTwoPi = _mm256_set1_pd(0.15915494309189533576888376337251);
+    __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(a.v));
+    __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(a.v, 1));
+    lo = _mm256_sub_pd(lo, _mm256_mul_pd(twoPi, _mm256_round_pd(_mm256_mul_pd(lo, invTwoPi), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)));
+    hi = _mm256_sub_pd(hi, _mm256_mul_pd(twoPi, _mm256_round_pd(_mm256_mul_pd(hi, invTwoPi), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)));
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1);
+}
+
+#elif defined(SAO_SIMD_SSE41)
+//////////////////////////////////////////////////////////////////////////////////////
+// SSE4.1
+
+static const int WIDTH = 4;
+
+inline const char* name() { return "SSE4.1"; }
+
+class Float {
+public:
+    __m128 v;
+    SAO_FORCEINLINE Float() {}
+    SAO_FORCEINLINE Float(__m128 x) : v(x) {}
+    SAO_FORCEINLINE Float(float x) : v(_mm_set1_ps(x)) {}
+
+    static SAO_FORCEINLINE Float load(const float* p) { return _mm_loadu_ps(p); }
+    SAO_FORCEINLINE void store(float* p) const { _mm_storeu_ps(p, v); }
+
+    static SAO_FORCEINLINE Float laneIndex() { return _mm_setr_ps(0, 1, 2, 3); }
+    SAO_FORCEINLINE Float swapPairs() const { return _mm_shuffle_ps(v, v, 0xB1); }
+    SAO_FORCEINLINE float lane(int i) const { float t[WIDTH]; store(t); return t[i]; }
+};
+
+class Int {
+public:
+    __m128i v;
+    SAO_FORCEINLINE Int() {}
+    SAO_FORCEINLINE Int(__m128i x) : v(x) {}
+    SAO_FORCEINLINE Int(int x) : v(_mm_set1_epi32(x)) {}
+
+    static SAO_FORCEINLINE Int laneIndex() { return _mm_setr_epi32(0, 1, 2, 3); }
+    SAO_FORCEINLINE void store(int* p) const { _mm_storeu_si128((__m128i*)p, v); }
+};
+
+SAO_FORCEINLINE Float operator+(Float a, Float b) { return _mm_add_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator-(Float a, Float b) { return _mm_sub_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator*(Float a, Float b) { return _mm_mul_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator/(Float a, Float b) { return _mm_div_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator&(Float a, Float b) { return _mm_and_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator|(Float a, Float b) { return _mm_or_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator<(Float a, Float b) { return _mm_cmplt_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator<=(Float a, Float b) { return _mm_cmple_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator>=(Float a, Float b) { return _mm_cmpge_ps(a.v, b.v); }
+SAO_FORCEINLINE Float operator==(Float a, Float b) { return _mm_cmpeq_ps(a.v, b.v); }
+
+SAO_FORCEINLINE Float madd(Float a, Float b, Float c) { return _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v); }
+SAO_FORCEINLINE Float max(Float a, Float b) { return _mm_max_ps(a.v, b.v); }
+SAO_FORCEINLINE Float min(Float a, Float b) { return _mm_min_ps(a.v, b.v); }
+SAO_FORCEINLINE Float abs(Float a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+SAO_FORCEINLINE Float sqrt(Float a) { return _mm_sqrt_ps(a.v); }
+SAO_FORCEINLINE Float floor(Float a) { return _mm_floor_ps(a.v); }
+SAO_FORCEINLINE Float round(Float a) { return _mm_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+SAO_FORCEINLINE Float select(Float mask, Float a, Float b) { return _mm_blendv_ps(b.v, a.v, mask.v); }
+SAO_FORCEINLINE bool any(Float mask) { return _mm_movemask_ps(mask.v) != 0; }
+SAO_FORCEINLINE bool all(Float mask) { return _mm_movemask_ps(mask.v) == 0xF; }
+
+SAO_FORCEINLINE Int operator+(Int a, Int b) { return _mm_add_epi32(a.v, b.v); }
+SAO_FORCEINLINE Int operator-(Int a, Int b) { return _mm_sub_epi32(a.v, b.v); }
+SAO_FORCEINLINE Int operator*(Int a, Int b) { return _mm_mullo_epi32(a.v, b.v); }
+SAO_FORCEINLINE Int operator^(Int a, Int b) { return _mm_xor_si128(a.v, b.v); }
+SAO_FORCEINLINE Int operator&(Int a, Int b) { return _mm_and_si128(a.v, b.v); }
+SAO_FORCEINLINE Int operator|(Int a, Int b) { return _mm_or_si128(a.v, b.v); }
+SAO_FORCEINLINE Int operator==(Int a, Int b) { return _mm_cmpeq_epi32(a.v, b.v); }
+SAO_FORCEINLINE Int min(Int a, Int b) { return _mm_min_epi32(a.v, b.v); }
+SAO_FORCEINLINE Int max(Int a, Int b) { return _mm_max_epi32(a.v, b.v); }
+template<int s> SAO_FORCEINLINE Int shiftRight(Int a) { return _mm_srai_epi32(a.v, s); }
+template<int s> SAO_FORCEINLINE Int shiftLeft(Int a) { return _mm_slli_epi32(a.v, s); }
+
+SAO_FORCEINLINE Float toFloat(Int a) { return _mm_cvtepi32_ps(a.v); }
+SAO_FORCEINLINE Int truncate(Float a) { return _mm_cvttps_epi32(a.v); }
+SAO_FORCEINLINE Int asInt(Float a) { return _mm_castps_si128(a.v); }
+SAO_FORCEINLINE Float asFloat(Int a) { return _mm_castsi128_ps(a.v); }
+
+SAO_FORCEINLINE Float gather(const float* base, Int index) {
+    return _mm_setr_ps(base[_mm_extract_epi32(index.v, 0)], base[_mm_extract_epi32(index.v, 1)],
+                       base[_mm_extract_epi32(index.v, 2)], base[_mm_extract_epi32(index.v, 3)]);
+}
+
+SAO_FORCEINLINE Int gather(const int* base, Int index) {
+    return _mm_setr_epi32(base[_mm_extract_epi32(index.v, 0)], base[_mm_extract_epi32(index.v, 1)],
+                          base[_mm_extract_epi32(index.v, 2)], base[_mm_extract_epi32(index.v, 3)]);
+}
+
+/** Eight-entry lookup table.  SSE4.1 has no lane permute for 32-bit elements, so this stays in memory */
+class Table8 {
+public:
+    int t[8];
+};
+
+SAO_FORCEINLINE Table8 loadTable8(const int* table) { Table8 r; std::memcpy(r.t, table, sizeof(r.t)); return r; }
+SAO_FORCEINLINE Int lookup8(const Table8& table, Int index) { return gather(table.t, index); }
+
+SAO_FORCEINLINE Float reduceAngle(Float a) {
+    const __m128d twoPi    = _mm_set1_pd(6.283185307179586476925286766559);
+    const __m128d invTwoPi = _mm_set1_pd(0.15915494309189533576888376337251);
+    __m128d lo = _mm_cvtps_pd(a.v);
+    __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(a.v, a.v));
+    lo = _mm_sub_pd(lo, _mm_mul_pd(twoPi, _mm_round_pd(_mm_mul_pd(lo, invTwoPi), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)));
+    hi = _mm_sub_pd(hi, _mm_mul_pd(twoPi, _mm_round_pd(_mm_mul_pd(hi, invTwoPi), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)));
+    return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+}
+
+#else
+//////////////////////////////////////////////////////////////////////////////////////
+// Portable
+
+static const int WIDTH = 4;
+
+inline const char* name() { return "portable"; }
+
+class Float {
+public:
+    float v[WIDTH];
+    SAO_FORCEINLINE Float() {}
+    SAO_FORCEINLINE Float(float x) { for (int i = 0; i < WIDTH; ++i) { v[i] = x; } }
+
+    static SAO_FORCEINLINE Float load(const float* p) { Float r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+    SAO_FORCEINLINE void store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+
+    static SAO_FORCEINLINE Float laneIndex() { Float r; for (int i = 0; i < WIDTH; ++i) { r.v[i] = float(i); } return r; }
+    SAO_FORCEINLINE Float swapPairs() const { Float r; for (int i = 0; i < WIDTH; ++i) { r.v[i] = v[i ^ 1]; } return r; }
+    SAO_FORCEINLINE float lane(int i) const { return v[i]; }
+};
+
+class Int {
+public:
+    int32_t v[WIDTH];
+    SAO_FORCEINLINE Int() {}
+    SAO_FORCEINLINE Int(int x) { for (int i = 0; i < WIDTH; ++i) { v[i] = x; } }
+
+    static SAO_FORCEINLINE Int laneIndex() { Int r; for (int i = 0; i < WIDTH; ++i) { r.v[i] = i; } return r; }
+    SAO_FORCEINLINE void store(int* p) const { std::memcpy(p, v, sizeof(v)); }
+};
+
+#define SAO_SIMD_LANEWISE(T, expr) T r; for (int i = 0; i < WIDTH; ++i) { r.v[i] = (expr); } return r
+
+/** Comparison masks are all-ones or all-zeros bit patterns, like the hardware versions */
+SAO_FORCEINLINE float maskBits(bool b) { uint32_t u = b ? 0xFFFFFFFFu : 0u; float f; std::memcpy(&f, &u, 4); return f; }
+SAO_FORCEINLINE bool maskBit(float f) { uint32_t u; std::memcpy(&u, &f, 4); return (u & 0x80000000u) != 0; }
+SAO_FORCEINLINE float bitAnd(float a, float b) { uint32_t x, y; std::memcpy(&x, &a, 4); std::memcpy(&y, &b, 4); x &= y; std::memcpy(&a, &x, 4); return a; }
+SAO_FORCEINLINE float bitOr(float a, float b) { uint32_t x, y; std::memcpy(&x, &a, 4); std::memcpy(&y, &b, 4); x |= y; std::memcpy(&a, &x, 4); return a; }
+
+SAO_FORCEINLINE Float operator+(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, a.v[i] + b.v[i]); }
+SAO_FORCEINLINE Float operator-(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, a.v[i] - b.v[i]); }
+SAO_FORCEINLINE Float operator*(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, a.v[i] * b.v[i]); }
+SAO_FORCEINLINE Float operator/(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, a.v[i] / b.v[i]); }
+SAO_FORCEINLINE Float operator&(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, bitAnd(a.v[i], b.v[i])); }
+SAO_FORCEINLINE Float operator|(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, bitOr(a.v[i], b.v[i])); }
+SAO_FORCEINLINE Float operator<(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, maskBits(a.v[i] < b.v[i])); }
+SAO_FORCEINLINE Float operator<=(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, maskBits(a.v[i] <= b.v[i])); }
+SAO_FORCEINLINE Float operator>=(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, maskBits(a.v[i] >= b.v[i])); }
+SAO_FORCEINLINE Float operator==(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, maskBits(a.v[i] == b.v[i])); }
+
+SAO_FORCEINLINE Float madd(const Float& a, const Float& b, const Float& c) { SAO_SIMD_LANEWISE(Float, a.v[i] * b.v[i] + c.v[i]); }
+/** Same NaN convention as maxps: returns b when either argument is NaN */
+SAO_FORCEINLINE Float max(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, (a.v[i] > b.v[i]) ? a.v[i] : b.v[i]); }
+SAO_FORCEINLINE Float min(const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, (a.v[i] < b.v[i]) ? a.v[i] : b.v[i]); }
+SAO_FORCEINLINE Float abs(const Float& a) { SAO_SIMD_LANEWISE(Float, std::fabs(a.v[i])); }
+SAO_FORCEINLINE Float sqrt(const Float& a) { SAO_SIMD_LANEWISE(Float, std::sqrt(a.v[i])); }
+SAO_FORCEINLINE Float floor(const Float& a) { SAO_SIMD_LANEWISE(Float, std::floor(a.v[i])); }
+SAO_FORCEINLINE Float round(const Float& a) { SAO_SIMD_LANEWISE(Float, float(std::floor(double(a.v[i]) + 0.5))); }
+SAO_FORCEINLINE Float select(const Float& mask, const Float& a, const Float& b) { SAO_SIMD_LANEWISE(Float, maskBit(mask.v[i]) ? a.v[i] : b.v[i]); }
+SAO_FORCEINLINE bool any(const Float& mask) { bool r = false; for (int i = 0; i < WIDTH; ++i) { r = r || maskBit(mask.v[i]); } return r; }
+SAO_FORCEINLINE bool all(const Float& mask) { bool r = true; for (int i = 0; i < WIDTH; ++i) { r = r && maskBit(mask.v[i]); } return r; }
+
+SAO_FORCEINLINE Int operator+(const Int& a, const Int& b) { SAO_SIMD_LANEWISE(Int, a.v[i] + b.v[i]); }
+SAO_FORCEINLINE Int operator-(const Int& a, const Int& b) { SAO_SIMD_LANEWISE(Int, a.v[i] - b.v[i]); }
+SAO_FORCEINLINE Int operator*(const Int& a, const Int& b) { SAO_SIMD_LANEWISE(Int, a.v[i] * b.v[i]); }
+SAO_FORCEINLINE Int operator^(const Int& a, const Int& b) { SAO_SIMD_LANEWISE(Int, a.v[i] ^ b.v[i]); }
+SAO_FORCEINLINE Int operator&(const Int& a, const Int& b) { SAO_SIMD_LANEWISE(Int, a.v[i] & b.v[i]); }
+SAO_FORCEINLINE Int operator|(const Int& a, const Int& b) { SAO_SIMD_LANEWISE(Int, a.v[i] | b.v[i]); }
+SAO_FORCEINLINE Int operator==(const Int& a, const Int& b) { SAO_SIMD_LANEWISE(Int, (a.v[i] == b.v[i]) ? -1 : 0); }
+SAO_FORCEINLINE Int min(const Int& a, const Int& b) { SAO_SIMD_LANEWISE(Int, (a.v[i] < b.v[i]) ? a.v[i] : b.v[i]); }
+SAO_FORCEINLINE Int max(const Int& a, const Int& b) { SAO_SIMD_LANEWISE(Int, (a.v[i] > b.v[i]) ? a.v[i] : b.v[i]); }
+template<int s> SAO_FORCEINLINE Int shiftRight(const Int& a) { SAO_SIMD_LANEWISE(Int, a.v[i] >> s); }
+template<int s> SAO_FORCEINLINE Int shiftLeft(const Int& a) { SAO_SIMD_LANEWISE(Int, int32_t(uint32_t(a.v[i]) << s)); }
+
+SAO_FORCEINLINE Float toFloat(const Int& a) { SAO_SIMD_LANEWISE(Float, float(a.v[i])); }
+SAO_FORCEINLINE Int truncate(const Float& a) { SAO_SIMD_LANEWISE(Int, int32_t(a.v[i])); }
+SAO_FORCEINLINE Int asInt(const Float& a) { Int r; std::memcpy(r.v, a.v, sizeof(r.v)); return r; }
+SAO_FORCEINLINE Float asFloat(const Int& a) { Float r; std::memcpy(r.v, a.v, sizeof(r.v)); return r; }
+
+SAO_FORCEINLINE Float gather(const float* base, const Int& index) { SAO_SIMD_LANEWISE(Float, base[index.v[i]]); }
+SAO_FORCEINLINE Int gather(const int* base, const Int& index) { SAO_SIMD_LANEWISE(Int, base[index.v[i]]); }
+
+class Table8 {
+public:
+    int t[8];
+};
+
+SAO_FORCEINLINE Table8 loadTable8(const int* table) { Table8 r; std::memcpy(r.t, table, sizeof(r.t)); return r; }
+SAO_FORCEINLINE Int lookup8(const Table8& table, const Int& index) { return gather(table.t, index); }
+
+SAO_FORCEINLINE Float reduceAngle(const Float& a) {
+    SAO_SIMD_LANEWISE(Float, float(double(a.v[i]) - 6.283185307179586476925286766559 * std::floor(double(a.v[i]) * 0.15915494309189533576888376337251 + 0.5)));
+}
+
+#undef SAO_SIMD_LANEWISE
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Shared
+
+SAO_FORCEINLINE Float clamp(const Float& x, const Float& lo, const Float& hi) { return min(max(x, lo), hi); }
+SAO_FORCEINLINE Int clamp(const Int& x, const Int& lo, const Int& hi) { return min(max(x, lo), hi); }
+
+/** Returns floor(log2(x)) for positive normalized x by reading the exponent field */
+SAO_FORCEINLINE Int floorLog2(const Float& x) {
+    return shiftRight<23>(asInt(x)) - Int(127);
+}
+
+/** Sets \a s = sin(x) and \a c = cos(x).  Accurate to about 2 ulp for |x| < 100, which is
+    the range used by the AO spiral after reduceAngle(). Cephes-style quadrant reduction and minimax polynomials. */
+SAO_FORCEINLINE void sincos(const Float& x, Float& s, Float& c) {
+    const Float j = round(x * Float(0.63661977236758134308f));
+    // Three-part Cody-Waite reduction by pi/2
+    Float r = madd(j, Float(-1.5703125f), x);
+    r = madd(j, Float(-4.837512969970703125e-4f), r);
+    r = madd(j, Float(-7.549789948768648e-8f), r);
+
+    const Float r2 = r * r;
+    Float ps = madd(r2, Float(-1.9515295891e-4f), Float(8.3321608736e-3f));
+    ps = madd(ps, r2, Float(-1.6666654611e-1f));
+    ps = madd(ps * r2, r, r);
+
+    Float pc = madd(r2, Float(2.443315711809948e-5f), Float(-1.388731625493765e-3f));
+    pc = madd(pc, r2, Float(4.166664568298827e-2f));
+    pc = madd(pc * r2, r2, madd(r2, Float(-0.5f), Float(1.0f)));
+
+    // Quadrant selection: q = j mod 4
+    const Int q = truncate(j) & Int(3);
+    const Float swap = asFloat((q & Int(1)) == Int(1));
+    const Float sinNeg = asFloat((q & Int(2)) == Int(2));
+    const Float cosNeg = asFloat(((q + Int(1)) & Int(2)) == Int(2));
+
+    const Float sv = select(swap, pc, ps);
+    const Float cv = select(swap, ps, pc);
+    const Float signBit(-0.0f);
+    s = asFloat(asInt(sv) ^ asInt(sinNeg & signBit));
+    c = asFloat(asInt(cv) ^ asInt(cosNeg & signBit));
+}
+
+} // namespace SAOSIMD
+
+#endif // SAOSIMD_h
@@ -1,103 +1,1125 @@
 #include "Scene.h"
+#include "ModelCache.h"
+#include "SceneIndex.h"
+#include "ThreadPool.h"
+#include <condition_variable>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 using namespace G3D::units;
 
 
+/** Splines per chunk of Scene::onSimulation; a multiple of EntityAnimation::PADDING */
+static const int ANIMATION_CHUNK_SIZE = 1024;
+
+/** Entities per chunk of Scene::onPose */
+static const int POSE_CHUNK_SIZE = 256;
+
+
+Scene::~Scene() {
+    delete m_threadPool;
+}
+
+
+ThreadPool& Scene::threadPool() {
+    if (m_threadPool == NULL) {
+        m_threadPool = new ThreadPool();
+    }
+    return *m_threadPool;
+}
+
+
+void Scene::forEachChunk(int count, const std::function<void (int)>& task) {
+    if (count == 1) {
+        task(0);
+    } else if (count > 1) {
+        threadPool().parallelFor(count, [&task](int chunk, int worker) { (void)worker; task(chunk); });
+    }
+}
+
+
+static CFrame toCFrame(const float m[12]) {
+    return CFrame(Matrix3(m[0], m[1], m[2], m[4], m[5], m[6], m[8], m[9], m[10]), Vector3(m[3], m[7], m[11]));
+}
+
+
 void Scene::onSimulation(GameTime deltaTime) {
     m_time += deltaTime;
-    for (int i = 0; i < m_entityArray.size(); ++i) {
-        m_entityArray[i]->onSimulation(m_time, deltaTime);
+
+    const float time = float(m_time);
+    forEachChunk((m_animation.size() + ANIMATION_CHUNK_SIZE - 1) / ANIMATION_CHUNK_SIZE, [this, time](int chunk) {
+        const int begin = chunk * ANIMATION_CHUNK_SIZE;
+        const int end   = min(m_animation.size(), begin + ANIMATION_CHUNK_SIZE);
+        m_animation.evaluate(time, begin, end);
+        for (int i = begin; i < end; ++i) {
+            Entity* entity = m_animatedEntity[i];
+            if (entity != NULL) {
+                float m[12];
+                m_animation.frame(i, m);
+                entity->setSimulatedFrame(toCFrame(m));
+            }
+        }
+    });
+
+    for (int i = 0; i < m_serialEntity.size(); ++i) {
+        m_serialEntity[i]->onSimulation(m_time, deltaTime);
     }
+    updateBVH();
 }
 
 
-/** Returns a table mapping scene names to filenames */
-static Table<std::string, std::string>& filenameTable() {
-    static Table<std::string, std::string> filenameTable;
+void Scene::setFrameSpline(const Entity::Ref& entity, const PhysicsFrameSpline& spline) {
+    entity->setFrameSpline(spline);
+    const int i = m_animatedEntity.findIndex(entity.pointer());
+    if (i != -1) {
+        m_animation.remove(i);
+        m_animatedEntity[i] = NULL;
+    }
+    if (! m_serialEntity.contains(entity.pointer())) {
+        m_serialEntity.append(entity.pointer());
+    }
+}
 
-    if (filenameTable.size() == 0) {
-        // Create a table mapping scene names to filenames
-        Array<std::string> filenameArray;
 
-        FileSystem::ListSettings settings;
-        settings.files = true;
-        settings.directories = false;
-        settings.includeParentPath = true;
-        settings.recursive = true;
+/** True if \a animation reproduces G3D's evaluation of \a spline, which is spline \a s of it, before, during,
+    and after its control points */
+static bool matches(const EntityAnimation& animation, int s, const PhysicsFrameSpline& spline) {
+    const int N = spline.control.size();
+    Array<float> sampleTime;
+    sampleTime.append(spline.time[0] - 0.5f * (spline.time[1] - spline.time[0]));
+    for (int i = 0; i + 1 < N; i += max(1, N / 4)) {
+        sampleTime.append(0.5f * (spline.time[i] + spline.time[i + 1]));
+    }
+    sampleTime.append(spline.time[N - 1] + 0.3f * (spline.time[N - 1] - spline.time[N - 2]));
+    sampleTime.append(spline.time[N - 1] + 2.7f * (spline.time[N - 1] - spline.time[0]));
 
-        FileSystem::list("*.scn.any", filenameArray, settings);
+    for (int i = 0; i < sampleTime.size(); ++i) {
+        const CFrame expected = spline.evaluate(sampleTime[i]).toCoordinateFrame();
+        float m[12];
+        animation.evaluateScalar(s, sampleTime[i], m);
+        const CFrame actual = toCFrame(m);
+        if ((actual.translation - expected.translation).length() > 1e-3f * (1.0f + expected.translation.length())) {
+            return false;
+        }
+        for (int r = 0; r < 3; ++r) {
+            if ((actual.rotation.row(r) - expected.rotation.row(r)).length() > 1e-3f) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
 
-        logLazyPrintf("Found scenes:\n");
-        for (int i = 0; i < filenameArray.size(); ++i) {
-            Any a;
-            std::string msg;
-            try {
-                a.load(filenameArray[i]);
-                
-                const std::string& name = a["name"].string();
-                alwaysAssertM(! filenameTable.containsKey(name),
-                              "Duplicate scene names in " + filenameArray[i] + " and " +
-                              filenameTable[name]);
-                
-                msg = format("  \"%s\" (%s)\n", name.c_str(), filenameArray[i].c_str());
-                filenameTable.set(name, filenameArray[i]);
-            } catch (const ParseError& e) {
-                msg = format("  <Parse error at %s:%d(%d): %s>\n", e.filename.c_str(), e.line, e.character, e.message.c_str());
-            } catch (...) {
-                msg = format("  <Error while loading %s>\n", filenameArray[i].c_str());
+
+void Scene::buildAnimation() {
+    m_animation.clear();
+    m_animatedEntity.clear();
+    m_serialEntity.clear();
+    m_parallelPoseEntity.clear();
+    m_serialPoseEntity.clear();
+
+    int mismatched = 0;
+    Array<float> time;
+    Array<EntityAnimation::Control> control;
+    for (int e = 0; e < m_entityArray.size(); ++e) {
+        Entity* entity = m_entityArray[e].pointer();
+        (entity->articulatedModel().notNull() ? m_parallelPoseEntity : m_serialPoseEntity).append(entity);
+
+        const PhysicsFrameSpline& spline = entity->frameSpline();
+        if (entity->articulatedModel().isNull() || entity->hasPoseSpline()) {
+            // GEntity::onSimulation() also advances the pose, e.g., the keyframes of MD2 and MD3 models
+            m_serialEntity.append(entity);
+            continue;
+        }
+        if (spline.control.size() < 2) {
+            // Never moves; onSimulation() once more makes the previous frame equal the frame
+            entity->onSimulation(m_time, 0);
+            continue;
+        }
+
+        time.fastClear();
+        control.resize(spline.control.size());
+        for (int i = 0; i < spline.control.size(); ++i) {
+            const PhysicsFrame& f = spline.control[i];
+            for (int k = 0; k < 3; ++k) {
+                control[i].translation[k] = f.translation[k];
             }
+            control[i].rotation[0] = f.rotation.x;
+            control[i].rotation[1] = f.rotation.y;
+            control[i].rotation[2] = f.rotation.z;
+            control[i].rotation[3] = f.rotation.w;
+            time.append(spline.time[i]);
+        }
+        const int s = m_animation.add(time.getCArray(), control.getCArray(), control.size(), spline.cyclic, spline.finalInterval);
+        m_animatedEntity.append(entity);
+        if (! matches(m_animation, s, spline)) {
+            m_animation.remove(s);
+            m_animatedEntity[s] = NULL;
+            m_serialEntity.append(entity);
+            ++mismatched;
+        }
+    }
+    if (mismatched > 0) {
+        logPrintf("Scene: %d frame splines differ from EntityAnimation and are evaluated one at a time\n", mismatched);
+    }
+}
+
+
+/** Row-major 3 x 4, as SceneBVH takes it */
+static void toRowMajor(const CFrame& frame, float m[12]) {
+    const Matrix3& R = frame.rotation;
+    const Vector3& t = frame.translation;
+    const float r[12] = {
+        R[0][0], R[0][1], R[0][2], t.x,
+        R[1][0], R[1][1], R[1][2], t.y,
+        R[2][0], R[2][1], R[2][2], t.z};
+    System::memcpy(m, r, sizeof(r));
+}
+
+
+/** The triangles of \a model in its default pose, in object space */
+static void getTriangles(const ArticulatedModel::Ref& model, Array<Vector3>& position, Array<uint32>& index) {
+    // Parents before their children, so that each part's cframe composes with its parent's
+    Array<ArticulatedModel::Part*> part;
+    part.append(model->rootArray());
+    for (int i = 0; i < part.size(); ++i) {
+        part.append(part[i]->childArray());
+    }
+
+    Table<const ArticulatedModel::Part*, CFrame> partToObject;
+    Table<const ArticulatedModel::Part*, int> firstVertex;
+    for (int i = 0; i < part.size(); ++i) {
+        const ArticulatedModel::Part* p = part[i];
+        const CFrame frame = p->isRoot() ? p->cframe : partToObject[p->parent()] * p->cframe;
+        partToObject.set(p, frame);
+        firstVertex.set(p, position.size());
+        const CPUVertexArray& vertex = p->cpuVertexArray;
+        for (int v = 0; v < vertex.size(); ++v) {
+            position.append(frame.pointToWorldSpace(vertex.vertex[v].position));
+        }
+    }
+
+    const Array<ArticulatedModel::Mesh*>& mesh = model->meshArray();
+    for (int i = 0; i < mesh.size(); ++i) {
+        const ArticulatedModel::Mesh* m = mesh[i];
+        if (m->primitive != PrimitiveType::TRIANGLES) {
+            continue;
+        }
+        const int base = firstVertex[m->logicalPart];
+        for (int j = 0; j < m->cpuIndexArray.size(); ++j) {
+            index.append(uint32(base + m->cpuIndexArray[j]));
+        }
+    }
+}
+
+
+static int addToBVH(const ArticulatedModel::Ref& model, SceneBVH& bvh) {
+    Array<Vector3> position;
+    Array<uint32> index;
+    getTriangles(model, position, index);
+    return bvh.addMesh(position.getCArray(), sizeof(Vector3), position.size(), index.getCArray(), index.size());
+}
+
+
+void Scene::buildBVH() {
+    m_bvh.clear();
+    m_bvhEntity.clear();
+    m_bvhFrame.clear();
+    m_linearEntity.clear();
+
+    // Entities that share a model share its triangle BVH, which holds the default pose, so entities
+    // whose pose is animated are tested with their posed geometry instead
+    Table<const ArticulatedModel*, int> meshIndex;
+    for (int e = 0; e < m_entityArray.size(); ++e) {
+        const Entity::Ref& entity = m_entityArray[e];
+        const ArticulatedModel::Ref& model = entity->articulatedModel();
+        if (model.isNull() || entity->hasPoseSpline()) {
+            m_linearEntity.append(entity);
+            continue;
+        }
+        if (! meshIndex.containsKey(model.pointer())) {
+            meshIndex.set(model.pointer(), addToBVH(model, m_bvh));
+        }
+        float m[12];
+        toRowMajor(entity->frame(), m);
+        m_bvh.addInstance(meshIndex[model.pointer()], m);
+        m_bvhEntity.append(entity);
+        m_bvhFrame.append(entity->frame());
+    }
+    m_bvh.update();
+}
+
+
+void Scene::updateBVH() {
+    bool moved = false;
+    for (int i = 0; i < m_bvhEntity.size(); ++i) {
+        const CFrame& frame = m_bvhEntity[i]->frame();
+        if (frame != m_bvhFrame[i]) {
+            float m[12];
+            toRowMajor(frame, m);
+            m_bvh.setTransform(i, m);
+            m_bvhFrame[i] = frame;
+            moved = true;
+        }
+    }
+    if (moved) {
+        m_bvh.update();
+    }
+}
+
+
+/** Occluder triangles kept per model, largest first */
+static const int MAX_OCCLUDER_TRIANGLES = 4096;
+
+/** Occluder triangles have at least the area of a square of this fraction of their model's bounding box diagonal */
+static const float OCCLUDER_SIZE = 0.02f;
+
+void Scene::buildCulling() {
+    m_culling.clear();
+    m_occluderEntity.clear();
+    m_occluderMesh.clear();
+
+    Table<const ArticulatedModel*, int> meshIndex;
+    for (int e = 0; e < m_entityArray.size(); ++e) {
+        Entity* entity = m_entityArray[e].pointer();
+        const ArticulatedModel::Ref& model = entity->articulatedModel();
+        if (model.isNull() || entity->hasPoseSpline()) {
+            continue;
+        }
+        if (! meshIndex.containsKey(model.pointer())) {
+            Array<Vector3> position;
+            Array<uint32> index;
+            getTriangles(model, position, index);
+            AABox bounds;
+            if (position.size() > 0) {
+                bounds = AABox(position[0]);
+                for (int v = 1; v < position.size(); ++v) {
+                    bounds.merge(position[v]);
+                }
+            }
+            const float minArea = square(OCCLUDER_SIZE * bounds.extent().length());
+            meshIndex.set(model.pointer(), m_culling.addOccluderMesh(position.getCArray(), sizeof(Vector3), position.size(),
+                                                                     index.getCArray(), index.size(), minArea, MAX_OCCLUDER_TRIANGLES));
+        }
+        m_occluderEntity.append(entity);
+        m_occluderMesh.append(meshIndex[model.pointer()]);
+    }
+}
+
+
+/** Triangles of \a surface for SceneCulling::Statistics, or 0 if it is not a SuperSurface */
+static uint32 triangleCount(const Surface::Ref& surface) {
+    const SuperSurface* s = dynamic_cast<const SuperSurface*>(surface.pointer());
+    return ((s != NULL) && s->gpuGeom().notNull()) ? uint32(s->gpuGeom()->index.size() / 3) : 0;
+}
+
+
+void Scene::cull(const Array<Surface::Ref>& surfaceArray, const GCamera& camera, const Rect2D& viewport, Array<Surface::Ref>& visibleArray) {
+    Matrix4 P;
+    camera.getProjectUnitMatrix(viewport, P);
+    const Matrix4 viewProjection = P * camera.coordinateFrame().inverse().toMatrix4();
+    float m[16];
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            m[r * 4 + c] = viewProjection[r][c];
+        }
+    }
+    m_culling.beginFrame(m);
+
+    for (int i = 0; i < m_occluderEntity.size(); ++i) {
+        float objectToWorld[12];
+        toRowMajor(m_occluderEntity[i]->frame(), objectToWorld);
+        m_culling.addOccluder(m_occluderMesh[i], objectToWorld);
+    }
+
+    m_cullBoxes.clear();
+    m_cullSurface.fastClear();
+    for (int s = 0; s < surfaceArray.size(); ++s) {
+        const Surface::Ref& surface = surfaceArray[s];
+        CFrame frame;
+        AABox box;
+        surface->getCoordinateFrame(frame);
+        surface->getObjectSpaceBoundingBox(box);
+        if (! box.isFinite()) {
+            visibleArray.append(surface);
+            continue;
+        }
+
+        Vector3 lo = Vector3::inf(), hi = -Vector3::inf();
+        for (int c = 0; c < 8; ++c) {
+            const Vector3 p = frame.pointToWorldSpace(box.corner(c));
+            lo = lo.min(p);
+            hi = hi.max(p);
+        }
+        m_cullBoxes.append(&lo.x, &hi.x, triangleCount(surface));
+        m_cullSurface.append(s);
+    }
+
+    m_culling.cull(m_cullBoxes, m_cullResult);
+    for (int i = 0; i < m_cullSurface.size(); ++i) {
+        if (m_cullResult[i] == SceneCulling::VISIBLE) {
+            visibleArray.append(surfaceArray[m_cullSurface[i]]);
+        }
+    }
+}
+
+
+/** Where the scene index is kept between launches, relative to the working directory */
+static const char* SCENE_INDEX_FILENAME = "scene.index";
+
+
+/** The scene files under the working directory.  startSceneScan() loads SCENE_INDEX_FILENAME at once and
+    refreshes it on a background thread, which never touches G3D; the other functions read it on the main
+    thread under the mutex. */
+class SceneCatalog {
+public:
+    std::mutex                          mutex;
+    std::condition_variable             scanFinished;
+    bool                                started;
+    bool                                scanning;
+    int                                 version;
+
+    /** Scene name to filename */
+    std::map<std::string, std::string>  filename;
+
+    /** Scene name to its entry in the index, with the modification time and size of the file when it was read */
+    std::map<std::string, SceneIndex::Entry> entry;
+
+    /** Written by the scan and printed to the log by the main thread */
+    std::string                         log;
 
-            if (! msg.empty()) {
-                logLazyPrintf("%s", msg.c_str());
-                debugPrintf("%s", msg.c_str());
+    std::thread                         thread;
+
+    SceneCatalog() : started(false), scanning(false), version(0) {}
+
+    ~SceneCatalog() {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    /** Replaces the table with the named entries of \a index.  Called with the mutex locked. */
+    void set(const SceneIndex& index) {
+        std::map<std::string, std::string> table;
+        entry.clear();
+        log = "Found scenes:\n";
+        for (size_t i = 0; i < index.entries().size(); ++i) {
+            const SceneIndex::Entry& e = index.entries()[i];
+            std::string msg;
+            if (e.name.empty()) {
+                msg = "  <" + e.error + ">\n";
+            } else if (table.count(e.name) > 0) {
+                // Entries are sorted by path, so the first file with a name keeps it on every launch
+                msg = "  <Duplicate scene name \"" + e.name + "\" in " + e.path + " ignored; it is in " + table[e.name] + ">\n";
+            } else {
+                msg = "  \"" + e.name + "\" (" + e.path + ")\n";
+                table[e.name] = e.path;
+                entry[e.name] = e;
             }
+            log += msg;
         }
-        logPrintf("");
+        if (table != filename) {
+            filename.swap(table);
+            ++version;
+        }
+    }
+
+    /** Prints the log of the last scan.  Called on the main thread with the mutex locked. */
+    void flushLog() {
+        if (! log.empty()) {
+            logLazyPrintf("%s", log.c_str());
+            debugPrintf("%s", log.c_str());
+            logPrintf("");
+            log.clear();
+        }
+    }
+};
+
+
+static SceneCatalog& sceneCatalog() {
+    static SceneCatalog catalog;
+    return catalog;
+}
+
+
+void Scene::startSceneScan() {
+    SceneCatalog& catalog = sceneCatalog();
+    std::lock_guard<std::mutex> lock(catalog.mutex);
+    if (catalog.started) {
+        return;
     }
+    catalog.started  = true;
+    catalog.scanning = true;
+
+    // The names of the last launch are available at once; the scan adds, removes, and renames scenes when it finishes
+    std::shared_ptr<SceneIndex> index(new SceneIndex());
+    if (index->load(SCENE_INDEX_FILENAME)) {
+        catalog.set(*index);
+        catalog.log.clear();
+    }
+
+    catalog.thread = std::thread([index, &catalog]() {
+        std::string error, msg;
+        if (index->refresh(".", error)) {
+            const SceneIndex::Statistics& s = index->statistics();
+            msg = format("Scene index: %d files, %d read, %.1f ms\n", s.files, s.read, s.listMilliseconds + s.readMilliseconds);
+            if ((s.read > 0) && ! index->save(SCENE_INDEX_FILENAME, error)) {
+                msg += error + "\n";
+            }
+        } else {
+            msg = error + "\n";
+        }
 
-    return filenameTable;
+        std::lock_guard<std::mutex> lock(catalog.mutex);
+        catalog.set(*index);
+        catalog.log += msg;
+        catalog.scanning = false;
+        catalog.scanFinished.notify_all();
+    });
+}
+
+
+void Scene::finishSceneScan() {
+    startSceneScan();
+    SceneCatalog& catalog = sceneCatalog();
+    std::unique_lock<std::mutex> lock(catalog.mutex);
+    catalog.scanFinished.wait(lock, [&catalog]() { return ! catalog.scanning; });
+    catalog.flushLog();
+}
+
+
+int Scene::sceneNamesVersion() {
+    startSceneScan();
+    SceneCatalog& catalog = sceneCatalog();
+    std::lock_guard<std::mutex> lock(catalog.mutex);
+    catalog.flushLog();
+    return catalog.version;
 }
 
 
 Array<std::string> Scene::sceneNames() {
+    startSceneScan();
+    SceneCatalog& catalog = sceneCatalog();
+    std::lock_guard<std::mutex> lock(catalog.mutex);
+    catalog.flushLog();
+
+    // std::map is sorted by name
     Array<std::string> a;
-    filenameTable().getKeys(a);
-    a.sort();
+    for (std::map<std::string, std::string>::const_iterator it = catalog.filename.begin(); it != catalog.filename.end(); ++it) {
+        a.append(it->first);
+    }
     return a;
 }
 
 
+/** The file of the scene named \a name.  Waits for the scan if the index of the last launch does not have the
+    name, or if its file is gone or has changed since, because the file may have been moved, renamed, or given
+    another name.  Returns false if there is none. */
+static bool sceneFilename(const std::string& name, std::string& filename) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (attempt == 1) {
+            Scene::finishSceneScan();
+        }
+        SceneCatalog& catalog = sceneCatalog();
+        std::lock_guard<std::mutex> lock(catalog.mutex);
+        std::map<std::string, SceneIndex::Entry>::const_iterator it = catalog.entry.find(name);
+        if (it == catalog.entry.end()) {
+            continue;
+        }
+        const SceneIndex::Entry& e = it->second;
+        int64_t  modifiedTime = 0;
+        uint64_t bytes = 0;
+        const bool unchanged = SceneIndex::status(e.path, modifiedTime, bytes) && (modifiedTime == e.modifiedTime) && (bytes == e.bytes) && ! e.recent;
+        if (unchanged || ! catalog.scanning) {
+            filename = e.path;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** Runs jobs on a ThreadPool from a background thread, so that the thread that starts them keeps working.
+    The jobs must not touch OpenGL, FileSystem, or anything else that is not thread-safe, and must not throw. */
+class BackgroundJobs {
+protected:
+    ThreadPool                              m_pool;
+    std::vector< std::function<void ()> >   m_jobs;
+    std::thread                             m_thread;
+
+public:
+
+    void add(const std::function<void ()>& job) {
+        m_jobs.push_back(job);
+    }
+
+    void start() {
+        m_thread = std::thread([this]() {
+            m_pool.parallelFor(int(m_jobs.size()), [this](int index, int worker) { (void)worker; m_jobs[index](); });
+        });
+    }
+
+    /** Blocks until every job has run */
+    void finish() {
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    /** Also when create() throws, because std::thread must not be destroyed while joinable */
+    ~BackgroundJobs() {
+        finish();
+    }
+};
+
+
+/** The six faces of a cube map that is named with a wildcard, read and decoded by BackgroundJobs */
+class DecodedCubeMap {
+public:
+    /** The wildcard filename from the scene file, e.g., "uffizi05_*.jpg" */
+    std::string             pattern;
+
+    /** Resolved on the render thread, in Texture::CubeFace order */
+    std::string             filename[6];
+    Texture::CubeMapInfo    info;
+
+    GImage                  face[6];
+
+    /** Empty if the face decoded.  One per face, because the faces are decoded concurrently. */
+    std::string             error[6];
+
+    DecodedCubeMap(const std::string& p) : pattern(p) {
+        std::string before, after;
+        Texture::splitFilenameAtWildCard(pattern, before, after);
+        info = Texture::cubeMapInfo(Texture::determineCubeConvention(pattern));
+        for (int f = 0; f < 6; ++f) {
+            filename[f] = System::findDataFile(before + info.face[f].suffix + after, false);
+            if (filename[f].empty()) {
+                error[f] = "Cannot find " + before + info.face[f].suffix + after;
+            }
+        }
+    }
+
+    /** Reads and decodes face \a f and orients it as Texture::fromFile would.  Runs on a worker thread. */
+    void decode(int f) {
+        if (filename[f].empty()) {
+            return;
+        }
+        std::ifstream file(filename[f].c_str(), std::ios::binary);
+        const std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (bytes.empty()) {
+            error[f] = "Cannot read " + filename[f];
+            return;
+        }
+        try {
+            face[f] = GImage((const uint8*)&bytes[0], int(bytes.size()));
+            if (info.face[f].flipX) {
+                face[f].flipHorizontal();
+            }
+            if (info.face[f].flipY) {
+                face[f].flipVertical();
+            }
+            face[f].rotate90CW(info.face[f].rotations);
+        } catch (const GImage::Error& e) {
+            error[f] = filename[f] + ": " + e.reason;
+        }
+    }
+
+    /** Uploads the faces, or has G3D load \a source if any of them failed.  Runs on the render thread. */
+    Texture::Ref upload(const Any& source) const {
+        for (int f = 0; f < 6; ++f) {
+            if (! error[f].empty()) {
+                debugPrintf("%s; loading %s serially\n", error[f].c_str(), pattern.c_str());
+                return Texture::create(source);
+            }
+        }
+
+        const ImageFormat* format = 
+            (face[0].channels() == 4) ? ImageFormat::RGBA8() : 
+            (face[0].channels() == 3) ? ImageFormat::RGB8() : ImageFormat::L8();
+        Array< Array<const void*> > bytes;
+        bytes.resize(1);
+        bytes[0].resize(6);
+        for (int f = 0; f < 6; ++f) {
+            bytes[0][f] = face[f].byte();
+        }
+        return Texture::fromMemory(pattern, bytes, format, face[0].width(), face[0].height(), 1, 
+                                   ImageFormat::AUTO(), Texture::DIM_CUBE_MAP, Texture::Settings::cubeMap());
+    }
+};
+
+
+/** Reads \a filename into the OS file cache ahead of the model loader, which then does not wait on the disk.
+    Runs on a worker thread. */
+static void readAhead(const std::string& filename) {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    std::vector<char> buffer(1 << 20);
+    while (file.read(&buffer[0], buffer.size()) || (file.gcount() > 0)) {}
+}
+
+
+/** The file on disk that holds the model of \a spec, i.e., the archive for "x.zip/y.obj", or "" if it has none */
+static std::string modelFile(const Any& spec) {
+    if ((spec.type() != Any::TABLE) || ! spec.containsKey("filename") || (spec["filename"].type() != Any::STRING)) {
+        return "";
+    }
+    std::string filename = spec["filename"].string();
+    const size_t zip = toLower(filename).find(".zip/");
+    if (zip != std::string::npos) {
+        filename = filename.substr(0, zip + 4);
+    }
+    return System::findDataFile(filename, false);
+}
+
+
+/** True if \a texture is a cube map filename with a wildcard, which create() decodes in parallel */
+static bool isCubeMapPattern(const Any& texture) {
+    return (texture.type() == Any::STRING) && (texture.string().find('*') != std::string::npos);
+}
+
+
+/** Directory of the ModelCache files written by loadArticulatedModel(), relative to the working directory */
+static const char* MODEL_CACHE_DIRECTORY = "modelcache";
+
+
+/** True if the ArticulatedModel of \a spec can be rebuilt from a ModelCache: an OBJ file whose materials come
+    unchanged from its MTL files, and whose preprocess only transforms, removes, or changes the sidedness of
+    geometry */
+static bool isCacheable(const Any& spec) {
+    if ((spec.type() != Any::TABLE) || ! spec.containsKey("filename") || ! endsWith(toLower(spec["filename"].string()), ".obj") ||
+        spec.get("stripMaterials", false)) {
+        return false;
+    }
+    if (spec.containsKey("preprocess")) {
+        const Any& preprocess = spec["preprocess"];
+        for (int i = 0; i < preprocess.size(); ++i) {
+            const std::string& n = preprocess[i].name();
+            if ((n != "scale") && (n != "setCFrame") && (n != "transformCFrame") && (n != "transformGeometry") && 
+                (n != "moveCenterToOrigin") && (n != "moveBaseToOrigin") && (n != "removeMesh") && (n != "removePart") && 
+                (n != "setTwoSided")) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+/** Hashes the MTL files that the plain OBJ file \a objFilename names with mtllib into \a key, as parseMaterials()
+    finds them, so that editing one rebuilds the cache.  A missing file hashes as its name.  Returns false and sets
+    \a error if the OBJ or an MTL file cannot be read. */
+static bool hashMaterialFiles(const std::string& objFilename, uint64_t& key, std::string& error) {
+    std::ifstream obj(objFilename.c_str(), std::ios::binary);
+    if (! obj) {
+        error = "Cannot open " + objFilename;
+        return false;
+    }
+    const std::string directory = filenamePath(objFilename);
+    std::string lineText;
+    while (std::getline(obj, lineText)) {
+        std::istringstream line(lineText);
+        std::string keyword, name;
+        if ((line >> keyword) && (keyword == "mtllib")) {
+            while (line >> name) {
+                const std::string mtlFilename = directory + name;
+                if (std::ifstream(mtlFilename.c_str()).good()) {
+                    if (! ModelCache::hashFile(mtlFilename, key, error, key)) {
+                        return false;
+                    }
+                } else {
+                    key = ModelCache::hash(mtlFilename.c_str(), mtlFilename.size(), key);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+
+/** Appends the materials of the MTL files that the OBJ \a objFilename names with mtllib to \a cache */
+static void parseMaterials(const std::string& objFilename, ModelCache::Builder& cache) {
+    BinaryInput obj(objFilename, G3D_LITTLE_ENDIAN);
+    std::istringstream input(std::string((const char*)obj.getCArray(), size_t(obj.size())));
+    std::string lineText;
+    while (std::getline(input, lineText)) {
+        std::istringstream line(lineText);
+        std::string keyword, name;
+        if ((line >> keyword) && (keyword == "mtllib")) {
+            while (line >> name) {
+                const std::string mtlFilename = filenamePath(objFilename) + name;
+                if (FileSystem::exists(mtlFilename)) {
+                    BinaryInput mtl(mtlFilename, G3D_LITTLE_ENDIAN);
+                    cache.parseMTL(std::string((const char*)mtl.getCArray(), size_t(mtl.size())), filenamePath(mtlFilename));
+                }
+            }
+        }
+    }
+}
+
+
+/** Fills \a cache from the parts and meshes of \a model, whose meshes are named after their MTL materials as
+    G3D's OBJ loader names them.  Returns false and sets \a reason if \a model cannot be cached. */
+static bool toModelCache(const ArticulatedModel::Ref& model, ModelCache::Builder& cache, std::string& reason) {
+    alwaysAssertM(sizeof(CPUVertexArray::Vertex) == sizeof(ModelCache::Vertex), "ModelCache::Vertex must match CPUVertexArray::Vertex");
+
+    // Parents before their children
+    Array<ArticulatedModel::Part*> part;
+    part.append(model->rootArray());
+    for (int i = 0; i < part.size(); ++i) {
+        part.append(part[i]->childArray());
+    }
+
+    Table<const ArticulatedModel::Part*, int> partIndex;
+    for (int i = 0; i < part.size(); ++i) {
+        const ArticulatedModel::Part* p = part[i];
+        partIndex.set(p, i);
+
+        ModelCache::Part c;
+        c.name   = cache.addString(p->name);
+        c.parent = p->isRoot() ? -1 : partIndex[p->parent()];
+        const Matrix3& R = p->cframe.rotation;
+        const Vector3& t = p->cframe.translation;
+        const float cframe[12] = {
+            R[0][0], R[0][1], R[0][2], t.x,
+            R[1][0], R[1][1], R[1][2], t.y,
+            R[2][0], R[2][1], R[2][2], t.z};
+        System::memcpy(c.cframe, cframe, sizeof(cframe));
+
+        const CPUVertexArray& vertex = p->cpuVertexArray;
+        c.firstVertex = uint32(cache.vertices.size());
+        c.vertexCount = uint32(vertex.size());
+        cache.vertices.resize(cache.vertices.size() + vertex.size());
+        if (vertex.size() > 0) {
+            System::memcpy(&cache.vertices[c.firstVertex], vertex.vertex.getCArray(), vertex.size() * sizeof(ModelCache::Vertex));
+        }
+        if (! vertex.hasTangent) {
+            cache.flags &= ~ModelCache::HAS_TANGENTS;
+        }
+        if (! vertex.hasTexCoord0) {
+            cache.flags &= ~ModelCache::HAS_TEXCOORDS;
+        }
+        cache.parts.push_back(c);
+    }
+
+    const Array<ArticulatedModel::Mesh*>& mesh = model->meshArray();
+    for (int i = 0; i < mesh.size(); ++i) {
+        const ArticulatedModel::Mesh* m = mesh[i];
+        ModelCache::Mesh c;
+        c.name     = cache.addString(m->name);
+        c.part     = partIndex[m->logicalPart];
+        c.material = cache.findMaterial(m->name);
+        if (m->primitive != PrimitiveType::TRIANGLES) {
+            reason = "mesh " + m->name + " is not a triangle list";
+            return false;
+        }
+        if (c.material == -1) {
+            reason = "mesh " + m->name + " has no MTL material of the same name";
+            return false;
+        }
+        c.firstIndex = uint32(cache.indices.size());
+        c.indexCount = uint32(m->cpuIndexArray.size());
+        c.twoSided   = m->twoSided ? 1 : 0;
+        cache.indices.insert(cache.indices.end(), m->cpuIndexArray.begin(), m->cpuIndexArray.end());
+        cache.meshes.push_back(c);
+    }
+    return true;
+}
+
+
+/** The material that G3D's OBJ loader makes of an MTL material */
+static Material::Ref toMaterial(const ModelCache& cache, const ModelCache::Material& m) {
+    Material::Specification s;
+
+    const Color3 diffuse(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
+    if (m.diffuseMap != 0) {
+        Texture::Specification lambertian;
+        lambertian.filename      = cache.string(m.diffuseMap);
+        lambertian.alphaFilename = cache.string(m.opacityMap);
+        lambertian.desiredFormat = ImageFormat::SRGBA8();
+        s.setLambertian(lambertian);
+    } else {
+        s.setLambertian(Color4(diffuse, m.opacity));
+    }
+
+    const Color3 specular(m.specular[0], m.specular[1], m.specular[2]);
+    if (m.specularMap != 0) {
+        s.setSpecular(cache.string(m.specularMap), specular);
+    } else {
+        s.setSpecular(specular);
+    }
+    s.setGlossyExponentShininess(m.shininess);
+
+    if (m.bumpMap != 0) {
+        BumpMap::Settings bump;
+        bump.scale = 0.05f * m.bumpScale;
+        s.setBump(cache.string(m.bumpMap), bump);
+    }
+
+    const Color3 emissive(m.emissive[0], m.emissive[1], m.emissive[2]);
+    if (emissive.max() > 0) {
+        s.setEmissive(emissive);
+    }
+
+    return Material::create(s);
+}
+
+
+/** Rebuilds the ArticulatedModel that toModelCache() stored.  The vertex and index arrays are copied from the
+    mapping with one memcpy each, because ArticulatedModel keeps its own CPU arrays for upload and ray casts. */
+static ArticulatedModel::Ref fromModelCache(const std::string& name, const ModelCache& cache) {
+    alwaysAssertM(sizeof(CPUVertexArray::Vertex) == sizeof(ModelCache::Vertex), "ModelCache::Vertex must match CPUVertexArray::Vertex");
+    ArticulatedModel::Ref model = ArticulatedModel::createEmpty(name);
+
+    Array<ArticulatedModel::Part*> part;
+    part.resize(cache.partCount());
+    for (int i = 0; i < cache.partCount(); ++i) {
+        const ModelCache::Part& c = cache.part(i);
+        part[i] = model->addPart(cache.string(c.name), (c.parent >= 0) ? part[c.parent] : NULL);
+        part[i]->cframe = CoordinateFrame(
+            Matrix3(c.cframe[0], c.cframe[1], c.cframe[2],
+                    c.cframe[4], c.cframe[5], c.cframe[6],
+                    c.cframe[8], c.cframe[9], c.cframe[10]),
+            Vector3(c.cframe[3], c.cframe[7], c.cframe[11]));
+
+        CPUVertexArray& vertex = part[i]->cpuVertexArray;
+        vertex.vertex.resize(c.vertexCount);
+        if (c.vertexCount > 0) {
+            System::memcpy(vertex.vertex.getCArray(), cache.vertices() + c.firstVertex, c.vertexCount * sizeof(ModelCache::Vertex));
+        }
+        vertex.hasTangent   = cache.hasTangents();
+        vertex.hasTexCoord0 = cache.hasTexCoords();
+    }
+
+    Array<Material::Ref> material;
+    material.resize(cache.materialCount());
+    for (int i = 0; i < cache.meshCount(); ++i) {
+        const ModelCache::Mesh& c = cache.mesh(i);
+        ArticulatedModel::Mesh* mesh = model->addMesh(cache.string(c.name), part[c.part]);
+        if (c.material >= 0) {
+            if (material[c.material].isNull()) {
+                material[c.material] = toMaterial(cache, cache.material(c.material));
+            }
+            mesh->material = material[c.material];
+        } else {
+            mesh->material = Material::create(Material::Specification());
+        }
+        mesh->primitive = PrimitiveType::TRIANGLES;
+        mesh->twoSided  = (c.twoSided != 0);
+        mesh->cpuIndexArray.resize(c.indexCount);
+        if (c.indexCount > 0) {
+            System::memcpy(mesh->cpuIndexArray.getCArray(), cache.indices() + c.firstIndex, c.indexCount * sizeof(uint32));
+        }
+    }
+
+    return model;
+}
+
+
+/** The ModelCache of one cacheable ArticulatedModel.  The constructor resolves the files on the render thread;
+    lookup() hashes them and maps the cache on a BackgroundJobs worker, or reads the source into the OS file
+    cache for G3D's loader when there is no valid cache. */
+class ModelCacheLookup {
+protected:
+    std::promise<void>      m_done;
+    std::future<void>       m_future;
+
+public:
+    /** The file on disk that holds the model, i.e., the archive for "x.zip/y.obj" */
+    std::string             source;
+    bool                    zip;
+    std::string             specification;
+    std::string             cacheFilename;
+
+    /** Set by lookup().  Without \a hashed, \a error says why the model cannot be cached. */
+    bool                    hashed;
+    uint64_t                key;
+    bool                    loaded;
+    ModelCache              cache;
+    std::string             error;
+
+    ModelCacheLookup(const std::string& sceneName, const std::string& name, const Any& spec) : 
+        source(modelFile(spec)), specification(spec.unparse()), hashed(false), key(0), loaded(false) {
+        m_future = m_done.get_future();
+        zip = ! endsWith(toLower(source), ".obj");
+
+        // Scene and model names may contain spaces and punctuation
+        cacheFilename = sceneName + "-" + name;
+        for (size_t i = 0; i < cacheFilename.size(); ++i) {
+            if (! isalnum((unsigned char)cacheFilename[i]) && (cacheFilename[i] != '-')) {
+                cacheFilename[i] = '_';
+            }
+        }
+        cacheFilename = std::string(MODEL_CACHE_DIRECTORY) + "/" + cacheFilename + ModelCache::extension();
+    }
+
+    /** Runs on a worker thread */
+    void lookup() {
+        // The key covers the whole source file (the zip for "x.zip/y.obj", which holds its MTL files), the MTL
+        // files of a plain OBJ, and the specification, including its preprocess
+        hashed = ModelCache::hashFile(source, key, error) && (zip || hashMaterialFiles(source, key, error));
+        if (hashed) {
+            key    = ModelCache::hash(specification.c_str(), specification.size(), key);
+            loaded = cache.load(cacheFilename, key, error);
+        }
+        if (! loaded) {
+            readAhead(source);
+        }
+        m_done.set_value();
+    }
+
+    /** Blocks until lookup() has run */
+    void wait() {
+        m_future.wait();
+    }
+};
+
+
+/** ArticulatedModel::create(\a spec), from the ModelCache that \a lookup mapped when it was built from the same
+    model and MTL files and specification.  Otherwise loads the model with G3D and writes the cache for the next
+    launch.  \a lookup is NULL for models that cannot be cached.  Sets \a fromCache. */
+static ArticulatedModel::Ref loadArticulatedModel(const std::string& name, const Any& spec, ModelCacheLookup* lookup, bool& fromCache) {
+    fromCache = false;
+    if (lookup == NULL) {
+        return ArticulatedModel::create(spec);
+    }
+
+    lookup->wait();
+    if (lookup->loaded) {
+        fromCache = true;
+        return fromModelCache(name, lookup->cache);
+    }
+    if (! lookup->hashed) {
+        debugPrintf("%s\n", lookup->error.c_str());
+        return ArticulatedModel::create(spec);
+    }
+    if (FileSystem::exists(lookup->cacheFilename)) {
+        debugPrintf("Rebuilding the model cache: %s\n", lookup->error.c_str());
+    }
+
+    const ArticulatedModel::Ref model = ArticulatedModel::create(spec);
+
+    ModelCache::Builder cache;
+    std::string reason, error;
+    parseMaterials(System::findDataFile(spec["filename"].string()), cache);
+    if (toModelCache(model, cache, reason)) {
+        FileSystem::createDirectory(MODEL_CACHE_DIRECTORY);
+        if (! cache.write(lookup->cacheFilename, lookup->key, error)) {
+            debugPrintf("%s\n", error.c_str());
+        }
+    } else {
+        debugPrintf("Not caching model %s: %s\n", name.c_str(), reason.c_str());
+    }
+    return model;
+}
+
+
+/** Appends the time since \a start to \a phases as \a name, and restarts \a start */
+static void endPhase(Array<Scene::LoadPhase>& phases, const std::string& name, RealTime& start) {
+    const RealTime now = System::time();
+    phases.append(Scene::LoadPhase(name, now - start));
+    start = now;
+}
+
+
 Scene::Ref Scene::create(const std::string& scene, GCamera& camera) {
     if (scene == "") {
         return NULL;
     }
 
     Scene::Ref s = new Scene();
+    const RealTime loadStart = System::time();
+    RealTime phaseStart = loadStart;
 
-    const std::string* f = filenameTable().getPointer(scene);
-    if (f == NULL) {
+    std::string filename;
+    if (! sceneFilename(scene, filename)) {
         throw "No scene with name '" + scene + "' found in (" + 
-            stringJoin(filenameTable().getKeys(), ", ") + ")";
+            stringJoin(sceneNames(), ", ") + ")";
     }
-    const std::string& filename = *f;
 
     Any any;
     any.load(filename);
     s->m_sourceAny = any;
+    endPhase(s->m_loadPhases, "parse " + filename, phaseStart);
+
+    // Start the work that does not need the GL context: look up the model caches first, because the models are
+    // created next, then decode the cube maps and read the other model files ahead for G3D's loaders
+    BackgroundJobs background;
+    Any models = any["models"];
+    Table< std::string, std::shared_ptr<ModelCacheLookup> > lookups;
+    for (Any::AnyTable::Iterator it = models.table().begin(); it.isValid(); ++it) {
+        const Any& v = it->value;
+        if (v.nameBeginsWith("ArticulatedModel") && isCacheable(v) && ! modelFile(v).empty()) {
+            const std::shared_ptr<ModelCacheLookup> lookup(new ModelCacheLookup(scene, it->key, v));
+            lookups.set(it->key, lookup);
+            background.add([lookup]() { lookup->lookup(); });
+        }
+    }
+
+    std::vector< std::shared_ptr<DecodedCubeMap> > cubeMaps;
+    Any lighting = any.get("lighting", Lighting::Specification());
+    Any environmentMap, skyBoxTexture;
+    Array<std::string> cubeMapPatterns;
+    if ((lighting.type() == Any::TABLE) && lighting.containsKey("environmentMap") && (lighting["environmentMap"].type() == Any::TABLE) &&
+        lighting["environmentMap"].containsKey("texture") && isCubeMapPattern(lighting["environmentMap"]["texture"])) {
+        environmentMap = lighting["environmentMap"];
+        cubeMapPatterns.append(environmentMap["texture"].string());
+    }
+    if (any.containsKey("skyBox") && (any["skyBox"].type() == Any::TABLE) && 
+        any["skyBox"].containsKey("texture") && isCubeMapPattern(any["skyBox"]["texture"])) {
+        skyBoxTexture = any["skyBox"]["texture"];
+        cubeMapPatterns.append(skyBoxTexture.string());
+    }
+    Table<std::string, int> cubeMapIndex;
+    for (int i = 0; i < cubeMapPatterns.size(); ++i) {
+        if (! cubeMapIndex.containsKey(cubeMapPatterns[i])) {
+            cubeMapIndex.set(cubeMapPatterns[i], int(cubeMaps.size()));
+            const std::shared_ptr<DecodedCubeMap> cube(new DecodedCubeMap(cubeMapPatterns[i]));
+            cubeMaps.push_back(cube);
+            for (int f = 0; f < 6; ++f) {
+                background.add([cube, f]() { cube->decode(f); });
+            }
+        }
+    }
 
-    // Load the lighting
-    s->m_lighting = Lighting::create(any.get("lighting", Lighting::Specification()));
+    for (Any::AnyTable::Iterator it = models.table().begin(); it.isValid(); ++it) {
+        const std::string file = modelFile(it->value);
+        if (! file.empty() && ! lookups.containsKey(it->key)) {
+            background.add([file]() { readAhead(file); });
+        }
+    }
+    background.start();
+
+    // Load the lighting, without the environment map if it is being decoded
+    if (! environmentMap.isNil()) {
+        Any withoutEnvironmentMap(Any::TABLE, lighting.name());
+        for (Any::AnyTable::Iterator it = lighting.table().begin(); it.isValid(); ++it) {
+            if (it->key != "environmentMap") {
+                withoutEnvironmentMap[it->key] = it->value;
+            }
+        }
+        lighting = withoutEnvironmentMap;
+    }
+    s->m_lighting = Lighting::create(lighting);
+    endPhase(s->m_loadPhases, "lighting", phaseStart);
 
     // Load the models
-    Any models = any["models"];
     typedef ReferenceCountedPointer<ReferenceCountedObject> ModelRef;
     Table< std::string, ModelRef > modelTable;
+    int cachedModels = 0;
     for (Any::AnyTable::Iterator it = models.table().begin(); it.isValid(); ++it) {
         ModelRef m;
         Any v = it->value;
         if (v.nameBeginsWith("ArticulatedModel")) {
-            m = ArticulatedModel::create(v);
+            bool fromCache = false;
+            m = loadArticulatedModel(it->key, v, lookups.containsKey(it->key) ? lookups[it->key].get() : NULL, fromCache);
             m.downcast<ArticulatedModel>()->name = it->key;
+            cachedModels += fromCache ? 1 : 0;
         } else if (v.nameBeginsWith("MD2Model")) {
             m = MD2Model::create(v);
         } else if (v.nameBeginsWith("MD3Model")) {
@@ -108,6 +1130,8 @@ Scene::Ref Scene::create(const std::string& scene, GCamera& camera) {
 
         modelTable.set(it->key, m);        
     }
+    endPhase(s->m_loadPhases, format("%d models: %d from %s/ (hashed and mapped on workers), %d parsed by G3D", 
+                                     int(models.table().size()), cachedModels, MODEL_CACHE_DIRECTORY, int(models.table().size()) - cachedModels), phaseStart);
 
     // Instance the models
     Any entities = any["entities"];
@@ -124,7 +1148,15 @@ Scene::Ref Scene::create(const std::string& scene, GCamera& camera) {
 
     // Load the camera
     camera = any["camera"];
+    endPhase(s->m_loadPhases, "entities", phaseStart);
 
+    background.finish();
+    endPhase(s->m_loadPhases, "wait for decoding", phaseStart);
+
+    if (! environmentMap.isNil()) {
+        s->m_lighting->environmentMapTexture  = cubeMaps[cubeMapIndex[environmentMap["texture"].string()]]->upload(environmentMap["texture"]);
+        s->m_lighting->environmentMapConstant = environmentMap.get("constant", 1.0f);
+    }
 
     // Use the environment map as a skybox if there isn't one already, and vice versa
     if (any.containsKey("skyBox")) {
@@ -132,7 +1164,13 @@ Scene::Ref Scene::create(const std::string& scene, GCamera& camera) {
 		sky.verifyType(Any::TABLE);
 		sky.verifyName("");
         s->m_skyBoxConstant = sky.get("constant", 1.0f);
-        if (sky.containsKey("texture")) {
+        if (! skyBoxTexture.isNil()) {
+            // The same texture as the environment map is uploaded once
+            const std::string& pattern = skyBoxTexture.string();
+            s->m_skyBoxTexture = 
+                (! environmentMap.isNil() && (environmentMap["texture"].string() == pattern)) ? 
+                s->m_lighting->environmentMapTexture : cubeMaps[cubeMapIndex[pattern]]->upload(skyBoxTexture);
+        } else if (sky.containsKey("texture")) {
             s->m_skyBoxTexture = Texture::create(sky["texture"]);
         }
     } else {
@@ -156,27 +1194,109 @@ Scene::Ref Scene::create(const std::string& scene, GCamera& camera) {
         throw std::string("environmentMap texture must be a cube map.");
     }
 
+    endPhase(s->m_loadPhases, format("upload %d cube maps", int(cubeMaps.size())), phaseStart);
+
     // Set the initial positions
     for (int e = 0; e < s->m_entityArray.size(); ++e) {
         s->m_entityArray[e]->onSimulation(0, 0);
     }
 
+    s->buildAnimation();
+    int animated = 0;
+    for (int i = 0; i < s->m_animatedEntity.size(); ++i) {
+        animated += (s->m_animatedEntity[i] != NULL) ? 1 : 0;
+    }
+    endPhase(s->m_loadPhases, format("animation: %d frame splines evaluated together, %d entities simulated one at a time",
+                                     animated, s->m_serialEntity.size()), phaseStart);
+
+    s->buildBVH();
+    endPhase(s->m_loadPhases, format("ray BVH: %d triangles in %d models, %d entities tested linearly", 
+                                     int(s->m_bvh.statistics().triangles), s->m_bvh.meshCount(), s->m_linearEntity.size()), phaseStart);
+
+    s->buildCulling();
+    int occluderTriangles = 0;
+    for (int i = 0; i < s->m_occluderMesh.size(); ++i) {
+        occluderTriangles += s->m_culling.occluderTriangleCount(s->m_occluderMesh[i]);
+    }
+    endPhase(s->m_loadPhases, format("occluders: %d triangles placed by %d entities", occluderTriangles, s->m_occluderEntity.size()), phaseStart);
+
+    std::string msg = format("Loaded scene \"%s\" in %.2f s:\n", scene.c_str(), System::time() - loadStart);
+    for (int i = 0; i < s->m_loadPhases.size(); ++i) {
+        msg += format("  %8.3f s  %s\n", s->m_loadPhases[i].seconds, s->m_loadPhases[i].name.c_str());
+    }
+    logPrintf("%s", msg.c_str());
+    debugPrintf("%s", msg.c_str());
+
     return s;
 }
 
 
 void Scene::onPose(Array<Surface::Ref>& surfaceArray) {
-    for (int e = 0; e < m_entityArray.size(); ++e) {
-        m_entityArray[e]->onPose(surfaceArray);
+    const int chunks = (m_parallelPoseEntity.size() + POSE_CHUNK_SIZE - 1) / POSE_CHUNK_SIZE;
+    if (! m_posedOnce || (chunks < 2)) {
+        // ArticulatedModel uploads its geometry the first time that it is posed, which must be on this thread
+        for (int e = 0; e < m_entityArray.size(); ++e) {
+            m_entityArray[e]->onPose(surfaceArray);
+        }
+        m_posedOnce = true;
+        return;
+    }
+
+    m_chunkSurfaceArray.resize(chunks);
+    forEachChunk(chunks, [this](int chunk) {
+        Array<Surface::Ref>& surfaces = m_chunkSurfaceArray[chunk];
+        const int end = min(m_parallelPoseEntity.size(), (chunk + 1) * POSE_CHUNK_SIZE);
+        for (int e = chunk * POSE_CHUNK_SIZE; e < end; ++e) {
+            m_parallelPoseEntity[e]->onPose(surfaces);
+        }
+    });
+
+    // In entity order, so that the result does not depend on the scheduling
+    for (int c = 0; c < chunks; ++c) {
+        surfaceArray.append(m_chunkSurfaceArray[c]);
+        m_chunkSurfaceArray[c].fastClear();
+    }
+    for (int e = 0; e < m_serialPoseEntity.size(); ++e) {
+        m_serialPoseEntity[e]->onPose(surfaceArray);
+    }
+}
+
+
+const uint8* Scene::excludedInstances(const Array<Entity::Ref>& exclude, Array<uint8>& excluded) const {
+    if (exclude.size() == 0) {
+        return NULL;
+    }
+    excluded.resize(m_bvhEntity.size());
+    for (int i = 0; i < m_bvhEntity.size(); ++i) {
+        excluded[i] = exclude.contains(m_bvhEntity[i]) ? 1 : 0;
+    }
+    return excluded.getCArray();
+}
+
+
+static SceneBVH::Ray toBVHRay(const Ray& ray, float distance) {
+    SceneBVH::Ray r;
+    for (int a = 0; a < 3; ++a) {
+        r.origin[a]    = ray.origin()[a];
+        r.direction[a] = ray.direction()[a];
     }
+    r.maxDistance = distance;
+    return r;
 }
 
 
 Entity::Ref Scene::intersectBounds(const Ray& ray, float& distance, const Array<Entity::Ref>& exclude) {
     Entity::Ref closest = NULL;
+
+    Array<uint8> excluded;
+    SceneBVH::Hit hit;
+    if (m_bvh.intersectBounds(toBVHRay(ray, distance), hit, excludedInstances(exclude, excluded))) {
+        closest  = m_bvhEntity[hit.instance];
+        distance = hit.distance;
+    }
     
-    for (int e = 0; e < m_entityArray.size(); ++e) {
-        const Entity::Ref& entity = m_entityArray[e];
+    for (int e = 0; e < m_linearEntity.size(); ++e) {
+        const Entity::Ref& entity = m_linearEntity[e];
         if (! exclude.contains(entity) && entity->intersectBounds(ray, distance)) {
             closest = entity;
         }
@@ -188,9 +1308,16 @@ Entity::Ref Scene::intersectBounds(const Ray& ray, float& distance, const Array<
 
 Entity::Ref Scene::intersect(const Ray& ray, float& distance, const Array<Entity::Ref>& exclude) {
     Entity::Ref closest = NULL;
+
+    Array<uint8> excluded;
+    SceneBVH::Hit hit;
+    if (m_bvh.intersect(toBVHRay(ray, distance), hit, excludedInstances(exclude, excluded))) {
+        closest  = m_bvhEntity[hit.instance];
+        distance = hit.distance;
+    }
     
-    for (int e = 0; e < m_entityArray.size(); ++e) {
-        const Entity::Ref& entity = m_entityArray[e];
+    for (int e = 0; e < m_linearEntity.size(); ++e) {
+        const Entity::Ref& entity = m_linearEntity[e];
         if (! exclude.contains(entity) && entity->intersect(ray, distance)) {
             closest = entity;
         }
@@ -200,6 +1327,39 @@ Entity::Ref Scene::intersect(const Ray& ray, float& distance, const Array<Entity
 }
 
 
+void Scene::intersect(const Array<Ray>& rayArray, Array<float>& distanceArray, Array<Entity::Ref>& entityArray, const Array<Entity::Ref>& exclude) {
+    Array<SceneBVH::Ray> bvhRay;
+    bvhRay.resize(rayArray.size());
+    for (int i = 0; i < rayArray.size(); ++i) {
+        bvhRay[i] = toBVHRay(rayArray[i], finf());
+    }
+
+    Array<uint8> excluded;
+    Array<SceneBVH::Hit> hit;
+    hit.resize(rayArray.size());
+    if (rayArray.size() > 0) {
+        m_bvh.intersectStream(bvhRay.getCArray(), bvhRay.size(), hit.getCArray(), excludedInstances(exclude, excluded));
+    }
+
+    distanceArray.resize(rayArray.size());
+    entityArray.resize(rayArray.size());
+    for (int i = 0; i < rayArray.size(); ++i) {
+        distanceArray[i] = finf();
+        entityArray[i]   = NULL;
+        if (hit[i].instance >= 0) {
+            distanceArray[i] = hit[i].distance;
+            entityArray[i]   = m_bvhEntity[hit[i].instance];
+        }
+        for (int e = 0; e < m_linearEntity.size(); ++e) {
+            const Entity::Ref& entity = m_linearEntity[e];
+            if (! exclude.contains(entity) && entity->intersect(rayArray[i], distanceArray[i])) {
+                entityArray[i] = entity;
+            }
+        }
+    }
+}
+
+
 Any Scene::toAny() const {
     Any a = m_sourceAny;
 
@@ -2,7 +2,13 @@
 #define Scene_h
 
 #include <G3D/G3DAll.h>
+#include <functional>
 #include "Entity.h"
+#include "EntityAnimation.h"
+#include "SceneBVH.h"
+#include "SceneCulling.h"
+
+class ThreadPool;
 
 
 /** \brief Sample scene graph.
@@ -15,6 +21,17 @@
     might begin to structure one to get you started.
 */
 class Scene : public ReferenceCountedObject {
+public:
+
+    /** Wall-clock time of one phase of create(); see loadPhases() */
+    class LoadPhase {
+    public:
+        std::string             name;
+        RealTime                seconds;
+
+        LoadPhase(const std::string& n = "", RealTime s = 0) : name(n), seconds(s) {}
+    };
+
 protected:
     
     /** The Any from which this scene was constructed. */
@@ -27,17 +44,101 @@ protected:
     float                       m_skyBoxConstant;
     Array<Entity::Ref>          m_entityArray;
 
+    /** Phases of create(), in order */
+    Array<LoadPhase>            m_loadPhases;
+
+    /** The triangles of every ArticulatedModel, one mesh per model, for intersect() and intersectBounds().
+        Instance i is m_bvhEntity[i], last placed at m_bvhFrame[i]. */
+    SceneBVH                    m_bvh;
+    Array<Entity::Ref>          m_bvhEntity;
+    Array<CFrame>               m_bvhFrame;
+
+    /** Entities without an ArticulatedModel or with a pose spline, which the ray queries test one by one */
+    Array<Entity::Ref>          m_linearEntity;
+
+    /** Adds every entity to m_bvh or m_linearEntity */
+    void buildBVH();
+
+    /** Moves the BVH instances of the entities that moved */
+    void updateBVH();
+
+    /** Marks the BVH instances of \a exclude in \a excluded, which is NULL if there are none */
+    const uint8* excludedInstances(const Array<Entity::Ref>& exclude, Array<uint8>& excluded) const;
+
+    /** Frame splines of the entities in m_animatedEntity, evaluated together by onSimulation() */
+    EntityAnimation             m_animation;
+
+    /** m_animatedEntity[i] follows spline i of m_animation; NULL once it is simulated one at a time */
+    Array<Entity*>              m_animatedEntity;
+
+    /** Entities that onSimulation() simulates one at a time: those without an ArticulatedModel or with a pose
+        spline, whose pose animates, those whose spline EntityAnimation does not reproduce, and those whose
+        spline was edited */
+    Array<Entity*>              m_serialEntity;
+
+    /** Entities with an ArticulatedModel, which onPose() poses in parallel chunks after the first frame */
+    Array<Entity*>              m_parallelPoseEntity;
+    Array<Entity*>              m_serialPoseEntity;
+
+    /** Surfaces of each chunk of m_parallelPoseEntity, kept between frames to reuse their storage */
+    Array< Array<Surface::Ref> > m_chunkSurfaceArray;
+
+    bool                        m_posedOnce;
+
+    /** Created by threadPool() */
+    ThreadPool*                 m_threadPool;
+
+    ThreadPool& threadPool();
+
+    /** Runs task(chunk) for each of \a count chunks, on threadPool() if there is more than one */
+    void forEachChunk(int count, const std::function<void (int)>& task);
+
+    /** Adds the frame spline of every ArticulatedModel entity without a pose spline to m_animation, and sorts
+        the entities into the arrays above */
+    void buildAnimation();
+
+    /** The large triangles of every ArticulatedModel, one occluder mesh per model.  m_occluderEntity[i]
+        places mesh m_occluderMesh[i]; entities with pose splines are not occluders, because their parts
+        move away from the triangles. */
+    SceneCulling                m_culling;
+    Array<Entity*>              m_occluderEntity;
+    Array<int>                  m_occluderMesh;
+
+    /** Bounds of the surfaces in cull(), and their indices in its \a surfaceArray */
+    SceneCulling::BoxArray      m_cullBoxes;
+    Array<int>                  m_cullSurface;
+    std::vector<uint8>          m_cullResult;
+
+    /** Adds the occluders of every entity to m_culling */
+    void buildCulling();
+
     Scene() : 
         m_time(0), 
         m_skyBoxTexture(Texture::whiteCube()), 
-        m_skyBoxConstant(1.0f) {}
+        m_skyBoxConstant(1.0f),
+        m_posedOnce(false),
+        m_threadPool(NULL) {}
 
 public:
 
     typedef ReferenceCountedPointer<Scene> Ref;
 
+    /** \brief Loads the scene named \a sceneName (see sceneNames()) and sets \a camera to its initial camera.
+
+        Work that does not touch OpenGL runs on a ThreadPool while this thread creates the lighting and models:
+        the source and MTL files of each cacheable ArticulatedModel are hashed and its ModelCache is mapped and
+        checked, and the cube map faces named with a wildcard, like "uffizi05_*.jpg", are read and decoded.
+        This thread waits for each model's cache only when it reaches that model, and then only copies the
+        arrays out of the mapping.  Models without a valid cache are parsed here by G3D's loaders, which
+        create their textures as they parse, after their files were read ahead into the OS file cache.  The
+        material textures of every model are decoded here by G3D, serially.  The decoded cube maps are
+        uploaded at the end.  The time of each phase is logged and kept in loadPhases(). */
     static Scene::Ref create(const std::string& sceneName, GCamera& camera);
 
+    const Array<LoadPhase>& loadPhases() const {
+        return m_loadPhases;
+    }
+
     /** Creates an Any representing this scene by updating the one
      from which it was loaded with the current Entity positions.  This
      will overwrite any <code>\#include</code> entries that appeared in
@@ -47,10 +148,21 @@ public:
     */
     Any toAny() const;
 
+    virtual ~Scene();
+
+    /** Poses every entity.  After the first frame, in which ArticulatedModel uploads its geometry on this
+        thread, entities with an ArticulatedModel are posed in parallel chunks, each into its own array, and
+        the arrays are appended to \a surfaceArray in order.  This relies on G3D's atomic reference counts. */
     virtual void onPose(Array<Surface::Ref>& surfaceArray);
 
+    /** Advances the time and moves the entities.  The frame splines of entities without a pose spline are
+        evaluated together by EntityAnimation in parallel chunks, each of which writes the frames of its
+        own entities; the others run Entity::onSimulation one at a time. */
     virtual void onSimulation(GameTime deltaTime);
 
+    /** Use instead of Entity::setFrameSpline, so that the entity is simulated from its new spline */
+    void setFrameSpline(const Entity::Ref& entity, const PhysicsFrameSpline& spline);
+
     Lighting::Ref lighting() const {
         return m_lighting;
     }
@@ -83,11 +195,26 @@ public:
         return m_skyBoxConstant;
     }
 
-    /** Enumerate the names of all available scenes. */
+    /** Loads the index of scene files that the last launch saved and refreshes it on a background thread
+        (SceneIndex.h), which lists every *.scn.any file under the working directory and reads the name of
+        only the new and changed files.  Called by sceneNames() and create() if needed; call it early so
+        that the scan overlaps initialization. */
+    static void startSceneScan();
+
+    /** Blocks until the background scan has finished. */
+    static void finishSceneScan();
+
+    /** Enumerate the names of all available scenes.  Until the background scan finishes, these are the
+        names of the last launch, which is empty on the first one.  Does not block. */
     static Array<std::string> sceneNames();
 
+    /** Changes whenever sceneNames() does, so that a GUI can poll for the end of the scan. */
+    static int sceneNamesVersion();
+
     /** Returns the Entity whose conservative bounds are first
         intersected by \a ray, excluding Entity%s in \a exclude.  
+        The bounds are the object-space boxes of the entities' models, found
+        through the top level of a BVH.
         Useful for mouse selection and coarse hit-scan collision detection.  
         Returns NULL if none are intersected.
         
@@ -105,9 +232,28 @@ public:
      */  
     Entity::Ref intersectBounds(const Ray& ray, float& distance, const Array<Entity::Ref>& exclude = Array<Entity::Ref>());
 
-    /** Performs very precise (usually, ray-triangle) intersection, and is much slower
-        than intersectBounds.  */
+    /** Performs very precise (usually, ray-triangle) intersection, and is slower
+        than intersectBounds.  The triangles of ArticulatedModel%s are found through
+        a two-level BVH (SceneBVH.h) in the default pose of each model, so part
+        animation is ignored.  Other entities are tested one by one. */
     Entity::Ref intersect(const Ray& ray, float& distance, const Array<Entity::Ref>& exclude = Array<Entity::Ref>());
+
+    /** intersect() for many rays at once, traced in SIMD packets of SceneBVH::packetSize(), which is fastest
+        when neighboring rays are coherent, like the pellets of a shotgun.  \a distanceArray receives the
+        distance of each hit, or finf(), and \a entityArray the entity, or NULL. */
+    void intersect(const Array<Ray>& rayArray, Array<float>& distanceArray, Array<Entity::Ref>& entityArray, const Array<Entity::Ref>& exclude = Array<Entity::Ref>());
+
+    /** Appends the surfaces of \a surfaceArray that may be visible from \a camera in \a viewport to
+        \a visibleArray.  Their world-space bounding boxes are tested against the view frustum and then
+        against a software-rasterized occlusion buffer of the largest triangles of the scene's models
+        (SceneCulling.h), which never culls a surface that any pixel would show.  Surfaces with infinite
+        bounds are always visible. */
+    void cull(const Array<Surface::Ref>& surfaceArray, const GCamera& camera, const Rect2D& viewport, Array<Surface::Ref>& visibleArray);
+
+    /** Of the last cull() */
+    const SceneCulling::Statistics& cullingStatistics() const {
+        return m_culling.statistics();
+    }
 };
 
 #endif
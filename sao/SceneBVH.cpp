@@ -0,0 +1,779 @@
+/**
+ \file SceneBVH.cpp
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#include "SceneBVH.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+using namespace SAOSIMD;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+const float SceneBVH::TRAVERSAL_COST     = 1.0f;
+const float SceneBVH::REBUILD_COST_RATIO = 1.5f;
+
+enum {BIN_COUNT = 16, MESH_LEAF_SIZE = 8, INSTANCE_LEAF_SIZE = 2, MAX_DEPTH = 60, STACK_SIZE = 64};
+
+static const float inf = std::numeric_limits<float>::infinity();
+
+/** Barycentric tolerance, so that rays through a shared edge or vertex hit one of its triangles despite
+    rounding, which grows with the distance of the origin relative to the size of the triangle */
+static const float EDGE_EPSILON = 1e-5f;
+
+/** Triangle bounds are padded by this fraction of their size and position, so that the slab test, whose
+    rounding differs from the triangle test's, never culls a ray that hits within EDGE_EPSILON of an edge
+    or vertex on the boundary of a box, like a wall on a grid line */
+static const float BOUNDS_EPSILON = 1e-5f;
+
+static float millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+static void setEmpty(float lo[3], float hi[3]) {
+    for (int a = 0; a < 3; ++a) {
+        lo[a] =  inf;
+        hi[a] = -inf;
+    }
+}
+
+
+static void grow(float lo[3], float hi[3], const float plo[3], const float phi[3]) {
+    for (int a = 0; a < 3; ++a) {
+        lo[a] = std::min(lo[a], plo[a]);
+        hi[a] = std::max(hi[a], phi[a]);
+    }
+}
+
+
+static float area(const float lo[3], const float hi[3]) {
+    const float x = std::max(0.0f, hi[0] - lo[0]), y = std::max(0.0f, hi[1] - lo[1]), z = std::max(0.0f, hi[2] - lo[2]);
+    return 2.0f * (x * y + y * z + z * x);
+}
+
+
+/** Applies the row-major 3 x 4 \a m to the point \a p */
+static void transformPoint(const float m[12], const float p[3], float r[3]) {
+    for (int i = 0; i < 3; ++i) {
+        r[i] = m[4 * i] * p[0] + m[4 * i + 1] * p[1] + m[4 * i + 2] * p[2] + m[4 * i + 3];
+    }
+}
+
+
+static void transformVector(const float m[12], const float v[3], float r[3]) {
+    for (int i = 0; i < 3; ++i) {
+        r[i] = m[4 * i] * v[0] + m[4 * i + 1] * v[1] + m[4 * i + 2] * v[2];
+    }
+}
+
+
+/** Inverse of an affine transform */
+static void invert(const float m[12], float r[12]) {
+    const float a = m[0], b = m[1], c = m[2], d = m[4], e = m[5], f = m[6], g = m[8], h = m[9], i = m[10];
+    const float A = e * i - f * h, B = f * g - d * i, C = d * h - e * g;
+    const float det = a * A + b * B + c * C;
+    assert(det != 0.0f);
+    const float s = 1.0f / det;
+    r[0] = A * s;   r[1] = (c * h - b * i) * s;   r[2]  = (b * f - c * e) * s;
+    r[4] = B * s;   r[5] = (a * i - c * g) * s;   r[6]  = (c * d - a * f) * s;
+    r[8] = C * s;   r[9] = (b * g - a * h) * s;   r[10] = (a * e - b * d) * s;
+    for (int k = 0; k < 3; ++k) {
+        r[4 * k + 3] = -(r[4 * k] * m[3] + r[4 * k + 1] * m[7] + r[4 * k + 2] * m[11]);
+    }
+}
+
+
+/** Slab test of a ray with precomputed inverse direction; sets \a tNear to the entry distance, at least 0 */
+static inline bool intersectBox(const float lo[3], const float hi[3], const float origin[3], const float inverse[3], float maxDistance, float& tNear) {
+    float t0 = 0.0f, t1 = maxDistance;
+    for (int a = 0; a < 3; ++a) {
+        float tLo = (lo[a] - origin[a]) * inverse[a];
+        float tHi = (hi[a] - origin[a]) * inverse[a];
+        if (tLo > tHi) {
+            std::swap(tLo, tHi);
+        }
+        t0 = std::max(t0, tLo);
+        t1 = std::min(t1, tHi);
+    }
+    tNear = t0;
+    return t0 <= t1;
+}
+
+
+SceneBVH::SceneBVH() : m_builtCost(0), m_needsBuild(false), m_needsRefit(false) {}
+
+
+void SceneBVH::clear() {
+    m_meshes.clear();
+    m_instances.clear();
+    m_nodes.clear();
+    m_order.clear();
+    m_builtCost  = 0;
+    m_needsBuild = false;
+    m_needsRefit = false;
+    m_statistics = Statistics();
+}
+
+
+void SceneBVH::buildNodes(const std::vector<Bounds>& primitives, int maxLeafSize, std::vector<Node>& nodes, std::vector<uint32_t>& order) {
+    const uint32_t n = uint32_t(primitives.size());
+    nodes.clear();
+    order.resize(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    std::vector<float> centroid(3 * n);
+    for (uint32_t i = 0; i < n; ++i) {
+        for (int a = 0; a < 3; ++a) {
+            centroid[3 * i + a] = 0.5f * (primitives[i].lo[a] + primitives[i].hi[a]);
+        }
+    }
+
+    class Task {
+    public:
+        uint32_t    node;
+        uint32_t    first;
+        uint32_t    count;
+        int         depth;
+    };
+
+    nodes.reserve(2 * size_t(n));
+    nodes.push_back(Node());
+    std::vector<Task> tasks;
+    Task root = {0, 0, n, 0};
+    tasks.push_back(root);
+
+    while (! tasks.empty()) {
+        const Task task = tasks.back();
+        tasks.pop_back();
+
+        float lo[3], hi[3], clo[3], chi[3];
+        setEmpty(lo, hi);
+        setEmpty(clo, chi);
+        for (uint32_t i = task.first; i < task.first + task.count; ++i) {
+            grow(lo, hi, primitives[order[i]].lo, primitives[order[i]].hi);
+            grow(clo, chi, &centroid[3 * order[i]], &centroid[3 * order[i]]);
+        }
+        {
+            // Only a leaf at MAX_DEPTH can exceed the 16-bit count
+            assert(task.count <= 0xFFFF || task.depth < MAX_DEPTH);
+            Node& node = nodes[task.node];
+            std::copy(lo, lo + 3, node.lo);
+            std::copy(hi, hi + 3, node.hi);
+            node.index = task.first;
+            node.count = uint16_t(task.count);
+            node.axis  = 0;
+        }
+
+        // Find the cheapest split among the bin boundaries of all three axes
+        const float nodeArea = std::max(area(lo, hi), 1e-30f);
+        float bestCost = inf;
+        int bestAxis = -1, bestSplit = 0;
+        for (int a = 0; (a < 3) && (task.count > 1) && (task.depth < MAX_DEPTH); ++a) {
+            const float extent = chi[a] - clo[a];
+            if (! (extent > 0.0f)) {
+                continue;
+            }
+            const float scale = float(BIN_COUNT) / extent;
+
+            uint32_t binCount[BIN_COUNT] = {0};
+            float binLo[BIN_COUNT][3], binHi[BIN_COUNT][3];
+            for (int b = 0; b < BIN_COUNT; ++b) {
+                setEmpty(binLo[b], binHi[b]);
+            }
+            for (uint32_t i = task.first; i < task.first + task.count; ++i) {
+                const int b = std::min(BIN_COUNT - 1, int((centroid[3 * order[i] + a] - clo[a]) * scale));
+                ++binCount[b];
+                grow(binLo[b], binHi[b], primitives[order[i]].lo, primitives[order[i]].hi);
+            }
+
+            // Area x count of everything left of each boundary, then sweep from the right
+            float leftCost[BIN_COUNT];
+            float sweepLo[3], sweepHi[3];
+            setEmpty(sweepLo, sweepHi);
+            uint32_t sweepCount = 0;
+            for (int b = 0; b < BIN_COUNT - 1; ++b) {
+                grow(sweepLo, sweepHi, binLo[b], binHi[b]);
+                sweepCount += binCount[b];
+                leftCost[b + 1] = (sweepCount > 0) ? area(sweepLo, sweepHi) * float(sweepCount) : 0.0f;
+            }
+            setEmpty(sweepLo, sweepHi);
+            sweepCount = 0;
+            for (int b = BIN_COUNT - 1; b > 0; --b) {
+                grow(sweepLo, sweepHi, binLo[b], binHi[b]);
+                sweepCount += binCount[b];
+                if ((sweepCount > 0) && (sweepCount < task.count)) {
+                    const float c = TRAVERSAL_COST + (leftCost[b] + area(sweepLo, sweepHi) * float(sweepCount)) / nodeArea;
+                    if (c < bestCost) {
+                        bestCost  = c;
+                        bestAxis  = a;
+                        bestSplit = b;
+                    }
+                }
+            }
+        }
+
+        const bool mustSplit = (task.count > uint32_t(maxLeafSize)) && (task.depth < MAX_DEPTH);
+        if ((bestAxis == -1) && ! mustSplit) {
+            continue;
+        }
+        if ((bestAxis != -1) && (bestCost >= float(task.count)) && ! mustSplit) {
+            continue;
+        }
+
+        uint32_t* begin = &order[task.first];
+        uint32_t* end   = begin + task.count;
+        uint32_t* middle;
+        if (bestAxis != -1) {
+            const int a = bestAxis;
+            const float scale = float(BIN_COUNT) / (chi[a] - clo[a]);
+            const float minimum = clo[a];
+            const float* c = &centroid[0];
+            middle = std::partition(begin, end, [c, a, scale, minimum, bestSplit](uint32_t i) {
+                return std::min(int(BIN_COUNT) - 1, int((c[3 * i + a] - minimum) * scale)) < bestSplit;
+            });
+        } else {
+            // All centroids coincide; split the list in half
+            middle = begin + task.count / 2;
+            bestAxis = 0;
+        }
+        assert((middle != begin) && (middle != end));
+
+        const uint32_t left = uint32_t(nodes.size());
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        Node& node = nodes[task.node];
+        node.index = left;
+        node.count = 0;
+        node.axis  = uint16_t(bestAxis);
+
+        const uint32_t leftCount = uint32_t(middle - begin);
+        Task l = {left,     task.first,             leftCount,              task.depth + 1};
+        Task r = {left + 1, task.first + leftCount, task.count - leftCount, task.depth + 1};
+        tasks.push_back(r);
+        tasks.push_back(l);
+    }
+}
+
+
+float SceneBVH::cost(const std::vector<Node>& nodes) {
+    if (nodes.empty()) {
+        return 0.0f;
+    }
+    float c = 0.0f;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const Node& n = nodes[i];
+        c += area(n.lo, n.hi) * ((n.count > 0) ? float(n.count) : TRAVERSAL_COST);
+    }
+    return c / std::max(area(nodes[0].lo, nodes[0].hi), 1e-30f);
+}
+
+
+int SceneBVH::addMesh(const void* positions, size_t stride, size_t vertexCount, const uint32_t* indices, size_t indexCount) {
+    const Clock::time_point start = Clock::now();
+    assert(indexCount % 3 == 0);
+    const size_t triangleCount = indexCount / 3;
+
+    std::vector<Bounds> bounds(triangleCount);
+    std::vector<Triangle> triangles(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        const float* v[3];
+        for (int k = 0; k < 3; ++k) {
+            const uint32_t index = indices[3 * t + k];
+            assert(index < vertexCount);
+            (void)vertexCount;
+            v[k] = (const float*)((const char*)positions + stride * index);
+        }
+        Triangle& tri = triangles[t];
+        setEmpty(bounds[t].lo, bounds[t].hi);
+        for (int a = 0; a < 3; ++a) {
+            tri.v0[a] = v[0][a];
+            tri.e1[a] = v[1][a] - v[0][a];
+            tri.e2[a] = v[2][a] - v[0][a];
+            for (int k = 0; k < 3; ++k) {
+                bounds[t].lo[a] = std::min(bounds[t].lo[a], v[k][a]);
+                bounds[t].hi[a] = std::max(bounds[t].hi[a], v[k][a]);
+            }
+        }
+        float size = 0;
+        for (int a = 0; a < 3; ++a) {
+            size = std::max(size, std::max(bounds[t].hi[a] - bounds[t].lo[a], std::max(fabsf(bounds[t].lo[a]), fabsf(bounds[t].hi[a]))));
+        }
+        for (int a = 0; a < 3; ++a) {
+            bounds[t].lo[a] -= BOUNDS_EPSILON * size;
+            bounds[t].hi[a] += BOUNDS_EPSILON * size;
+        }
+        tri.id = uint32_t(t);
+    }
+
+    m_meshes.push_back(Mesh());
+    Mesh& mesh = m_meshes.back();
+    std::vector<uint32_t> order;
+    buildNodes(bounds, MESH_LEAF_SIZE, mesh.nodes, order);
+    mesh.triangles.resize(triangleCount);
+    for (size_t i = 0; i < triangleCount; ++i) {
+        mesh.triangles[i] = triangles[order[i]];
+    }
+
+    m_statistics.meshes     = int(m_meshes.size());
+    m_statistics.triangles += triangleCount;
+    m_statistics.meshNodes += mesh.nodes.size();
+    m_statistics.meshBuildMilliseconds += millisecondsSince(start);
+    return int(m_meshes.size()) - 1;
+}
+
+
+int SceneBVH::addInstance(int mesh, const float objectToWorld[12]) {
+    assert((mesh >= 0) && (mesh < int(m_meshes.size())));
+    Instance instance;
+    instance.mesh = mesh;
+    memcpy(instance.objectToWorld, objectToWorld, sizeof(instance.objectToWorld));
+    invert(objectToWorld, instance.worldToObject);
+    m_instances.push_back(instance);
+    m_statistics.instances = int(m_instances.size());
+    m_needsBuild = true;
+    return int(m_instances.size()) - 1;
+}
+
+
+void SceneBVH::setTransform(int i, const float objectToWorld[12]) {
+    Instance& instance = m_instances[i];
+    if (memcmp(instance.objectToWorld, objectToWorld, sizeof(instance.objectToWorld)) != 0) {
+        memcpy(instance.objectToWorld, objectToWorld, sizeof(instance.objectToWorld));
+        invert(objectToWorld, instance.worldToObject);
+        m_needsRefit = true;
+    }
+}
+
+
+void SceneBVH::computeInstanceBounds(Instance& instance) const {
+    const std::vector<Node>& nodes = m_meshes[instance.mesh].nodes;
+    if (nodes.empty()) {
+        setEmpty(instance.lo, instance.hi);
+        return;
+    }
+
+    // Arvo's method: each row of the transform stretches the box by the extreme products of its entries
+    const float* lo = nodes[0].lo;
+    const float* hi = nodes[0].hi;
+    const float* m  = instance.objectToWorld;
+    for (int i = 0; i < 3; ++i) {
+        instance.lo[i] = instance.hi[i] = m[4 * i + 3];
+        for (int j = 0; j < 3; ++j) {
+            const float a = m[4 * i + j] * lo[j];
+            const float b = m[4 * i + j] * hi[j];
+            instance.lo[i] += std::min(a, b);
+            instance.hi[i] += std::max(a, b);
+        }
+    }
+}
+
+
+void SceneBVH::buildTopLevel() {
+    std::vector<Bounds> bounds(m_instances.size());
+    for (size_t i = 0; i < m_instances.size(); ++i) {
+        std::copy(m_instances[i].lo, m_instances[i].lo + 3, bounds[i].lo);
+        std::copy(m_instances[i].hi, m_instances[i].hi + 3, bounds[i].hi);
+    }
+    buildNodes(bounds, INSTANCE_LEAF_SIZE, m_nodes, m_order);
+    m_builtCost = cost(m_nodes);
+    m_statistics.instanceNodes = int(m_nodes.size());
+}
+
+
+void SceneBVH::refitTopLevel() {
+    // Children always follow their parent, so a reverse sweep sees them first
+    for (size_t k = m_nodes.size(); k > 0; --k) {
+        Node& node = m_nodes[k - 1];
+        setEmpty(node.lo, node.hi);
+        if (node.count > 0) {
+            for (uint32_t i = node.index; i < node.index + node.count; ++i) {
+                grow(node.lo, node.hi, m_instances[m_order[i]].lo, m_instances[m_order[i]].hi);
+            }
+        } else {
+            grow(node.lo, node.hi, m_nodes[node.index].lo, m_nodes[node.index].hi);
+            grow(node.lo, node.hi, m_nodes[node.index + 1].lo, m_nodes[node.index + 1].hi);
+        }
+    }
+}
+
+
+void SceneBVH::update() {
+    if (! m_needsBuild && ! m_needsRefit) {
+        return;
+    }
+    const Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < m_instances.size(); ++i) {
+        computeInstanceBounds(m_instances[i]);
+    }
+
+    if (m_needsBuild) {
+        buildTopLevel();
+    } else {
+        refitTopLevel();
+        if (cost(m_nodes) > REBUILD_COST_RATIO * m_builtCost) {
+            buildTopLevel();
+            ++m_statistics.rebuilds;
+        } else {
+            ++m_statistics.refits;
+        }
+    }
+    m_needsBuild = false;
+    m_needsRefit = false;
+    m_statistics.updateMilliseconds = millisecondsSince(start);
+}
+
+
+/** Moller-Trumbore, double-sided */
+static inline bool intersectTriangle(const float v0[3], const float e1[3], const float e2[3], const float origin[3], const float direction[3],
+                                     float maxDistance, float& t, float& u, float& v) {
+    const float p[3] = {direction[1] * e2[2] - direction[2] * e2[1], direction[2] * e2[0] - direction[0] * e2[2], direction[0] * e2[1] - direction[1] * e2[0]};
+    const float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if (det == 0.0f) {
+        return false;
+    }
+    const float inverseDet = 1.0f / det;
+    const float s[3] = {origin[0] - v0[0], origin[1] - v0[1], origin[2] - v0[2]};
+    u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverseDet;
+    if ((u < -EDGE_EPSILON) || (u > 1.0f + EDGE_EPSILON)) {
+        return false;
+    }
+    const float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+    v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * inverseDet;
+    if ((v < -EDGE_EPSILON) || (u + v > 1.0f + EDGE_EPSILON)) {
+        return false;
+    }
+    t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverseDet;
+    return (t > 0.0f) && (t < maxDistance);
+}
+
+
+bool SceneBVH::intersectMesh(const Mesh& mesh, const float origin[3], const float direction[3], float& maxDistance, int& triangle, float& u, float& v) {
+    if (mesh.nodes.empty()) {
+        return false;
+    }
+    const float inverse[3] = {1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]};
+    const int negative[3] = {direction[0] < 0.0f, direction[1] < 0.0f, direction[2] < 0.0f};
+
+    uint32_t stack[STACK_SIZE];
+    int stackSize = 0;
+    uint32_t n = 0;
+    bool hit = false;
+    for (;;) {
+        const Node& node = mesh.nodes[n];
+        float tNear;
+        if (intersectBox(node.lo, node.hi, origin, inverse, maxDistance, tNear)) {
+            if (node.count > 0) {
+                for (uint32_t i = node.index; i < node.index + node.count; ++i) {
+                    const Triangle& tri = mesh.triangles[i];
+                    float t, tu, tv;
+                    if (intersectTriangle(tri.v0, tri.e1, tri.e2, origin, direction, maxDistance, t, tu, tv)) {
+                        maxDistance = t;
+                        triangle    = int(tri.id);
+                        u           = tu;
+                        v           = tv;
+                        hit         = true;
+                    }
+                }
+            } else {
+                // Visit the child on the side the ray comes from first
+                const uint32_t nearChild = node.index + negative[node.axis];
+                stack[stackSize++] = node.index + 1 - negative[node.axis];
+                n = nearChild;
+                continue;
+            }
+        }
+        if (stackSize == 0) {
+            return hit;
+        }
+        n = stack[--stackSize];
+    }
+}
+
+
+bool SceneBVH::intersect(const Ray& ray, Hit& hit, const uint8_t* excluded) const {
+    assert(! m_needsBuild && ! m_needsRefit);
+    if (m_nodes.empty()) {
+        return false;
+    }
+    const float inverse[3] = {1.0f / ray.direction[0], 1.0f / ray.direction[1], 1.0f / ray.direction[2]};
+    const int negative[3] = {ray.direction[0] < 0.0f, ray.direction[1] < 0.0f, ray.direction[2] < 0.0f};
+
+    float maxDistance = ray.maxDistance;
+    bool found = false;
+    uint32_t stack[STACK_SIZE];
+    int stackSize = 0;
+    uint32_t n = 0;
+    for (;;) {
+        const Node& node = m_nodes[n];
+        float tNear;
+        if (intersectBox(node.lo, node.hi, ray.origin, inverse, maxDistance, tNear)) {
+            if (node.count > 0) {
+                for (uint32_t i = node.index; i < node.index + node.count; ++i) {
+                    const int instanceIndex = int(m_order[i]);
+                    if ((excluded != NULL) && excluded[instanceIndex]) {
+                        continue;
+                    }
+                    const Instance& instance = m_instances[instanceIndex];
+                    float origin[3], direction[3];
+                    transformPoint(instance.worldToObject, ray.origin, origin);
+                    transformVector(instance.worldToObject, ray.direction, direction);
+                    if (intersectMesh(m_meshes[instance.mesh], origin, direction, maxDistance, hit.triangle, hit.u, hit.v)) {
+                        hit.instance = instanceIndex;
+                        hit.distance = maxDistance;
+                        found = true;
+                    }
+                }
+            } else {
+                stack[stackSize++] = node.index + 1 - negative[node.axis];
+                n = node.index + negative[node.axis];
+                continue;
+            }
+        }
+        if (stackSize == 0) {
+            return found;
+        }
+        n = stack[--stackSize];
+    }
+}
+
+
+bool SceneBVH::intersectBounds(const Ray& ray, Hit& hit, const uint8_t* excluded) const {
+    assert(! m_needsBuild && ! m_needsRefit);
+    if (m_nodes.empty()) {
+        return false;
+    }
+    const float inverse[3] = {1.0f / ray.direction[0], 1.0f / ray.direction[1], 1.0f / ray.direction[2]};
+
+    float maxDistance = ray.maxDistance;
+    bool found = false;
+    uint32_t stack[STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const Node& node = m_nodes[stack[--stackSize]];
+        float tNear;
+        if (! intersectBox(node.lo, node.hi, ray.origin, inverse, maxDistance, tNear)) {
+            continue;
+        }
+        if (node.count == 0) {
+            stack[stackSize++] = node.index;
+            stack[stackSize++] = node.index + 1;
+            continue;
+        }
+        for (uint32_t i = node.index; i < node.index + node.count; ++i) {
+            const int instanceIndex = int(m_order[i]);
+            const Instance& instance = m_instances[instanceIndex];
+            const Mesh& mesh = m_meshes[instance.mesh];
+            if (((excluded != NULL) && excluded[instanceIndex]) || mesh.nodes.empty()) {
+                continue;
+            }
+            // The object-space box, which is tighter than the world-space bounds of a rotated instance
+            float origin[3], direction[3];
+            transformPoint(instance.worldToObject, ray.origin, origin);
+            transformVector(instance.worldToObject, ray.direction, direction);
+            const float objectInverse[3] = {1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]};
+            float t;
+            if (intersectBox(mesh.nodes[0].lo, mesh.nodes[0].hi, origin, objectInverse, maxDistance, t) && (t < maxDistance)) {
+                maxDistance  = t;
+                hit.instance = instanceIndex;
+                hit.triangle = -1;
+                hit.distance = t;
+                hit.u = hit.v = 0.0f;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+
+/** Lanes of \a p whose rays enter the box before their maxDistance */
+static SAO_FORCEINLINE Float intersectBox(const float lo[3], const float hi[3], const Float origin[3], const Float inverse[3], const Float& maxDistance) {
+    const Float x0 = (Float(lo[0]) - origin[0]) * inverse[0], x1 = (Float(hi[0]) - origin[0]) * inverse[0];
+    const Float y0 = (Float(lo[1]) - origin[1]) * inverse[1], y1 = (Float(hi[1]) - origin[1]) * inverse[1];
+    const Float z0 = (Float(lo[2]) - origin[2]) * inverse[2], z1 = (Float(hi[2]) - origin[2]) * inverse[2];
+    const Float tNear = max(max(min(x0, x1), min(y0, y1)), max(min(z0, z1), Float(0.0f)));
+    const Float tFar  = min(min(max(x0, x1), max(y0, y1)), min(max(z0, z1), maxDistance));
+    return tNear <= tFar;
+}
+
+
+static SAO_FORCEINLINE Int select(const Float& mask, const Int& a, const Int& b) {
+    return asInt(select(mask, asFloat(a), asFloat(b)));
+}
+
+
+Float SceneBVH::intersectMesh(const Mesh& mesh, Packet& p) {
+    Float hit(0.0f);
+    if (mesh.nodes.empty()) {
+        return hit;
+    }
+
+    uint32_t stack[STACK_SIZE];
+    int stackSize = 0;
+    uint32_t n = 0;
+    for (;;) {
+        const Node& node = mesh.nodes[n];
+        if (any(intersectBox(node.lo, node.hi, p.origin, p.inverseDirection, p.maxDistance))) {
+            if (node.count > 0) {
+                for (uint32_t i = node.index; i < node.index + node.count; ++i) {
+                    const Triangle& tri = mesh.triangles[i];
+                    const Float e1x(tri.e1[0]), e1y(tri.e1[1]), e1z(tri.e1[2]);
+                    const Float e2x(tri.e2[0]), e2y(tri.e2[1]), e2z(tri.e2[2]);
+                    const Float px = p.direction[1] * e2z - p.direction[2] * e2y;
+                    const Float py = p.direction[2] * e2x - p.direction[0] * e2z;
+                    const Float pz = p.direction[0] * e2y - p.direction[1] * e2x;
+                    const Float inverseDet = Float(1.0f) / madd(e1x, px, madd(e1y, py, e1z * pz));
+                    const Float sx = p.origin[0] - Float(tri.v0[0]), sy = p.origin[1] - Float(tri.v0[1]), sz = p.origin[2] - Float(tri.v0[2]);
+                    const Float u = madd(sx, px, madd(sy, py, sz * pz)) * inverseDet;
+                    const Float qx = sy * e1z - sz * e1y;
+                    const Float qy = sz * e1x - sx * e1z;
+                    const Float qz = sx * e1y - sy * e1x;
+                    const Float v = madd(p.direction[0], qx, madd(p.direction[1], qy, p.direction[2] * qz)) * inverseDet;
+                    const Float t = madd(e2x, qx, madd(e2y, qy, e2z * qz)) * inverseDet;
+
+                    // A zero determinant makes u or v infinite or NaN, which fails these tests
+                    const Float mask = (Float(-EDGE_EPSILON) <= u) & (Float(-EDGE_EPSILON) <= v) & (u + v <= Float(1.0f + EDGE_EPSILON)) &
+                        (Float(0.0f) < t) & (t < p.maxDistance);
+                    if (any(mask)) {
+                        p.maxDistance = select(mask, t, p.maxDistance);
+                        p.u           = select(mask, u, p.u);
+                        p.v           = select(mask, v, p.v);
+                        p.triangle    = select(mask, Int(int(tri.id)), p.triangle);
+                        hit = hit | mask;
+                    }
+                }
+            } else {
+                stack[stackSize++] = node.index + 1 - p.negative[node.axis];
+                n = node.index + p.negative[node.axis];
+                continue;
+            }
+        }
+        if (stackSize == 0) {
+            return hit;
+        }
+        n = stack[--stackSize];
+    }
+}
+
+
+void SceneBVH::intersectPacket(const Ray* rays, int count, Hit* hits, const uint8_t* excluded) const {
+    assert(! m_needsBuild && ! m_needsRefit);
+    assert((count > 0) && (count <= WIDTH));
+
+    // Transpose to one register per component; unused lanes repeat the first ray and can never hit
+    float lanes[7][WIDTH];
+    for (int i = 0; i < WIDTH; ++i) {
+        const Ray& r = rays[(i < count) ? i : 0];
+        for (int a = 0; a < 3; ++a) {
+            lanes[a][i]     = r.origin[a];
+            lanes[3 + a][i] = r.direction[a];
+        }
+        lanes[6][i] = (i < count) ? r.maxDistance : -1.0f;
+    }
+    for (int i = 0; i < count; ++i) {
+        hits[i] = Hit();
+    }
+
+    Packet world;
+    for (int a = 0; a < 3; ++a) {
+        world.origin[a]           = Float::load(lanes[a]);
+        world.direction[a]        = Float::load(lanes[3 + a]);
+        world.inverseDirection[a] = Float(1.0f) / world.direction[a];
+        world.negative[a]         = rays[0].direction[a] < 0.0f;
+    }
+    world.maxDistance = Float::load(lanes[6]);
+    world.u           = Float(0.0f);
+    world.v           = Float(0.0f);
+    world.triangle    = Int(-1);
+    Int instanceIndex(-1);
+
+    if (! m_nodes.empty()) {
+        uint32_t stack[STACK_SIZE];
+        int stackSize = 0;
+        uint32_t n = 0;
+        for (;;) {
+            const Node& node = m_nodes[n];
+            if (any(intersectBox(node.lo, node.hi, world.origin, world.inverseDirection, world.maxDistance))) {
+                if (node.count > 0) {
+                    for (uint32_t k = node.index; k < node.index + node.count; ++k) {
+                        if ((excluded != NULL) && excluded[m_order[k]]) {
+                            continue;
+                        }
+                        const Instance& instance = m_instances[m_order[k]];
+                        const float* m = instance.worldToObject;
+
+                        Packet object;
+                        for (int i = 0; i < 3; ++i) {
+                            object.origin[i] = madd(Float(m[4 * i]), world.origin[0], madd(Float(m[4 * i + 1]), world.origin[1],
+                                madd(Float(m[4 * i + 2]), world.origin[2], Float(m[4 * i + 3]))));
+                            object.direction[i] = madd(Float(m[4 * i]), world.direction[0], madd(Float(m[4 * i + 1]), world.direction[1],
+                                Float(m[4 * i + 2]) * world.direction[2]));
+                            object.inverseDirection[i] = Float(1.0f) / object.direction[i];
+                        }
+                        float firstDirection[3];
+                        transformVector(m, rays[0].direction, firstDirection);
+                        for (int i = 0; i < 3; ++i) {
+                            object.negative[i] = firstDirection[i] < 0.0f;
+                        }
+                        object.maxDistance = world.maxDistance;
+                        object.u           = world.u;
+                        object.v           = world.v;
+                        object.triangle    = world.triangle;
+
+                        const Float hit = intersectMesh(m_meshes[instance.mesh], object);
+                        if (any(hit)) {
+                            world.maxDistance = object.maxDistance;
+                            world.u           = object.u;
+                            world.v           = object.v;
+                            world.triangle    = object.triangle;
+                            instanceIndex     = select(hit, Int(int(m_order[k])), instanceIndex);
+                        }
+                    }
+                } else {
+                    stack[stackSize++] = node.index + 1 - world.negative[node.axis];
+                    n = node.index + world.negative[node.axis];
+                    continue;
+                }
+            }
+            if (stackSize == 0) {
+                break;
+            }
+            n = stack[--stackSize];
+        }
+    }
+
+    int instanceLane[WIDTH], triangleLane[WIDTH];
+    float distanceLane[WIDTH], uLane[WIDTH], vLane[WIDTH];
+    instanceIndex.store(instanceLane);
+    world.triangle.store(triangleLane);
+    world.maxDistance.store(distanceLane);
+    world.u.store(uLane);
+    world.v.store(vLane);
+    for (int i = 0; i < count; ++i) {
+        if (instanceLane[i] >= 0) {
+            hits[i].instance = instanceLane[i];
+            hits[i].triangle = triangleLane[i];
+            hits[i].distance = distanceLane[i];
+            hits[i].u        = uLane[i];
+            hits[i].v        = vLane[i];
+        }
+    }
+}
+
+
+void SceneBVH::intersectStream(const Ray* rays, size_t count, Hit* hits, const uint8_t* excluded) const {
+    for (size_t i = 0; i < count; i += WIDTH) {
+        intersectPacket(rays + i, int(std::min(size_t(WIDTH), count - i)), hits + i, excluded);
+    }
+}
@@ -0,0 +1,255 @@
+/**
+ \file SceneBVH.h
+
+ Two-level bounding volume hierarchy for the ray queries of Scene (picking and hit-scan).  No G3D
+ dependency; Scene.cpp adds the triangles of each ArticulatedModel and the frame of each Entity.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef SceneBVH_h
+#define SceneBVH_h
+
+#include "SAOSIMD.h"
+#include <cstddef>
+#include <limits>
+#include <stdint.h>
+#include <vector>
+
+/**
+ \brief A BVH over the triangles of each mesh in object space, and a BVH over the world-space bounds of
+ the instances of those meshes.
+
+ Both levels are built with the surface area heuristic over 16 centroid bins.  An instance references a
+ mesh and a 3 x 4 object-to-world transform, so entities that share a model share its triangle BVH, and
+ moving an entity only changes the top level: setTransform() followed by update() refits the instance
+ bounds bottom-up in O(instances), and rebuilds the top level only when refitting has made it more than
+ REBUILD_COST_RATIO times as expensive to traverse as when it was built.
+
+ intersect() traces one ray front to back.  intersectPacket() traces SAOSIMD::WIDTH rays (8 with AVX2, 4
+ with SSE4.1) together, testing each node and triangle against all of them at once, which pays off when
+ the rays are coherent, like the pixels of a tile or the pellets of a shotgun.  intersectStream() splits
+ any number of rays into packets in the order given.
+
+ Triangles are double-sided.  Ray directions need not be unit length; distances are in multiples of the
+ direction, and are the same in object and world space because the transform is affine.
+ */
+class SceneBVH {
+public:
+
+    /** Traversal cost relative to one ray-triangle test */
+    static const float TRAVERSAL_COST;
+
+    /** update() rebuilds the top level when refitting has raised its cost by more than this factor */
+    static const float REBUILD_COST_RATIO;
+
+    class Ray {
+    public:
+        float               origin[3];
+        float               direction[3];
+
+        /** Hits at or beyond this distance are ignored */
+        float               maxDistance;
+
+        Ray() : maxDistance(std::numeric_limits<float>::infinity()) {
+            origin[0] = origin[1] = origin[2] = 0;
+            direction[0] = direction[1] = direction[2] = 0;
+        }
+    };
+
+    class Hit {
+    public:
+        /** -1 if nothing was hit */
+        int                 instance;
+
+        /** Index of the triangle in the index array of the instance's mesh / 3, or -1 for intersectBounds() */
+        int                 triangle;
+
+        float               distance;
+
+        /** Barycentric weights of the second and third vertex */
+        float               u;
+        float               v;
+
+        Hit() : instance(-1), triangle(-1), distance(std::numeric_limits<float>::infinity()), u(0), v(0) {}
+    };
+
+    class Statistics {
+    public:
+        int                 meshes;
+        int                 instances;
+        size_t              triangles;
+        size_t              meshNodes;
+        int                 instanceNodes;
+
+        /** Of all triangle BVHs */
+        float               meshBuildMilliseconds;
+
+        /** Of the last top-level build or refit */
+        float               updateMilliseconds;
+        int                 refits;
+        int                 rebuilds;
+
+        Statistics() : meshes(0), instances(0), triangles(0), meshNodes(0), instanceNodes(0), meshBuildMilliseconds(0),
+            updateMilliseconds(0), refits(0), rebuilds(0) {}
+    };
+
+protected:
+
+    /** 32 bytes.  A leaf holds primitives [index, index + count); an interior node (count == 0) has children
+        index and index + 1, split along \a axis. */
+    class Node {
+    public:
+        float               lo[3];
+        uint32_t            index;
+        float               hi[3];
+        uint16_t            count;
+        uint16_t            axis;
+    };
+
+    /** A vertex and two edges, for the Moller-Trumbore test */
+    class Triangle {
+    public:
+        float               v0[3];
+        float               e1[3];
+        float               e2[3];
+
+        /** Index in the mesh's index array / 3 */
+        uint32_t            id;
+    };
+
+    class Bounds {
+    public:
+        float               lo[3];
+        float               hi[3];
+    };
+
+    /** Rays of one intersectPacket(), in world or object space */
+    class Packet {
+    public:
+        SAOSIMD::Float      origin[3];
+        SAOSIMD::Float      direction[3];
+        SAOSIMD::Float      inverseDirection[3];
+
+        /** Shrinks as hits are found; negative in unused lanes so that they hit nothing */
+        SAOSIMD::Float      maxDistance;
+        SAOSIMD::Float      u;
+        SAOSIMD::Float      v;
+        SAOSIMD::Int        triangle;
+
+        /** Per axis, 1 if the first ray's direction is negative, which orders the traversal of the packet */
+        int                 negative[3];
+    };
+
+    class Mesh {
+    public:
+        std::vector<Node>       nodes;
+
+        /** In leaf order */
+        std::vector<Triangle>   triangles;
+    };
+
+    class Instance {
+    public:
+        int                 mesh;
+
+        /** Row-major 3 x 4 */
+        float               objectToWorld[12];
+        float               worldToObject[12];
+
+        /** World-space bounds of the mesh under objectToWorld */
+        float               lo[3];
+        float               hi[3];
+    };
+
+    std::vector<Mesh>       m_meshes;
+    std::vector<Instance>   m_instances;
+
+    /** Top level */
+    std::vector<Node>       m_nodes;
+
+    /** Instance indices in leaf order */
+    std::vector<uint32_t>   m_order;
+
+    /** Top-level cost when it was last built */
+    float                   m_builtCost;
+
+    /** Instances were added since the last build */
+    bool                    m_needsBuild;
+
+    /** Transforms changed since the last update() */
+    bool                    m_needsRefit;
+
+    Statistics              m_statistics;
+
+    /** Binned SAH build over \a primitives.  \a order receives the primitive indices in leaf order. */
+    static void buildNodes(const std::vector<Bounds>& primitives, int maxLeafSize, std::vector<Node>& nodes, std::vector<uint32_t>& order);
+
+    /** Expected cost of tracing a ray that hits the root, in ray-triangle tests */
+    static float cost(const std::vector<Node>& nodes);
+
+    /** Closest hit in \a mesh of the ray, which is in object space.  Shrinks \a maxDistance on a hit. */
+    static bool intersectMesh(const Mesh& mesh, const float origin[3], const float direction[3], float& maxDistance, int& triangle, float& u, float& v);
+
+    /** Updates the lanes of \a packet that hit \a mesh closer than before, and returns them as a mask */
+    static SAOSIMD::Float intersectMesh(const Mesh& mesh, Packet& packet);
+
+    void computeInstanceBounds(Instance& instance) const;
+
+    void buildTopLevel();
+
+    /** Recomputes the top-level node bounds from the instance bounds */
+    void refitTopLevel();
+
+public:
+
+    SceneBVH();
+
+    /** Removes all meshes and instances */
+    void clear();
+
+    /** Builds the triangle BVH of a triangle list whose vertex positions are three floats every \a stride bytes
+        from \a positions.  Returns the index of the mesh for addInstance(). */
+    int addMesh(const void* positions, size_t stride, size_t vertexCount, const uint32_t* indices, size_t indexCount);
+
+    /** Places mesh \a mesh with the row-major 3 x 4 \a objectToWorld transform.  Returns the index of the
+        instance, which is the Hit::instance of rays that hit it.  Takes effect at the next update(). */
+    int addInstance(int mesh, const float objectToWorld[12]);
+
+    /** Moves an instance.  Takes effect at the next update(). */
+    void setTransform(int instance, const float objectToWorld[12]);
+
+    /** Builds or refits the top level after addInstance() or setTransform().  Must be called before tracing. */
+    void update();
+
+    /** Finds the closest triangle hit before ray.maxDistance, skipping instance i where \a excluded is non-NULL
+        and excluded[i] is non-zero.  Returns false and leaves \a hit unchanged on a miss. */
+    bool intersect(const Ray& ray, Hit& hit, const uint8_t* excluded = NULL) const;
+
+    /** Finds the instance whose object-space bounding box the ray enters first, at distance 0 if it starts
+        inside.  Hit::triangle is -1. */
+    bool intersectBounds(const Ray& ray, Hit& hit, const uint8_t* excluded = NULL) const;
+
+    /** Traces \a count <= packetSize() rays together.  hits[i] is set for every ray; Hit::instance is -1 on a miss. */
+    void intersectPacket(const Ray* rays, int count, Hit* hits, const uint8_t* excluded = NULL) const;
+
+    /** Traces \a count rays as consecutive packets; order them so that neighbors are coherent. */
+    void intersectStream(const Ray* rays, size_t count, Hit* hits, const uint8_t* excluded = NULL) const;
+
+    static int packetSize() {
+        return SAOSIMD::WIDTH;
+    }
+
+    int meshCount() const {
+        return int(m_meshes.size());
+    }
+
+    int instanceCount() const {
+        return int(m_instances.size());
+    }
+
+    const Statistics& statistics() const {
+        return m_statistics;
+    }
+};
+
+#endif // SceneBVH_h
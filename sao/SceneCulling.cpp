@@ -0,0 +1,599 @@
+/**
+ \file SceneCulling.cpp
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#include "SceneCulling.h"
+#include "SAOSIMD.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+
+using namespace SAOSIMD;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+static const float inf = std::numeric_limits<float>::infinity();
+
+static bool isPowerOfTwo(int x) {
+    return (x > 0) && ((x & (x - 1)) == 0);
+}
+
+
+SceneCulling::SceneCulling(int width, int height) : m_width(width), m_height(height), m_meshDepth(size_t(width) * height, inf),
+    m_meshCoverage(size_t(width) * height, 0.0f), m_touchedX0(width), m_touchedY0(height), m_touchedX1(-1), m_touchedY1(-1), m_pyramidValid(true) {
+
+    assert(isPowerOfTwo(width) && isPowerOfTwo(height) && (width >= WIDTH));
+    for (int level = 0; ((width >> level) >= 1) && ((height >> level) >= 1); ++level) {
+        m_level.push_back(std::vector<float>(size_t(width >> level) * (height >> level), 0.0f));
+    }
+    std::memset(m_viewProjection, 0, sizeof(m_viewProjection));
+    std::memset(m_plane, 0, sizeof(m_plane));
+}
+
+
+void SceneCulling::clear() {
+    m_meshes.clear();
+}
+
+
+int SceneCulling::addOccluderMesh(const void* positions, size_t stride, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+                                  float minArea, int maxTriangles) {
+    const char* base = static_cast<const char*>(positions);
+    Mesh mesh;
+
+    // Merge vertices at the same position
+    std::vector<uint32_t> merged(vertexCount);
+    {
+        std::map< std::vector<float>, uint32_t > vertexIndex;
+        std::vector<float> p(3);
+        for (size_t v = 0; v < vertexCount; ++v) {
+            std::memcpy(&p[0], base + v * stride, 3 * sizeof(float));
+            std::map< std::vector<float>, uint32_t >::iterator it = vertexIndex.find(p);
+            if (it == vertexIndex.end()) {
+                it = vertexIndex.insert(std::make_pair(p, uint32_t(mesh.position.size() / 3))).first;
+                mesh.position.insert(mesh.position.end(), p.begin(), p.end());
+            }
+            merged[v] = it->second;
+        }
+    }
+
+    // (area, first index) of each triangle that is large enough
+    std::vector< std::pair<float, size_t> > candidate;
+    for (size_t i = 0; i + 2 < indexCount; i += 3) {
+        const uint32_t i0 = merged[indices[i]], i1 = merged[indices[i + 1]], i2 = merged[indices[i + 2]];
+        if ((i0 == i1) || (i1 == i2) || (i2 == i0)) {
+            continue;
+        }
+        const float* a = &mesh.position[i0 * 3];
+        const float* b = &mesh.position[i1 * 3];
+        const float* c = &mesh.position[i2 * 3];
+        const float e0[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        const float e1[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        const float n[3] = {e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0]};
+        const float area = 0.5f * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (area >= minArea) {
+            candidate.push_back(std::make_pair(area, i));
+        }
+    }
+
+    // Largest first; ties in the order given, so that the selection does not depend on the sort
+    std::stable_sort(candidate.begin(), candidate.end(),
+                     [](const std::pair<float, size_t>& x, const std::pair<float, size_t>& y) { return x.first > y.first; });
+    candidate.resize(std::min(candidate.size(), size_t(std::max(maxTriangles, 0))));
+
+    // Rasterize in the original order, which keeps neighbors together
+    std::sort(candidate.begin(), candidate.end(),
+              [](const std::pair<float, size_t>& x, const std::pair<float, size_t>& y) { return x.second < y.second; });
+    mesh.index.reserve(candidate.size() * 3);
+    for (size_t t = 0; t < candidate.size(); ++t) {
+        for (int k = 0; k < 3; ++k) {
+            mesh.index.push_back(merged[indices[candidate[t].second + k]]);
+        }
+    }
+
+    // Edges of the triangles that were kept
+    std::map< std::pair<uint32_t, uint32_t>, size_t > edgeIndex;
+    for (size_t i = 0; i < mesh.index.size(); i += 3) {
+        for (int k = 0; k < 3; ++k) {
+            const uint32_t u = mesh.index[i + k], v = mesh.index[i + (k + 1) % 3];
+            const std::pair<uint32_t, uint32_t> key(std::min(u, v), std::max(u, v));
+            std::map< std::pair<uint32_t, uint32_t>, size_t >::iterator it = edgeIndex.find(key);
+            if (it == edgeIndex.end()) {
+                Edge e;
+                e.vertex[0] = key.first;
+                e.vertex[1] = key.second;
+                e.triangle[0] = int32_t(i);
+                e.triangle[1] = -1;
+                edgeIndex.insert(std::make_pair(key, mesh.edge.size()));
+                mesh.edge.push_back(e);
+            } else {
+                Edge& e = mesh.edge[it->second];
+                e.triangle[1] = (e.triangle[1] == -1) ? int32_t(i) : -2;
+            }
+        }
+    }
+
+    m_meshes.push_back(Mesh());
+    m_meshes.back().position.swap(mesh.position);
+    m_meshes.back().index.swap(mesh.index);
+    m_meshes.back().edge.swap(mesh.edge);
+    return int(m_meshes.size()) - 1;
+}
+
+
+void SceneCulling::beginFrame(const float viewProjection[16]) {
+    std::memcpy(m_viewProjection, viewProjection, sizeof(m_viewProjection));
+    const float* M = m_viewProjection;
+    for (int p = 0; p < 6; ++p) {
+        // Rows 0, 1, 2 for x, y, z; added for the negative side, subtracted for the positive side
+        const float* row = M + 4 * (p / 2);
+        const float sign = (p & 1) ? -1.0f : 1.0f;
+        for (int k = 0; k < 4; ++k) {
+            m_plane[p][k] = M[12 + k] + sign * row[k];
+        }
+    }
+
+    for (size_t level = 0; level < m_level.size(); ++level) {
+        std::fill(m_level[level].begin(), m_level[level].end(), 0.0f);
+    }
+    m_pyramidValid = true;
+    m_statistics = Statistics();
+}
+
+
+void SceneCulling::addOccluder(int mesh, const float objectToWorld[12]) {
+    const Clock::time_point start = Clock::now();
+    const Mesh& m = m_meshes[mesh];
+    const float* V = m_viewProjection;
+    const float* W = objectToWorld;
+
+    // Object to clip
+    float M[16];
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            M[r * 4 + c] = V[r * 4 + 0] * W[c] + V[r * 4 + 1] * W[4 + c] + V[r * 4 + 2] * W[8 + c] + ((c == 3) ? V[r * 4 + 3] : 0.0f);
+        }
+    }
+
+    const size_t vertexCount = m.position.size() / 3;
+    m_clipPosition.resize(vertexCount * 4);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        const float* p = &m.position[v * 3];
+        float* q = &m_clipPosition[v * 4];
+        for (int r = 0; r < 4; ++r) {
+            q[r] = M[r * 4] * p[0] + M[r * 4 + 1] * p[1] + M[r * 4 + 2] * p[2] + M[r * 4 + 3];
+        }
+    }
+
+    for (size_t i = 0; i < m.index.size(); i += 3) {
+        const float* a = &m_clipPosition[m.index[i] * 4];
+        const float* b = &m_clipPosition[m.index[i + 1] * 4];
+        const float* c = &m_clipPosition[m.index[i + 2] * 4];
+
+        // Reject triangles entirely outside one of the clip planes
+        bool outside = false;
+        for (int axis = 0; (axis < 3) && ! outside; ++axis) {
+            outside = ((a[axis] < -a[3]) && (b[axis] < -b[3]) && (c[axis] < -c[3])) ||
+                      ((a[axis] >  a[3]) && (b[axis] >  b[3]) && (c[axis] >  c[3]));
+        }
+        if (! outside) {
+            addTriangle(a, b, c);
+            ++m_statistics.occluderTriangles;
+        }
+    }
+
+    if (m_touchedX0 > m_touchedX1) {
+        // Entirely off screen
+        m_statistics.rasterizeMilliseconds += millisecondsSince(start);
+        return;
+    }
+
+    for (size_t e = 0; e < m.edge.size(); ++e) {
+        const Edge& edge = m.edge[e];
+        const float* u = &m_clipPosition[edge.vertex[0] * 4];
+        const float* v = &m_clipPosition[edge.vertex[1] * 4];
+        bool silhouette = (edge.triangle[1] < 0);
+        if (! silhouette) {
+            // The triangles project to opposite sides of the edge when their third vertices are on opposite
+            // sides of the plane through the eye and the edge, whose normal is (x, y, w) u cross (x, y, w) v
+            const float n[3] = {u[1] * v[3] - u[3] * v[1], u[3] * v[0] - u[0] * v[3], u[0] * v[1] - u[1] * v[0]};
+            float side[2];
+            for (int t = 0; t < 2; ++t) {
+                const uint32_t* triangle = &m.index[edge.triangle[t]];
+                const uint32_t third = triangle[0] ^ triangle[1] ^ triangle[2] ^ edge.vertex[0] ^ edge.vertex[1];
+                const float* w = &m_clipPosition[third * 4];
+                side[t] = n[0] * w[0] + n[1] * w[1] + n[2] * w[3];
+            }
+            silhouette = ! (side[0] * side[1] < 0.0f);
+        }
+        if (silhouette) {
+            addSilhouette(u, v);
+        }
+    }
+
+    // Merge the pixels that the mesh covers entirely, and reset the mesh's pixels for the next one
+    std::vector<float>& buffer = m_level[0];
+    const int x0 = m_touchedX0 - (m_touchedX0 % WIDTH);
+    for (int y = m_touchedY0; y <= m_touchedY1; ++y) {
+        const size_t row = size_t(y) * m_width;
+        for (int x = x0; x <= m_touchedX1; x += WIDTH) {
+            const Float covered = Float(0.0f) < Float::load(&m_meshCoverage[row + x]);
+            const Float depth = select(covered, Float::load(&m_meshDepth[row + x]), Float(0.0f));
+            max(Float::load(&buffer[row + x]), depth).store(&buffer[row + x]);
+            Float(inf).store(&m_meshDepth[row + x]);
+            Float(0.0f).store(&m_meshCoverage[row + x]);
+        }
+    }
+    m_touchedX0 = m_width;
+    m_touchedY0 = m_height;
+    m_touchedX1 = m_touchedY1 = -1;
+
+    m_pyramidValid = false;
+    m_statistics.rasterizeMilliseconds += millisecondsSince(start);
+}
+
+
+void SceneCulling::addTriangle(const float a[4], const float b[4], const float c[4]) {
+    // Clip the polygon at the near plane, z + w >= 0, which leaves 3 or 4 vertices when any remain
+    const float* in[3] = {a, b, c};
+    float out[4][4];
+    int n = 0;
+
+    // The vertices that clipping created
+    int cut[2];
+    int cuts = 0;
+    for (int i = 0; i < 3; ++i) {
+        const float* p = in[i];
+        const float* q = in[(i + 1) % 3];
+        const float dp = p[2] + p[3], dq = q[2] + q[3];
+        if (dp >= 0) {
+            std::memcpy(out[n++], p, 4 * sizeof(float));
+        }
+        if ((dp >= 0) != (dq >= 0)) {
+            const float t = dp / (dp - dq);
+            for (int k = 0; k < 4; ++k) {
+                out[n][k] = p[k] + t * (q[k] - p[k]);
+            }
+            // Exactly on the plane, so that addSilhouette() keeps it
+            out[n][2] = -out[n][3];
+            cut[cuts++] = n;
+            ++n;
+        }
+    }
+    if (n < 3) {
+        return;
+    }
+    if (cuts == 2) {
+        addSilhouette(out[cut[0]], out[cut[1]]);
+    }
+
+    float screen[4][3];
+    for (int i = 0; i < n; ++i) {
+        if (! (out[i][3] > 0.0f)) {
+            // Only a degenerate projection reaches here
+            return;
+        }
+        const float inverseW = 1.0f / out[i][3];
+        screen[i][0] = (out[i][0] * inverseW * 0.5f + 0.5f) * float(m_width);
+        screen[i][1] = (out[i][1] * inverseW * 0.5f + 0.5f) * float(m_height);
+        screen[i][2] = inverseW;
+    }
+    for (int i = 2; i < n; ++i) {
+        rasterize(screen[0], screen[i - 1], screen[i]);
+    }
+}
+
+
+void SceneCulling::rasterize(const float a[3], const float b[3], const float c[3]) {
+    float area2 = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+    if (! (std::fabs(area2) > 1e-12f)) {
+        // Seen edge on; its edges are silhouettes
+        return;
+    }
+    if (area2 < 0) {
+        // Occluders are double-sided
+        std::swap(b, c);
+        area2 = -area2;
+    }
+
+    // Pixels that the bounds touch
+    const float minX = std::min(a[0], std::min(b[0], c[0])), maxX = std::max(a[0], std::max(b[0], c[0]));
+    const float minY = std::min(a[1], std::min(b[1], c[1])), maxY = std::max(a[1], std::max(b[1], c[1]));
+    const int x0 = std::max(0,            int(std::floor(std::max(minX, -1.0f))));
+    const int x1 = std::min(m_width - 1,  int(std::floor(std::min(maxX, float(m_width) + 1.0f))));
+    const int y0 = std::max(0,            int(std::floor(std::max(minY, -1.0f))));
+    const int y1 = std::min(m_height - 1, int(std::floor(std::min(maxY, float(m_height) + 1.0f))));
+    if ((x0 > x1) || (y0 > y1)) {
+        return;
+    }
+    m_touchedX0 = std::min(m_touchedX0, x0);  m_touchedX1 = std::max(m_touchedX1, x1);
+    m_touchedY0 = std::min(m_touchedY0, y0);  m_touchedY1 = std::max(m_touchedY1, y1);
+
+    // Edge functions A x + B y + C, non-negative inside; edge k is opposite vertex k.  A pixel touches the
+    // triangle where each is non-negative at one of its corners, at most R away from its center.
+    const float* v[3] = {a, b, c};
+    float A[3], B[3], C[3], R[3];
+    for (int k = 0; k < 3; ++k) {
+        const float* p = v[(k + 1) % 3];
+        const float* q = v[(k + 2) % 3];
+        A[k] = p[1] - q[1];
+        B[k] = q[0] - p[0];
+        C[k] = -(A[k] * p[0] + B[k] * p[1]);
+        R[k] = 0.5f * (std::fabs(A[k]) + std::fabs(B[k]));
+    }
+
+    // 1 / w is affine in screen space; its weights are the edge functions over twice the area.  Its least
+    // value over a pixel is at the corner that is R away from the center.
+    const float scale = 1.0f / area2;
+    float IA = 0, IB = 0, IC = 0;
+    for (int k = 0; k < 3; ++k) {
+        IA += A[k] * v[k][2] * scale;
+        IB += B[k] * v[k][2] * scale;
+        IC += C[k] * v[k][2] * scale;
+    }
+    IC -= 0.5f * (std::fabs(IA) + std::fabs(IB));
+
+    const Float laneX = Float::laneIndex() + Float(0.5f);
+    for (int y = y0; y <= y1; ++y) {
+        const float py = float(y) + 0.5f;
+        const Float rowE0(B[0] * py + C[0]), rowE1(B[1] * py + C[1]), rowE2(B[2] * py + C[2]), rowI(IB * py + IC);
+        float* depth = &m_meshDepth[size_t(y) * m_width];
+        float* coverage = &m_meshCoverage[size_t(y) * m_width];
+        for (int x = x0 - (x0 % WIDTH); x <= x1; x += WIDTH) {
+            const Float px = laneX + Float(float(x));
+            const Float e0 = madd(Float(A[0]), px, rowE0), e1 = madd(Float(A[1]), px, rowE1), e2 = madd(Float(A[2]), px, rowE2);
+            const Float touches = (e0 >= Float(-R[0])) & (e1 >= Float(-R[1])) & (e2 >= Float(-R[2]));
+            if (any(touches)) {
+                const Float inside = touches & (e0 >= Float(0.0f)) & (e1 >= Float(0.0f)) & (e2 >= Float(0.0f));
+                const Float oldDepth = Float::load(depth + x);
+                select(touches, min(oldDepth, madd(Float(IA), px, rowI)), oldDepth).store(depth + x);
+                select(inside, Float(1.0f), Float::load(coverage + x)).store(coverage + x);
+            }
+        }
+    }
+}
+
+
+void SceneCulling::addSilhouette(const float a[4], const float b[4]) {
+    // The part in front of the near plane
+    double p[2][4];
+    for (int k = 0; k < 4; ++k) {
+        p[0][k] = a[k];
+        p[1][k] = b[k];
+    }
+    const double da = p[0][2] + p[0][3], db = p[1][2] + p[1][3];
+    if ((da < 0) && (db < 0)) {
+        return;
+    } else if ((da < 0) || (db < 0)) {
+        const double t = da / (da - db);
+        double* behind = p[(da < 0) ? 0 : 1];
+        for (int k = 0; k < 4; ++k) {
+            behind[k] = p[0][k] + t * (p[1][k] - p[0][k]);
+        }
+    }
+    for (int axis = 0; axis < 2; ++axis) {
+        if (((p[0][axis] < -p[0][3]) && (p[1][axis] < -p[1][3])) || ((p[0][axis] > p[0][3]) && (p[1][axis] > p[1][3]))) {
+            return;
+        }
+    }
+    if (! ((p[0][3] > 0) && (p[1][3] > 0))) {
+        return;
+    }
+
+    double x[2], y[2];
+    for (int i = 0; i < 2; ++i) {
+        x[i] = (p[i][0] / p[i][3] * 0.5 + 0.5) * m_width;
+        y[i] = (p[i][1] / p[i][3] * 0.5 + 0.5) * m_height;
+    }
+
+    // Clamp to a pixel beyond the screen, which keeps the row loop short for points near the near plane
+    double t0 = 0, t1 = 1;
+    const double dx = x[1] - x[0], dy = y[1] - y[0];
+    const double lo[2] = {-1.0, -1.0}, hi[2] = {m_width + 1.0, m_height + 1.0};
+    const double start[2] = {x[0], y[0]}, delta[2] = {dx, dy};
+    for (int axis = 0; axis < 2; ++axis) {
+        if (delta[axis] == 0) {
+            if ((start[axis] < lo[axis]) || (start[axis] > hi[axis])) {
+                return;
+            }
+        } else {
+            double ta = (lo[axis] - start[axis]) / delta[axis], tb = (hi[axis] - start[axis]) / delta[axis];
+            if (ta > tb) {
+                std::swap(ta, tb);
+            }
+            t0 = std::max(t0, ta);
+            t1 = std::min(t1, tb);
+        }
+    }
+    if (t0 > t1) {
+        return;
+    }
+
+    // Every pixel that the segment crosses or passes within SLOP of, a row at a time
+    static const double SLOP = 1e-3;
+    const double ya = y[0] + t0 * dy, yb = y[0] + t1 * dy;
+    const int row0 = std::max(0, int(std::floor(std::min(ya, yb) - SLOP)));
+    const int row1 = std::min(m_height - 1, int(std::floor(std::max(ya, yb) + SLOP)));
+    for (int row = row0; row <= row1; ++row) {
+        double s0 = t0, s1 = t1;
+        if (dy != 0) {
+            double sa = (row - SLOP - y[0]) / dy, sb = (row + 1 + SLOP - y[0]) / dy;
+            if (sa > sb) {
+                std::swap(sa, sb);
+            }
+            s0 = std::max(s0, sa);
+            s1 = std::min(s1, sb);
+        }
+        if (s0 > s1) {
+            continue;
+        }
+        const double xa = x[0] + s0 * dx, xb = x[0] + s1 * dx;
+        const int column0 = std::max(0, int(std::floor(std::min(xa, xb) - SLOP)));
+        const int column1 = std::min(m_width - 1, int(std::floor(std::max(xa, xb) + SLOP)));
+        if (column0 > column1) {
+            continue;
+        }
+        std::fill(&m_meshDepth[size_t(row) * m_width + column0], &m_meshDepth[size_t(row) * m_width + column1] + 1, -inf);
+        m_touchedX0 = std::min(m_touchedX0, column0);  m_touchedX1 = std::max(m_touchedX1, column1);
+        m_touchedY0 = std::min(m_touchedY0, row);      m_touchedY1 = std::max(m_touchedY1, row);
+    }
+}
+
+
+void SceneCulling::buildPyramid() {
+    for (size_t level = 1; level < m_level.size(); ++level) {
+        const int w = m_width >> level, h = m_height >> level;
+        const std::vector<float>& finer = m_level[level - 1];
+        std::vector<float>& coarser = m_level[level];
+        for (int y = 0; y < h; ++y) {
+            const float* row0 = &finer[size_t(2 * y) * (2 * w)];
+            const float* row1 = row0 + 2 * w;
+            for (int x = 0; x < w; ++x) {
+                coarser[size_t(y) * w + x] = std::min(std::min(row0[2 * x], row0[2 * x + 1]), std::min(row1[2 * x], row1[2 * x + 1]));
+            }
+        }
+    }
+    m_pyramidValid = true;
+}
+
+
+bool SceneCulling::occluded(int level, int x, int y, int x0, int y0, int x1, int y1, float inverseDepth) const {
+    if (this->inverseDepth(x, y, level) > inverseDepth) {
+        // Everything under this texel is nearer than the box
+        return true;
+    } else if (level == 0) {
+        return false;
+    }
+
+    const int finer = level - 1;
+    const int cx0 = std::max(2 * x, x0 >> finer), cx1 = std::min(2 * x + 1, x1 >> finer);
+    const int cy0 = std::max(2 * y, y0 >> finer), cy1 = std::min(2 * y + 1, y1 >> finer);
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        for (int cx = cx0; cx <= cx1; ++cx) {
+            if (! occluded(finer, cx, cy, x0, y0, x1, y1, inverseDepth)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+void SceneCulling::cull(const BoxArray& boxes, std::vector<uint8_t>& result) {
+    if (! m_pyramidValid) {
+        const Clock::time_point start = Clock::now();
+        buildPyramid();
+        m_statistics.rasterizeMilliseconds += millisecondsSince(start);
+    }
+
+    const Clock::time_point start = Clock::now();
+    const int count = boxes.size();
+    result.resize(count);
+    const bool anyOccluders = (m_statistics.occluderTriangles > 0);
+    const float* M = m_viewProjection;
+    const int topLevel = int(m_level.size()) - 1;
+
+    for (int first = 0; first < count; first += WIDTH) {
+        const int lanes = std::min(int(WIDTH), count - first);
+
+        // The last group is padded with copies of its first box
+        float lo[3][WIDTH], hi[3][WIDTH];
+        for (int a = 0; a < 3; ++a) {
+            for (int i = 0; i < WIDTH; ++i) {
+                const int b = first + ((i < lanes) ? i : 0);
+                lo[a][i] = boxes.lo[a][b];
+                hi[a][i] = boxes.hi[a][b];
+            }
+        }
+        const Float lx = Float::load(lo[0]), ly = Float::load(lo[1]), lz = Float::load(lo[2]);
+        const Float hx = Float::load(hi[0]), hy = Float::load(hi[1]), hz = Float::load(hi[2]);
+
+        // Outside if the corner farthest along a plane's normal is behind it.  0.0f is the mask of no lanes.
+        Float outside(0.0f);
+        for (int p = 0; p < 6; ++p) {
+            const float* P = m_plane[p];
+            const Float x = (P[0] >= 0) ? hx : lx, y = (P[1] >= 0) ? hy : ly, z = (P[2] >= 0) ? hz : lz;
+            outside = outside | (madd(Float(P[0]), x, madd(Float(P[1]), y, madd(Float(P[2]), z, Float(P[3])))) < Float(0.0f));
+        }
+
+        // Screen-space bounds and nearest 1 / w of the corners
+        Float minX(1e30f), minY(1e30f), maxX(-1e30f), maxY(-1e30f), nearest(0.0f), crossesNear(0.0f);
+        if (anyOccluders) {
+            for (int corner = 0; corner < 8; ++corner) {
+                const Float x = (corner & 1) ? hx : lx, y = (corner & 2) ? hy : ly, z = (corner & 4) ? hz : lz;
+                Float clip[4];
+                for (int r = 0; r < 4; ++r) {
+                    clip[r] = madd(Float(M[r * 4]), x, madd(Float(M[r * 4 + 1]), y, madd(Float(M[r * 4 + 2]), z, Float(M[r * 4 + 3]))));
+                }
+                crossesNear = crossesNear | ((clip[2] + clip[3]) <= Float(0.0f)) | (clip[3] <= Float(0.0f));
+                const Float inverseW = Float(1.0f) / clip[3];
+                const Float sx = clip[0] * inverseW, sy = clip[1] * inverseW;
+                minX = min(minX, sx);  maxX = max(maxX, sx);
+                minY = min(minY, sy);  maxY = max(maxY, sy);
+                nearest = max(nearest, inverseW);
+            }
+        }
+
+        float outsideLane[WIDTH], crossesLane[WIDTH], minXLane[WIDTH], minYLane[WIDTH], maxXLane[WIDTH], maxYLane[WIDTH], nearestLane[WIDTH];
+        select(outside, Float(1.0f), Float(0.0f)).store(outsideLane);
+        select(crossesNear, Float(1.0f), Float(0.0f)).store(crossesLane);
+        minX.store(minXLane);  minY.store(minYLane);
+        maxX.store(maxXLane);  maxY.store(maxYLane);
+        nearest.store(nearestLane);
+
+        for (int i = 0; i < lanes; ++i) {
+            uint8_t r = VISIBLE;
+            if (outsideLane[i] != 0.0f) {
+                r = OUTSIDE_FRUSTUM;
+            } else if (anyOccluders && (crossesLane[i] == 0.0f)) {
+                // Pixels that the rectangle touches
+                const int x0 = std::max(0,            int(std::floor((minXLane[i] * 0.5f + 0.5f) * float(m_width))));
+                const int x1 = std::min(m_width - 1,  int(std::floor((std::min(maxXLane[i], 2.0f) * 0.5f + 0.5f) * float(m_width))));
+                const int y0 = std::max(0,            int(std::floor((minYLane[i] * 0.5f + 0.5f) * float(m_height))));
+                const int y1 = std::min(m_height - 1, int(std::floor((std::min(maxYLane[i], 2.0f) * 0.5f + 0.5f) * float(m_height))));
+                if ((minXLane[i] > 1.0f) || (maxXLane[i] < -1.0f) || (minYLane[i] > 1.0f) || (maxYLane[i] < -1.0f)) {
+                    // Inside the planes but not on screen, which the plane test misses near the frustum's edges
+                    r = OUTSIDE_FRUSTUM;
+                } else {
+                    int level = 0;
+                    while ((level < topLevel) && (((x1 >> level) - (x0 >> level) > 1) || ((y1 >> level) - (y0 >> level) > 1))) {
+                        ++level;
+                    }
+                    bool hidden = true;
+                    for (int y = y0 >> level; hidden && (y <= (y1 >> level)); ++y) {
+                        for (int x = x0 >> level; hidden && (x <= (x1 >> level)); ++x) {
+                            hidden = occluded(level, x, y, x0, y0, x1, y1, nearestLane[i]);
+                        }
+                    }
+                    if (hidden) {
+                        r = OCCLUDED;
+                    }
+                }
+            }
+
+            result[first + i] = r;
+            const uint32_t triangles = boxes.triangles[first + i];
+            ++m_statistics.boxes;
+            m_statistics.triangles += triangles;
+            if (r == OUTSIDE_FRUSTUM) {
+                ++m_statistics.frustumCulledBoxes;
+                m_statistics.frustumCulledTriangles += triangles;
+            } else if (r == OCCLUDED) {
+                ++m_statistics.occlusionCulledBoxes;
+                m_statistics.occlusionCulledTriangles += triangles;
+            }
+        }
+    }
+
+    m_statistics.testMilliseconds += millisecondsSince(start);
+}
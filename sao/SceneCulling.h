@@ -0,0 +1,212 @@
+/**
+ \file SceneCulling.h
+
+ Frustum and occlusion culling of the posed surfaces before G-buffer fill.  No G3D dependency; Scene.cpp
+ adds the large triangles of each ArticulatedModel as occluders and passes the world-space bounds of the
+ surfaces to cull().
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef SceneCulling_h
+#define SceneCulling_h
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+/**
+ \brief Culls world-space boxes against the view frustum and against a low-resolution depth buffer of
+ large occluders, rasterized in software.
+
+ Each frame: beginFrame() with the view-projection matrix, addOccluder() for each placed occluder mesh,
+ then cull().  cull() tests SAOSIMD::WIDTH boxes at a time against the six frustum planes and projects
+ their corners to screen-space rectangles; the boxes that remain are tested against the occlusion
+ buffer from the coarsest level of its depth pyramid at which the rectangle spans at most 2 x 2 texels,
+ descending only into the texels that do not already hide the box.
+
+ The occlusion buffer holds, at each pixel that occluders cover entirely, a lower bound on 1 / w of the
+ occluders over the whole pixel, and 0 elsewhere.  Each placed mesh is rasterized on its own first: a
+ pixel is covered when the mesh covers its center and no silhouette edge of the mesh crosses it, where
+ a silhouette edge is one with a single triangle, more than two, or two that project to the same side of
+ it, and the bound is the least 1 / w at the pixel's corners of the planes of all triangles that touch
+ it.  The covered pixels then take the nearer of their value and the buffer's.  A box is occluded when
+ its nearest corner is behind the buffer over its entire rectangle, so no box that any point of the
+ scene would show is culled.  Boxes that cross the near plane are never occluded.
+
+ Occluders should be opaque: an alpha-tested leaf or chain link in the occlusion buffer hides what is
+ seen through it.
+ */
+class SceneCulling {
+public:
+
+    enum Result {VISIBLE = 0, OUTSIDE_FRUSTUM = 1, OCCLUDED = 2};
+
+    /** World-space axis-aligned boxes, one array per coordinate, with the number of triangles inside each
+        for Statistics */
+    class BoxArray {
+    public:
+        std::vector<float>      lo[3];
+        std::vector<float>      hi[3];
+        std::vector<uint32_t>   triangles;
+
+        void clear() {
+            for (int a = 0; a < 3; ++a) {
+                lo[a].clear();
+                hi[a].clear();
+            }
+            triangles.clear();
+        }
+
+        void append(const float boxLo[3], const float boxHi[3], uint32_t triangleCount) {
+            for (int a = 0; a < 3; ++a) {
+                lo[a].push_back(boxLo[a]);
+                hi[a].push_back(boxHi[a]);
+            }
+            triangles.push_back(triangleCount);
+        }
+
+        int size() const {
+            return int(triangles.size());
+        }
+    };
+
+    /** Of the last frame */
+    class Statistics {
+    public:
+        int                 boxes;
+        size_t              triangles;
+
+        int                 frustumCulledBoxes;
+        size_t              frustumCulledTriangles;
+
+        int                 occlusionCulledBoxes;
+        size_t              occlusionCulledTriangles;
+
+        /** Occluder triangles rasterized, after those outside the frustum were rejected */
+        size_t              occluderTriangles;
+
+        float               rasterizeMilliseconds;
+        float               testMilliseconds;
+
+        Statistics() : boxes(0), triangles(0), frustumCulledBoxes(0), frustumCulledTriangles(0), occlusionCulledBoxes(0),
+            occlusionCulledTriangles(0), occluderTriangles(0), rasterizeMilliseconds(0), testMilliseconds(0) {}
+    };
+
+protected:
+
+    /** An edge of an occluder mesh and the one or two triangles that share it */
+    class Edge {
+    public:
+        uint32_t            vertex[2];
+
+        /** Indices of the first vertex of each triangle in Mesh::index; triangle[1] is -1 for a boundary
+            edge and -2 for an edge of more than two triangles */
+        int32_t             triangle[2];
+    };
+
+    /** Object-space occluder triangles, with vertices at the same position merged so that neighbors share
+        their edges */
+    class Mesh {
+    public:
+        std::vector<float>      position;
+        std::vector<uint32_t>   index;
+        std::vector<Edge>       edge;
+    };
+
+    int                         m_width;
+    int                         m_height;
+
+    /** m_level[0] is the m_width x m_height occlusion buffer, bottom row first.  Each level after it is half
+        the size, and each texel holds the minimum of the 2 x 2 below it. */
+    std::vector< std::vector<float> > m_level;
+
+    /** Row-major; clip = m_viewProjection * (x, y, z, 1) */
+    float                       m_viewProjection[16];
+
+    /** Left, right, bottom, top, near, far: a point is inside where (a, b, c) . p + d >= 0 */
+    float                       m_plane[6][4];
+
+    std::vector<Mesh>           m_meshes;
+
+    /** Clip-space (x, y, z, w) of the vertices of the mesh in addOccluder(), kept to reuse its storage */
+    std::vector<float>          m_clipPosition;
+
+    /** The mesh in addOccluder() before it is merged into level 0: the least 1 / w of the triangles that
+        touch each pixel, +inf where none does and -inf on silhouettes, and 1 where it covers the center.
+        Both are reset over [m_touchedX0, m_touchedX1] x [m_touchedY0, m_touchedY1] after each mesh. */
+    std::vector<float>          m_meshDepth;
+    std::vector<float>          m_meshCoverage;
+    int                         m_touchedX0;
+    int                         m_touchedY0;
+    int                         m_touchedX1;
+    int                         m_touchedY1;
+
+    /** False between addOccluder() and the pyramid build at the next cull() */
+    bool                        m_pyramidValid;
+
+    Statistics                  m_statistics;
+
+    /** Rasterizes one triangle whose clip-space vertices are (x, y, z, w) into m_meshDepth and
+        m_meshCoverage, clipping it at the near plane, where the cut is a silhouette */
+    void addTriangle(const float a[4], const float b[4], const float c[4]);
+
+    /** Rasterizes one triangle in front of the near plane; (x, y) in pixels and 1 / w */
+    void rasterize(const float a[3], const float b[3], const float c[3]);
+
+    /** Marks the pixels that the part of the clip-space segment in front of the near plane crosses as silhouette */
+    void addSilhouette(const float a[4], const float b[4]);
+
+    /** Builds the levels above 0 */
+    void buildPyramid();
+
+    /** True if every level-0 texel of [x0, x1] x [y0, y1] under texel (x, y) of \a level is nearer than \a inverseDepth */
+    bool occluded(int level, int x, int y, int x0, int y0, int x1, int y1, float inverseDepth) const;
+
+public:
+
+    /** \a width and \a height are the resolution of the occlusion buffer; powers of two, \a width at least 8. */
+    SceneCulling(int width = 256, int height = 128);
+
+    /** Removes all occluder meshes */
+    void clear();
+
+    /** Adds the \a maxTriangles largest triangles of at least \a minArea of a triangle list, whose vertex
+        positions are three floats every \a stride bytes from \a positions, as an occluder.  Returns the
+        index of the mesh for addOccluder(). */
+    int addOccluderMesh(const void* positions, size_t stride, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+                        float minArea, int maxTriangles);
+
+    /** Triangles kept by addOccluderMesh() */
+    int occluderTriangleCount(int mesh) const {
+        return int(m_meshes[mesh].index.size() / 3);
+    }
+
+    /** Clears the occlusion buffer and the statistics.  \a viewProjection is row-major with OpenGL clip
+        conventions, -w <= x, y, z <= w, and may have its far plane at infinity. */
+    void beginFrame(const float viewProjection[16]);
+
+    /** Rasterizes mesh \a mesh with the row-major 3 x 4 \a objectToWorld transform into the occlusion buffer */
+    void addOccluder(int mesh, const float objectToWorld[12]);
+
+    /** Sets result[i] to a Result for each box and adds them to statistics() */
+    void cull(const BoxArray& boxes, std::vector<uint8_t>& result);
+
+    int width() const {
+        return m_width;
+    }
+
+    int height() const {
+        return m_height;
+    }
+
+    /** 1 / w of the occlusion buffer at texel (x, y) of \a level, after cull() */
+    float inverseDepth(int x, int y, int level = 0) const {
+        return m_level[level][y * (m_width >> level) + x];
+    }
+
+    const Statistics& statistics() const {
+        return m_statistics;
+    }
+};
+
+#endif // SceneCulling_h
@@ -0,0 +1,427 @@
+/**
+ \file SceneIndex.cpp
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#include "SceneIndex.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#ifdef _WIN32
+#   define NOMINMAX
+#   include <windows.h>
+#else
+#   include <dirent.h>
+#   include <sys/stat.h>
+#endif
+
+typedef std::chrono::high_resolution_clock Clock;
+
+/** Bytes read by readName() before falling back to the whole file.  The name is usually the first field. */
+static const size_t HEAD_BYTES = 4096;
+
+static const char* const HEADER = "SceneIndex";
+
+
+static float millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+static bool endsWith(const std::string& s, const char* suffix) {
+    const size_t n = strlen(suffix);
+    return (s.size() > n) && (s.compare(s.size() - n, n, suffix) == 0);
+}
+
+
+#ifdef _WIN32
+/** Seconds since 1970 of \a time, in 100 ns intervals since 1601 */
+static int64_t unixTime(const FILETIME& time) {
+    const int64_t ticks = (int64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    return (ticks - 116444736000000000LL) / 10000000;
+}
+#endif
+
+
+/** Appends the files with \a extension under \a directory + "/" + \a relative to \a entries, with path,
+    modification time, and size set */
+static bool listRecursive(const std::string& directory, const std::string& relative, const char* extension, std::vector<SceneIndex::Entry>& entries) {
+    const std::string full = relative.empty() ? directory : directory + "/" + relative;
+    const std::string prefix = relative.empty() ? "" : relative + "/";
+    std::vector<std::string> subdirectories;
+
+#   ifdef _WIN32
+        WIN32_FIND_DATAA data;
+        const HANDLE find = FindFirstFileA((full + "\\*").c_str(), &data);
+        if (find == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        do {
+            const std::string name = data.cFileName;
+            if (name[0] == '.') {
+                continue;
+            }
+            if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+                // Junctions and directory symlinks can form cycles
+                if ((data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0) {
+                    subdirectories.push_back(prefix + name);
+                }
+            } else if (endsWith(name, extension)) {
+                SceneIndex::Entry e;
+                e.path         = prefix + name;
+                e.modifiedTime = unixTime(data.ftLastWriteTime);
+                e.bytes        = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+                entries.push_back(e);
+            }
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+#   else
+        DIR* dir = opendir(full.c_str());
+        if (dir == NULL) {
+            return false;
+        }
+        for (struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+            const std::string name = entry->d_name;
+            if (name[0] == '.') {
+                continue;
+            }
+            // lstat, so that symbolic links to directories, which can form cycles, are not followed
+            struct stat st;
+            if (lstat((full + "/" + name).c_str(), &st) != 0) {
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                subdirectories.push_back(prefix + name);
+            } else if (endsWith(name, extension)) {
+                if (S_ISLNK(st.st_mode) && (stat((full + "/" + name).c_str(), &st) != 0)) {
+                    continue;
+                }
+                SceneIndex::Entry e;
+                e.path         = prefix + name;
+                e.modifiedTime = int64_t(st.st_mtime);
+                e.bytes        = uint64_t(st.st_size);
+                entries.push_back(e);
+            }
+        }
+        closedir(dir);
+#   endif
+
+    // Unreadable subdirectories are skipped, as FileSystem::list does
+    for (size_t i = 0; i < subdirectories.size(); ++i) {
+        listRecursive(directory, subdirectories[i], extension, entries);
+    }
+    return true;
+}
+
+
+bool SceneIndex::status(const std::string& filename, int64_t& modifiedTime, uint64_t& bytes) {
+#   ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (! GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &data) || ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)) {
+            return false;
+        }
+        modifiedTime = unixTime(data.ftLastWriteTime);
+        bytes        = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+#   else
+        struct stat st;
+        if ((stat(filename.c_str(), &st) != 0) || ! S_ISREG(st.st_mode)) {
+            return false;
+        }
+        modifiedTime = int64_t(st.st_mtime);
+        bytes        = uint64_t(st.st_size);
+#   endif
+    return true;
+}
+
+
+static bool lessPath(const SceneIndex::Entry& a, const SceneIndex::Entry& b) {
+    return a.path < b.path;
+}
+
+
+bool SceneIndex::refresh(const std::string& directory, std::string& error) {
+    m_statistics = Statistics();
+    Clock::time_point start = Clock::now();
+
+    std::vector<Entry> current;
+    if (! listRecursive(directory, "", extension(), current)) {
+        error = "Cannot list " + directory;
+        return false;
+    }
+    std::sort(current.begin(), current.end(), lessPath);
+    m_statistics.files = int(current.size());
+    m_statistics.listMilliseconds = millisecondsSince(start);
+
+    start = Clock::now();
+    const int64_t now = int64_t(time(NULL));
+    std::vector<Entry>::const_iterator old = m_entries.begin();
+    for (size_t i = 0; i < current.size(); ++i) {
+        Entry& e = current[i];
+
+        // Both lists are sorted by path
+        while ((old != m_entries.end()) && (old->path < e.path)) {
+            ++old;
+        }
+        if ((old != m_entries.end()) && (old->path == e.path) && (old->modifiedTime == e.modifiedTime) && (old->bytes == e.bytes) && ! old->recent) {
+            e.name  = old->name;
+            e.error = old->error;
+        } else {
+            if (! readName(directory + "/" + e.path, e.name, e.error)) {
+                e.name.clear();
+            }
+            e.recent = (e.modifiedTime >= now - 1);
+            ++m_statistics.read;
+        }
+    }
+    m_entries.swap(current);
+    m_statistics.readMilliseconds = millisecondsSince(start);
+    return true;
+}
+
+
+bool SceneIndex::readName(const std::string& filename, std::string& name, std::string& error) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL) {
+        error = "Cannot open " + filename;
+        return false;
+    }
+
+    std::vector<char> text(HEAD_BYTES);
+    text.resize(fread(&text[0], 1, HEAD_BYTES, file));
+    bool complete = (text.size() < HEAD_BYTES);
+    NameResult result = extractName(text.empty() ? "" : &text[0], text.size(), complete, name);
+
+    if (result == NAME_INCOMPLETE) {
+        // The name is after the first field or the first field is large; read the rest
+        char buffer[1 << 16];
+        for (size_t n = fread(buffer, 1, sizeof(buffer), file); n > 0; n = fread(buffer, 1, sizeof(buffer), file)) {
+            text.insert(text.end(), buffer, buffer + n);
+        }
+        complete = true;
+        result = extractName(&text[0], text.size(), complete, name);
+    }
+    fclose(file);
+
+    if (result != NAME_FOUND) {
+        error = "No top-level string field 'name' in " + filename;
+        return false;
+    }
+    error.clear();
+    return true;
+}
+
+
+static bool isIdentifierStart(char c) {
+    return isalpha((unsigned char)c) || (c == '_');
+}
+
+
+static bool isIdentifier(char c) {
+    return isalnum((unsigned char)c) || (c == '_');
+}
+
+
+SceneIndex::NameResult SceneIndex::extractName(const char* text, size_t bytes, bool complete, std::string& name) {
+    const NameResult end = complete ? NAME_MISSING : NAME_INCOMPLETE;
+
+    // Nesting depth; the fields of the outermost table or list are at depth 1
+    int depth = 0;
+
+    // At the start of a field of the outermost table, where a key may appear
+    bool atKey = false;
+
+    // 1 after the key "name" at a field start, 2 after "name ="
+    int state = 0;
+
+    size_t i = 0;
+    while (i < bytes) {
+        const char c = text[i];
+
+        if (isspace((unsigned char)c)) {
+            ++i;
+        } else if ((c == '/') && (i + 1 < bytes) && (text[i + 1] == '/')) {
+            const char* newline = (const char*)memchr(text + i, '\n', bytes - i);
+            i = (newline == NULL) ? bytes : size_t(newline - text);
+        } else if ((c == '/') && (i + 1 < bytes) && (text[i + 1] == '*')) {
+            const char* close = NULL;
+            for (size_t j = i + 2; (j + 1 < bytes) && (close == NULL); ++j) {
+                if ((text[j] == '*') && (text[j + 1] == '/')) {
+                    close = text + j;
+                }
+            }
+            if (close == NULL) {
+                return end;
+            }
+            i = (close - text) + 2;
+        } else if ((c == '"') || (c == '\'')) {
+            // Only the value of name is unescaped; other strings are skipped
+            const bool isName = (state == 2) && (depth == 1);
+            std::string value;
+            size_t j = i + 1;
+            while ((j < bytes) && (text[j] != c)) {
+                if ((text[j] == '\\') && (j + 1 < bytes)) {
+                    ++j;
+                    if (isName) {
+                        switch (text[j]) {
+                        case 'n': value += '\n'; break;
+                        case 't': value += '\t'; break;
+                        case 'r': value += '\r'; break;
+                        default:  value += text[j]; break;
+                        }
+                    }
+                } else if (isName) {
+                    value += text[j];
+                }
+                ++j;
+            }
+            if (j >= bytes) {
+                return end;
+            }
+            if (isName) {
+                name = value;
+                return NAME_FOUND;
+            }
+            state = 0;
+            atKey = false;
+            i = j + 1;
+        } else if ((c == '{') || (c == '(') || (c == '[')) {
+            ++depth;
+            atKey = (depth == 1);
+            state = 0;
+            ++i;
+        } else if ((c == '}') || (c == ')') || (c == ']')) {
+            --depth;
+            if (depth <= 0) {
+                // The outermost value ended without a name
+                return NAME_MISSING;
+            }
+            atKey = false;
+            state = 0;
+            ++i;
+        } else if (((c == ',') || (c == ';')) && (depth == 1)) {
+            atKey = true;
+            state = 0;
+            ++i;
+        } else if (((c == '=') || (c == ':')) && (state == 1) && ! ((i + 1 < bytes) && (text[i + 1] == ':'))) {
+            state = 2;
+            atKey = false;
+            ++i;
+        } else if (isIdentifierStart(c)) {
+            size_t j = i;
+            while ((j < bytes) && isIdentifier(text[j])) {
+                ++j;
+            }
+            if ((j == bytes) && ! complete) {
+                return NAME_INCOMPLETE;
+            }
+            state = (atKey && (depth == 1) && (j - i == 4) && (strncmp(text + i, "name", 4) == 0)) ? 1 : 0;
+            atKey = false;
+            i = j;
+        } else {
+            state = 0;
+            atKey = false;
+            ++i;
+        }
+    }
+    return end;
+}
+
+
+bool SceneIndex::load(const std::string& filename) {
+    m_entries.clear();
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    std::string text;
+    char buffer[1 << 16];
+    for (size_t n = fread(buffer, 1, sizeof(buffer), file); n > 0; n = fread(buffer, 1, sizeof(buffer), file)) {
+        text.append(buffer, n);
+    }
+    fclose(file);
+
+    // One line per entry: modifiedTime, bytes, recent, path, name, error, separated by tabs
+    std::vector<Entry> entries;
+    size_t lineStart = 0;
+    bool ok = true;
+    for (int line = 0; ok && (lineStart < text.size()); ++line) {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = text.size();
+        }
+        std::vector<std::string> field;
+        for (size_t f = lineStart; f <= lineEnd; ) {
+            size_t tab = text.find('\t', f);
+            if ((tab == std::string::npos) || (tab > lineEnd)) {
+                tab = lineEnd;
+            }
+            field.push_back(text.substr(f, tab - f));
+            f = tab + 1;
+        }
+        lineStart = lineEnd + 1;
+
+        if (line == 0) {
+            ok = (field.size() == 2) && (field[0] == HEADER) && (atoi(field[1].c_str()) == VERSION);
+        } else if (field.size() == 6) {
+            Entry e;
+            e.modifiedTime = strtoll(field[0].c_str(), NULL, 10);
+            e.bytes        = strtoull(field[1].c_str(), NULL, 10);
+            e.recent       = (field[2] != "0");
+            e.path         = field[3];
+            e.name         = field[4];
+            e.error        = field[5];
+            ok = ! e.path.empty() && (entries.empty() || (entries.back().path < e.path));
+            entries.push_back(e);
+        } else {
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        m_entries.swap(entries);
+    }
+    return ok;
+}
+
+
+bool SceneIndex::save(const std::string& filename, std::string& error) const {
+    const std::string temporary = filename + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == NULL) {
+        error = "Cannot open " + temporary + " for writing";
+        return false;
+    }
+
+    bool ok = (fprintf(file, "%s\t%d\n", HEADER, int(VERSION)) > 0);
+    for (size_t i = 0; ok && (i < m_entries.size()); ++i) {
+        const Entry& e = m_entries[i];
+        const std::string fields = e.path + e.name + e.error;
+        if (fields.find_first_of("\t\r\n") != std::string::npos) {
+            // Cannot be stored in this format; the next refresh() reads the file again
+            continue;
+        }
+        ok = (fprintf(file, "%lld\t%llu\t%d\t%s\t%s\t%s\n", (long long)e.modifiedTime, (unsigned long long)e.bytes, e.recent ? 1 : 0,
+                      e.path.c_str(), e.name.c_str(), e.error.c_str()) > 0);
+    }
+    ok = (fclose(file) == 0) && ok;
+    if (! ok) {
+        error = "Cannot write " + temporary;
+        remove(temporary.c_str());
+        return false;
+    }
+
+    // rename() does not replace an existing file on Windows
+    remove(filename.c_str());
+    if (rename(temporary.c_str(), filename.c_str()) != 0) {
+        error = "Cannot rename " + temporary + " to " + filename;
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,118 @@
+/**
+ \file SceneIndex.h
+
+ Persistent index of the scene files under a directory, so that Scene::sceneNames() does not parse every
+ scene file on every launch.  No G3D dependency; Scene.cpp runs it on a background thread.
+
+  Open Source under the "BSD" license: http://www.opensource.org/licenses/bsd-license.php
+ */
+#ifndef SceneIndex_h
+#define SceneIndex_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ \brief The path, modification time, size, and top-level \c name field of every file with extension()
+ under a directory tree.
+
+ refresh() lists the tree and reads the name of only those files whose path, modification time, or size
+ differ from the index, through readName(), which scans the G3D Any text for the top-level <code>name =
+ "..."</code> without parsing the rest of the file.  save() and load() keep the index between launches in
+ a small text file.
+
+ Modification times have a resolution of one second, so a file that was modified in the second before it
+ was read could change again without a visible difference.  Such entries are marked \a recent and are read
+ again by the next refresh(), as git does for its index.
+ */
+class SceneIndex {
+public:
+
+    enum {VERSION = 1};
+
+    class Entry {
+    public:
+        /** Relative to the directory passed to refresh(), with '/' separators */
+        std::string         path;
+
+        /** Seconds since 1970 */
+        int64_t             modifiedTime;
+        uint64_t            bytes;
+
+        /** The top-level name field; empty if it could not be read */
+        std::string         name;
+
+        /** Why \a name is empty */
+        std::string         error;
+
+        /** Modified within a second of being read, so the next refresh() must read it again */
+        bool                recent;
+
+        Entry() : modifiedTime(0), bytes(0), recent(false) {}
+    };
+
+    /** Work done by the last refresh() */
+    class Statistics {
+    public:
+        int                 files;
+
+        /** Files whose name was read; the others came from the index */
+        int                 read;
+        float               listMilliseconds;
+        float               readMilliseconds;
+
+        Statistics() : files(0), read(0), listMilliseconds(0), readMilliseconds(0) {}
+    };
+
+protected:
+
+    /** Sorted by path */
+    std::vector<Entry>      m_entries;
+
+    Statistics              m_statistics;
+
+public:
+
+    /** Replaces the entries with those of \a filename.  Returns false, leaving the index empty, if the file is
+        missing, of another version, or malformed; refresh() then reads every file. */
+    bool load(const std::string& filename);
+
+    /** Writes through a temporary file that is renamed over \a filename.  Returns false and sets \a error on failure. */
+    bool save(const std::string& filename, std::string& error) const;
+
+    /** Lists every file with extension() under \a directory, skipping hidden directories, and reads the name of
+        each file that is new or changed.  Entries of files that no longer exist are removed.  Returns false and
+        sets \a error if \a directory cannot be listed. */
+    bool refresh(const std::string& directory, std::string& error);
+
+    /** Sorted by path */
+    const std::vector<Entry>& entries() const {
+        return m_entries;
+    }
+
+    const Statistics& statistics() const {
+        return m_statistics;
+    }
+
+    /** Sets the modification time and size of the regular file \a filename as refresh() records them.  Returns
+        false if it does not exist. */
+    static bool status(const std::string& filename, int64_t& modifiedTime, uint64_t& bytes);
+
+    /** Reads the start of \a filename, and all of it only if the name is not there.  Returns false and sets
+        \a error if the file cannot be read or has no top-level string field \c name. */
+    static bool readName(const std::string& filename, std::string& name, std::string& error);
+
+    enum NameResult {NAME_FOUND, NAME_MISSING, NAME_INCOMPLETE};
+
+    /** Finds the string value of the field \c name of the outermost table or list of the G3D Any text
+        \a text, skipping comments and nested values.  Returns NAME_INCOMPLETE if the text ends first and
+        \a complete is false, i.e., \a text is only the start of the file. */
+    static NameResult extractName(const char* text, size_t bytes, bool complete, std::string& name);
+
+    static const char* extension() {
+        return ".scn.any";
+    }
+};
+
+#endif // SceneIndex_h
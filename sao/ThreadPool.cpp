@@ -0,0 +1,153 @@
+/**
+ \file ThreadPool.cpp
+ */
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+
+ThreadPool::ThreadPool(int numThreads) :
+    m_task(NULL),
+    m_generation(0),
+    m_busyWorkers(0),
+    m_shutdown(false),
+    m_stealCount(0) {
+
+    if (numThreads <= 0) {
+        numThreads = std::max(1, int(std::thread::hardware_concurrency()));
+    }
+
+    for (int i = 0; i < numThreads; ++i) {
+        m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+
+    // Worker 0 is the thread that calls parallelFor
+    for (int i = 1; i < numThreads; ++i) {
+        m_threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_wake.notify_all();
+
+    for (size_t i = 0; i < m_threads.size(); ++i) {
+        m_threads[i].join();
+    }
+}
+
+
+void ThreadPool::parallelFor(int count, const Task& task) {
+    if (count <= 0) {
+        return;
+    }
+
+    const int n = size();
+    m_stealCount = 0;
+
+    if (n == 1) {
+        for (int i = 0; i < count; ++i) {
+            task(i, 0);
+        }
+        return;
+    }
+
+    // Deal contiguous runs so that adjacent items share caches
+    for (int w = 0; w < n; ++w) {
+        std::lock_guard<std::mutex> lock(m_queues[w]->mutex);
+        const int begin = int((long long)count * w / n);
+        const int end   = int((long long)count * (w + 1) / n);
+        for (int i = begin; i < end; ++i) {
+            m_queues[w]->items.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(m_task == NULL && "ThreadPool::parallelFor is not reentrant");
+        m_task = &task;
+        m_busyWorkers = n - 1;
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_busyWorkers > 0) {
+        m_done.wait(lock);
+    }
+    m_task = NULL;
+}
+
+
+void ThreadPool::workerLoop(int worker) {
+    int generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (! m_shutdown && (m_generation == generation)) {
+                m_wake.wait(lock);
+            }
+            if (m_shutdown) {
+                return;
+            }
+            generation = m_generation;
+        }
+
+        drain(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_busyWorkers;
+        }
+        m_done.notify_one();
+    }
+}
+
+
+void ThreadPool::drain(int worker) {
+    const Task& task = *m_task;
+    int index;
+
+    while (pop(worker, index)) {
+        task(index, worker);
+    }
+
+    while (steal(worker, index)) {
+        ++m_stealCount;
+        task(index, worker);
+    }
+}
+
+
+bool ThreadPool::pop(int worker, int& index) {
+    Queue& q = *m_queues[worker];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.items.empty()) {
+        return false;
+    }
+    index = q.items.front();
+    q.items.pop_front();
+    return true;
+}
+
+
+bool ThreadPool::steal(int thief, int& index) {
+    const int n = size();
+    for (int i = 1; i < n; ++i) {
+        Queue& q = *m_queues[(thief + i) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (! q.items.empty()) {
+            // Take from the opposite end from the owner to avoid contending for the same items
+            index = q.items.back();
+            q.items.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
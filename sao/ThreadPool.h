@@ -0,0 +1,95 @@
+/**
+ \file ThreadPool.h
+
+ Work-stealing thread pool used by the CPU implementation of SAO.  No G3D dependency.
+ */
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ \brief Fixed set of worker threads that run index ranges with work stealing.
+
+ parallelFor() deals the indices out to the workers in contiguous runs, so that neighboring
+ tiles stay on one core. Each worker drains its own queue from the front. When its queue is empty,
+ it steals from the back of another worker's queue. Workers that draw cheap items, e.g., tiles
+ that are mostly sky, therefore take over the remaining items of slower workers instead of idling.
+
+ The calling thread participates as worker 0, so a pool of size 1 runs everything inline.
+ */
+class ThreadPool {
+public:
+
+    /** \param index Item on [0, count)  \param worker Worker on [0, size()) that ran the item */
+    typedef std::function<void (int index, int worker)> Task;
+
+protected:
+
+    class Queue {
+    public:
+        std::mutex                  mutex;
+        std::deque<int>             items;
+    };
+
+    std::vector<std::thread>        m_threads;
+    std::vector<std::unique_ptr<Queue> > m_queues;
+
+    std::mutex                      m_mutex;
+    std::condition_variable         m_wake;
+    std::condition_variable         m_done;
+
+    /** Task for the current parallelFor(), NULL between calls */
+    const Task*                     m_task;
+
+    /** Incremented for each parallelFor() so that sleeping workers can tell new work from spurious wakeups */
+    int                             m_generation;
+
+    /** Background workers that have not finished the current generation */
+    int                             m_busyWorkers;
+
+    bool                            m_shutdown;
+
+    std::atomic<int>                m_stealCount;
+
+    void workerLoop(int worker);
+
+    /** Runs items from this worker's queue, then from the other queues, until all are empty */
+    void drain(int worker);
+
+    bool pop(int worker, int& index);
+
+    bool steal(int thief, int& index);
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+public:
+
+    /** \param numThreads Total number of workers including the caller.  0 means one per hardware thread. */
+    explicit ThreadPool(int numThreads = 0);
+
+    ~ThreadPool();
+
+    int size() const {
+        return int(m_queues.size());
+    }
+
+    /** Runs task(i, worker) for every i on [0, count) and returns when all have completed.
+        Not reentrant: \a task must not call parallelFor() on the same pool. */
+    void parallelFor(int count, const Task& task);
+
+    /** Number of items that were run by a worker other than the one they were dealt to in the last parallelFor() */
+    int stealCount() const {
+        return m_stealCount;
+    }
+};
+
+#endif // ThreadPool_h
@@ -0,0 +1,272 @@
+/**
+ \file EntityAnimationBenchmark.cpp
+
+ Measures the frame-spline evaluation of Scene::onSimulation for many animated entities.  Each entity has a
+ random PhysicsFrame spline of 2 to 10 control points, half of them cyclic, and is evaluated at 60 Hz from
+ before its first control point until after the last control point of most splines, so that extrapolation
+ and wrapping are exercised.
+
+ It reports, per frame:
+
+ - per entity: an object per entity with its own arrays, evaluated one at a time the way Spline<PhysicsFrame>
+   does, which is the reference for the others
+ - scalar: EntityAnimation::evaluateScalar for each spline
+ - SIMD: EntityAnimation::evaluate on one thread
+ - parallel: EntityAnimation::evaluate in chunks on a ThreadPool, as Scene::onSimulation runs it
+
+ and the largest difference of any frame element from the reference.
+
+ Build from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -I. tools/EntityAnimationBenchmark.cpp EntityAnimation.cpp ThreadPool.cpp -pthread -o EntityAnimationBenchmark
+
+ Usage:  EntityAnimationBenchmark [entities [frames [threads]]]
+ */
+#include "EntityAnimation.h"
+#include "SAOSIMD.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+/** Splines per ThreadPool item, as in Scene.cpp */
+static const int CHUNK_SIZE = 1024;
+
+/** A PhysicsFrame with the arithmetic that Spline needs */
+class Frame {
+public:
+    float   t[3];
+    float   q[4];
+
+    Frame operator*(float s) const {
+        Frame r;
+        for (int k = 0; k < 3; ++k) { r.t[k] = t[k] * s; }
+        for (int k = 0; k < 4; ++k) { r.q[k] = q[k] * s; }
+        return r;
+    }
+
+    Frame operator+(const Frame& f) const {
+        Frame r;
+        for (int k = 0; k < 3; ++k) { r.t[k] = t[k] + f.t[k]; }
+        for (int k = 0; k < 4; ++k) { r.q[k] = q[k] + f.q[k]; }
+        return r;
+    }
+
+    void unitize() {
+        const float s = 1.0f / std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        for (int k = 0; k < 4; ++k) { q[k] *= s; }
+    }
+};
+
+
+/** An entity that owns its spline and frame, evaluated as Spline<PhysicsFrame>::evaluate does */
+class SplineEntity {
+public:
+    std::vector<float>  time;
+    std::vector<Frame>  control;
+    bool                cyclic;
+    float               finalInterval;
+    float               frame[12];
+
+    float duration() const {
+        float f = finalInterval;
+        if (f <= 0.0f) {
+            const size_t N = time.size();
+            f = 0.5f * (time[1] - time[0] + time[N - 1] - time[N - 2]);
+        }
+        return time.back() - time[0] + f;
+    }
+
+    void getControl(int i, float& t, Frame& c) const {
+        const int N = int(control.size());
+        if (cyclic) {
+            const int wraps = (i >= 0) ? (i / N) : -((N - 1 - i) / N);
+            const int j = i - wraps * N;
+            c = control[j];
+            t = time[j] + float(wraps) * duration();
+        } else if (i < 0) {
+            c = control[1] * float(i) + control[0] * float(1 - i);
+            c.unitize();
+            t = (time[1] - time[0]) * float(i) + time[0];
+        } else if (i >= N) {
+            c = control[N - 1] * float(i - N + 2) + control[N - 2] * -float(i - N + 1);
+            c.unitize();
+            t = time[N - 1] + (time[N - 1] - time[N - 2]) * float(i - N + 1);
+        } else {
+            c = control[i];
+            t = time[i];
+        }
+    }
+
+    void computeIndex(float s, int& i, float& u) const {
+        const int N = int(time.size());
+        if (cyclic) {
+            const float d = duration();
+            s -= std::floor((s - time[0]) / d) * d;
+            s = std::max(time[0], s);
+            if (s >= time[N - 1]) {
+                i = N - 1;
+                u = (s - time[N - 1]) / (d - (time[N - 1] - time[0]));
+                return;
+            }
+        }
+        if (s < time[0]) {
+            const float x = (s - time[0]) / (time[1] - time[0]);
+            i = int(std::floor(x));
+            u = x - float(i);
+        } else if (s >= time[N - 1]) {
+            const float x = float(N - 1) + (s - time[N - 1]) / (time[N - 1] - time[N - 2]);
+            i = int(std::floor(x));
+            u = x - float(i);
+        } else {
+            i = 0;
+            while (time[i + 1] <= s) {
+                ++i;
+            }
+            u = (s - time[i]) / (time[i + 1] - time[i]);
+        }
+    }
+
+    void onSimulation(float s) {
+        int i;
+        float u;
+        computeIndex(s, i, u);
+        Frame p[4];
+        float t[4];
+        for (int j = 0; j < 4; ++j) {
+            getControl(i - 1 + j, t[j], p[j]);
+        }
+        for (int j = 1; j < 4; ++j) {
+            const float cosphi = p[j - 1].q[0] * p[j].q[0] + p[j - 1].q[1] * p[j].q[1] + p[j - 1].q[2] * p[j].q[2] + p[j - 1].q[3] * p[j].q[3];
+            if (cosphi < 0.0f) {
+                for (int k = 0; k < 4; ++k) {
+                    p[j].q[k] = -p[j].q[k];
+                }
+            }
+        }
+        const float dt0 = t[1] - t[0], dt1 = t[2] - t[1], dt2 = t[3] - t[2];
+        const float x = (dt0 + dt1) * 0.5f;
+        const Frame dp1n1 = (p[2] + p[1] * -1.0f) * (x / dt1);
+        const Frame tan1  = (p[1] + p[0] * -1.0f) * (x / dt0) + dp1n1;
+        const Frame tan2  = dp1n1 + (p[3] + p[2] * -1.0f) * (x / dt2);
+        const float w[4] = {0.5f * u * u * u - u * u + 0.5f * u, 2 * u * u * u - 3 * u * u + 1, -2 * u * u * u + 3 * u * u, 0.5f * u * u * u - 0.5f * u * u};
+        Frame sum = tan1 * w[0] + p[1] * w[1] + p[2] * w[2] + tan2 * w[3];
+        sum.unitize();
+
+        const float qx = sum.q[0], qy = sum.q[1], qz = sum.q[2], qw = sum.q[3];
+        const float m[12] = {
+            1 - 2 * (qy * qy + qz * qz), 2 * (qx * qy - qw * qz), 2 * (qx * qz + qw * qy), sum.t[0],
+            2 * (qx * qy + qw * qz), 1 - 2 * (qx * qx + qz * qz), 2 * (qy * qz - qw * qx), sum.t[1],
+            2 * (qx * qz - qw * qy), 2 * (qy * qz + qw * qx), 1 - 2 * (qx * qx + qy * qy), sum.t[2]};
+        std::copy(m, m + 12, frame);
+    }
+};
+
+
+int main(int argc, char** argv) {
+    const int entityCount = (argc > 1) ? atoi(argv[1]) : 50000;
+    const int frameCount  = (argc > 2) ? atoi(argv[2]) : 600;
+    const int threadCount = (argc > 3) ? atoi(argv[3]) : 0;
+
+    std::mt19937 rng(23);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    std::vector<SplineEntity> entities(entityCount);
+    EntityAnimation animation;
+    for (int e = 0; e < entityCount; ++e) {
+        SplineEntity& entity = entities[e];
+        const int count = 2 + int(uniform(rng) * 9.0f);
+        entity.cyclic = (uniform(rng) < 0.5f);
+        entity.finalInterval = (uniform(rng) < 0.5f) ? 0.0f : 0.5f + uniform(rng);
+        float t = 2.0f * uniform(rng);
+        std::vector<EntityAnimation::Control> controls(count);
+        for (int i = 0; i < count; ++i) {
+            Frame f;
+            for (int k = 0; k < 3; ++k) {
+                f.t[k] = 100.0f * uniform(rng) - 50.0f;
+            }
+            for (int k = 0; k < 4; ++k) {
+                f.q[k] = 2.0f * uniform(rng) - 1.0f;
+            }
+            f.unitize();
+            entity.time.push_back(t);
+            entity.control.push_back(f);
+            std::copy(f.t, f.t + 3, controls[i].translation);
+            std::copy(f.q, f.q + 4, controls[i].rotation);
+            t += 0.25f + 1.5f * uniform(rng);
+        }
+        animation.add(&entity.time[0], &controls[0], count, entity.cyclic, entity.finalInterval);
+    }
+
+    const float startTime = -1.0f;
+    const float step = 1.0f / 60.0f;
+
+    // Each keeps its own current segments
+    EntityAnimation parallelAnimation = animation;
+
+    ThreadPool pool(threadCount);
+    const int chunks = (animation.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    float entityMs = 0, scalarMs = 0, simdMs = 0, parallelMs = 0, maxError = 0;
+    float scalarFrame[12], frame[12];
+    for (int f = 0; f < frameCount; ++f) {
+        const float time = startTime + step * float(f);
+
+        Clock::time_point start = Clock::now();
+        for (int e = 0; e < entityCount; ++e) {
+            entities[e].onSimulation(time);
+        }
+        entityMs += millisecondsSince(start);
+
+        start = Clock::now();
+        float checksum = 0.0f;
+        for (int e = 0; e < entityCount; ++e) {
+            animation.evaluateScalar(e, time, scalarFrame);
+            checksum += scalarFrame[3];
+        }
+        scalarMs += millisecondsSince(start);
+
+        start = Clock::now();
+        animation.evaluate(time, 0, animation.size());
+        simdMs += millisecondsSince(start);
+
+        start = Clock::now();
+        pool.parallelFor(chunks, [&](int chunk, int worker) {
+            (void)worker;
+            parallelAnimation.evaluate(time, chunk * CHUNK_SIZE, std::min(parallelAnimation.size(), (chunk + 1) * CHUNK_SIZE));
+        });
+        parallelMs += millisecondsSince(start);
+
+        for (int e = 0; e < entityCount; ++e) {
+            for (int a = 0; a < 2; ++a) {
+                (a ? parallelAnimation : animation).frame(e, frame);
+                for (int k = 0; k < 12; ++k) {
+                    // Relative to the magnitude of the translations
+                    const float scale = (k % 4 == 3) ? 50.0f : 1.0f;
+                    maxError = std::max(maxError, std::fabs(frame[k] - entities[e].frame[k]) / scale);
+                }
+            }
+        }
+        (void)checksum;
+    }
+
+    printf("%d entities, %d frames, %d lanes (%s), %d threads\n", entityCount, frameCount, SAOSIMD::WIDTH, SAOSIMD::name(), pool.size());
+    printf("per entity: %8.3f ms per frame\n", entityMs / frameCount);
+    printf("scalar:     %8.3f ms per frame\n", scalarMs / frameCount);
+    printf("SIMD:       %8.3f ms per frame\n", simdMs / frameCount);
+    printf("parallel:   %8.3f ms per frame  (%d chunks of %d)\n", parallelMs / frameCount, chunks, CHUNK_SIZE);
+    printf("largest difference from per entity: %g\n", maxError);
+
+    return (maxError < 1e-3f) ? 0 : 1;
+}
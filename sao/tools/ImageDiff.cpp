@@ -0,0 +1,176 @@
+/**
+ \file ImageDiff.cpp
+ */
+#include "ImageDiff.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+bool FloatImage::writePFM(const std::string& filename) const {
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    // A negative scale marks little-endian data
+    fprintf(file, "Pf\n%d %d\n-1.0\n", width, height);
+    bool ok = true;
+    for (int y = height - 1; (y >= 0) && ok; --y) {
+        ok = fwrite(&pixel[size_t(y) * size_t(width)], sizeof(float), width, file) == size_t(width);
+    }
+    return (fclose(file) == 0) && ok;
+}
+
+
+bool FloatImage::readPFM(const std::string& filename) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char magic[3] = {0, 0, 0};
+    float scale = 0;
+    int w = 0, h = 0;
+    // The single whitespace character after the scale ends the header
+    bool ok = (fscanf(file, "%2s %d %d %f", magic, &w, &h, &scale) == 4) && (fgetc(file) != EOF) &&
+              (strcmp(magic, "Pf") == 0) && (w > 0) && (h > 0) && (scale < 0);
+    if (ok) {
+        width  = w;
+        height = h;
+        pixel.resize(size_t(w) * size_t(h));
+        for (int y = height - 1; (y >= 0) && ok; --y) {
+            ok = fread(&pixel[size_t(y) * size_t(width)], sizeof(float), width, file) == size_t(width);
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+
+/** SSIM of the 8 x 8 window at (x0, y0), on [-1, 1], or -2 if the window has a non-finite pixel */
+static double windowSSIM(const FloatImage& a, const FloatImage& b, int x0, int y0, double c1, double c2) {
+    double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+    for (int y = y0; y < y0 + 8; ++y) {
+        for (int x = x0; x < x0 + 8; ++x) {
+            const double va = a(x, y), vb = b(x, y);
+            if (! (std::isfinite(va) && std::isfinite(vb))) {
+                return -2.0;
+            }
+            sa += va;  sb += vb;  saa += va * va;  sbb += vb * vb;  sab += va * vb;
+        }
+    }
+    const double n = 64.0;
+    const double ma = sa / n, mb = sb / n;
+    const double va = std::max(0.0, saa / n - ma * ma), vb = std::max(0.0, sbb / n - mb * mb), cov = sab / n - ma * mb;
+    return ((2 * ma * mb + c1) * (2 * cov + c2)) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+}
+
+
+ImageDiff::Result ImageDiff::compare(const FloatImage& test, const FloatImage& golden, const Thresholds& thresholds, FloatImage* diff) {
+    Result r;
+    r.sizeMatches = (test.width == golden.width) && (test.height == golden.height);
+    if (! r.sizeMatches) {
+        return r;
+    }
+    if (diff != NULL) {
+        *diff = FloatImage(golden.width, golden.height);
+    }
+
+    const float inf = std::numeric_limits<float>::infinity();
+    float lo = inf, hi = -inf;
+    double squaredError = 0;
+    long long finitePixels = 0;
+
+    for (int y = 0; y < golden.height; ++y) {
+        for (int x = 0; x < golden.width; ++x) {
+            const float t = test(x, y), g = golden(x, y);
+            float e;
+            if (std::isfinite(t) && std::isfinite(g)) {
+                lo = std::min(lo, g);
+                hi = std::max(hi, g);
+                squaredError += double(t - g) * double(t - g);
+                ++finitePixels;
+                e = std::fabs(t - g);
+                if (thresholds.relative) {
+                    e /= std::max(1.0f, std::fabs(g));
+                }
+            } else {
+                // Equal infinities match; NaN never does
+                e = (t == g) ? 0.0f : inf;
+            }
+
+            ++r.pixels;
+            if (e > thresholds.pixelTolerance) {
+                ++r.outliers;
+            }
+            if (e > r.maxError) {
+                r.maxError = e;
+                r.worstX   = x;
+                r.worstY   = y;
+            }
+            if (diff != NULL) {
+                (*diff)(x, y) = e;
+            }
+        }
+    }
+
+    const double peak = (hi > lo) ? double(hi) - double(lo) : 1.0;
+    const double mse  = (finitePixels > 0) ? squaredError / double(finitePixels) : 0.0;
+    r.psnr = (mse > 0) ? 10.0 * std::log10(peak * peak / mse) : std::numeric_limits<double>::infinity();
+
+    // Constants of Wang et al. 2004 for the dynamic range of the golden
+    const double c1 = (0.01 * peak) * (0.01 * peak), c2 = (0.03 * peak) * (0.03 * peak);
+    double ssimSum = 0;
+    int windows = 0;
+    for (int y = 0; y + 8 <= golden.height; y += 4) {
+        for (int x = 0; x + 8 <= golden.width; x += 4) {
+            const double s = windowSSIM(test, golden, x, y, c1, c2);
+            if (s >= -1.0) {
+                ssimSum += s;
+                ++windows;
+            }
+        }
+    }
+    r.ssim = (windows > 0) ? ssimSum / windows : 1.0;
+
+    r.passed = (r.outlierFraction() <= thresholds.maxOutlierFraction) && (r.psnr >= thresholds.minPSNR) && (r.ssim >= thresholds.minSSIM);
+    return r;
+}
+
+
+std::string ImageDiff::Result::toString() const {
+    if (! sizeMatches) {
+        return "size mismatch";
+    }
+    char s[256];
+    snprintf(s, sizeof(s), "max error %.3g at (%d, %d), %lld / %lld outliers, PSNR %.1f dB, SSIM %.6f",
+             maxError, worstX, worstY, outliers, pixels, psnr, ssim);
+    return s;
+}
+
+
+bool ImageDiff::writeDiffPGM(const std::string& filename, const FloatImage& diff, float tolerance) {
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    fprintf(file, "P5\n%d %d\n255\n", diff.width, diff.height);
+    std::vector<unsigned char> row(diff.width);
+    bool ok = true;
+    for (int y = 0; (y < diff.height) && ok; ++y) {
+        for (int x = 0; x < diff.width; ++x) {
+            const float e = diff(x, y);
+            if (e <= 0.0f) {
+                row[x] = 0;
+            } else if (e <= tolerance) {
+                row[x] = (unsigned char)(1.0f + 127.0f * e / tolerance);
+            } else {
+                // Log scale above the tolerance, saturating at 1000x
+                const float t = std::min(1.0f, std::log10(e / tolerance) / 3.0f);
+                row[x] = (unsigned char)(128.0f + 127.0f * t);
+            }
+        }
+        ok = fwrite(&row[0], 1, row.size(), file) == row.size();
+    }
+    return (fclose(file) == 0) && ok;
+}
@@ -0,0 +1,106 @@
+/**
+ \file ImageDiff.h
+
+ Tolerance-aware comparison of single-channel float images for the headless SAOCPU tools: per-pixel error
+ with an allowed fraction of outliers, PSNR, and SSIM, plus PFM and PGM file I/O for goldens and diff images.
+ No G3D dependency.
+ */
+#ifndef ImageDiff_h
+#define ImageDiff_h
+
+#include <string>
+#include <vector>
+
+/** Single-channel float image, row 0 at the top like the SAOCPU buffers */
+class FloatImage {
+public:
+    int                 width;
+    int                 height;
+    std::vector<float>  pixel;
+
+    FloatImage() : width(0), height(0) {}
+
+    FloatImage(int w, int h) : width(w), height(h), pixel(size_t(w) * size_t(h), 0.0f) {}
+
+    float& operator()(int x, int y) {
+        return pixel[size_t(x) + size_t(y) * size_t(width)];
+    }
+
+    float operator()(int x, int y) const {
+        return pixel[size_t(x) + size_t(y) * size_t(width)];
+    }
+
+    /** Portable float map ("Pf"), little-endian.  PFM stores the bottom row first, which these flip. */
+    bool writePFM(const std::string& filename) const;
+    bool readPFM(const std::string& filename);
+};
+
+
+class ImageDiff {
+public:
+
+    /** Limits that a test image must meet against its golden */
+    class Thresholds {
+    public:
+        /** Largest per-pixel error that does not count as an outlier */
+        float           pixelTolerance;
+
+        /** When true, the error of a pixel is |test - golden| / max(1, |golden|), for values such as
+            camera-space z whose precision scales with magnitude */
+        bool            relative;
+
+        /** Fraction of the compared pixels that may exceed pixelTolerance */
+        float           maxOutlierFraction;
+
+        /** Lower bounds; PSNR is infinite and SSIM 1 for identical images */
+        double          minPSNR;
+        double          minSSIM;
+
+        Thresholds(float tolerance = 0.0f, bool rel = false, float outliers = 0.0f, double psnr = 0.0, double ssim = 0.0) :
+            pixelTolerance(tolerance), relative(rel), maxOutlierFraction(outliers), minPSNR(psnr), minSSIM(ssim) {}
+    };
+
+    class Result {
+    public:
+        bool            sizeMatches;
+
+        /** Largest per-pixel error, in the sense of Thresholds::relative, and where it occurred */
+        float           maxError;
+        int             worstX;
+        int             worstY;
+
+        /** Pixels compared, which is all of them */
+        long long       pixels;
+
+        /** Pixels above the tolerance, including those that are finite in only one image or are different
+            non-finite values */
+        long long       outliers;
+
+        /** Over the pixels that are finite in both, with the peak being the range of the golden */
+        double          psnr;
+
+        /** Mean SSIM of 8 x 8 windows with a stride of 4, skipping windows that contain non-finite pixels */
+        double          ssim;
+
+        bool            passed;
+
+        Result() : sizeMatches(false), maxError(0), worstX(0), worstY(0), pixels(0), outliers(0), psnr(0), ssim(0), passed(false) {}
+
+        float outlierFraction() const {
+            return (pixels > 0) ? float(double(outliers) / double(pixels)) : 0.0f;
+        }
+
+        /** One line summary, e.g., for logs */
+        std::string toString() const;
+    };
+
+    /** Compares \a test against \a golden.  \param diff If not NULL, receives the per-pixel error (infinity
+        for mismatched non-finite values) for writeDiffPGM(). */
+    static Result compare(const FloatImage& test, const FloatImage& golden, const Thresholds& thresholds, FloatImage* diff = NULL);
+
+    /** Writes |error| as 8-bit gray, with \a tolerance at 128 and larger errors up to 255.  Errors of
+        exactly 0 are black so that any difference is visible. */
+    static bool writeDiffPGM(const std::string& filename, const FloatImage& diff, float tolerance);
+};
+
+#endif // ImageDiff_h
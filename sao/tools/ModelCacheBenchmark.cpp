@@ -0,0 +1,125 @@
+/**
+ \file ModelCacheBenchmark.cpp
+
+ Compares a cold start, which parses a Wavefront OBJ and its MTL files as text, applies a scale preprocess,
+ and writes a ModelCache, with warm starts that hash the OBJ and map that cache, as Scene::create does for
+ the models of a scene.  The OBJ is parsed by the small loader of OBJFile.h, which is enough to time text
+ parsing against mapping; the demo builds the cache from the ArticulatedModel that G3D loaded instead.
+
+ It reports, in milliseconds:
+
+ - cold: reading and parsing the OBJ and MTL, and writing the cache
+ - warm (median of the runs): hashing the OBJ, mapping and checking the cache, and copying its vertex and
+   index arrays into memory of their own, as the demo does for ArticulatedModel
+
+ and checks that the warm arrays are identical to the cold ones.  Both are measured with the OBJ in the OS
+ file cache; a start after a reboot also waits for the disk, which a cache file smaller than the text
+ reduces further.  Extract sponza.obj and sponza.mtl from data/models/crytek_sponza/sponza.zip to time
+ Crytek Sponza.
+
+ Build from the sao directory with:
+
+     g++ -O3 -I. tools/ModelCacheBenchmark.cpp ModelCache.cpp -o ModelCacheBenchmark
+
+ Usage:  ModelCacheBenchmark model.obj [scale [runs [cacheFile]]]
+ */
+#include "ModelCache.h"
+#include "OBJFile.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+static float median(std::vector<float> v) {
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: ModelCacheBenchmark model.obj [scale [runs [cacheFile]]]\n");
+        return 1;
+    }
+    const std::string objFilename   = argv[1];
+    const float       scale         = (argc > 2) ? float(atof(argv[2])) : 1.0f;
+    const int         runs          = (argc > 3) ? std::max(1, atoi(argv[3])) : 5;
+    const std::string cacheFilename = (argc > 4) ? argv[4] : objFilename + ModelCache::extension();
+
+    // The specification is part of the key, so a different scale rebuilds the cache
+    char specification[64];
+    snprintf(specification, sizeof(specification), "scale(%.9g)", scale);
+
+    // Cold start
+    Clock::time_point start = Clock::now();
+    ModelCache::Builder builder;
+    if (! parseOBJ(objFilename, scale, builder)) {
+        fprintf(stderr, "Cannot read %s\n", objFilename.c_str());
+        return 1;
+    }
+    const float parseMs = millisecondsSince(start);
+
+    start = Clock::now();
+    std::string error;
+    uint64_t key = 0;
+    if (! ModelCache::hashFile(objFilename, key, error) ||
+        ! builder.write(cacheFilename, ModelCache::hash(specification, strlen(specification), key), error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    const float writeMs = millisecondsSince(start);
+
+    // Warm starts
+    std::vector<float> hashMs, mapMs, copyMs, totalMs;
+    bool identical = true;
+    size_t cacheBytes = 0;
+    for (int r = 0; r < runs; ++r) {
+        const Clock::time_point runStart = Clock::now();
+        start = Clock::now();
+        if (! ModelCache::hashFile(objFilename, key, error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        key = ModelCache::hash(specification, strlen(specification), key);
+        hashMs.push_back(millisecondsSince(start));
+
+        start = Clock::now();
+        ModelCache cache;
+        if (! cache.load(cacheFilename, key, error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        mapMs.push_back(millisecondsSince(start));
+        cacheBytes = cache.fileBytes();
+
+        start = Clock::now();
+        std::vector<ModelCache::Vertex> vertices(cache.vertices(), cache.vertices() + cache.vertexCount());
+        std::vector<uint32_t> indices(cache.indices(), cache.indices() + cache.indexCount());
+        copyMs.push_back(millisecondsSince(start));
+        totalMs.push_back(millisecondsSince(runStart));
+
+        identical = identical && (vertices.size() == builder.vertices.size()) && (indices == builder.indices) &&
+            (vertices.empty() || (memcmp(&vertices[0], &builder.vertices[0], vertices.size() * sizeof(ModelCache::Vertex)) == 0)) &&
+            (cache.meshCount() == int(builder.meshes.size())) && (cache.materialCount() == int(builder.materials.size()));
+    }
+
+    printf("%s: %d vertices, %d triangles, %d meshes, %d materials; cache %.1f MB\n", objFilename.c_str(),
+           int(builder.vertices.size()), int(builder.indices.size() / 3), int(builder.meshes.size()), int(builder.materials.size()),
+           cacheBytes / 1e6);
+    printf("cold:  parse %9.2f ms   write cache %7.2f ms   total %9.2f ms\n", parseMs, writeMs, parseMs + writeMs);
+    printf("warm:  hash  %9.2f ms   map %7.2f ms   copy %7.2f ms   total %9.2f ms  (median of %d)\n",
+           median(hashMs), median(mapMs), median(copyMs), median(totalMs), runs);
+    printf("speedup %.1fx; warm arrays %s\n", (parseMs + writeMs) / median(totalMs), identical ? "identical" : "DIFFER");
+
+    return identical ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+/**
+ \file OBJFile.h
+
+ Minimal Wavefront OBJ reader for the headless tools that need real geometry, like Crytek Sponza: positions,
+ texture coordinates, normals, faces, and MTL materials.  It builds one part with one mesh per material,
+ welding corners that repeat the same position, texture coordinate, and normal, and fan-triangulates
+ polygons.  The demo loads models with G3D instead.  No G3D dependency.
+ */
+#ifndef OBJFile_h
+#define OBJFile_h
+
+#include "ModelCache.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+inline bool readFile(const std::string& filename, std::string& text) {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (! file) {
+        return false;
+    }
+    text.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return true;
+}
+
+
+inline std::string directoryOf(const std::string& filename) {
+    const size_t slash = filename.find_last_of("/\\");
+    return (slash == std::string::npos) ? "" : filename.substr(0, slash + 1);
+}
+
+
+/** Parses "i", "i/t", "i//n", or "i/t/n" into 0-based indices, -1 where absent */
+inline void parseCorner(const char* s, int vertexCount, int texCoordCount, int normalCount, int corner[3]) {
+    const int count[3] = {vertexCount, texCoordCount, normalCount};
+    for (int k = 0; k < 3; ++k) {
+        corner[k] = -1;
+        if ((*s != '\0') && (*s != '/')) {
+            const int i = atoi(s);
+            corner[k] = (i < 0) ? count[k] + i : i - 1;
+        }
+        while ((*s != '\0') && (*s != '/')) {
+            ++s;
+        }
+        if (*s == '/') {
+            ++s;
+        }
+    }
+}
+
+
+/** Builds \a cache from the OBJ \a filename as one part, scaled by \a scale.  Returns false if it cannot be read. */
+inline bool parseOBJ(const std::string& filename, float scale, ModelCache::Builder& cache) {
+    std::string text;
+    if (! readFile(filename, text)) {
+        return false;
+    }
+    const std::string directory = directoryOf(filename);
+
+    std::vector<float> position, texCoord, normal;
+    std::unordered_map<std::string, uint32_t> vertexIndex;
+    std::map<int, std::vector<uint32_t> > meshIndices;
+    int material = -1;
+
+    std::istringstream input(text);
+    std::string lineText;
+    std::vector<uint32_t> polygon;
+    while (std::getline(input, lineText)) {
+        std::istringstream line(lineText);
+        std::string keyword;
+        if (! (line >> keyword)) {
+            continue;
+        }
+        if (keyword == "v") {
+            float x = 0, y = 0, z = 0;
+            line >> x >> y >> z;
+            position.push_back(x * scale);
+            position.push_back(y * scale);
+            position.push_back(z * scale);
+        } else if (keyword == "vt") {
+            float u = 0, v = 0;
+            line >> u >> v;
+            texCoord.push_back(u);
+            texCoord.push_back(1.0f - v);
+        } else if (keyword == "vn") {
+            float x = 0, y = 0, z = 0;
+            line >> x >> y >> z;
+            normal.push_back(x);
+            normal.push_back(y);
+            normal.push_back(z);
+        } else if (keyword == "mtllib") {
+            std::string name, mtl;
+            std::getline(line >> std::ws, name);
+            while (! name.empty() && isspace((unsigned char)name[name.size() - 1])) {
+                name.erase(name.size() - 1);
+            }
+            if (readFile(directory + name, mtl)) {
+                cache.parseMTL(mtl, directory + directoryOf(name));
+            }
+        } else if (keyword == "usemtl") {
+            std::string name;
+            line >> name;
+            material = cache.findMaterial(name);
+        } else if (keyword == "f") {
+            polygon.clear();
+            std::string cornerText;
+            while (line >> cornerText) {
+                // Welds corners that repeat the same position, texture coordinate, and normal
+                std::unordered_map<std::string, uint32_t>::iterator it = vertexIndex.find(cornerText);
+                if (it == vertexIndex.end()) {
+                    int corner[3];
+                    parseCorner(cornerText.c_str(), int(position.size() / 3), int(texCoord.size() / 2), int(normal.size() / 3), corner);
+                    ModelCache::Vertex v;
+                    memset(&v, 0, sizeof(v));
+                    if ((corner[0] >= 0) && (corner[0] < int(position.size() / 3))) {
+                        std::copy(&position[3 * corner[0]], &position[3 * corner[0]] + 3, v.position);
+                    }
+                    if ((corner[1] >= 0) && (corner[1] < int(texCoord.size() / 2))) {
+                        std::copy(&texCoord[2 * corner[1]], &texCoord[2 * corner[1]] + 2, v.texCoord0);
+                    }
+                    if ((corner[2] >= 0) && (corner[2] < int(normal.size() / 3))) {
+                        std::copy(&normal[3 * corner[2]], &normal[3 * corner[2]] + 3, v.normal);
+                    }
+                    it = vertexIndex.insert(std::make_pair(cornerText, uint32_t(cache.vertices.size()))).first;
+                    cache.vertices.push_back(v);
+                }
+                polygon.push_back(it->second);
+            }
+            std::vector<uint32_t>& indices = meshIndices[material];
+            for (size_t i = 2; i < polygon.size(); ++i) {
+                indices.push_back(polygon[0]);
+                indices.push_back(polygon[i - 1]);
+                indices.push_back(polygon[i]);
+            }
+        }
+    }
+
+    ModelCache::Part part;
+    memset(&part, 0, sizeof(part));
+    part.name        = cache.addString("root");
+    part.parent      = -1;
+    part.cframe[0]   = part.cframe[5] = part.cframe[10] = 1.0f;
+    part.vertexCount = uint32_t(cache.vertices.size());
+    cache.parts.push_back(part);
+
+    for (std::map<int, std::vector<uint32_t> >::const_iterator it = meshIndices.begin(); it != meshIndices.end(); ++it) {
+        ModelCache::Mesh mesh;
+        memset(&mesh, 0, sizeof(mesh));
+        mesh.material   = it->first;
+        mesh.name       = (it->first >= 0) ? cache.materials[it->first].name : 0;
+        mesh.firstIndex = uint32_t(cache.indices.size());
+        mesh.indexCount = uint32_t(it->second.size());
+        cache.meshes.push_back(mesh);
+        cache.indices.insert(cache.indices.end(), it->second.begin(), it->second.end());
+    }
+    cache.flags = texCoord.empty() ? 0 : ModelCache::HAS_TEXCOORDS;
+    return true;
+}
+
+#endif // OBJFile_h
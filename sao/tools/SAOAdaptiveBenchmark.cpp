@@ -0,0 +1,138 @@
+/**
+ \file SAOAdaptiveBenchmark.cpp
+
+ Compares adaptive sampling (SAOCPU::setAdaptiveSampling) with the full spiral on views of the synthetic
+ scene at increasing distance:
+
+ - near:     the default camera, inside the scene, where most disks are tens of pixels wide
+ - outdoor:  30 m back and tilted up so that the bottom of the image is just below the horizon: sky over
+             a floor that runs from about 25 m to the horizon, with the scene in the distance
+ - distant:  the same, 120 m back
+
+ For each view it runs the full spiral and adaptive sampling at several adaptivePixelsPerTap() values, and
+ reports the median time of the raw AO pass and of compute(), the mean taps per shaded pixel
+ (SAOCPU::TileTiming::taps), and the error of the final, blurred AO against the full spiral over the non-sky
+ pixels inside the guard band.
+
+ Build from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -pthread -I. tools/SAOAdaptiveBenchmark.cpp SAOCPU.cpp ThreadPool.cpp -o SAOAdaptiveBenchmark
+
+ Usage:  SAOAdaptiveBenchmark [width height [guardBandSize [frames]]]
+ */
+#include "SAOCPU.h"
+#include "SyntheticScene.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/** RMS difference over the non-sky pixels inside the guard band */
+static double rmse(const std::vector<float>& a, const std::vector<float>& b, const SyntheticScene& scene, int guardBandSize) {
+    double sum = 0.0;
+    long long n = 0;
+    for (int y = guardBandSize; y < scene.height - guardBandSize; ++y) {
+        for (int x = guardBandSize; x < scene.width - guardBandSize; ++x) {
+            const int i = x + y * scene.width;
+            if (scene.depth[i] < 1.0f) {
+                sum += (a[i] - b[i]) * (a[i] - b[i]);
+                ++n;
+            }
+        }
+    }
+    return (n > 0) ? sqrt(sum / double(n)) : 0.0;
+}
+
+
+/** Taps per shaded pixel of the last frame */
+static double meanTapCount(const SAOCPU& sao) {
+    const std::vector<SAOCPU::TileTiming>& tiles = sao.tileTiming();
+    double taps = 0, pixels = 0;
+    for (int t = 0; t < int(tiles.size()); ++t) {
+        taps   += double(tiles[t].taps);
+        pixels += tiles[t].shadedPixels;
+    }
+    return (pixels > 0) ? taps / pixels : 0.0;
+}
+
+
+static float median(std::vector<float> v) {
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+
+/** Median times and mean tap count of \a frames calls of compute(), whose last result is left in \a result */
+class Run {
+public:
+    float       rawAOMilliseconds;
+    float       computeMilliseconds;
+    double      meanTapCount;
+
+    Run(SAOCPU& sao, const SyntheticScene& scene, int guardBandSize, int frames, std::vector<float>& result) {
+        std::vector<float> rawAO, total;
+        for (int f = 0; f < frames; ++f) {
+            const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            sao.compute(&scene.depth[0], scene.width, scene.height, scene.clipInfo, scene.projInfo, scene.projScale, &result[0], guardBandSize);
+            total.push_back(std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+
+            const std::vector<SAOCPU::PassTiming>& timing = sao.passTiming();
+            for (int i = 0; i < int(timing.size()); ++i) {
+                if (strcmp(timing[i].name, "raw AO") == 0) {
+                    rawAO.push_back(timing[i].milliseconds);
+                }
+            }
+        }
+        rawAOMilliseconds   = median(rawAO);
+        computeMilliseconds = median(total);
+        meanTapCount        = ::meanTapCount(sao);
+    }
+};
+
+
+int main(int argc, char** argv) {
+    const int width         = (argc > 2) ? atoi(argv[1]) : 1920;
+    const int height        = (argc > 2) ? atoi(argv[2]) : 1080;
+    const int guardBandSize = (argc > 3) ? atoi(argv[3]) : 0;
+    const int frames        = (argc > 4) ? std::max(1, atoi(argv[4])) : 5;
+
+    static const char*  viewName[]     = {"near", "outdoor", "distant"};
+    static const float  viewDistance[] = {0.0f, 30.0f, 120.0f};
+
+    // Half of the 60 degree field of view, less 5 degrees
+    static const float  viewPitch[]    = {0.0f, 0.436f, 0.436f};
+    static const float  pixelsPerTap[] = {2.0f, 4.0f, 8.0f};
+
+    printf("SAOCPU (%s) adaptive sampling, %d x %d, guard band %d, %d frames per mode\n",
+           SAOCPU::instructionSet(), width, height, guardBandSize, frames);
+
+    std::vector<float> full(width * height), adaptive(width * height);
+    for (int v = 0; v < 3; ++v) {
+        // Backed away along +z, raised 1 m, and pitched up about x
+        const float c = cosf(viewPitch[v]), s = sinf(viewPitch[v]);
+        const float pose[12] = {1, 0, 0, 0,  0, c, -s, (viewDistance[v] > 0) ? 1.0f : 0.0f,  0, s, c, viewDistance[v]};
+        const SyntheticScene scene(width, height, pose);
+
+        SAOCPU sao;
+        printf("\n%s view\n", viewName[v]);
+        printf("mode                 raw AO ms   compute ms   taps/px   RMSE vs full\n");
+
+        // The first frame also allocates the buffers
+        sao.compute(&scene.depth[0], width, height, scene.clipInfo, scene.projInfo, scene.projScale, &full[0], guardBandSize);
+        const Run reference(sao, scene, guardBandSize, frames, full);
+        printf("full spiral          %9.2f   %10.2f   %7.2f\n", reference.rawAOMilliseconds, reference.computeMilliseconds, reference.meanTapCount);
+
+        sao.setAdaptiveSampling(true);
+        for (int p = 0; p < 3; ++p) {
+            sao.setAdaptivePixelsPerTap(pixelsPerTap[p]);
+            const Run run(sao, scene, guardBandSize, frames, adaptive);
+            printf("adaptive, %3.0f px/tap %9.2f   %10.2f   %7.2f   %8.4f\n", pixelsPerTap[p], run.rawAOMilliseconds, run.computeMilliseconds,
+                   run.meanTapCount, rmse(adaptive, full, scene, guardBandSize));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+/**
+ \file SAOBatchBenchmark.cpp
+
+ Measures SAOCPU::computeBatch() on the six views of a light probe, i.e., the synthetic scene seen from the
+ default camera position along +x, -x, +y, -y, +z, and -z, against calling compute() for each view on the
+ same thread pool.  Small views have too few CSZ bands and tiles per pass to keep every worker busy, so the
+ batch runs each pass of all six views as one parallel loop.
+
+ For each view size it reports the median time of a whole probe both ways, the probes per second, and the
+ largest difference between the two results, which must be zero.
+
+ Build from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -pthread -I. tools/SAOBatchBenchmark.cpp SAOCPU.cpp ThreadPool.cpp -o SAOBatchBenchmark
+
+ Usage:  SAOBatchBenchmark [size [guardBandSize [frames [threads]]]]
+
+ With no size, it runs 64, 128, 256, and 512 pixel views.  threads = 0 (the default) uses one per hardware thread.
+ */
+#include "SAOCPU.h"
+#include "SyntheticScene.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+static float median(std::vector<float> v) {
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+
+int main(int argc, char** argv) {
+    typedef std::chrono::high_resolution_clock Clock;
+
+    std::vector<int> sizes;
+    if (argc > 1) {
+        sizes.push_back(atoi(argv[1]));
+    } else {
+        sizes.push_back(64);  sizes.push_back(128);  sizes.push_back(256);  sizes.push_back(512);
+    }
+    const int guardBandSize = (argc > 2) ? atoi(argv[2]) : 0;
+    const int frames        = (argc > 3) ? std::max(1, atoi(argv[3])) : 20;
+    const int threads       = (argc > 4) ? atoi(argv[4]) : 0;
+
+    // Row-major rotations whose -z axis is each face direction
+    static const int   FACES = 6;
+    static const char* faceName[FACES] = {"-z", "+z", "+x", "-x", "+y", "-y"};
+    static const float faceRotation[FACES][9] = {
+        { 1, 0, 0,   0, 1, 0,   0, 0, 1},
+        {-1, 0, 0,   0, 1, 0,   0, 0,-1},
+        { 0, 0,-1,   0, 1, 0,   1, 0, 0},
+        { 0, 0, 1,   0, 1, 0,  -1, 0, 0},
+        { 1, 0, 0,   0, 0,-1,   0, 1, 0},
+        { 1, 0, 0,   0, 0, 1,   0,-1, 0}};
+
+    SAOCPU sequential, batch;
+    sequential.setThreadCount(threads);
+    batch.setThreadCount(threads);
+
+    printf("SAOCPU (%s) light probe of %d views, guard band %d, %d threads, %d frames per mode\n",
+           SAOCPU::instructionSet(), FACES, guardBandSize, (threads > 0) ? threads : int(std::thread::hardware_concurrency()), frames);
+    printf("view size   sequential ms   batch ms   speedup   probes/s   max difference\n");
+
+    for (size_t s = 0; s < sizes.size(); ++s) {
+        const int size = sizes[s];
+
+        std::vector<SyntheticScene> scene;
+        for (int f = 0; f < FACES; ++f) {
+            const float* r = faceRotation[f];
+            const float pose[12] = {r[0], r[1], r[2], 0,  r[3], r[4], r[5], 0,  r[6], r[7], r[8], 0};
+            scene.push_back(SyntheticScene(size, size, pose));
+        }
+
+        std::vector<std::vector<float> > sequentialResult(FACES, std::vector<float>(size * size));
+        std::vector<std::vector<float> > batchResult(FACES, std::vector<float>(size * size));
+
+        std::vector<SAOCPU::View> views(FACES);
+        for (int f = 0; f < FACES; ++f) {
+            SAOCPU::View& v = views[f];
+            v.depthBuffer   = &scene[f].depth[0];
+            v.width         = size;
+            v.height        = size;
+            std::copy(scene[f].clipInfo, scene[f].clipInfo + 3, v.clipConstant);
+            std::copy(scene[f].projInfo, scene[f].projInfo + 4, v.projConstant);
+            v.projScale     = scene[f].projScale;
+            v.result        = &batchResult[f][0];
+            v.guardBandSize = guardBandSize;
+        }
+
+        // The first frame of each mode also allocates the buffers
+        std::vector<float> sequentialTime, batchTime;
+        for (int frame = 0; frame <= frames; ++frame) {
+            Clock::time_point start = Clock::now();
+            for (int f = 0; f < FACES; ++f) {
+                sequential.compute(&scene[f].depth[0], size, size, scene[f].clipInfo, scene[f].projInfo, scene[f].projScale,
+                                   &sequentialResult[f][0], guardBandSize);
+            }
+            const float sequentialMilliseconds = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+
+            start = Clock::now();
+            batch.computeBatch(views);
+            const float batchMilliseconds = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+
+            if (frame > 0) {
+                sequentialTime.push_back(sequentialMilliseconds);
+                batchTime.push_back(batchMilliseconds);
+            }
+        }
+
+        float maxDifference = 0.0f;
+        for (int f = 0; f < FACES; ++f) {
+            for (int i = 0; i < size * size; ++i) {
+                maxDifference = std::max(maxDifference, std::fabs(sequentialResult[f][i] - batchResult[f][i]));
+            }
+        }
+
+        const float sequentialMilliseconds = median(sequentialTime), batchMilliseconds = median(batchTime);
+        printf("%4d x %-4d %13.2f %10.2f %8.2fx %10.1f   %g\n", size, size, sequentialMilliseconds, batchMilliseconds,
+               sequentialMilliseconds / batchMilliseconds, 1000.0f / batchMilliseconds, maxDifference);
+    }
+
+    printf("\nSky tiles skipped per face at the last size:");
+    for (int f = 0; f < batch.batchViewCount(); ++f) {
+        printf(" %s %.0f%%", faceName[f], 100.0f * batch.batchView(f).depthTileStatistics().skippedRawAOFraction());
+    }
+    printf("\n");
+
+    return 0;
+}
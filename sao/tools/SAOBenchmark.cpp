@@ -0,0 +1,258 @@
+/**
+ \file SAOBenchmark.cpp
+
+ Headless per-pass benchmark of SAOCPU for tracking performance regressions on machines without a GPU.
+ Runs every pass of SAOCPU::passTiming() (CSZ reconstruction, each minify level, raw AO, horizontal and
+ vertical blur) at 1920 x 1080, 2560 x 1440, and 3840 x 2160, each without a guard band and with the
+ guard band that App uses (COMPUTE_GUARD_BAND = 192 at 1080p, scaled with the height).
+
+ Each configuration runs --warmup untimed frames and then --frames timed ones, and reports for every pass
+ the median (p50), p95, and minimum time, the throughput in megapixels per second at the median, and the
+ frame-buffer bytes per pixel.  The last row is the wall-clock time of the whole compute() call.
+
+ By default the CSZ levels and the blur axes run as separate passes (SAOCPU::setSingleSweepCSZ(false),
+ SAOCPU::setFusedBlur(false)) so that each is timed on its own, like the GPU passes of SAO.cpp.
+ --production times the SAOCPU defaults instead, which report "CSZ sweep" and "blur fused".
+
+ --culling also runs every guard band configuration with SAOCPU::setGuardBandCulling(false) and reports, for
+ each pass, the texels that it wrote and its median time with and without culling and the time saved.
+
+ --depth adds a captured depth buffer to the synthetic scene: a raw file of width * height little-endian
+ 32-bit floats, top row first, holding z-buffer values with 1 for sky.  It is run at its own resolution with
+ the camera of SyntheticScene (60 degree vertical field of view, near plane at z = -0.1).
+
+ Build from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -pthread -I. tools/SAOBenchmark.cpp SAOCPU.cpp ThreadPool.cpp -o SAOBenchmark
+
+ Usage:  SAOBenchmark [--frames n] [--warmup n] [--threads n] [--quality low|medium|high|ultra]
+                      [--production] [--culling] [--csv] [--depth file width height]
+ */
+#include "SAOCPU.h"
+#include "SyntheticScene.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Depth buffer and camera of one benchmark input */
+class Input {
+public:
+    std::string     name;
+    SyntheticScene  scene;
+
+    Input(const std::string& n, int width, int height) : name(n), scene(width, height) {}
+};
+
+
+/** Nearest-rank percentile \a p of \a sorted */
+static float percentile(const std::vector<float>& sorted, float p) {
+    const int rank = int(std::ceil(p / 100.0f * float(sorted.size())));
+    return sorted[std::max(0, std::min(rank - 1, int(sorted.size()) - 1))];
+}
+
+
+/** Samples of one pass over the timed frames */
+class PassSamples {
+public:
+    std::string         name;
+    std::vector<float>  milliseconds;
+    float               bytesPerPixel;
+
+    /** Texels written per frame; see SAOCPU::PassTiming::texels */
+    long long           texels;
+
+    PassSamples() : bytesPerPixel(0), texels(0) {}
+};
+
+
+static void report(const Input& input, int guardBandSize, bool culling, std::vector<PassSamples>& passes, bool csv) {
+    const int pixels = input.scene.width * input.scene.height;
+    if (! csv) {
+        printf("\n%s, %d x %d, guard band %d%s\n", input.name.c_str(), input.scene.width, input.scene.height, guardBandSize,
+               ((guardBandSize > 0) && ! culling) ? ", no culling" : "");
+        printf("pass                  p50 ms    p95 ms    min ms    Mpix/s   bytes/px\n");
+    }
+
+    for (int i = 0; i < int(passes.size()); ++i) {
+        PassSamples& p = passes[i];
+        std::sort(p.milliseconds.begin(), p.milliseconds.end());
+        const float p50 = percentile(p.milliseconds, 50), p95 = percentile(p.milliseconds, 95);
+        const float mpixPerSecond = (p50 > 0) ? float(pixels) / (p50 * 1000.0f) : 0.0f;
+        if (csv) {
+            printf("%s,%d,%d,%d,%d,%s,%lld,%.3f,%.3f,%.3f,%.1f,%.1f\n", input.name.c_str(), input.scene.width, input.scene.height, guardBandSize,
+                   culling ? 1 : 0, p.name.c_str(), p.texels, p50, p95, p.milliseconds[0], mpixPerSecond, p.bytesPerPixel);
+        } else {
+            printf("%-18s  %8.3f  %8.3f  %8.3f  %8.1f   %8.1f\n", p.name.c_str(), p50, p95, p.milliseconds[0], mpixPerSecond, p.bytesPerPixel);
+        }
+    }
+}
+
+
+/** Texels and median time of each pass with guard band culling (\a culled) against without (\a full), after report() has sorted both */
+static void reportCulling(const std::vector<PassSamples>& full, const std::vector<PassSamples>& culled) {
+    printf("guard band culling   texels full  texels culled   p50 full  p50 culled   saved ms   saved\n");
+    for (int i = 0; (i < int(full.size())) && (i < int(culled.size())); ++i) {
+        const PassSamples& f = full[i];
+        const PassSamples& c = culled[i];
+        const float p50Full = percentile(f.milliseconds, 50), p50Culled = percentile(c.milliseconds, 50);
+        printf("%-18s  %12lld  %13lld  %9.3f  %10.3f  %9.3f  %5.1f%%\n", c.name.c_str(), f.texels, c.texels, p50Full, p50Culled,
+               p50Full - p50Culled, (p50Full > 0) ? 100.0f * (p50Full - p50Culled) / p50Full : 0.0f);
+    }
+}
+
+
+static std::vector<PassSamples> run(SAOCPU& sao, const Input& input, int guardBandSize, int warmup, int frames) {
+    const SyntheticScene& s = input.scene;
+    std::vector<float> result(s.width * s.height);
+
+    // The first warmup frame also reallocates the buffers when the resolution changes
+    std::vector<PassSamples> passes;
+    PassSamples total;
+    total.name = "compute()";
+    for (int f = 0; f < warmup + frames; ++f) {
+        const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        sao.compute(&s.depth[0], s.width, s.height, s.clipInfo, s.projInfo, s.projScale, &result[0], guardBandSize);
+        const float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        if (f < warmup) {
+            continue;
+        }
+
+        const std::vector<SAOCPU::PassTiming>& timing = sao.passTiming();
+        passes.resize(timing.size());
+        float bytesPerPixel = 0;
+        long long texels = 0;
+        for (int i = 0; i < int(timing.size()); ++i) {
+            passes[i].name          = timing[i].name;
+            passes[i].bytesPerPixel = timing[i].bytesPerPixel();
+            passes[i].texels        = timing[i].texels;
+            passes[i].milliseconds.push_back(timing[i].milliseconds);
+            bytesPerPixel += timing[i].bytesPerPixel();
+            texels        += timing[i].texels;
+        }
+        total.bytesPerPixel = bytesPerPixel;
+        total.texels        = texels;
+        total.milliseconds.push_back(ms);
+    }
+
+    passes.push_back(total);
+    return passes;
+}
+
+
+static bool readDepth(const char* filename, int width, int height, std::vector<float>& depth) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    depth.resize(width * height);
+    const size_t count = fread(&depth[0], sizeof(float), depth.size(), file);
+    fclose(file);
+    return count == depth.size();
+}
+
+
+int main(int argc, char** argv) {
+    int  frames     = 20;
+    int  warmup     = 3;
+    int  threads    = 0;
+    bool production = false;
+    bool culling    = false;
+    bool csv        = false;
+    SAOCPU::Quality quality = SAOCPU::HIGH_QUALITY;
+    const char* depthFile = NULL;
+    int depthWidth = 0, depthHeight = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if ((arg == "--frames") && (i + 1 < argc)) {
+            frames = std::max(1, atoi(argv[++i]));
+        } else if ((arg == "--warmup") && (i + 1 < argc)) {
+            warmup = std::max(0, atoi(argv[++i]));
+        } else if ((arg == "--threads") && (i + 1 < argc)) {
+            threads = atoi(argv[++i]);
+        } else if ((arg == "--quality") && (i + 1 < argc)) {
+            const std::string name = argv[++i];
+            int q = 0;
+            while ((q < SAOCPU::QUALITY_COUNT) && (strcasecmp(name.c_str(), SAOCPU::qualityParameters(SAOCPU::Quality(q)).name) != 0)) {
+                ++q;
+            }
+            if (q == SAOCPU::QUALITY_COUNT) {
+                fprintf(stderr, "Unknown quality %s\n", name.c_str());
+                return 1;
+            }
+            quality = SAOCPU::Quality(q);
+        } else if (arg == "--production") {
+            production = true;
+        } else if (arg == "--culling") {
+            culling = true;
+        } else if (arg == "--csv") {
+            csv = true;
+        } else if ((arg == "--depth") && (i + 3 < argc)) {
+            depthFile   = argv[++i];
+            depthWidth  = atoi(argv[++i]);
+            depthHeight = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: SAOBenchmark [--frames n] [--warmup n] [--threads n] [--quality low|medium|high|ultra]\n"
+                            "                    [--production] [--culling] [--csv] [--depth file width height]\n");
+            return 1;
+        }
+    }
+
+    SAOCPU sao;
+    sao.setThreadCount(threads);
+    sao.setQuality(quality);
+    sao.setSingleSweepCSZ(production);
+    sao.setFusedBlur(production);
+
+    std::vector<Input*> inputs;
+    static const int resolution[][2] = {{1920, 1080}, {2560, 1440}, {3840, 2160}};
+    for (int r = 0; r < 3; ++r) {
+        inputs.push_back(new Input("synthetic", resolution[r][0], resolution[r][1]));
+    }
+    if (depthFile != NULL) {
+        // The synthetic scene of the same size supplies the camera constants
+        Input* captured = new Input(depthFile, depthWidth, depthHeight);
+        if (! readDepth(depthFile, depthWidth, depthHeight, captured->scene.depth)) {
+            fprintf(stderr, "Cannot read %d x %d floats from %s\n", depthWidth, depthHeight, depthFile);
+            return 1;
+        }
+        inputs.push_back(captured);
+    }
+
+    if (csv) {
+        printf("input,width,height,guard_band,culling,pass,texels,p50_ms,p95_ms,min_ms,mpix_per_s,bytes_per_px\n");
+    } else {
+        printf("SAOCPU (%s) per-pass benchmark, %s quality, %d threads, %d warmup + %d timed frames%s\n",
+               SAOCPU::instructionSet(), SAOCPU::qualityParameters(quality).name,
+               (threads > 0) ? threads : std::max(1, int(std::thread::hardware_concurrency())), warmup, frames,
+               production ? ", single-sweep CSZ and fused blur" : "");
+    }
+
+    for (int i = 0; i < int(inputs.size()); ++i) {
+        // App's COMPUTE_GUARD_BAND is 192 at 1080p
+        const int guardBands[] = {0, inputs[i]->scene.height * 192 / 1080};
+        for (int g = 0; g < 2; ++g) {
+            std::vector<PassSamples> passes = run(sao, *inputs[i], guardBands[g], warmup, frames);
+            report(*inputs[i], guardBands[g], true, passes, csv);
+
+            if (culling && (guardBands[g] > 0)) {
+                sao.setGuardBandCulling(false);
+                std::vector<PassSamples> full = run(sao, *inputs[i], guardBands[g], warmup, frames);
+                sao.setGuardBandCulling(true);
+                report(*inputs[i], guardBands[g], false, full, csv);
+                if (! csv) {
+                    reportCulling(full, passes);
+                }
+            }
+        }
+        delete inputs[i];
+    }
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/**
+ \file SAOCacheBenchmark.cpp
+
+ Counts the cache misses per pixel of the raw AO pass of SAOCPU for the row-major and swizzled
+ camera-space z layouts (see SAOCPU::setCSZLayout) and for the deinterleaved mode
+ (SAOCPU::setDeinterleaved) at several AO radii.  SAOCPU.cpp reports the
+ address of every CSZ read when it is compiled with SAO_TRACE_CSZ_READS, and this program feeds
+ those addresses, in execution order on one thread, to a simulated two-level LRU cache.
+
+ Only CSZ reads are simulated; the depth input, AO output, and blur passes stream through memory
+ identically in all modes.  The sequential copies into and out of the deinterleaved layers are not
+ counted either.  Addresses are taken relative to the start of the CSZ buffer, i.e., as if the buffer
+ were aligned to a cache line.
+
+ Build from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -pthread -DSAO_TRACE_CSZ_READS -I. tools/SAOCacheBenchmark.cpp SAOCPU.cpp ThreadPool.cpp -o SAOCacheBenchmark
+
+ Usage:  SAOCacheBenchmark [width height [guardBandSize]]
+ */
+#include "SAOCPU.h"
+#include "SyntheticScene.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/** Set-associative cache with LRU replacement that only counts hits and misses */
+class CacheSimulator {
+protected:
+
+    int                         m_lineBytes;
+    int                         m_sets;
+    int                         m_ways;
+
+    /** m_ways line tags per set, most recently used first; -1 is empty */
+    std::vector<long long>      m_tag;
+
+public:
+
+    long long                   accesses;
+    long long                   misses;
+
+    CacheSimulator(int sizeBytes, int ways, int lineBytes) :
+        m_lineBytes(lineBytes), m_sets(sizeBytes / (lineBytes * ways)), m_ways(ways),
+        m_tag(m_sets * ways, -1), accesses(0), misses(0) {}
+
+    /** Returns true on a hit */
+    bool access(long long address) {
+        ++accesses;
+        const long long line = address / m_lineBytes;
+        long long* set = &m_tag[(line % m_sets) * m_ways];
+
+        int way = 0;
+        while ((way < m_ways) && (set[way] != line)) {
+            ++way;
+        }
+
+        const bool hit = (way < m_ways);
+        if (! hit) {
+            ++misses;
+            way = m_ways - 1;
+        }
+
+        // Move to the front
+        for (; way > 0; --way) {
+            set[way] = set[way - 1];
+        }
+        set[0] = line;
+        return hit;
+    }
+
+    void reset() {
+        std::fill(m_tag.begin(), m_tag.end(), -1);
+        accesses = 0;
+        misses   = 0;
+    }
+};
+
+/** Typical desktop core: 32 KB 8-way L1D and 1 MB 16-way L2 (inclusive), 64-byte lines */
+static CacheSimulator  L1(32 * 1024, 8, 64);
+static CacheSimulator  L2(1024 * 1024, 16, 64);
+static const float*    traceBase = NULL;
+
+void saoTraceCSZRead(const float* address) {
+    const long long offset = (const char*)address - (const char*)traceBase;
+    if (! L1.access(offset)) {
+        L2.access(offset);
+    }
+}
+
+
+int main(int argc, char** argv) {
+    const int width         = (argc > 2) ? atoi(argv[1]) : 1920;
+    const int height        = (argc > 2) ? atoi(argv[2]) : 1080;
+    const int guardBandSize = (argc > 3) ? atoi(argv[3]) : 0;
+
+    static const float radius[]   = {0.25f, 0.5f, 1.0f, 2.0f, 4.0f};
+    static const char* modeName[] = {"row-major", "swizzled", "deinterl."};
+
+    const SyntheticScene scene(width, height);
+    std::vector<float> result(width * height);
+
+    SAOCPU sao;
+    sao.setThreadCount(1);
+
+    printf("SAOCPU (%s) raw AO CSZ reads, %d x %d, guard band %d\n", SAOCPU::instructionSet(), width, height, guardBandSize);
+    printf("L1 32 KB 8-way, L2 1 MB 16-way, 64 B lines; misses per output pixel\n\n");
+    printf("radius   mode        reads/px   L1 miss/px   L2 miss/px   L1 miss rate\n");
+
+    for (int r = 0; r < int(sizeof(radius) / sizeof(radius[0])); ++r) {
+        sao.setRadius(radius[r]);
+        // The last mode is the row-major layout with deinterleaved AO
+        for (int mode = 0; mode < 3; ++mode) {
+            sao.setCSZLayout((mode == 1) ? SAOCPU::SWIZZLED_LAYOUT : SAOCPU::ROW_MAJOR_LAYOUT);
+            sao.setDeinterleaved(mode == 2);
+
+            // Untraced frame to reallocate the CSZ buffers for the new mode
+            traceBase = NULL;
+            L1.reset();
+            L2.reset();
+            sao.compute(&scene.depth[0], width, height, scene.clipInfo, scene.projInfo, scene.projScale, &result[0], guardBandSize);
+
+            traceBase = sao.deinterleaved() ? sao.layerCSZBuffer() : sao.cszBuffer();
+            L1.reset();
+            L2.reset();
+            sao.compute(&scene.depth[0], width, height, scene.clipInfo, scene.projInfo, scene.projScale, &result[0], guardBandSize);
+
+            const double pixels = double(width - 2 * guardBandSize) * double(height - 2 * guardBandSize);
+            printf("%5.2f m  %-10s  %8.2f   %10.3f   %10.4f   %10.2f%%\n", radius[r], modeName[mode],
+                   L1.accesses / pixels, L1.misses / pixels, L2.misses / pixels, 100.0 * L1.misses / double(L1.accesses));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+/**
+ \file SAOPipelineBenchmark.cpp
+
+ Measures the latency and throughput of SAOFrameQueue at several queue depths against computing the AO
+ synchronously, for a headless renderer that produces a G-buffer, computes AO, and encodes each frame.  The
+ G-buffer and encode stages are simulated by sleeping for a fixed time, as they would wait on a GPU or on I/O,
+ and the AO runs on the synthetic scene with a camera that moves every frame.
+
+ For each mode it reports:
+
+ - frames per second over the whole run
+ - AO latency: submit() until the AO is ready, including time queued behind earlier frames
+ - frame latency: start of G-buffer production until the frame is encoded
+ - the time per frame that submit() blocked for a free slot (backpressure)
+
+ Build from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -pthread -I. tools/SAOPipelineBenchmark.cpp SAOFrameQueue.cpp SAOCPU.cpp ThreadPool.cpp -o SAOPipelineBenchmark
+
+ Usage:  SAOPipelineBenchmark [width height [produceMilliseconds [encodeMilliseconds [frames [threads]]]]]
+ */
+#include "SAOCPU.h"
+#include "SAOFrameQueue.h"
+#include "SyntheticScene.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+static float percentile(std::vector<float> v, float p) {
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, size_t(p * float(v.size())))];
+}
+
+
+/** Camera of frame \a f: a slow pan to the right */
+static SyntheticScene makeScene(int width, int height, int f) {
+    const float a = 0.01f * float(f);
+    const float pose[12] = {cosf(a), 0, sinf(a), 0.02f * float(f),  0, 1, 0, 0,  -sinf(a), 0, cosf(a), 0};
+    return SyntheticScene(width, height, pose);
+}
+
+
+class Result {
+public:
+    float               framesPerSecond;
+    std::vector<float>  aoLatency;
+    std::vector<float>  frameLatency;
+    float               blockedPerFrame;
+
+    Result() : framesPerSecond(0), blockedPerFrame(0) {}
+
+    void print(const char* mode) const {
+        printf("%-12s %8.1f   %8.2f %8.2f   %8.2f %8.2f   %8.2f\n", mode, framesPerSecond,
+               percentile(aoLatency, 0.5f), percentile(aoLatency, 0.95f),
+               percentile(frameLatency, 0.5f), percentile(frameLatency, 0.95f), blockedPerFrame);
+    }
+};
+
+
+int main(int argc, char** argv) {
+    const int   width     = (argc > 2) ? atoi(argv[1]) : 1280;
+    const int   height    = (argc > 2) ? atoi(argv[2]) : 720;
+    const float produceMs = (argc > 3) ? float(atof(argv[3])) : 8.0f;
+    const float encodeMs  = (argc > 4) ? float(atof(argv[4])) : 4.0f;
+    const int   frames    = (argc > 5) ? std::max(1, atoi(argv[5])) : 60;
+    const int   threads   = (argc > 6) ? atoi(argv[6]) : 0;
+
+    std::vector<SyntheticScene> scene;
+    for (int f = 0; f < frames; ++f) {
+        scene.push_back(makeScene(width, height, f));
+    }
+    const std::chrono::microseconds produceTime(int(produceMs * 1000.0f)), encodeTime(int(encodeMs * 1000.0f));
+
+    printf("SAOCPU (%s) pipeline, %d x %d, %.1f ms G-buffer + AO + %.1f ms encode per frame, %d frames\n",
+           SAOCPU::instructionSet(), width, height, produceMs, encodeMs, frames);
+    printf("                         AO latency ms        frame latency ms   blocked\n");
+    printf("mode         frames/s       p50      p95        p50      p95     ms/frame\n");
+
+    {
+        // Each stage waits for the previous one
+        SAOCPU sao;
+        sao.setThreadCount(threads);
+        std::vector<float> ao(width * height);
+        Result r;
+        const Clock::time_point start = Clock::now();
+        for (int f = 0; f < frames; ++f) {
+            const Clock::time_point frameStart = Clock::now();
+            std::this_thread::sleep_for(produceTime);
+
+            const Clock::time_point aoStart = Clock::now();
+            sao.compute(&scene[f].depth[0], width, height, scene[f].clipInfo, scene[f].projInfo, scene[f].projScale, &ao[0]);
+            r.aoLatency.push_back(millisecondsSince(aoStart));
+
+            std::this_thread::sleep_for(encodeTime);
+            r.frameLatency.push_back(millisecondsSince(frameStart));
+        }
+        r.framesPerSecond = 1000.0f * float(frames) / millisecondsSince(start);
+        r.print("synchronous");
+    }
+
+    for (int depth = 1; depth <= 4; ++depth) {
+        SAOFrameQueue queue(depth);
+        queue.sao().setThreadCount(threads);
+
+        // Encodes the oldest frame once all slots are in use, so the next submit() has one to reuse
+        Result r;
+        std::deque<SAOFrameQueue::Future> pending;
+        std::deque<Clock::time_point> frameStart;
+        const auto encodeOldest = [&]() {
+            const SAOFrameQueue::Frame frame = pending.front().get();
+            r.aoLatency.push_back(frame.latencyMilliseconds);
+            std::this_thread::sleep_for(encodeTime);
+            queue.release(frame);
+            r.frameLatency.push_back(millisecondsSince(frameStart.front()));
+            pending.pop_front();
+            frameStart.pop_front();
+        };
+
+        const Clock::time_point start = Clock::now();
+        for (int f = 0; f < frames; ++f) {
+            frameStart.push_back(Clock::now());
+            std::this_thread::sleep_for(produceTime);
+            pending.push_back(queue.submit(&scene[f].depth[0], width, height, scene[f].clipInfo, scene[f].projInfo, scene[f].projScale));
+            if (int(pending.size()) == depth) {
+                encodeOldest();
+            }
+        }
+        while (! pending.empty()) {
+            encodeOldest();
+        }
+        r.framesPerSecond = 1000.0f * float(frames) / millisecondsSince(start);
+        r.blockedPerFrame = queue.statistics().blockedMilliseconds / float(frames);
+
+        char mode[32];
+        snprintf(mode, sizeof(mode), "queue of %d", depth);
+        r.print(mode);
+    }
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+/**
+ \file SAOPresetCheck.cpp
+
+ Checks that the #ifndef defaults of the preset macros in the SAO shaders agree with the HIGH_QUALITY preset
+ of SAOPresets.h (SAOCPU::checkShaderDefaults), and prints the macros of every preset (SAOCPU::shaderDefines)
+ in the /D form of fxc for building the DX11 shader permutations offline.  SAO::reloadShaders asserts the
+ same check for the GLSL shaders at run time.  Exits with status 1 if any file is missing or disagrees.
+
+ Build and run from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -pthread -I. tools/SAOPresetCheck.cpp SAOCPU.cpp ThreadPool.cpp -o SAOPresetCheck
+     ./SAOPresetCheck
+
+ Usage:  SAOPresetCheck [shaderFile ...]
+
+ With no arguments, checks the AO and blur shaders of both the OpenGL and DX11 paths.
+ */
+#include "SAOCPU.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        files.push_back(argv[i]);
+    }
+    if (files.empty()) {
+        const char* defaults[] = {
+            "SAO_AO.pix", "SAO_blur.pix", "SAO_blurFused.pix",
+            "DX11shaders/SAO_AO.hlsl", "DX11shaders/SAO_blur.hlsl", "DX11shaders/SAO_blurFused.hlsl"};
+        files.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+
+    bool ok = true;
+    for (int i = 0; i < int(files.size()); ++i) {
+        std::ifstream in(files[i].c_str());
+        if (! in) {
+            printf("%-32s cannot be read\n", files[i].c_str());
+            ok = false;
+            continue;
+        }
+        std::ostringstream source;
+        source << in.rdbuf();
+
+        std::string mismatches;
+        if (SAOCPU::checkShaderDefaults(source.str(), mismatches)) {
+            printf("%-32s ok\n", files[i].c_str());
+        } else {
+            printf("%-32s MISMATCH\n%s", files[i].c_str(), mismatches.c_str());
+            ok = false;
+        }
+    }
+
+    printf("\n");
+    for (int q = 0; q < SAOCPU::QUALITY_COUNT; ++q) {
+        const std::vector<std::pair<std::string, std::string> > defines = SAOCPU::shaderDefines(SAOCPU::Quality(q));
+        printf("%-7s", SAOCPU::qualityParameters(SAOCPU::Quality(q)).name);
+        for (int d = 0; d < int(defines.size()); ++d) {
+            printf(" /D%s=\"%s\"", defines[d].first.c_str(), defines[d].second.c_str());
+        }
+        printf("\n");
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,348 @@
+/**
+ \file SAORegression.cpp
+
+ Golden-output regression check for SAOCPU.  Runs synthetic depth buffers, and optionally a directory of
+ SAOCapture files, through SAOCPU and compares the output of every stage against stored goldens with
+ ImageDiff:
+
+ - csz0 ... csz5:  camera-space z of each MIP level (relative per-pixel error, since z precision scales with distance)
+ - rawAO:          AO before the blur
+ - key:            bilateral key
+ - ao:             final blurred AO
+
+ Goldens are PFM files named <input>.<quality>.<stage>.pfm in the --golden directory.  --update writes them
+ from the reference configuration (separate CSZ and blur passes, row-major CSZ layout, all threads).  Every
+ run then checks the reference configuration and the variants that are documented to give the same result
+ (single-sweep CSZ with the fused blur, the swizzled CSZ layout, one thread, and no guard band culling)
+ against the goldens, so a kernel change that alters any of them fails even when the variants still agree
+ with each other.  The CSZ stages only compare the texels of SAOCPU::cszLevelRects(), which are the
+ ones that the raw AO pass reads, and the ao stage treats the guard band as white.
+
+ The workflow is to write the goldens on a known-good revision (README1.txt gives the commands), then
+ change the kernels and rerun without --update.  The default thresholds allow the last-bit differences
+ between the AVX2, SSE4.1, and portable builds and between compilers, so goldens from one build also check
+ the others; --exact requires bit identity.  For each failing stage, the test image (.pfm) and an 8-bit
+ error image (.pgm, with the tolerance at gray 128) are written to the --diff directory.
+
+ --update creates the --golden directory, and every run creates the --diff directory.  Without --update,
+ a missing --golden directory is an error.
+
+ Exits with status 0 if every comparison passes, 1 otherwise, so it can run headless, e.g., in CI.
+
+ Build from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -pthread -I. tools/SAORegression.cpp tools/ImageDiff.cpp SAOCapture.cpp SAOCPU.cpp ThreadPool.cpp -o SAORegression
+
+ Usage:  SAORegression [--golden dir] [--update] [--diff dir] [--captures dir] [--quality low|medium|high|ultra] [--exact]
+ */
+#include "SAOCPU.h"
+#include "SAOCapture.h"
+#include "ImageDiff.h"
+#include "SyntheticScene.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#   include <direct.h>
+#   define mkdir(path, mode) _mkdir(path)
+#endif
+
+/** Depth buffer and constants of one regression input */
+class Input {
+public:
+    std::string         name;
+    int                 width;
+    int                 height;
+    int                 guardBandSize;
+    std::vector<float>  depth;
+    float               clipInfo[3];
+    float               projInfo[4];
+    float               projScale;
+
+    Input(const std::string& n, const SyntheticScene& s, int g) : name(n), width(s.width), height(s.height), guardBandSize(g),
+        depth(s.depth), projScale(s.projScale) {
+        std::copy(s.clipInfo, s.clipInfo + 3, clipInfo);
+        std::copy(s.projInfo, s.projInfo + 4, projInfo);
+    }
+
+    Input(const std::string& n, const SAOCapture& c) : name(n), width(c.width), height(c.height), guardBandSize(c.guardBandSize),
+        depth(c.depth(), c.depth() + size_t(c.width) * size_t(c.height)), projScale(c.projScale) {
+        std::copy(c.clipInfo, c.clipInfo + 3, clipInfo);
+        std::copy(c.projInfo, c.projInfo + 4, projInfo);
+    }
+};
+
+
+/** Settings that must not change the result */
+class Configuration {
+public:
+    const char*         name;
+    bool                singleSweepAndFused;
+    SAOCPU::CSZLayout   layout;
+    int                 threads;
+    bool                guardBandCulling;
+};
+
+static const Configuration configuration[] = {
+    {"reference",             false, SAOCPU::ROW_MAJOR_LAYOUT, 0, true},
+    {"single-sweep + fused",  true,  SAOCPU::ROW_MAJOR_LAYOUT, 0, true},
+    {"swizzled",              false, SAOCPU::SWIZZLED_LAYOUT,  0, true},
+    {"1 thread",              false, SAOCPU::ROW_MAJOR_LAYOUT, 1, true},
+    {"no guard band culling", false, SAOCPU::ROW_MAJOR_LAYOUT, 0, false}};
+
+
+/** Output of one stage of one run */
+class Stage {
+public:
+    std::string             name;
+    FloatImage              image;
+    ImageDiff::Thresholds   thresholds;
+
+    /** Texels that are compared; the others are zero in both images */
+    SAOCPU::TexelRect       compared;
+
+    /** Zeroes the texels of \a image outside of compared */
+    void mask(FloatImage& image) const {
+        for (int y = 0; y < image.height; ++y) {
+            for (int x = 0; x < image.width; ++x) {
+                if (! compared.contains(x, y)) {
+                    image(x, y) = 0.0f;
+                }
+            }
+        }
+    }
+};
+
+
+static void collectStages(const SAOCPU& sao, const Input& input, const std::vector<float>& result, bool exact, std::vector<Stage>& stages) {
+    stages.clear();
+
+    // Texels of the MIP levels outside of these are undefined with guard band culling
+    SAOCPU::TexelRect cszRect[SAOCPU::MAX_MIP_LEVEL + 1], minified[SAOCPU::MAX_MIP_LEVEL + 1];
+    SAOCPU::cszLevelRects(sao.quality(), input.width, input.height, input.guardBandSize, cszRect, minified);
+
+    for (int level = 0; level <= SAOCPU::MAX_MIP_LEVEL; ++level) {
+        Stage s;
+        s.name       = "csz" + std::to_string(level);
+        s.image      = FloatImage(sao.cszLevelWidth(level), sao.cszLevelHeight(level));
+        s.thresholds = ImageDiff::Thresholds(1e-5f, true, 0.0f, 90.0, 0.9999);
+        s.compared   = cszRect[level];
+        for (int y = 0; y < s.image.height; ++y) {
+            for (int x = 0; x < s.image.width; ++x) {
+                s.image(x, y) = sao.cszBuffer()[sao.cszIndex(level, x, y)];
+            }
+        }
+        s.mask(s.image);
+        stages.push_back(s);
+    }
+
+    Stage raw, key, ao;
+    raw.name = "rawAO";
+    key.name = "key";
+    ao.name  = "ao";
+    raw.image = key.image = FloatImage(input.width, input.height);
+    raw.compared = key.compared = ao.compared = SAOCPU::TexelRect(0, 0, input.width, input.height);
+    ao.image.width  = input.width;
+    ao.image.height = input.height;
+    ao.image.pixel  = result;
+    const int g = input.guardBandSize;
+    for (int y = 0; y < input.height; ++y) {
+        for (int x = 0; x < input.width; ++x) {
+            raw.image(x, y) = sao.rawAO(x, y);
+            key.image(x, y) = sao.bilateralKey(x, y);
+
+            // The guard band of the result is only written when guard band culling is off
+            if ((x < g) || (y < g) || (x >= input.width - g) || (y >= input.height - g)) {
+                ao.image(x, y) = 1.0f;
+            }
+        }
+    }
+
+    // A tap that lands on the other side of a texel boundary changes a pixel's AO by a visible amount, so a
+    // few pixels may exceed the per-pixel tolerance as long as the image as a whole agrees
+    raw.thresholds = ImageDiff::Thresholds(1e-3f, false, 1e-4f, 60.0, 0.999);
+    key.thresholds = ImageDiff::Thresholds(1e-5f, false, 0.0f,  90.0, 0.9999);
+    ao.thresholds  = ImageDiff::Thresholds(1e-3f, false, 1e-4f, 60.0, 0.999);
+    stages.push_back(raw);
+    stages.push_back(key);
+    stages.push_back(ao);
+
+    if (exact) {
+        for (int i = 0; i < int(stages.size()); ++i) {
+            stages[i].thresholds = ImageDiff::Thresholds(0.0f, false, 0.0f, 0.0, 0.0);
+        }
+    }
+}
+
+
+static bool isDirectory(const std::string& path) {
+    struct stat st;
+    return (stat(path.c_str(), &st) == 0) && ((st.st_mode & S_IFDIR) != 0);
+}
+
+
+/** Creates \a path and its missing parents.  Returns false if it is not a directory afterward. */
+static bool makeDirectories(const std::string& path) {
+    for (size_t i = 1; i <= path.size(); ++i) {
+        if ((i == path.size()) || (path[i] == '/') || (path[i] == '\\')) {
+            mkdir(path.substr(0, i).c_str(), 0755);
+        }
+    }
+    return isDirectory(path);
+}
+
+
+int main(int argc, char** argv) {
+    std::string goldenDirectory = "golden";
+    std::string diffDirectory   = ".";
+    std::string captureDirectory;
+    bool update = false;
+    bool exact  = false;
+    SAOCPU::Quality quality = SAOCPU::HIGH_QUALITY;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if ((arg == "--golden") && (i + 1 < argc)) {
+            goldenDirectory = argv[++i];
+        } else if ((arg == "--diff") && (i + 1 < argc)) {
+            diffDirectory = argv[++i];
+        } else if ((arg == "--captures") && (i + 1 < argc)) {
+            captureDirectory = argv[++i];
+        } else if ((arg == "--quality") && (i + 1 < argc)) {
+            const std::string name = argv[++i];
+            int q = 0;
+            while ((q < SAOCPU::QUALITY_COUNT) && (strcasecmp(name.c_str(), SAOCPU::qualityParameters(SAOCPU::Quality(q)).name) != 0)) {
+                ++q;
+            }
+            if (q == SAOCPU::QUALITY_COUNT) {
+                fprintf(stderr, "Unknown quality %s\n", name.c_str());
+                return 1;
+            }
+            quality = SAOCPU::Quality(q);
+        } else if (arg == "--update") {
+            update = true;
+        } else if (arg == "--exact") {
+            exact = true;
+        } else {
+            fprintf(stderr, "Usage: SAORegression [--golden dir] [--update] [--diff dir] [--captures dir] [--quality low|medium|high|ultra] [--exact]\n");
+            return 1;
+        }
+    }
+
+    if (update) {
+        if (! makeDirectories(goldenDirectory)) {
+            fprintf(stderr, "Cannot create the golden directory %s\n", goldenDirectory.c_str());
+            return 1;
+        }
+    } else if (! isDirectory(goldenDirectory)) {
+        fprintf(stderr, "No golden directory %s; write the goldens with --update on a known-good revision (see README1.txt)\n", goldenDirectory.c_str());
+        return 1;
+    }
+    if (! makeDirectories(diffDirectory)) {
+        fprintf(stderr, "Cannot create the diff directory %s\n", diffDirectory.c_str());
+        return 1;
+    }
+
+    // Sizes that are and are not multiples of the SIMD width and of 2^MAX_MIP_LEVEL, with and without a
+    // guard band, and a camera pose that puts the walls at an angle
+    std::vector<Input*> inputs;
+    static const float pose[12] = {0.96f, 0, 0.28f, 0.3f,  0, 1, 0, 0.1f,  -0.28f, 0, 0.96f, -0.4f};
+    inputs.push_back(new Input("synthetic-640x360", SyntheticScene(640, 360), 0));
+    inputs.push_back(new Input("synthetic-333x217-guard16", SyntheticScene(333, 217, pose), 16));
+
+    if (! captureDirectory.empty()) {
+        std::vector<std::string> files;
+        std::string error;
+        if (! SAOCapture::listDirectory(captureDirectory, SAOCapture::extension(), files, error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        for (int i = 0; i < int(files.size()); ++i) {
+            SAOCapture capture;
+            if (! capture.load(files[i], error)) {
+                fprintf(stderr, "%s\n", error.c_str());
+                return 1;
+            }
+            const size_t slash = files[i].find_last_of("/\\");
+            const std::string base = files[i].substr(slash + 1, files[i].size() - slash - 1 - strlen(SAOCapture::extension()));
+            inputs.push_back(new Input(base, capture));
+        }
+    }
+
+    const char* qualityName = SAOCPU::qualityParameters(quality).name;
+    printf("SAOCPU (%s) regression, %s quality, goldens in %s%s\n", SAOCPU::instructionSet(), qualityName,
+           goldenDirectory.c_str(), update ? " (updating)" : "");
+
+    int failures = 0, comparisons = 0;
+    for (int i = 0; i < int(inputs.size()); ++i) {
+        const Input& input = *inputs[i];
+        std::vector<float> result(size_t(input.width) * size_t(input.height));
+
+        for (int c = 0; c < int(sizeof(configuration) / sizeof(configuration[0])); ++c) {
+            const Configuration& config = configuration[c];
+            SAOCPU sao;
+            sao.setQuality(quality);
+            sao.setThreadCount(config.threads);
+            sao.setSingleSweepCSZ(config.singleSweepAndFused);
+            sao.setFusedBlur(config.singleSweepAndFused);
+            sao.setCSZLayout(config.layout);
+            sao.setGuardBandCulling(config.guardBandCulling);
+            sao.compute(&input.depth[0], input.width, input.height, input.clipInfo, input.projInfo, input.projScale, &result[0], input.guardBandSize);
+
+            std::vector<Stage> stages;
+            collectStages(sao, input, result, exact, stages);
+
+            for (int s = 0; s < int(stages.size()); ++s) {
+                const Stage& stage = stages[s];
+                const std::string prefix = input.name + "." + qualityName + "." + stage.name;
+                const std::string goldenFile = goldenDirectory + "/" + prefix + ".pfm";
+
+                if (update && (c == 0)) {
+                    if (! stage.image.writePFM(goldenFile)) {
+                        fprintf(stderr, "Cannot write %s\n", goldenFile.c_str());
+                        return 1;
+                    }
+                }
+
+                FloatImage golden;
+                ++comparisons;
+                if (! golden.readPFM(goldenFile)) {
+                    printf("FAIL  %-28s %-22s %-6s missing golden %s\n", input.name.c_str(), config.name, stage.name.c_str(), goldenFile.c_str());
+                    ++failures;
+                    continue;
+                }
+                stage.mask(golden);
+
+                FloatImage diff;
+                const ImageDiff::Result r = ImageDiff::compare(stage.image, golden, stage.thresholds, &diff);
+                if (r.passed) {
+                    continue;
+                }
+
+                ++failures;
+                printf("FAIL  %-28s %-22s %-6s %s\n", input.name.c_str(), config.name, stage.name.c_str(), r.toString().c_str());
+                if (r.sizeMatches) {
+                    std::string tag = config.name;
+                    for (int k = 0; k < int(tag.size()); ++k) {
+                        if (! isalnum((unsigned char)tag[k])) {
+                            tag[k] = '_';
+                        }
+                    }
+                    const std::string out = diffDirectory + "/" + prefix + "." + tag;
+                    stage.image.writePFM(out + ".pfm");
+                    ImageDiff::writeDiffPGM(out + ".diff.pgm", diff, stage.thresholds.pixelTolerance);
+                }
+            }
+        }
+        delete inputs[i];
+    }
+
+    printf("%d of %d comparisons passed\n", comparisons - failures, comparisons);
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,263 @@
+/**
+ \file SAOReplay.cpp
+
+ Streams a directory of SAOCapture files (written by SAO::captureNextFrame(), e.g., with F9 in the demo) through
+ SAOCPU as fast as it can compute them, so that captured frames of a real scene can be profiled and compared on
+ machines without a GPU.  The captures are processed in file-name order, which is frame order for the numbered
+ files of the demo.  Each file is memory-mapped and the next one is mapped on a background thread while the
+ current one is computed; uncompressed depth is read in place from the mapping.
+
+ Reports the p50 and p95 time of every pass of SAOCPU::passTiming() over all frames, followed by the
+ wall-clock time of compute() and of loading, and the overall frames per second.
+
+ --temporal replays the captures in temporal mode with their recorded cameras (SAOCPU::setTemporal,
+ setCameraToWorld), which is only meaningful for consecutive frames.  --loop replays the directory n times.
+
+ The depth tile line gives the fraction of raw AO and blur tiles that the depth tiles skipped as sky or blurred
+ on the flat path (SAOCPU::setDepthTileSkipping, depthTileStatistics).  Replay captures of the camera bookmarks
+ of a scene with and without --no-depth-tiles to measure the time they save; --flat-tolerance sets
+ SAOCPU::setFlatBlurTolerance.
+
+ --profile prefix records every pass of every frame with SAOProfiler and writes prefix.json (for chrome://tracing
+ or https://ui.perfetto.dev), prefix.csv, and prefix-stats.csv.  The time spent waiting for a capture to load is
+ on the "CPU submit" track.
+
+ Build from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -pthread -I. tools/SAOReplay.cpp SAOCapture.cpp SAOCPU.cpp SAOProfiler.cpp ThreadPool.cpp -o SAOReplay
+
+ and add -DSAO_CAPTURE_ZLIB ... -lz to read compressed captures.
+
+ Usage:  SAOReplay [--threads n] [--quality low|medium|high|ultra] [--temporal] [--production] [--no-depth-tiles]
+                   [--flat-tolerance e] [--loop n] [--profile prefix] [--verbose] directory
+ */
+#include "SAOCPU.h"
+#include "SAOCapture.h"
+#include "SAOProfiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <string>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+/** Nearest-rank percentile \a p of \a sorted */
+static float percentile(const std::vector<float>& sorted, float p) {
+    const int rank = int(std::ceil(p / 100.0f * float(sorted.size())));
+    return sorted[std::max(0, std::min(rank - 1, int(sorted.size()) - 1))];
+}
+
+
+/** Samples of one pass over all frames.  Passes are matched by name because temporal mode adds one. */
+class PassSamples {
+public:
+    std::string         name;
+    std::vector<float>  milliseconds;
+
+    void print() {
+        std::sort(milliseconds.begin(), milliseconds.end());
+        double sum = 0;
+        for (int i = 0; i < int(milliseconds.size()); ++i) {
+            sum += milliseconds[i];
+        }
+        printf("%-18s  %8.3f  %8.3f  %8.3f\n", name.c_str(), percentile(milliseconds, 50), percentile(milliseconds, 95),
+               float(sum / milliseconds.size()));
+    }
+};
+
+
+static PassSamples& samplesNamed(std::vector<PassSamples>& passes, const std::string& name) {
+    for (int i = 0; i < int(passes.size()); ++i) {
+        if (passes[i].name == name) {
+            return passes[i];
+        }
+    }
+    passes.push_back(PassSamples());
+    passes.back().name = name;
+    return passes.back();
+}
+
+
+int main(int argc, char** argv) {
+    int  threads    = 0;
+    int  loops      = 1;
+    bool temporal   = false;
+    bool production = false;
+    bool verbose    = false;
+    bool depthTiles = true;
+    float flatTolerance = 0.0f;
+    SAOCPU::Quality quality = SAOCPU::HIGH_QUALITY;
+    std::string directory, profilePrefix;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if ((arg == "--threads") && (i + 1 < argc)) {
+            threads = atoi(argv[++i]);
+        } else if ((arg == "--quality") && (i + 1 < argc)) {
+            const std::string name = argv[++i];
+            int q = 0;
+            while ((q < SAOCPU::QUALITY_COUNT) && (strcasecmp(name.c_str(), SAOCPU::qualityParameters(SAOCPU::Quality(q)).name) != 0)) {
+                ++q;
+            }
+            if (q == SAOCPU::QUALITY_COUNT) {
+                fprintf(stderr, "Unknown quality %s\n", name.c_str());
+                return 1;
+            }
+            quality = SAOCPU::Quality(q);
+        } else if ((arg == "--loop") && (i + 1 < argc)) {
+            loops = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--temporal") {
+            temporal = true;
+        } else if (arg == "--production") {
+            production = true;
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else if (arg == "--no-depth-tiles") {
+            depthTiles = false;
+        } else if ((arg == "--flat-tolerance") && (i + 1 < argc)) {
+            flatTolerance = std::max(0.0f, float(atof(argv[++i])));
+        } else if ((arg == "--profile") && (i + 1 < argc)) {
+            profilePrefix = argv[++i];
+        } else if ((arg[0] != '-') && directory.empty()) {
+            directory = arg;
+        } else {
+            directory.clear();
+            break;
+        }
+    }
+    if (directory.empty()) {
+        fprintf(stderr, "Usage: SAOReplay [--threads n] [--quality low|medium|high|ultra] [--temporal] [--production] [--no-depth-tiles] "
+                "[--flat-tolerance e] [--loop n] [--profile prefix] [--verbose] directory\n");
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    std::string error;
+    if (! SAOCapture::listDirectory(directory, SAOCapture::extension(), files, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    if (files.empty()) {
+        fprintf(stderr, "No %s files in %s\n", SAOCapture::extension(), directory.c_str());
+        return 1;
+    }
+
+    SAOCPU sao;
+    sao.setThreadCount(threads);
+    sao.setQuality(quality);
+    sao.setTemporal(temporal);
+    sao.setSingleSweepCSZ(production);
+    sao.setFusedBlur(production);
+    sao.setDepthTileSkipping(depthTiles);
+    sao.setFlatBlurTolerance(flatTolerance);
+
+    printf("SAOCPU (%s) replay of %d captures x %d from %s, %s quality%s\n", SAOCPU::instructionSet(), int(files.size()), loops,
+           directory.c_str(), SAOCPU::qualityParameters(quality).name, temporal ? ", temporal" : "");
+
+    // Double-buffered: capture[f % 2] is computed while capture[(f + 1) % 2] is loaded
+    SAOCapture capture[2];
+    std::string loadError[2];
+    const int frames = int(files.size()) * loops;
+
+    std::vector<PassSamples> passes;
+    PassSamples total, load;
+    total.name = "compute()";
+    load.name  = "load (waited)";
+    std::vector<float> result;
+    long long pixels = 0;
+    size_t fileBytes = 0;
+    SAOCPU::DepthTileStatistics tileTotals;
+
+    SAOProfiler profiler;
+    profiler.setEnabled(! profilePrefix.empty());
+    profiler.setMaxEvents(size_t(frames) * 16);
+
+    const Clock::time_point start = Clock::now();
+    std::future<bool> pending = std::async(std::launch::async, [&]() { return capture[0].load(files[0], loadError[0]); });
+
+    for (int f = 0; f < frames; ++f) {
+        const int current = f % 2;
+
+        const int profileFrame = profiler.beginFrame();
+        const double waitStartMicroseconds = profiler.nowMicroseconds();
+        const Clock::time_point waitStart = Clock::now();
+        const bool loaded = pending.get();
+        load.milliseconds.push_back(std::chrono::duration<float, std::milli>(Clock::now() - waitStart).count());
+        profiler.record("load (waited)", SAOProfiler::CPU_TRACK, profileFrame, waitStartMicroseconds, load.milliseconds.back());
+        if (! loaded) {
+            fprintf(stderr, "%s\n", loadError[current].c_str());
+            return 1;
+        }
+
+        if (f + 1 < frames) {
+            const int next = 1 - current;
+            const std::string& name = files[(f + 1) % files.size()];
+            pending = std::async(std::launch::async, [&capture, &loadError, next, name]() { return capture[next].load(name, loadError[next]); });
+        }
+
+        const SAOCapture& c = capture[current];
+        result.resize(size_t(c.width) * size_t(c.height));
+        if (temporal) {
+            sao.setCameraToWorld(c.cameraToWorld);
+        }
+
+        const double computeStartMicroseconds = profiler.nowMicroseconds();
+        const Clock::time_point computeStart = Clock::now();
+        sao.compute(c.depth(), c.width, c.height, c.clipInfo, c.projInfo, c.projScale, &result[0], c.guardBandSize);
+        const float ms = std::chrono::duration<float, std::milli>(Clock::now() - computeStart).count();
+        profiler.recordPasses(sao.passTiming(), profileFrame, computeStartMicroseconds);
+
+        total.milliseconds.push_back(ms);
+        const std::vector<SAOCPU::PassTiming>& timing = sao.passTiming();
+        for (int i = 0; i < int(timing.size()); ++i) {
+            samplesNamed(passes, timing[i].name).milliseconds.push_back(timing[i].milliseconds);
+        }
+        pixels    += (long long)(c.width) * c.height;
+        fileBytes += c.fileBytes();
+
+        const SAOCPU::DepthTileStatistics& tiles = sao.depthTileStatistics();
+        tileTotals.rawAOTiles        += tiles.rawAOTiles;
+        tileTotals.skippedRawAOTiles += tiles.skippedRawAOTiles;
+        tileTotals.blurTiles         += tiles.blurTiles;
+        tileTotals.skippedBlurTiles  += tiles.skippedBlurTiles;
+        tileTotals.flatBlurTiles     += tiles.flatBlurTiles;
+
+        if (verbose) {
+            printf("%s  %d x %d  guard band %d  frame %u  %.3f ms\n", files[f % files.size()].c_str(), c.width, c.height,
+                   c.guardBandSize, c.frameIndex, ms);
+        }
+    }
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    printf("\npass                  p50 ms    p95 ms   mean ms\n");
+    for (int i = 0; i < int(passes.size()); ++i) {
+        passes[i].print();
+    }
+    total.print();
+    load.print();
+
+    if (depthTiles) {
+        printf("\ndepth tiles: %.1f%% of raw AO tiles skipped; %.1f%% of blur tiles skipped, %.1f%% flat\n",
+               100.0f * tileTotals.skippedRawAOFraction(), 100.0f * tileTotals.skippedBlurFraction(), 100.0f * tileTotals.flatBlurFraction());
+    }
+
+    printf("\n%d frames in %.3f s: %.1f frames/s, %.1f Mpix/s, %.1f MB/s of captures\n", frames, seconds, frames / seconds,
+           pixels / (seconds * 1e6), fileBytes / (seconds * 1e6));
+
+    if (! profilePrefix.empty()) {
+        if (! (profiler.writeChromeTrace(profilePrefix + ".json") && profiler.writeCSV(profilePrefix + ".csv") &&
+               profiler.writeStatisticsCSV(profilePrefix + "-stats.csv"))) {
+            fprintf(stderr, "Could not write the profile to %s\n", profilePrefix.c_str());
+            return 1;
+        }
+        printf("Profile written to %s.json, .csv, and -stats.csv\n", profilePrefix.c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+/**
+ \file SAOTemporalBenchmark.cpp
+
+ Compares the temporal accumulation mode of SAOCPU (SAOCPU::setTemporal) with the single-frame
+ compute() along a camera path through the synthetic scene: a dolly toward the scene combined with a
+ slow pan, followed by a still segment.  Three instances see every frame:
+
+ - single-frame: all NUM_SAMPLES taps every frame, the default
+ - temporal:     temporalTapsPerFrame() taps per frame, blended with the reprojected history
+ - no history:   the same taps per frame with the history reset every frame, i.e., what temporal mode
+                 costs and looks like without reprojection
+
+ For each, it reports the time of compute(), the effective samples per pixel, the fraction of pixels whose
+ history was rejected, and the error of the final, blurred AO against a converged reference.  The reference
+ for each frame is a fourth instance that takes all taps per frame and accumulates that same frame
+ REFERENCE_FRAMES times from a reset history, i.e., averages REFERENCE_FRAMES rotations of the full spiral.
+ Errors are measured over the non-sky pixels inside the guard band.
+
+ Screen-space AO near the image border depends on the view, so without a guard band the history carries
+ the border darkening of earlier frames a few pixels into the image.  Compare a guard band of 0 and, e.g., 32.
+
+ Build from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -pthread -I. tools/SAOTemporalBenchmark.cpp SAOCPU.cpp ThreadPool.cpp -o SAOTemporalBenchmark
+
+ Usage:  SAOTemporalBenchmark [width height [guardBandSize [frames [tapsPerFrame [historyLength]]]]]
+ */
+#include "SAOCPU.h"
+#include "SyntheticScene.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/** Full-spiral frames averaged for the reference AO of each frame */
+#define REFERENCE_FRAMES (32)
+
+/** The camera moves during the first 2/3 of the frames and then holds still */
+static bool isMoving(int i, int frames) {
+    return 3 * i < 2 * frames;
+}
+
+
+/** Camera pose of frame \a i: moves forward and pans left, then holds still */
+static void cameraPose(int i, int frames, float M[12]) {
+    const double t   = isMoving(i, frames) ? double(i) : std::ceil(frames * 2.0 / 3.0);
+    const double yaw = t * 0.004;
+    const double z   = -t * 0.02;
+    const double c = cos(yaw), s = sin(yaw);
+    const float pose[12] = {
+        float(c),  0, float(s), 0,
+        0,         1, 0,        0,
+        float(-s), 0, float(c), float(z)};
+    std::copy(pose, pose + 12, M);
+}
+
+
+/** NUM_SAMPLES of the default preset */
+static int allTaps() {
+    return SAOCPU::qualityParameters(SAOCPU::HIGH_QUALITY).numSamples;
+}
+
+
+/** RMS difference over the non-sky pixels inside the guard band */
+static double rmse(const std::vector<float>& a, const std::vector<float>& b, const SyntheticScene& scene, int guardBandSize) {
+    double sum = 0.0;
+    long long n = 0;
+    for (int y = guardBandSize; y < scene.height - guardBandSize; ++y) {
+        for (int x = guardBandSize; x < scene.width - guardBandSize; ++x) {
+            const int i = x + y * scene.width;
+            if (scene.depth[i] < 1.0f) {
+                sum += (a[i] - b[i]) * (a[i] - b[i]);
+                ++n;
+            }
+        }
+    }
+    return (n > 0) ? sqrt(sum / double(n)) : 0.0;
+}
+
+
+/** Per-frame sums over one segment of the path */
+class Totals {
+public:
+    int         frames;
+    double      milliseconds, samples, rejected, error;
+
+    Totals() : frames(0), milliseconds(0), samples(0), rejected(0), error(0) {}
+
+    void print(const char* name) const {
+        const double e = error / frames;
+        printf("%-13s  %8.2f   %10.2f   %7.1f%%   %8.4f   %7.2f dB\n", name, milliseconds / frames, samples / frames,
+               100.0 * rejected / frames, e, 10.0 * log10(1.0 / (e * e)));
+    }
+};
+
+
+class Instance {
+public:
+    const char*         name;
+    SAOCPU              sao;
+    std::vector<float>  result;
+
+    /** Moving and still segments of the path */
+    Totals              segment[2];
+
+    Instance(const char* n, int pixels) : name(n), result(pixels) {
+        sao.setThreadCount(1);
+    }
+};
+
+
+int main(int argc, char** argv) {
+    const int width         = (argc > 2) ? atoi(argv[1]) : 1280;
+    const int height        = (argc > 2) ? atoi(argv[2]) : 720;
+    const int guardBandSize = (argc > 3) ? atoi(argv[3]) : 0;
+    const int frames        = (argc > 4) ? atoi(argv[4]) : 48;
+    const int tapsPerFrame  = (argc > 5) ? atoi(argv[5]) : 3;
+    const int historyLength = (argc > 6) ? atoi(argv[6]) : 8;
+
+    // The first frames fill the history and are not counted
+    const int warmup = historyLength;
+
+    Instance single("single-frame", width * height);
+    Instance temporal("temporal", width * height);
+    Instance noHistory("no history", width * height);
+    Instance* instance[] = {&single, &temporal, &noHistory};
+
+    for (int m = 1; m < 3; ++m) {
+        instance[m]->sao.setTemporal(true);
+        instance[m]->sao.setTemporalTapsPerFrame(tapsPerFrame);
+        instance[m]->sao.setTemporalHistoryLength(historyLength);
+    }
+
+    Instance reference("reference", width * height);
+    reference.sao.setTemporal(true);
+    reference.sao.setTemporalTapsPerFrame(allTaps());
+    reference.sao.setTemporalHistoryLength(REFERENCE_FRAMES);
+
+    printf("SAOCPU (%s) temporal accumulation, %d x %d, guard band %d, %d taps/frame, history %d\n",
+           SAOCPU::instructionSet(), width, height, guardBandSize, tapsPerFrame, historyLength);
+
+    for (int i = 0; i < frames; ++i) {
+        float pose[12];
+        cameraPose(i, frames, pose);
+        const SyntheticScene scene(width, height, pose);
+        const int seg = isMoving(i, frames) ? 0 : 1;
+
+        if (i >= warmup) {
+            reference.sao.resetTemporalHistory();
+            for (int r = 0; r < REFERENCE_FRAMES; ++r) {
+                reference.sao.compute(&scene.depth[0], width, height, scene.clipInfo, scene.projInfo, scene.projScale, &reference.result[0], guardBandSize);
+            }
+        }
+
+        for (int m = 0; m < 3; ++m) {
+            Instance& a = *instance[m];
+            a.sao.setCameraToWorld(scene.cameraToWorld);
+            if (&a == &noHistory) {
+                a.sao.resetTemporalHistory();
+            }
+
+            const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            a.sao.compute(&scene.depth[0], width, height, scene.clipInfo, scene.projInfo, scene.projScale, &a.result[0], guardBandSize);
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+            if (i >= warmup) {
+                Totals& t = a.segment[seg];
+                ++t.frames;
+                t.milliseconds += ms;
+                t.samples      += a.sao.temporal() ? a.sao.temporalStatistics().effectiveSamplesPerPixel : double(allTaps());
+                t.rejected     += a.sao.temporalStatistics().rejectedFraction;
+                t.error        += rmse(a.result, reference.result, scene, guardBandSize);
+            }
+        }
+    }
+
+    static const char* segmentName[] = {"moving", "still"};
+    for (int seg = 0; seg < 2; ++seg) {
+        if (single.segment[seg].frames == 0) {
+            continue;
+        }
+        printf("\n%s camera, %d frames\n", segmentName[seg], single.segment[seg].frames);
+        printf("mode           ms/frame   samples/px   rejected   RMSE vs reference\n");
+        for (int m = 0; m < 3; ++m) {
+            instance[m]->segment[seg].print(instance[m]->name);
+        }
+    }
+
+    return 0;
+}
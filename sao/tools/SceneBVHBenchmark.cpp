@@ -0,0 +1,362 @@
+/**
+ \file SceneBVHBenchmark.cpp
+
+ Measures the ray throughput of SceneBVH against testing every triangle of every instance, which is what
+ Scene::intersect did before, on a model plus a set of small moving props.  Pass Crytek Sponza (sponza.obj
+ from the crytek_sponza/sponza.zip that data/sponza.scn.any loads, which is distributed separately) with
+ the 0.01 scale of its scene file; without a model it builds a synthetic atrium of columns with a similar
+ triangle count.
+
+ It reports rays per second, on one thread, for:
+
+ - brute force, on a subset of the rays
+ - primary rays of a 1280 x 720 camera in tiles of SceneBVH::packetSize(), one at a time and as a stream
+   of packets
+ - incoherent rays in random directions from random points, one at a time and as a stream
+
+ and the time of update() when every prop moves, which refits the top level.  Every hit is checked
+ against single-ray traversal, and a subset against brute force.
+
+ Build from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -I. tools/SceneBVHBenchmark.cpp SceneBVH.cpp ModelCache.cpp -o SceneBVHBenchmark
+
+ Usage:  SceneBVHBenchmark [model.obj [scale [props]]]
+ */
+#include "SceneBVH.h"
+#include "OBJFile.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+/** An indexed triangle list */
+class TriangleList {
+public:
+    std::vector<float>      position;
+    std::vector<uint32_t>   index;
+
+    uint32_t addVertex(float x, float y, float z) {
+        position.push_back(x);
+        position.push_back(y);
+        position.push_back(z);
+        return uint32_t(position.size() / 3 - 1);
+    }
+
+    void addQuad(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+        const uint32_t q[6] = {a, b, c, a, c, d};
+        index.insert(index.end(), q, q + 6);
+    }
+
+    size_t triangleCount() const {
+        return index.size() / 3;
+    }
+};
+
+
+/** A cylinder of \a sides around the y axis */
+static void addCylinder(TriangleList& mesh, float x, float z, float radius, float y0, float y1, int sides, int rings) {
+    const uint32_t base = uint32_t(mesh.position.size() / 3);
+    for (int r = 0; r <= rings; ++r) {
+        const float y = y0 + (y1 - y0) * float(r) / float(rings);
+        for (int s = 0; s < sides; ++s) {
+            const float a = 6.2831853f * float(s) / float(sides);
+            mesh.addVertex(x + radius * std::cos(a), y, z + radius * std::sin(a));
+        }
+    }
+    for (int r = 0; r < rings; ++r) {
+        for (int s = 0; s < sides; ++s) {
+            const uint32_t i = base + r * sides;
+            mesh.addQuad(i + s, i + (s + 1) % sides, i + sides + (s + 1) % sides, i + sides + s);
+        }
+    }
+}
+
+
+/** A finely tessellated axis-aligned grid in the plane \a axis = \a c */
+static void addGrid(TriangleList& mesh, int axis, float c, float u0, float u1, float v0, float v1, int n) {
+    const uint32_t base = uint32_t(mesh.position.size() / 3);
+    for (int j = 0; j <= n; ++j) {
+        for (int i = 0; i <= n; ++i) {
+            float p[3];
+            p[axis] = c;
+            p[(axis + 1) % 3] = u0 + (u1 - u0) * float(i) / float(n);
+            p[(axis + 2) % 3] = v0 + (v1 - v0) * float(j) / float(n);
+            mesh.addVertex(p[0], p[1], p[2]);
+        }
+    }
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            const uint32_t k = base + j * (n + 1) + i;
+            mesh.addQuad(k, k + 1, k + n + 2, k + n + 1);
+        }
+    }
+}
+
+
+/** A Sponza-sized hall: floor, walls, and two storeys of columns */
+static void buildAtrium(TriangleList& mesh) {
+    addGrid(mesh, 1,  0.0f, -14.0f, 14.0f, -6.0f, 6.0f, 120);
+    addGrid(mesh, 1, 12.0f, -14.0f, 14.0f, -6.0f, 6.0f, 60);
+    addGrid(mesh, 2, -6.0f,  0.0f, 12.0f, -14.0f, 14.0f, 80);
+    addGrid(mesh, 2,  6.0f,  0.0f, 12.0f, -14.0f, 14.0f, 80);
+    addGrid(mesh, 0, -14.0f, -6.0f, 6.0f, 0.0f, 12.0f, 60);
+    addGrid(mesh, 0,  14.0f, -6.0f, 6.0f, 0.0f, 12.0f, 60);
+    for (int storey = 0; storey < 2; ++storey) {
+        for (int i = 0; i < 10; ++i) {
+            for (int side = -1; side <= 1; side += 2) {
+                addCylinder(mesh, -12.0f + 2.7f * float(i), 3.5f * float(side), 0.35f, 5.5f * float(storey), 5.5f * float(storey) + 4.5f, 48, 40);
+            }
+        }
+    }
+}
+
+
+static void translation(float x, float y, float z, float m[12]) {
+    const float t[12] = {1, 0, 0, x,  0, 1, 0, y,  0, 0, 1, z};
+    std::copy(t, t + 12, m);
+}
+
+
+/** The single-ray traversal, without the BVH: every triangle of every instance */
+static bool bruteForce(const std::vector<const TriangleList*>& meshOf, const std::vector<std::vector<float> >& worldToObject,
+                       const SceneBVH::Ray& ray, SceneBVH::Hit& hit) {
+    bool found = false;
+    float maxDistance = ray.maxDistance;
+    for (size_t k = 0; k < meshOf.size(); ++k) {
+        const float* m = &worldToObject[k][0];
+        float o[3], d[3];
+        for (int i = 0; i < 3; ++i) {
+            o[i] = m[4 * i] * ray.origin[0] + m[4 * i + 1] * ray.origin[1] + m[4 * i + 2] * ray.origin[2] + m[4 * i + 3];
+            d[i] = m[4 * i] * ray.direction[0] + m[4 * i + 1] * ray.direction[1] + m[4 * i + 2] * ray.direction[2];
+        }
+        const TriangleList& mesh = *meshOf[k];
+        for (size_t t = 0; t < mesh.triangleCount(); ++t) {
+            const float* v0 = &mesh.position[3 * mesh.index[3 * t]];
+            const float* v1 = &mesh.position[3 * mesh.index[3 * t + 1]];
+            const float* v2 = &mesh.position[3 * mesh.index[3 * t + 2]];
+            const float e1[3] = {v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2]};
+            const float e2[3] = {v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2]};
+            const float p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+            const float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+            if (det == 0.0f) {
+                continue;
+            }
+            const float s[3] = {o[0] - v0[0], o[1] - v0[1], o[2] - v0[2]};
+            const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) / det;
+            const float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+            const float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) / det;
+            const float dist = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+            if ((u >= -1e-5f) && (v >= -1e-5f) && (u + v <= 1 + 1e-5f) && (dist > 0) && (dist < maxDistance)) {
+                maxDistance  = dist;
+                hit.instance = int(k);
+                hit.triangle = int(t);
+                hit.distance = dist;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+
+/** Same instance, or the same distance where two instances touch */
+static bool agree(const SceneBVH::Hit& a, const SceneBVH::Hit& b) {
+    if ((a.instance < 0) || (b.instance < 0)) {
+        return a.instance == b.instance;
+    }
+    return std::fabs(a.distance - b.distance) <= 1e-4f * std::max(1.0f, a.distance);
+}
+
+
+static void report(const char* name, size_t rays, float ms) {
+    printf("%-34s %10.2f Mrays/s  (%zu rays, %.1f ms)\n", name, double(rays) / (1000.0 * ms), rays, ms);
+}
+
+
+int main(int argc, char** argv) {
+    const float scale = (argc > 2) ? float(atof(argv[2])) : 0.01f;
+    const int propCount = (argc > 3) ? atoi(argv[3]) : 64;
+
+    TriangleList model;
+    if (argc > 1) {
+        ModelCache::Builder obj;
+        if (! parseOBJ(argv[1], scale, obj)) {
+            fprintf(stderr, "Cannot read %s\n", argv[1]);
+            return 1;
+        }
+        for (size_t i = 0; i < obj.vertices.size(); ++i) {
+            model.addVertex(obj.vertices[i].position[0], obj.vertices[i].position[1], obj.vertices[i].position[2]);
+        }
+        model.index = obj.indices;
+    } else {
+        buildAtrium(model);
+    }
+
+    // A prop is a small closed cylinder, instanced and moved every frame like a physics object
+    TriangleList prop;
+    addCylinder(prop, 0.0f, 0.0f, 0.25f, 0.0f, 0.5f, 24, 4);
+
+    const Clock::time_point buildStart = Clock::now();
+    SceneBVH bvh;
+    const int modelMesh = bvh.addMesh(&model.position[0], 3 * sizeof(float), model.position.size() / 3, &model.index[0], model.index.size());
+    const int propMesh  = bvh.addMesh(&prop.position[0], 3 * sizeof(float), prop.position.size() / 3, &prop.index[0], prop.index.size());
+
+    // Bounds of the model, for placing the camera, rays, and props
+    float lo[3] = {1e30f, 1e30f, 1e30f}, hi[3] = {-1e30f, -1e30f, -1e30f};
+    for (size_t i = 0; i < model.position.size(); ++i) {
+        lo[i % 3] = std::min(lo[i % 3], model.position[i]);
+        hi[i % 3] = std::max(hi[i % 3], model.position[i]);
+    }
+    const float center[3] = {0.5f * (lo[0] + hi[0]), 0.5f * (lo[1] + hi[1]), 0.5f * (lo[2] + hi[2])};
+    const float extent[3] = {hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]};
+
+    std::vector<const TriangleList*> meshOf;
+    std::vector<std::vector<float> > worldToObject;
+    float m[12];
+    translation(0, 0, 0, m);
+    bvh.addInstance(modelMesh, m);
+    meshOf.push_back(&model);
+    worldToObject.push_back(std::vector<float>(m, m + 12));
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<float> propPosition;
+    for (int i = 0; i < propCount; ++i) {
+        const float p[3] = {lo[0] + extent[0] * (0.1f + 0.8f * unit(random)), lo[1] + extent[1] * 0.02f, lo[2] + extent[2] * (0.2f + 0.6f * unit(random))};
+        propPosition.insert(propPosition.end(), p, p + 3);
+        translation(p[0], p[1], p[2], m);
+        bvh.addInstance(propMesh, m);
+        meshOf.push_back(&prop);
+        translation(-p[0], -p[1], -p[2], m);
+        worldToObject.push_back(std::vector<float>(m, m + 12));
+    }
+    bvh.update();
+    const float buildMs = millisecondsSince(buildStart);
+
+    const SceneBVH::Statistics& s = bvh.statistics();
+    printf("%s: %zu triangles, %d props, %d lanes (%s)\n", (argc > 1) ? argv[1] : "synthetic atrium", model.triangleCount(), propCount,
+           SceneBVH::packetSize(), SAOSIMD::name());
+    printf("build %.1f ms: %zu triangle BVH nodes, %d instance nodes\n\n", buildMs, s.meshNodes, s.instanceNodes);
+
+    // Primary rays from the center of the model at standing height, looking along its longest horizontal axis
+    const int width = 1280, height = 720;
+    const int axis = (extent[0] >= extent[2]) ? 0 : 2;
+    const float eye[3] = {center[0] - ((axis == 0) ? 0.35f * extent[0] : 0.0f), lo[1] + 0.15f * extent[1], center[2] - ((axis == 2) ? 0.35f * extent[2] : 0.0f)};
+    const float forward[3] = {(axis == 0) ? 1.0f : 0.0f, 0.0f, (axis == 2) ? 1.0f : 0.0f};
+    const float right[3] = {-forward[2], 0.0f, forward[0]};
+    const float tanHalf = std::tan(0.5f * 60.0f * 3.14159265f / 180.0f);
+
+    // Tiles of packetSize() pixels: 4 x 2 for 8 lanes, 2 x 2 for 4
+    const int tileW = (SceneBVH::packetSize() >= 8) ? 4 : 2, tileH = SceneBVH::packetSize() / tileW;
+    std::vector<SceneBVH::Ray> primary;
+    primary.reserve(width * height);
+    for (int ty = 0; ty < height; ty += tileH) {
+        for (int tx = 0; tx < width; tx += tileW) {
+            for (int y = ty; y < ty + tileH; ++y) {
+                for (int x = tx; x < tx + tileW; ++x) {
+                    const float px = (2.0f * (x + 0.5f) / width - 1.0f) * tanHalf * width / height;
+                    const float py = (1.0f - 2.0f * (y + 0.5f) / height) * tanHalf;
+                    SceneBVH::Ray r;
+                    for (int a = 0; a < 3; ++a) {
+                        r.origin[a]    = eye[a];
+                        r.direction[a] = forward[a] + px * right[a] + ((a == 1) ? py : 0.0f);
+                    }
+                    const float len = std::sqrt(r.direction[0] * r.direction[0] + r.direction[1] * r.direction[1] + r.direction[2] * r.direction[2]);
+                    for (int a = 0; a < 3; ++a) {
+                        r.direction[a] /= len;
+                    }
+                    primary.push_back(r);
+                }
+            }
+        }
+    }
+
+    std::vector<SceneBVH::Ray> incoherent(width * height / 4);
+    for (size_t i = 0; i < incoherent.size(); ++i) {
+        SceneBVH::Ray& r = incoherent[i];
+        float len = 0.0f;
+        for (int a = 0; a < 3; ++a) {
+            r.origin[a]    = lo[a] + extent[a] * (0.1f + 0.8f * unit(random));
+            r.direction[a] = 2.0f * unit(random) - 1.0f;
+            len += r.direction[a] * r.direction[a];
+        }
+        for (int a = 0; a < 3; ++a) {
+            r.direction[a] /= std::sqrt(std::max(len, 1e-12f));
+        }
+    }
+
+    int mismatches = 0;
+    const std::vector<SceneBVH::Ray>* rayset[2] = {&primary, &incoherent};
+    const char* names[2] = {"primary", "incoherent"};
+    for (int k = 0; k < 2; ++k) {
+        const std::vector<SceneBVH::Ray>& rays = *rayset[k];
+        std::vector<SceneBVH::Hit> single(rays.size()), stream(rays.size());
+
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < rays.size(); ++i) {
+            bvh.intersect(rays[i], single[i]);
+        }
+        const float singleMs = millisecondsSince(start);
+
+        start = Clock::now();
+        bvh.intersectStream(&rays[0], rays.size(), &stream[0]);
+        const float streamMs = millisecondsSince(start);
+
+        // Brute force is too slow for every ray
+        const size_t bruteCount = std::max(size_t(1), std::min(rays.size(), size_t(2e8 / double(model.triangleCount() + 1))));
+        const size_t step = rays.size() / bruteCount;
+        start = Clock::now();
+        for (size_t i = 0; i < bruteCount; ++i) {
+            SceneBVH::Hit h;
+            bruteForce(meshOf, worldToObject, rays[i * step], h);
+            if (! agree(h, single[i * step])) {
+                ++mismatches;
+            }
+        }
+        const float bruteMs = millisecondsSince(start);
+
+        for (size_t i = 0; i < rays.size(); ++i) {
+            if (! agree(single[i], stream[i])) {
+                ++mismatches;
+            }
+        }
+
+        char label[64];
+        snprintf(label, sizeof(label), "%s brute force", names[k]);
+        report(label, bruteCount, bruteMs);
+        snprintf(label, sizeof(label), "%s BVH single ray", names[k]);
+        report(label, rays.size(), singleMs);
+        snprintf(label, sizeof(label), "%s BVH packets", names[k]);
+        report(label, rays.size(), streamMs);
+        printf("\n");
+    }
+
+    // Move every prop, as Scene::onSimulation does for entities, and refit
+    const int frames = 200;
+    float updateMs = 0.0f;
+    for (int f = 0; f < frames; ++f) {
+        for (int i = 0; i < propCount; ++i) {
+            const float* p = &propPosition[3 * i];
+            const float phase = 0.05f * float(f) + float(i);
+            translation(p[0] + 0.5f * std::sin(phase), p[1], p[2] + 0.5f * std::cos(phase), m);
+            bvh.setTransform(1 + i, m);
+        }
+        const Clock::time_point start = Clock::now();
+        bvh.update();
+        updateMs += millisecondsSince(start);
+    }
+    printf("update with %d moving props: %.3f ms per frame (%d refits, %d rebuilds)\n", propCount, updateMs / frames, s.refits, s.rebuilds);
+
+    printf("%d mismatches\n", mismatches);
+    return (mismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,332 @@
+/**
+ \file SceneCullingCheck.cpp
+
+ Checks SceneCulling against brute-force visibility on a synthetic city: a ground plane, a 10 x 10 grid of
+ box buildings as occluders, and many small boxes in the streets and on the roofs.  For each of several
+ views, from street level and from above, it culls the small boxes and separately renders every triangle
+ of the scene into a z-buffer of four times the occlusion buffer's resolution in each axis, with an
+ object id per pixel.  A box is visible in the reference if any pixel shows it.
+
+ It reports, per view, the boxes culled by the frustum and by occlusion, the boxes hidden in the
+ reference that were not culled, and the time of each, and exits with status 1 if any box that the
+ reference shows was culled.
+
+ Build and run from the sao directory with:
+
+     g++ -O3 -mavx2 -mfma -I. tools/SceneCullingCheck.cpp SceneCulling.cpp -o SceneCullingCheck
+     ./SceneCullingCheck
+
+ Usage:  SceneCullingCheck [boxes [views]]
+ */
+#include "SceneCulling.h"
+#include "SAOSIMD.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+/** Blocks per side, block pitch, and building footprint of the city, in meters */
+static const int   BLOCKS     = 10;
+static const float PITCH      = 24.0f;
+static const float FOOTPRINT  = 16.0f;
+
+/** The reference has this many pixels per occlusion-buffer pixel in each axis */
+static const int   SUPERSAMPLE = 4;
+
+/** The 12 triangles of an axis-aligned box */
+static void appendBox(const float lo[3], const float hi[3], std::vector<float>& position, std::vector<uint32_t>& index) {
+    const uint32_t base = uint32_t(position.size() / 3);
+    for (int corner = 0; corner < 8; ++corner) {
+        position.push_back((corner & 1) ? hi[0] : lo[0]);
+        position.push_back((corner & 2) ? hi[1] : lo[1]);
+        position.push_back((corner & 4) ? hi[2] : lo[2]);
+    }
+    static const uint32_t face[12][3] = {
+        {0, 2, 3}, {0, 3, 1},  {4, 5, 7}, {4, 7, 6},  {0, 1, 5}, {0, 5, 4},
+        {2, 6, 7}, {2, 7, 3},  {0, 4, 6}, {0, 6, 2},  {1, 3, 7}, {1, 7, 5}};
+    for (int t = 0; t < 12; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            index.push_back(base + face[t][k]);
+        }
+    }
+}
+
+
+/** A z-buffer of 1 / w with the id of the nearest triangle at each pixel center, drawn one triangle at a time */
+class ReferenceImage {
+public:
+    int                 width;
+    int                 height;
+    std::vector<float>  inverseDepth;
+    std::vector<int>    id;
+
+    ReferenceImage(int w, int h) : width(w), height(h), inverseDepth(w * h, 0.0f), id(w * h, -1) {}
+
+    void draw(const double viewProjection[16], const float* const world[3], int triangleId) {
+        // Clip space, then the polygon on the near side of z + w = 0
+        double clip[3][4];
+        for (int v = 0; v < 3; ++v) {
+            for (int r = 0; r < 4; ++r) {
+                clip[v][r] = viewProjection[r * 4] * world[v][0] + viewProjection[r * 4 + 1] * world[v][1] +
+                             viewProjection[r * 4 + 2] * world[v][2] + viewProjection[r * 4 + 3];
+            }
+        }
+        double polygon[4][4];
+        int n = 0;
+        for (int v = 0; v < 3; ++v) {
+            const double* p = clip[v];
+            const double* q = clip[(v + 1) % 3];
+            if (p[2] + p[3] >= 0) {
+                std::copy(p, p + 4, polygon[n++]);
+            }
+            if ((p[2] + p[3] >= 0) != (q[2] + q[3] >= 0)) {
+                const double t = (p[2] + p[3]) / ((p[2] + p[3]) - (q[2] + q[3]));
+                for (int k = 0; k < 4; ++k) {
+                    polygon[n][k] = p[k] + t * (q[k] - p[k]);
+                }
+                ++n;
+            }
+        }
+        double screen[4][3];
+        for (int v = 0; v < n; ++v) {
+            screen[v][0] = (polygon[v][0] / polygon[v][3] * 0.5 + 0.5) * width;
+            screen[v][1] = (polygon[v][1] / polygon[v][3] * 0.5 + 0.5) * height;
+            screen[v][2] = 1.0 / polygon[v][3];
+        }
+        for (int v = 2; v < n; ++v) {
+            drawScreen(screen[0], screen[v - 1], screen[v], triangleId);
+        }
+    }
+
+    void drawScreen(const double* a, const double* b, const double* c, int triangleId) {
+        const double area = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+        if (area == 0) {
+            return;
+        }
+        const int x0 = std::max(0, int(std::floor(std::min(a[0], std::min(b[0], c[0])))));
+        const int x1 = std::min(width - 1, int(std::ceil(std::max(a[0], std::max(b[0], c[0])))));
+        const int y0 = std::max(0, int(std::floor(std::min(a[1], std::min(b[1], c[1])))));
+        const int y1 = std::min(height - 1, int(std::ceil(std::max(a[1], std::max(b[1], c[1])))));
+        for (int y = y0; y <= y1; ++y) {
+            for (int x = x0; x <= x1; ++x) {
+                const double px = x + 0.5, py = y + 0.5;
+                // Barycentric weights of b and c
+                const double u = ((px - a[0]) * (c[1] - a[1]) - (py - a[1]) * (c[0] - a[0])) / area;
+                const double v = ((b[0] - a[0]) * (py - a[1]) - (b[1] - a[1]) * (px - a[0])) / area;
+                if ((u < 0) || (v < 0) || (u + v > 1)) {
+                    continue;
+                }
+                const float iz = float(a[2] + u * (b[2] - a[2]) + v * (c[2] - a[2]));
+                if (iz > inverseDepth[y * width + x]) {
+                    inverseDepth[y * width + x] = iz;
+                    id[y * width + x] = triangleId;
+                }
+            }
+        }
+    }
+};
+
+
+/** Row-major OpenGL view-projection with an infinite far plane, 60 degree vertical field of view */
+static void makeViewProjection(const float eye[3], float yaw, float pitch, float aspect, double VP[16]) {
+    const double forward[3] = {std::cos(pitch) * std::sin(yaw), std::sin(pitch), -std::cos(pitch) * std::cos(yaw)};
+    double right[3] = {-forward[2], 0, forward[0]};
+    const double rl = std::sqrt(right[0] * right[0] + right[2] * right[2]);
+    right[0] /= rl;  right[2] /= rl;
+    const double up[3] = {right[1] * forward[2] - right[2] * forward[1], right[2] * forward[0] - right[0] * forward[2], right[0] * forward[1] - right[1] * forward[0]};
+    const double* axis[3] = {right, up, forward};
+
+    double V[16] = {0};
+    for (int r = 0; r < 3; ++r) {
+        // The third row is the back vector
+        const double s = (r == 2) ? -1.0 : 1.0;
+        for (int k = 0; k < 3; ++k) {
+            V[r * 4 + k] = s * axis[r][k];
+        }
+        V[r * 4 + 3] = -(V[r * 4] * eye[0] + V[r * 4 + 1] * eye[1] + V[r * 4 + 2] * eye[2]);
+    }
+    V[15] = 1;
+
+    const double nearZ = 0.1;
+    const double f = 1.0 / std::tan(30.0 * 3.14159265358979 / 180.0);
+    const double P[16] = {f / aspect, 0, 0, 0,  0, f, 0, 0,  0, 0, -1, -2 * nearZ,  0, 0, -1, 0};
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            VP[r * 4 + c] = 0;
+            for (int k = 0; k < 4; ++k) {
+                VP[r * 4 + c] += P[r * 4 + k] * V[k * 4 + c];
+            }
+        }
+    }
+}
+
+
+/** True if the square [x, x + size] x [z, z + size] overlaps the footprint of a building */
+static bool overlapsBuilding(float x, float z, float size) {
+    for (int i = std::max(0, int(std::floor(x / PITCH)) - 1); i <= std::min(BLOCKS - 1, int(std::floor((x + size) / PITCH))); ++i) {
+        for (int j = std::max(0, int(std::floor(z / PITCH)) - 1); j <= std::min(BLOCKS - 1, int(std::floor((z + size) / PITCH))); ++j) {
+            if ((x < i * PITCH + FOOTPRINT) && (x + size > i * PITCH) && (z < j * PITCH + FOOTPRINT) && (z + size > j * PITCH)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+int main(int argc, char** argv) {
+    const int boxCount  = (argc > 1) ? atoi(argv[1]) : 20000;
+    const int viewCount = (argc > 2) ? atoi(argv[2]) : 10;
+
+    std::mt19937 rng(25);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    SceneCulling culling;
+    const int width = culling.width(), height = culling.height();
+    const float aspect = float(width) / float(height);
+
+    // Occluders, in world space for the reference
+    std::vector<float> occluderPosition;
+    std::vector<uint32_t> occluderIndex;
+
+    const float groundLo[3] = {-100, -1, -100}, groundHi[3] = {BLOCKS * PITCH + 100, 0, BLOCKS * PITCH + 100};
+    {
+        std::vector<float> position;
+        std::vector<uint32_t> index;
+        appendBox(groundLo, groundHi, position, index);
+        const int ground = culling.addOccluderMesh(&position[0], 3 * sizeof(float), position.size() / 3, &index[0], index.size(), 1.0f, 12);
+        (void)ground;
+    }
+    std::vector<float> unitPosition;
+    std::vector<uint32_t> unitIndex;
+    {
+        const float lo[3] = {0, 0, 0}, hi[3] = {1, 1, 1};
+        appendBox(lo, hi, unitPosition, unitIndex);
+    }
+    const int unitBox = culling.addOccluderMesh(&unitPosition[0], 3 * sizeof(float), unitPosition.size() / 3, &unitIndex[0], unitIndex.size(), 0.0f, 12);
+
+    // Row-major 3 x 4 transforms of the unit box to each building
+    std::vector< std::vector<float> > building;
+    appendBox(groundLo, groundHi, occluderPosition, occluderIndex);
+    for (int i = 0; i < BLOCKS; ++i) {
+        for (int j = 0; j < BLOCKS; ++j) {
+            const float h = 10.0f + 30.0f * uniform(rng);
+            const float lo[3] = {i * PITCH, 0, j * PITCH}, hi[3] = {i * PITCH + FOOTPRINT, h, j * PITCH + FOOTPRINT};
+            const float m[12] = {FOOTPRINT, 0, 0, lo[0],  0, h, 0, 0,  0, 0, FOOTPRINT, lo[2]};
+            building.push_back(std::vector<float>(m, m + 12));
+            appendBox(lo, hi, occluderPosition, occluderIndex);
+        }
+    }
+
+    // Small boxes in the streets, one in five on a roof
+    SceneCulling::BoxArray boxes;
+    std::vector<float> boxPosition;
+    std::vector<uint32_t> boxIndex;
+    while (boxes.size() < boxCount) {
+        const float size = 0.3f + 1.7f * uniform(rng);
+        const float x = -20.0f + (BLOCKS * PITCH + 40.0f) * uniform(rng), z = -20.0f + (BLOCKS * PITCH + 40.0f) * uniform(rng);
+        float y = 0.01f;
+        if (overlapsBuilding(x, z, size + 0.1f)) {
+            // On the roof of the building under its first corner, if there is one
+            const int i = int(std::floor(x / PITCH)), j = int(std::floor(z / PITCH));
+            if ((uniform(rng) > 0.2f) || (i < 0) || (j < 0) || (i >= BLOCKS) || (j >= BLOCKS) ||
+                (x - i * PITCH >= FOOTPRINT) || (z - j * PITCH >= FOOTPRINT)) {
+                continue;
+            }
+            y = building[i * BLOCKS + j][5] + 0.01f;
+        }
+        const float lo[3] = {x, y, z}, hi[3] = {x + size, y + size, z + size};
+        boxes.append(lo, hi, 12);
+        appendBox(lo, hi, boxPosition, boxIndex);
+    }
+
+    printf("%d boxes, %d buildings, %d x %d occlusion buffer, %d lanes (%s)\n", boxes.size(), int(building.size()), width, height, SAOSIMD::WIDTH, SAOSIMD::name());
+    printf("%-6s %8s %8s %8s %8s %8s %9s %9s %9s\n", "view", "visible", "hidden", "frustum", "occluded", "missed", "raster ms", "test ms", "brute ms");
+
+    int falseCulls = 0;
+    size_t totalHidden = 0, totalCulled = 0;
+    std::vector<uint8_t> result;
+    for (int view = 0; view < viewCount; ++view) {
+        // Street level, then every third view from above
+        float eye[3];
+        float pitch, yaw;
+        if (view % 3 == 2) {
+            eye[0] = BLOCKS * PITCH * uniform(rng);  eye[1] = 60.0f + 40.0f * uniform(rng);  eye[2] = BLOCKS * PITCH * uniform(rng);
+            pitch = -0.3f - 0.4f * uniform(rng);
+            yaw = 6.2831853f * uniform(rng);
+        } else {
+            // Down a street along x or z
+            const int axis = view & 1;
+            const float along = BLOCKS * PITCH * uniform(rng);
+            const float street = PITCH * float(int(BLOCKS * uniform(rng))) - 0.5f * (PITCH - FOOTPRINT);
+            eye[axis ? 0 : 2] = along;  eye[axis ? 2 : 0] = street;  eye[1] = 1.7f;
+            pitch = 0.1f * (uniform(rng) - 0.5f);
+            yaw = (axis ? 1.5707963f : 0.0f) + ((uniform(rng) < 0.5f) ? 3.1415927f : 0.0f) + 0.6f * (uniform(rng) - 0.5f);
+        }
+        double VPd[16];
+        makeViewProjection(eye, yaw, pitch, aspect, VPd);
+        float VP[16];
+        std::copy(VPd, VPd + 16, VP);
+
+        culling.beginFrame(VP);
+        static const float identity[12] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0};
+        culling.addOccluder(0, identity);
+        for (size_t b = 0; b < building.size(); ++b) {
+            culling.addOccluder(unitBox, &building[b][0]);
+        }
+        culling.cull(boxes, result);
+        const SceneCulling::Statistics& stats = culling.statistics();
+
+        Clock::time_point start = Clock::now();
+        ReferenceImage reference(width * SUPERSAMPLE, height * SUPERSAMPLE);
+        for (size_t i = 0; i < occluderIndex.size(); i += 3) {
+            const float* world[3] = {&occluderPosition[3 * occluderIndex[i]], &occluderPosition[3 * occluderIndex[i + 1]], &occluderPosition[3 * occluderIndex[i + 2]]};
+            reference.draw(VPd, world, -1);
+        }
+        for (size_t i = 0; i < boxIndex.size(); i += 3) {
+            const float* world[3] = {&boxPosition[3 * boxIndex[i]], &boxPosition[3 * boxIndex[i + 1]], &boxPosition[3 * boxIndex[i + 2]]};
+            reference.draw(VPd, world, int(i / 36));
+        }
+        std::vector<uint8_t> visible(boxes.size(), 0);
+        for (size_t p = 0; p < reference.id.size(); ++p) {
+            if (reference.id[p] >= 0) {
+                visible[reference.id[p]] = 1;
+            }
+        }
+        const float bruteMs = millisecondsSince(start);
+
+        int visibleCount = 0, missed = 0, viewFalseCulls = 0;
+        for (int i = 0; i < boxes.size(); ++i) {
+            if (visible[i]) {
+                ++visibleCount;
+                if (result[i] != SceneCulling::VISIBLE) {
+                    ++viewFalseCulls;
+                    printf("  box %d is visible in the reference but culled (%s)\n", i, (result[i] == SceneCulling::OCCLUDED) ? "occluded" : "outside frustum");
+                }
+            } else if (result[i] == SceneCulling::VISIBLE) {
+                ++missed;
+            }
+        }
+        const int hidden = boxes.size() - visibleCount;
+        falseCulls += viewFalseCulls;
+        totalHidden += hidden;
+        totalCulled += hidden - missed;
+
+        printf("%-6d %8d %8d %8d %8d %8d %9.3f %9.3f %9.1f\n", view, visibleCount, hidden, stats.frustumCulledBoxes, stats.occlusionCulledBoxes, missed,
+               stats.rasterizeMilliseconds, stats.testMilliseconds, bruteMs);
+    }
+
+    printf("culled %.1f%% of the boxes hidden in the reference; %d visible boxes culled\n",
+           (totalHidden > 0) ? 100.0 * double(totalCulled) / double(totalHidden) : 100.0, falseCulls);
+    return (falseCulls == 0) ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+/**
+ \file SceneIndexBenchmark.cpp
+
+ Times the scene list that Scene::sceneNames() builds, over a directory of scene files.  Without a
+ directory, it writes a synthetic tree of scene files, each with its name after a model table of a few
+ kilobytes, to a temporary directory.
+
+ It reports, in milliseconds:
+
+ - read all: reading every file whole, a lower bound on the old approach of parsing each one with Any::load
+ - cold: SceneIndex::refresh with no index, which reads only the start of most files
+ - warm: SceneIndex::load of the saved index and a refresh that only lists the directory
+ - touched: a warm refresh after appending to one file, for synthetic scenes only
+
+ and checks that every refresh finds the same names.
+
+ Build from the sao directory with:
+
+     g++ -O3 -I. tools/SceneIndexBenchmark.cpp SceneIndex.cpp -o SceneIndexBenchmark
+
+ Usage:  SceneIndexBenchmark [directory | -synthetic count]
+ */
+#include "SceneIndex.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#   include <direct.h>
+#   define mkdir(path, mode) _mkdir(path)
+#else
+#   include <sys/stat.h>
+#endif
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+/** Writes \a count scene files in subdirectories of \a directory */
+static void writeSynthetic(const std::string& directory, int count) {
+    mkdir(directory.c_str(), 0755);
+    for (int i = 0; i < count; ++i) {
+        const std::string subdirectory = directory + "/" + std::to_string(i / 50);
+        mkdir(subdirectory.c_str(), 0755);
+        FILE* file = fopen((subdirectory + "/scene" + std::to_string(i) + SceneIndex::extension()).c_str(), "w");
+        fprintf(file, "// -*- c++ -*-\n// G3D Scene File Format\n{\n");
+        // Every tenth file has its name after the models, which are larger than the head that readName() reads
+        const bool nameLast = (i % 10 == 0);
+        if (! nameLast) {
+            fprintf(file, "    name = \"Scene %d\",\n", i);
+        }
+        fprintf(file, "    models = {\n");
+        for (int m = 0; m < 40; ++m) {
+            fprintf(file, "        model%d = ArticulatedModel::Specification {\n"
+                          "            filename = \"models/m%d.obj\"; /* \"name\" = \"not this\" */\n"
+                          "            preprocess = ( scale(0.01); setTwoSided(\"mesh\", true); );\n"
+                          "        };\n", m, m);
+        }
+        fprintf(file, "    };\n    entities = { camera = Camera { name = \"not this either\"; }; };\n");
+        if (nameLast) {
+            fprintf(file, "    name = \"Scene %d\";\n", i);
+        }
+        fprintf(file, "}\n");
+        fclose(file);
+    }
+}
+
+
+static std::vector<std::string> names(const SceneIndex& index) {
+    std::vector<std::string> result;
+    for (size_t i = 0; i < index.entries().size(); ++i) {
+        result.push_back(index.entries()[i].name);
+    }
+    return result;
+}
+
+
+int main(int argc, char** argv) {
+    std::string directory;
+    bool synthetic = true;
+    if ((argc > 2) && (std::string(argv[1]) == "-synthetic")) {
+        directory = "SceneIndexBenchmark.tmp";
+        writeSynthetic(directory, atoi(argv[2]));
+    } else if (argc > 1) {
+        directory = argv[1];
+        synthetic = false;
+    } else {
+        directory = "SceneIndexBenchmark.tmp";
+        writeSynthetic(directory, 500);
+    }
+    const std::string indexFilename = "SceneIndexBenchmark.index";
+    std::string error;
+
+    // Cold
+    remove(indexFilename.c_str());
+    Clock::time_point start = Clock::now();
+    SceneIndex cold;
+    if (! cold.refresh(directory, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    const float coldMs = millisecondsSince(start);
+    if (! cold.save(indexFilename, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    // Reading every file whole, as Any::load would before parsing it
+    start = Clock::now();
+    size_t totalBytes = 0;
+    for (size_t i = 0; i < cold.entries().size(); ++i) {
+        FILE* file = fopen((directory + "/" + cold.entries()[i].path).c_str(), "rb");
+        if (file != NULL) {
+            std::vector<char> text(size_t(cold.entries()[i].bytes));
+            totalBytes += fread(text.empty() ? NULL : &text[0], 1, text.size(), file);
+            fclose(file);
+        }
+    }
+    const float readAllMs = millisecondsSince(start);
+
+    // Warm
+    start = Clock::now();
+    SceneIndex warm;
+    warm.load(indexFilename);
+    warm.refresh(directory, error);
+    const float warmMs = millisecondsSince(start);
+    const int warmRead = warm.statistics().read;
+
+    // One file changed; never modify real scenes
+    int touchedRead = 0;
+    float touchedMs = 0;
+    if (synthetic && ! warm.entries().empty()) {
+        FILE* file = fopen((directory + "/" + warm.entries()[0].path).c_str(), "a");
+        if (file != NULL) {
+            fprintf(file, "\n");
+            fclose(file);
+        }
+        start = Clock::now();
+        warm.refresh(directory, error);
+        touchedMs = millisecondsSince(start);
+        touchedRead = warm.statistics().read;
+    }
+
+    int missing = 0;
+    for (size_t i = 0; i < cold.entries().size(); ++i) {
+        if (cold.entries()[i].name.empty()) {
+            fprintf(stderr, "%s: %s\n", cold.entries()[i].path.c_str(), cold.entries()[i].error.c_str());
+            ++missing;
+        }
+    }
+    const bool same = (names(cold) == names(warm));
+
+    printf("%s: %d scene files, %.1f MB, %d without a name\n", directory.c_str(), int(cold.entries().size()), totalBytes / 1e6, missing);
+    printf("read all: %9.2f ms\n", readAllMs);
+    printf("cold:     %9.2f ms  (list %.2f ms, read %d names %.2f ms)\n", coldMs, cold.statistics().listMilliseconds,
+           cold.statistics().read, cold.statistics().readMilliseconds);
+    printf("warm:     %9.2f ms  (%d names read; files modified in the last second are read again)\n", warmMs, warmRead);
+    printf("touched:  %9.2f ms  (%d names read)\n", touchedMs, touchedRead);
+    printf("names %s\n", same ? "identical" : "DIFFER");
+
+    return same ? 0 : 1;
+}
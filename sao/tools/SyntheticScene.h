@@ -0,0 +1,128 @@
+/**
+ \file SyntheticScene.h
+
+ Procedural depth buffer and camera constants for the headless SAOCPU tools.  The scene has a floor,
+ two walls, a few spheres, a flight of steps, and sky, so that the AO pass sees both contact creases
+ and open areas at every MIP level.  No G3D dependency.
+ */
+#ifndef SyntheticScene_h
+#define SyntheticScene_h
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/** Camera and depth buffer in the form that SAOCPU::compute() expects */
+class SyntheticScene {
+public:
+    int                 width;
+    int                 height;
+
+    /** Z-buffer values, 1 for sky */
+    std::vector<float>  depth;
+
+    float               clipInfo[3];
+    float               projInfo[4];
+    float               projScale;
+
+    /** Row-major 3 x 4 matrix, in the form that SAOCPU::setCameraToWorld() expects */
+    float               cameraToWorld[12];
+
+    /** Infinite perspective camera with a 60 degree vertical field of view, near plane at z = -0.1.
+        \param cameraToWorld Row-major 3 x 4 pose of the camera; NULL is the identity, at the origin looking down -z. */
+    SyntheticScene(int w, int h, const float* cameraToWorld = NULL) : width(w), height(h), depth(w * h) {
+        static const float identity[12] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0};
+        std::copy(cameraToWorld ? cameraToWorld : identity, (cameraToWorld ? cameraToWorld : identity) + 12, this->cameraToWorld);
+        const float* M = this->cameraToWorld;
+
+        const double nearZ           = -0.1;
+        const double verticalFieldOfView = 60.0 * 3.14159265358979 / 180.0;
+        const double P11             = 1.0 / tan(verticalFieldOfView / 2.0);
+        const double P00             = P11 * h / w;
+
+        clipInfo[0] = float(nearZ);
+        clipInfo[1] = -1.0f;
+        clipInfo[2] = 1.0f;
+
+        projInfo[0] = float(-2.0 / (w * P00));
+        projInfo[1] = float(-2.0 / (h * P11));
+        projInfo[2] = float(1.0 / P00);
+        projInfo[3] = float(1.0 / P11);
+
+        projScale = float(h / (2.0 * tan(verticalFieldOfView / 2.0)));
+
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                // The eye ray (dx, dy, -1) in world space.  Its parameter is the distance along the view axis.
+                const double dx = -((x + 0.5) * projInfo[0] + projInfo[2]), dy = -((y + 0.5) * projInfo[1] + projInfo[3]);
+                const double o[3] = {M[3], M[7], M[11]};
+                const double d[3] = {M[0] * dx + M[1] * dy - M[2], M[4] * dx + M[5] * dy - M[6], M[8] * dx + M[9] * dy - M[10]};
+                const double t = trace(o, d);
+                depth[x + y * w] = (t == inf()) ? 1.0f : float(1.0 + nearZ / t);
+            }
+        }
+    }
+
+protected:
+
+    static double inf() {
+        return 1e30;
+    }
+
+    /** Parameter t of the first surface along the ray o + t d, inf() for sky */
+    static double trace(const double o[3], const double d[3]) {
+        double best = inf();
+
+        // Floor at y = -1.5
+        if (d[1] < 0.0) {
+            best = std::min(best, (-1.5 - o[1]) / d[1]);
+        }
+
+        // Back wall at z = -12, open to the sky above y = 0.2
+        if (d[2] < 0.0) {
+            const double t = (-12.0 - o[2]) / d[2];
+            if (o[1] + t * d[1] < 0.2) {
+                best = std::min(best, t);
+            }
+        }
+
+        // Left wall at x = -4, one unit high
+        if (d[0] < 0.0) {
+            const double t = (-4.0 - o[0]) / d[0];
+            if ((o[1] + t * d[1] < 1.0) && (o[2] + t * d[2] > -12.0)) {
+                best = std::min(best, t);
+            }
+        }
+
+        static const double sphere[4][4] = {{0.0, -0.5, -5.0, 1.0}, {1.8, -1.0, -4.0, 0.5}, {-2.0, -0.7, -7.0, 0.8}, {0.5, 0.3, -9.0, 1.2}};
+        for (int i = 0; i < 4; ++i) {
+            const double* s = sphere[i];
+            const double  oc[3] = {o[0] - s[0], o[1] - s[1], o[2] - s[2]};
+            const double  a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            const double  b = oc[0] * d[0] + oc[1] * d[1] + oc[2] * d[2];
+            const double  c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - s[3] * s[3];
+            const double  discriminant = b * b - a * c;
+            if (discriminant > 0.0) {
+                const double t = (-b - sqrt(discriminant)) / a;
+                if (t > 0.0) {
+                    best = std::min(best, t);
+                }
+            }
+        }
+
+        // Steps on the right side of the floor
+        if (d[1] < 0.0) {
+            for (int k = 0; k < 5; ++k) {
+                const double t = (-1.5 + 0.15 * (k + 1) - o[1]) / d[1];
+                const double z = o[2] + t * d[2], x = o[0] + t * d[0];
+                if ((z < -(3.0 + k * 0.8) + 0.4) && (z > -(3.0 + k * 0.8) - 0.4) && (x > 1.5) && (x < 3.5)) {
+                    best = std::min(best, t);
+                }
+            }
+        }
+
+        return best;
+    }
+};
+
+#endif